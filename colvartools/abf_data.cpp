@@ -13,9 +13,49 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
 #include <ctime>
 #include <iomanip>
 
+/// Read the header of a Colvars binary grid file (see colvar_grid_binary_format
+/// in the Colvars sources); returns false, leaving the stream unchanged, if the
+/// file is in text format
+static bool read_binary_header(std::ifstream &is, const char *fileName,
+                               int &nvars, uint32_t &type, uint64_t &mult)
+{
+    char magic[8];
+    std::streampos const start = is.tellg();
+    if (!is.read(magic, 8) || strncmp(magic, "COLVGRID", 8)) {
+        is.clear();
+        is.seekg(start);
+        return false;
+    }
+    uint32_t header[4];
+    is.read(reinterpret_cast<char *>(header), sizeof(header));
+    is.read(reinterpret_cast<char *>(&mult), sizeof(mult));
+    if (!is || header[0] != 1 || header[1] != 0x01020304) {
+        std::cerr << "Unsupported version or byte order in binary file " << fileName << "\n";
+        exit(1);
+    }
+    type = header[2];
+    nvars = header[3];
+    return true;
+}
+
+/// Read the parameters of one dimension from a Colvars binary grid file
+static void read_binary_dimension(std::ifstream &is, double &min, double &width,
+                                  int &size, int &pbc)
+{
+    double dim_real[2];
+    int64_t dim_int[2];
+    is.read(reinterpret_cast<char *>(dim_real), sizeof(dim_real));
+    is.read(reinterpret_cast<char *>(dim_int), sizeof(dim_int));
+    min = dim_real[0];
+    width = dim_real[1];
+    size = dim_int[0];
+    pbc = dim_int[1];
+}
+
 /// Construct gradient field object from an ABF-saved file
 ABFdata::ABFdata(const char *gradFileName)
 {
@@ -38,18 +78,28 @@ ABFdata::ABFdata(const char *gradFileName)
     }
 
     std::cout << "Opening file " << gradFileName << " for reading\n";
-    gradFile.open(gradFileName);
+    gradFile.open(gradFileName, std::ios::binary);
     if (!gradFile) {
         std::cerr << "Cannot read from file " << gradFileName << ", aborting\n";
         exit(1);
     }
 
-    gradFile >> hash;
-    if (hash != '#') {
-        std::cerr << "Missing \'#\' sign in gradient file\n";
-        exit(1);
+    uint32_t type;
+    uint64_t mult;
+    bool const binary = read_binary_header(gradFile, gradFileName, Nvars, type, mult);
+    if (binary) {
+        if (type != 0 || mult != uint64_t(Nvars)) {
+            std::cerr << "Binary file " << gradFileName << " does not contain gradients\n";
+            exit(1);
+        }
+    } else {
+        gradFile >> hash;
+        if (hash != '#') {
+            std::cerr << "Missing \'#\' sign in gradient file\n";
+            exit(1);
+        }
+        gradFile >> Nvars;
     }
-    gradFile >> Nvars;
 
     std::cout << "Number of variables: " << Nvars << "\n";
 
@@ -62,13 +112,17 @@ ABFdata::ABFdata(const char *gradFileName)
     scalar_dim = 1;             // total is (n1 * n2 * ... * n_Nvars )
 
     for (int i = 0; i < Nvars; i++) {
-        gradFile >> hash;
-        if (hash != '#') {
-            std::cerr << "Missing \'#\' sign in gradient file\n";
-            exit(1);
+        if (binary) {
+            read_binary_dimension(gradFile, mins[i], widths[i], sizes[i], PBC[i]);
+        } else {
+            gradFile >> hash;
+            if (hash != '#') {
+                std::cerr << "Missing \'#\' sign in gradient file\n";
+                exit(1);
+            }
+            // format is: xiMin dxi Nbins PBCflag
+            gradFile >> mins[i] >> widths[i] >> sizes[i] >> PBC[i];
         }
-        // format is: xiMin dxi Nbins PBCflag
-        gradFile >> mins[i] >> widths[i] >> sizes[i] >> PBC[i];
         std::cout << "min = " << mins[i] << " width = " << widths[i]
             << " n = " << sizes[i] << " PBC: " << (PBC[i]?"yes":"no") << "\n";
 
@@ -97,73 +151,109 @@ ABFdata::ABFdata(const char *gradFileName)
     for (int i = 0; i < Nvars; i++)
         pos[i] = 0;
 
-    for (unsigned int i = 0; i < scalar_dim; i++) {
-        // Here we do the Euclidean division iteratively
-        for (int k = Nvars - 1; k > 0; k--) {
-            if (pos[k] == sizes[k]) {
-                pos[k] = 0;
-                pos[k - 1]++;
-            }
+    if (binary) {
+        // Values are stored in the same order as in the text file
+        if (!gradFile.read(reinterpret_cast<char *>(gradients), vec_dim * sizeof(double))) {
+            std::cout << "\nERROR: could not read gradient data\n";
+            exit(1);
         }
-        for (int j = 0; j < Nvars; j++) {
-            // Read values of the collective variables only to check for consistency with grid
-            gradFile >> xi;
-
-            double diff = mins[j] + widths[j] * (pos[j] + 0.5) - xi;
-            if ( diff * diff > 1e-7 )  {
-                std::cout << "\nERROR: wrong coordinates in gradient file\n";
-                std::cout << "Expected " << mins[j] + widths[j] * (pos[j] + 0.5) << ", got " <<  xi << std::endl;
-                exit(1);
-            }
+        if (gradFile.peek() != EOF) {
+            std::cout << "\nERROR: extraneous data at end of gradient file\n";
+            exit(1);
         }
-        for (int j = 0; j < Nvars; j++) {
-            // Read and store gradients
-            if ( ! (gradFile >> gradients[i * Nvars + j]) ) {
-                std::cout << "\nERROR: could not read gradient data\n";
-                exit(1);
+    } else {
+        for (unsigned int i = 0; i < scalar_dim; i++) {
+            // Here we do the Euclidean division iteratively
+            for (int k = Nvars - 1; k > 0; k--) {
+                if (pos[k] == sizes[k]) {
+                    pos[k] = 0;
+                    pos[k - 1]++;
+                }
             }
+            for (int j = 0; j < Nvars; j++) {
+                // Read values of the collective variables only to check for consistency with grid
+                gradFile >> xi;
+
+                double diff = mins[j] + widths[j] * (pos[j] + 0.5) - xi;
+                if ( diff * diff > 1e-7 )  {
+                    std::cout << "\nERROR: wrong coordinates in gradient file\n";
+                    std::cout << "Expected " << mins[j] + widths[j] * (pos[j] + 0.5) << ", got " <<  xi << std::endl;
+                    exit(1);
+                }
+            }
+            for (int j = 0; j < Nvars; j++) {
+                // Read and store gradients
+                if ( ! (gradFile >> gradients[i * Nvars + j]) ) {
+                    std::cout << "\nERROR: could not read gradient data\n";
+                    exit(1);
+                }
+            }
+            pos[Nvars - 1]++;       // move on to next position
+        }
+        // check for end of file
+        if ( gradFile >> xi ) {
+            std::cout << "\nERROR: extraneous data at end of gradient file\n";
+            exit(1);
         }
-        pos[Nvars - 1]++;       // move on to next position
-    }
-    // check for end of file
-    if ( gradFile >> xi ) {
-        std::cout << "\nERROR: extraneous data at end of gradient file\n";
-        exit(1);
     }
     gradFile.close();
 
 
     std::cout << "Opening file " << countFileName << " for reading\n";
-    countFile.open(countFileName);
+    countFile.open(countFileName, std::ios::binary);
 
     if (!countFile) {
         std::cerr << "Cannot read from file " << countFileName << ", aborting\n";
         exit(1);
     }
 
-    countFile >> hash;
-    if (hash != '#') {
-        std::cerr << "Missing \'#\' sign in count file\n";
-        exit(1);
-    }
-    countFile >> Nvars;
+    int count_nvars;
+    if (read_binary_header(countFile, countFileName, count_nvars, type, mult)) {
+        if (count_nvars != Nvars || type != 1 || mult != 1) {
+            std::cerr << "Binary file " << countFileName << " does not contain matching counts\n";
+            exit(1);
+        }
+        for (int i = 0; i < Nvars; i++) {
+            // Grid parameters are taken from the gradient file
+            double min, width;
+            int size, pbc;
+            read_binary_dimension(countFile, min, width, size, pbc);
+        }
+        for (unsigned int i = 0; i < scalar_dim; i++) {
+            uint64_t c;
+            countFile.read(reinterpret_cast<char *>(&c), sizeof(c));
+            count[i] = c;
+        }
+        if (!countFile) {
+            std::cerr << "Could not read count data from " << countFileName << "\n";
+            exit(1);
+        }
+    } else {
 
-    for (int i = 0; i < Nvars; i++) {
         countFile >> hash;
         if (hash != '#') {
-            std::cerr << "Missing \'#\' sign in gradient file\n";
+            std::cerr << "Missing \'#\' sign in count file\n";
             exit(1);
         }
-        countFile >> mins[i] >> widths[i] >> sizes[i] >> PBC[i];
-    }
+        countFile >> Nvars;
 
-    for (unsigned int i = 0; i < scalar_dim; i++) {
-        for (int j = 0; j < Nvars; j++) {
-            // Read and ignore values of the collective variables
-            countFile >> xi;
+        for (int i = 0; i < Nvars; i++) {
+            countFile >> hash;
+            if (hash != '#') {
+                std::cerr << "Missing \'#\' sign in gradient file\n";
+                exit(1);
+            }
+            countFile >> mins[i] >> widths[i] >> sizes[i] >> PBC[i];
+        }
+
+        for (unsigned int i = 0; i < scalar_dim; i++) {
+            for (int j = 0; j < Nvars; j++) {
+                // Read and ignore values of the collective variables
+                countFile >> xi;
+            }
+            // Read and store counts
+            countFile >> count[i];
         }
-        // Read and store counts
-        countFile >> count[i];
     }
     // Could check for end-of-file string here
     countFile.close();
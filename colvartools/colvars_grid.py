@@ -1,4 +1,5 @@
 import numpy as np
+import struct
 from os import path
 
 class colvars_grid:
@@ -109,10 +110,54 @@ class colvars_grid:
         return new
 
 
+    @staticmethod
+    def is_binary(filename):
+        '''Whether the file uses the binary grid format of Colvars (binaryGridFiles)'''
+        with open(filename, 'rb') as f:
+            return f.read(8) == b'COLVGRID'
+
+
+    @staticmethod
+    def _read_binary(filename):
+        '''Parse the header of a binary grid file and memory-map its values
+        Returns the grid parameters and an array of shape (number of points, number of data series)
+        '''
+        with open(filename, 'rb') as f:
+            magic, version, bom, vtype, dim, mult = struct.unpack('=8sIIIIQ', f.read(32))
+            assert version == 1, f'Unsupported binary grid version {version}'
+            assert bom == 0x01020304, 'Binary grid file was written with a different byte order'
+            xmin, dx, nx, pbc = [], [], [], []
+            for _ in range(dim):
+                lower, width, n, periodic = struct.unpack('=ddqq', f.read(32))
+                xmin.append(lower)
+                dx.append(width)
+                nx.append(n)
+                pbc.append(periodic == 1)
+        dtype = np.uint64 if vtype == 1 else np.float64
+        values = np.memmap(filename, dtype=dtype, mode='r', offset=32 * (dim + 1),
+                           shape=(int(np.prod(nx)), mult))
+        return dim, xmin, dx, nx, pbc, values
+
+
+    def _append_values(self, values):
+        '''Append one time frame from an array of shape (number of points, number of data series)'''
+        self.nframes += 1
+        self.data = []
+        for i in range(self.nsets):
+            self.histdata[i].append(np.array(values[:, i]))
+            self.data.append(self.histdata[i][-1])
+
+
     def read(self, filename):
-        '''Read data from a Colvars multicolumn file'''
+        '''Read data from a Colvars multicolumn (or binary) file'''
         self.reset()
         self.filenames.append(filename)
+        if self.is_binary(filename):
+            self.dim, self.xmin, self.dx, self.nx, self.pbc, values = self._read_binary(filename)
+            self.nsets = values.shape[1]
+            self.histdata = [[] for _ in range(self.nsets)]
+            self._append_values(values)
+            return
         with open(filename) as f:
             l = f.readline().split()
             assert len(l) == 2
@@ -139,6 +184,12 @@ class colvars_grid:
         Can be used to load history files from consecutive runs.
         '''
         self.filenames.append(filename)
+        if self.is_binary(filename):
+            dim, xmin, dx, nx, pbc, values = self._read_binary(filename)
+            assert (dim, xmin, dx, nx, pbc) == (self.dim, self.xmin, self.dx, self.nx, self.pbc)
+            assert values.shape[1] == self.nsets, f'File to be appended contains {values.shape[1]} data series, {self.nsets} expected'
+            self._append_values(values)
+            return
         with open(filename) as f:
             l = f.readline().split()
             assert len(l) == 2
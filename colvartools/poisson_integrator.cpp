@@ -8,12 +8,13 @@
 int main (int argc, char *argv[]) {
 
   if (argc < 2) {
-    std::cerr << "One argument needed: file name.\n";
+    std::cerr << "Usage: " << argv[0] << " <gradient file> [cg|multigrid|fft]\n";
     return 1;
   }
 
   colvarproxy *proxy = new colvarproxy();
   colvarmodule *colvars = new colvarmodule(proxy);
+  proxy->colvars = colvars; // Needed to report errors
 
   std::string gradfile (argv[1]);
   std::shared_ptr<colvar_grid_gradient> grad_ptr = std::make_shared<colvar_grid_gradient>(gradfile);
@@ -23,6 +24,14 @@ int main (int argc, char *argv[]) {
   cvm::real tol = 1e-6;
 
   integrate_potential potential(grad_ptr);
+  if (argc > 2) {
+    integrate_potential::solver_type solver;
+    if ((integrate_potential::parse_solver(argv[2], solver) != COLVARS_OK) ||
+        (potential.set_solver(solver) != COLVARS_OK)) {
+      delete colvars;
+      return 1;
+    }
+  }
   potential.set_div();
   potential.integrate(itmax, tol, err);
   potential.set_zero_minimum();
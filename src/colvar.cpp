@@ -10,6 +10,7 @@
 #include <list>
 #include <vector>
 #include <algorithm>
+#include <complex>
 #include <iostream>
 #include <iomanip>
 
@@ -38,10 +39,6 @@ colvar::colvar()
   potential_energy = 0.0;
   period = 0.0;
 
-#ifdef LEPTON
-  dev_null = 0.0;
-#endif
-
   matching_state = false;
 
   expand_boundaries = false;
@@ -236,6 +233,7 @@ int colvar::init(std::string const &conf)
          (cvm::fabs(cvcs[0]->sup_coeff - 1.0) < 1.0e-10) &&
          (cvcs[0]->sup_np == 1) ) {
       enable(f_cv_single_cvc);
+      scalar_single_cvc = is_enabled(f_cv_scalar);
     }
   }
 
@@ -339,10 +337,10 @@ int colvar::init(std::string const &conf)
 int colvar::init_custom_function(std::string const &conf)
 {
   std::string expr, expr_in; // expr_in is a buffer to remember expr after unsuccessful parsing
+  std::vector<std::string> exprs;
   std::vector<Lepton::ParsedExpression> pexprs;
   Lepton::ParsedExpression pexpr;
   size_t pos = 0; // current position in config string
-  double *ref;
 
   if (!key_lookup(conf, "customFunction", &expr_in, &pos)) {
     return COLVARS_OK;
@@ -360,77 +358,61 @@ int colvar::init_custom_function(std::string const &conf)
     try {
       pexpr = Lepton::Parser::parse(expr);
       pexprs.push_back(pexpr);
+      exprs.push_back(expr);
     }
     catch (...) {
       cvm::error("Error parsing expression \"" + expr + "\".\n", COLVARS_INPUT_ERROR);
       return COLVARS_INPUT_ERROR;
     }
+  } while (key_lookup(conf, "customFunction", &expr_in, &pos));
+
+  // Define variables for cvc values, serialized into scalars
+  std::vector<std::string> variable_names;
+  for (size_t i = 0; i < cvcs.size(); i++) {
+    for (size_t j = 0; j < cvcs[i]->value().size(); j++) {
+      variable_names.push_back(cvcs[i]->name +
+                               (cvcs[i]->value().size() > 1 ? cvm::to_str(j+1) : ""));
+    }
+  }
+
+  custom_function_evaluator.reset(new lepton_evaluator(variable_names));
 
+  // Values of the expressions first, so that they can be computed on their own
+  for (size_t c = 0; c < pexprs.size(); c++) {
     try {
-      value_evaluators.push_back(
-          new Lepton::CompiledExpression(pexpr.createCompiledExpression()));
-      // Define variables for cvc values
-      // Stored in order: expr1, cvc1, cvc2, expr2, cvc1...
-      for (size_t i = 0; i < cvcs.size(); i++) {
-        for (size_t j = 0; j < cvcs[i]->value().size(); j++) {
-          std::string vn = cvcs[i]->name +
-              (cvcs[i]->value().size() > 1 ? cvm::to_str(j+1) : "");
-          try {
-            ref =&value_evaluators.back()->getVariableReference(vn);
-          }
-          catch (...) { // Variable is absent from expression
-            // To keep the same workflow, we use a pointer to a double here
-            // that will receive CVC values - even though none was allocated by Lepton
-            ref = &dev_null;
-            cvm::log("Warning: Variable " + vn + " is absent from expression \"" + expr + "\".\n");
-          }
-          value_eval_var_refs.push_back(ref);
-        }
-      }
+      custom_function_evaluator->add_expression(pexprs[c]);
     }
     catch (...) {
-      cvm::error("Error compiling expression \"" + expr + "\".\n", COLVARS_INPUT_ERROR);
+      cvm::error("Error compiling expression \"" + exprs[c] + "\".\n", COLVARS_INPUT_ERROR);
       return COLVARS_INPUT_ERROR;
     }
-  } while (key_lookup(conf, "customFunction", &expr_in, &pos));
-
+    for (size_t v = 0; v < variable_names.size(); v++) {
+      if (!custom_function_evaluator->uses_input(c, v)) {
+        cvm::log("Warning: Variable " + variable_names[v] + " is absent from expression \"" +
+                 exprs[c] + "\".\n");
+      }
+    }
+  }
 
   // Now define derivative with respect to each scalar sub-component
-  for (size_t i = 0; i < cvcs.size(); i++) {
-    for (size_t j = 0; j < cvcs[i]->value().size(); j++) {
-      std::string vn = cvcs[i]->name +
-          (cvcs[i]->value().size() > 1 ? cvm::to_str(j+1) : "");
-      // Element ordering: we want the
-      // gradient vector of derivatives of all elements of the colvar
-      // wrt to a given element of a cvc ([i][j])
-      for (size_t c = 0; c < pexprs.size(); c++) {
-        gradient_evaluators.push_back(
-            new Lepton::CompiledExpression(pexprs[c].differentiate(vn).createCompiledExpression()));
-        // and record the refs to each variable in those expressions
-        for (size_t k = 0; k < cvcs.size(); k++) {
-          for (size_t l = 0; l < cvcs[k]->value().size(); l++) {
-            std::string vvn = cvcs[k]->name +
-                (cvcs[k]->value().size() > 1 ? cvm::to_str(l+1) : "");
-            try {
-              ref = &gradient_evaluators.back()->getVariableReference(vvn);
-            }
-            catch (...) { // Variable is absent from derivative
-              // To keep the same workflow, we use a pointer to a double here
-              // that will receive CVC values - even though none was allocated by Lepton
-              if (cvm::debug()) {
-                cvm::log("Warning: Variable " + vvn + " is absent from derivative of \"" + expr + "\" wrt " + vn + ".\n");
-              }
-              ref = &dev_null;
-            }
-            grad_eval_var_refs.push_back(ref);
-          }
-        }
+  // Element ordering: we want the gradient vector of derivatives of all
+  // elements of the colvar wrt to a given element of a cvc
+  for (size_t v = 0; v < variable_names.size(); v++) {
+    for (size_t c = 0; c < pexprs.size(); c++) {
+      try {
+        custom_function_evaluator->add_expression(pexprs[c].differentiate(variable_names[v]));
+      }
+      catch (...) {
+        cvm::error("Error compiling derivative of expression \"" + exprs[c] + "\" wrt " +
+                   variable_names[v] + ".\n", COLVARS_INPUT_ERROR);
+        return COLVARS_INPUT_ERROR;
       }
     }
   }
 
+  size_t const num_expressions = pexprs.size();
 
-  if (value_evaluators.size() == 0) {
+  if (num_expressions == 0) {
     cvm::error("Error: no custom function defined.\n", COLVARS_INPUT_ERROR);
     return COLVARS_INPUT_ERROR;
   }
@@ -453,7 +435,7 @@ int colvar::init_custom_function(std::string const &conf)
 
   // Guess type based on number of expressions
   if (!b_type_specified) {
-    if (value_evaluators.size() == 1) {
+    if (num_expressions == 1) {
       x.type(colvarvalue::type_scalar);
     } else {
       x.type(colvarvalue::type_vector);
@@ -461,7 +443,7 @@ int colvar::init_custom_function(std::string const &conf)
   }
 
   if (x.type() == colvarvalue::type_vector) {
-    x.vector1d_value.resize(value_evaluators.size());
+    x.vector1d_value.resize(num_expressions);
   }
 
   x_reported.type(x);
@@ -470,16 +452,179 @@ int colvar::init_custom_function(std::string const &conf)
     + (x.type()==colvarvalue::type_vector ? " of size " + cvm::to_str(x.size()) : "")
     + ".\n");
 
-  if (x.size() != value_evaluators.size()) {
+  if (x.size() != num_expressions) {
     cvm::error("Error: based on custom function type, expected "
                + cvm::to_str(x.size()) + " scalar expressions, but "
-               + cvm::to_str(value_evaluators.size()) + " were found.\n");
+               + cvm::to_str(num_expressions) + " were found.\n");
     return COLVARS_INPUT_ERROR;
   }
 
   return COLVARS_OK;
 }
 
+
+colvar::lepton_evaluator::lepton_evaluator(std::vector<std::string> const &names)
+  : variable_names(names), values(names.size(), 0.0)
+{
+  arg_offsets.push_back(0);
+}
+
+
+colvar::lepton_evaluator::~lepton_evaluator()
+{
+  for (size_t i = 0; i < ops.size(); i++) {
+    delete ops[i];
+  }
+  ops.clear();
+}
+
+
+size_t colvar::lepton_evaluator::constant_slot(cvm::real value)
+{
+  std::map<cvm::real, size_t>::const_iterator const it = constant_slots.find(value);
+  if (it != constant_slots.end()) {
+    return it->second;
+  }
+  values.push_back(value);
+  constant_slots[value] = values.size() - 1;
+  return values.size() - 1;
+}
+
+
+size_t colvar::lepton_evaluator::add_node(Lepton::ExpressionTreeNode const &node,
+                                          std::vector<bool> &used)
+{
+  Lepton::Operation const &op = node.getOperation();
+
+  if (op.getId() == Lepton::Operation::VARIABLE) {
+    for (size_t i = 0; i < variable_names.size(); i++) {
+      if (variable_names[i] == op.getName()) {
+        used[i] = true;
+        return i;
+      }
+    }
+    // Variables that are not defined are kept at zero
+    return constant_slot(0.0);
+  }
+
+  if (op.getId() == Lepton::Operation::CONSTANT) {
+    return constant_slot(dynamic_cast<Lepton::Operation::Constant const &>(op).getValue());
+  }
+
+  std::vector<size_t> args;
+  for (size_t i = 0; i < node.getChildren().size(); i++) {
+    args.push_back(add_node(node.getChildren()[i], used));
+  }
+
+  // Reuse an identical operation on the same arguments if already computed
+  std::pair<int, std::vector<size_t>> const key(static_cast<int>(op.getId()), args);
+  std::vector<size_t> &same_args = op_index[key];
+  for (size_t k = 0; k < same_args.size(); k++) {
+    if (*(ops[same_args[k]]) == op) {
+      return result_slots[same_args[k]];
+    }
+  }
+
+  cvm::real param = 0.0;
+  if (op.getId() == Lepton::Operation::ADD_CONSTANT) {
+    param = dynamic_cast<Lepton::Operation::AddConstant const &>(op).getValue();
+  } else if (op.getId() == Lepton::Operation::MULTIPLY_CONSTANT) {
+    param = dynamic_cast<Lepton::Operation::MultiplyConstant const &>(op).getValue();
+  }
+
+  same_args.push_back(ops.size());
+  op_ids.push_back(static_cast<int>(op.getId()));
+  ops.push_back(op.clone());
+  op_params.push_back(param);
+  arg_slots.insert(arg_slots.end(), args.begin(), args.end());
+  arg_offsets.push_back(arg_slots.size());
+  if (op_args.size() < args.size()) {
+    op_args.resize(args.size());
+  }
+  values.push_back(0.0);
+  result_slots.push_back(values.size() - 1);
+  return values.size() - 1;
+}
+
+
+size_t colvar::lepton_evaluator::add_expression(Lepton::ParsedExpression const &expression)
+{
+  std::vector<bool> used(variable_names.size(), false);
+  Lepton::ParsedExpression const optimized = expression.optimize();
+  output_slots.push_back(add_node(optimized.getRootNode(), used));
+  output_num_ops.push_back(ops.size());
+  used_inputs.push_back(used);
+  return output_slots.size() - 1;
+}
+
+
+void colvar::lepton_evaluator::evaluate(size_t n)
+{
+  size_t const num_ops = (n > 0) ? output_num_ops[n-1] : 0;
+  cvm::real *const v = values.data();
+  size_t const *const a_all = arg_slots.data();
+  std::map<std::string, double> const no_variables;
+
+  for (size_t i = 0; i < num_ops; i++) {
+    size_t const *const a = a_all + arg_offsets[i];
+    cvm::real &result = v[result_slots[i]];
+    switch (op_ids[i]) {
+    case Lepton::Operation::ADD:
+      result = v[a[0]] + v[a[1]];
+      break;
+    case Lepton::Operation::SUBTRACT:
+      result = v[a[0]] - v[a[1]];
+      break;
+    case Lepton::Operation::MULTIPLY:
+      result = v[a[0]] * v[a[1]];
+      break;
+    case Lepton::Operation::DIVIDE:
+      result = v[a[0]] / v[a[1]];
+      break;
+    case Lepton::Operation::NEGATE:
+      result = -v[a[0]];
+      break;
+    case Lepton::Operation::SQUARE:
+      result = v[a[0]] * v[a[0]];
+      break;
+    case Lepton::Operation::CUBE:
+      result = v[a[0]] * v[a[0]] * v[a[0]];
+      break;
+    case Lepton::Operation::RECIPROCAL:
+      result = 1.0 / v[a[0]];
+      break;
+    case Lepton::Operation::SQRT:
+      result = std::sqrt(v[a[0]]);
+      break;
+    case Lepton::Operation::EXP:
+      result = std::exp(v[a[0]]);
+      break;
+    case Lepton::Operation::LOG:
+      result = std::log(v[a[0]]);
+      break;
+    case Lepton::Operation::SIN:
+      result = std::sin(v[a[0]]);
+      break;
+    case Lepton::Operation::COS:
+      result = std::cos(v[a[0]]);
+      break;
+    case Lepton::Operation::ADD_CONSTANT:
+      result = v[a[0]] + op_params[i];
+      break;
+    case Lepton::Operation::MULTIPLY_CONSTANT:
+      result = v[a[0]] * op_params[i];
+      break;
+    default:
+      // All other operations (including custom functions) are done by Lepton
+      for (size_t k = 0; k < arg_offsets[i+1] - arg_offsets[i]; k++) {
+        op_args[k] = v[a[k]];
+      }
+      result = ops[i]->evaluate(op_args.data(), no_variables);
+      break;
+    }
+  }
+}
+
 #else
 
 int colvar::init_custom_function(std::string const &conf)
@@ -1343,22 +1488,6 @@ colvar::~colvar()
   }
 
   cv->config_changed();
-
-#ifdef LEPTON
-  for (std::vector<Lepton::CompiledExpression *>::iterator cei = value_evaluators.begin();
-       cei != value_evaluators.end();
-       ++cei) {
-    if (*cei != NULL) delete (*cei);
-  }
-  value_evaluators.clear();
-
-  for (std::vector<Lepton::CompiledExpression *>::iterator gei = gradient_evaluators.begin();
-       gei != gradient_evaluators.end();
-       ++gei) {
-    if (*gei != NULL) delete (*gei);
-  }
-  gradient_evaluators.clear();
-#endif
 }
 
 
@@ -1402,7 +1531,9 @@ int colvar::calc_cvcs(int first_cvc, size_t num_cvcs)
   }
   // atom coordinates are updated by the next line
   error_code |= calc_cvc_values(first_cvc, num_cvcs);
-  error_code |= calc_cvc_gradients(first_cvc, num_cvcs);
+  if (!defer_gradients()) {
+    error_code |= calc_cvc_gradients(first_cvc, num_cvcs);
+  }
   error_code |= calc_cvc_Jacobians(first_cvc, num_cvcs);
   if (proxy->total_forces_same_step()){
     // Use Jacobian derivative from this timestep
@@ -1424,6 +1555,9 @@ int colvar::collect_cvc_data()
   colvarproxy *proxy = cvm::main()->proxy;
   int error_code = COLVARS_OK;
 
+  // Same condition used by calc_cvcs() for the whole step
+  gradients_deferred = defer_gradients();
+
   if ((cvm::step_relative() > 0) && (!proxy->total_forces_same_step())){
     // Total force depends on Jacobian derivative from previous timestep
     // collect_cvc_total_forces() uses the previous value of jd
@@ -1492,7 +1626,13 @@ int colvar::collect_cvc_values()
   x.reset();
 
   // combine them appropriately, using either a scripted function or a polynomial
-  if (is_enabled(f_cv_scripted)) {
+  if (scalar_single_cvc) {
+    // the colvar value is the value of its only component
+    if (cvcs[0]->is_enabled()) {
+      x.real_value = cvcs[0]->value().real_value;
+    }
+
+  } else if (is_enabled(f_cv_scripted)) {
     // cvcs combined by user script
     int res = cvm::proxy->run_colvar_callback(scripted_function, sorted_cvc_values, x);
     if (res == COLVARS_NOT_IMPLEMENTED) {
@@ -1507,16 +1647,18 @@ int colvar::collect_cvc_values()
 #ifdef LEPTON
   } else if (is_enabled(f_cv_custom_function)) {
 
-    size_t l = 0; // index in the vector of variable references
+    size_t l = 0; // index of the evaluator input
 
-    for (size_t i = 0; i < x.size(); i++) {
-      // Fill Lepton evaluator variables with CVC values, serialized into scalars
-      for (size_t j = 0; j < cvcs.size(); j++) {
-        for (size_t k = 0; k < cvcs[j]->value().size(); k++) {
-          *(value_eval_var_refs[l++]) = cvcs[j]->value()[k];
-        }
+    // Fill Lepton evaluator variables with CVC values, serialized into scalars
+    for (size_t j = 0; j < cvcs.size(); j++) {
+      for (size_t k = 0; k < cvcs[j]->value().size(); k++) {
+        custom_function_evaluator->input(l++) = cvcs[j]->value()[k];
       }
-      x[i] = value_evaluators[i]->evaluate();
+    }
+    // Only the values are needed here, not the derivatives
+    custom_function_evaluator->evaluate(x.size());
+    for (size_t i = 0; i < x.size(); i++) {
+      x[i] = custom_function_evaluator->output(i);
     }
 #endif
 
@@ -1532,7 +1674,7 @@ int colvar::collect_cvc_values()
   } else {
     for (size_t i = 0; i < cvcs.size(); i++) {
       if (!cvcs[i]->is_enabled()) continue;
-      x += (cvcs[i])->sup_coeff * (cvcs[i])->value();
+      x.axpy((cvcs[i])->sup_coeff, (cvcs[i])->value());
     }
   }
 
@@ -1595,6 +1737,67 @@ int colvar::calc_cvc_gradients(int first_cvc, size_t num_cvcs)
 }
 
 
+bool colvar::defer_gradients() const
+{
+  if (!cvm::defer_gradients) {
+    return false;
+  }
+  // Gradients are needed before the forces are known by these features
+  if (is_enabled(f_cv_total_force_calc) || is_enabled(f_cv_Jacobian) ||
+      is_enabled(f_cv_collect_gradient)) {
+    return false;
+  }
+  for (size_t i = 0; i < cvcs.size(); i++) {
+    if (cvcs[i]->is_enabled() && cvcs[i]->is_enabled(f_cvc_debug_gradient)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+int colvar::calc_deferred_gradients(int first_cvc, size_t num_cvcs)
+{
+  if (!gradients_deferred || (f.norm2() == 0.0)) {
+    return COLVARS_OK;
+  }
+  return calc_cvc_gradients(first_cvc, num_cvcs);
+}
+
+
+int colvar::update_atomic_gradients()
+{
+  if (!defer_gradients()) {
+    // Already collected by collect_cvc_gradients() if enabled
+    return COLVARS_OK;
+  }
+
+  int error_code = COLVARS_OK;
+  if (gradients_deferred) {
+    error_code |= calc_cvc_gradients(0, num_active_cvcs());
+    gradients_deferred = false;
+  }
+
+  // Do not leave values from a previous step when the gradients cannot be collected
+  for (size_t a = 0; a < atomic_gradients.size(); a++) {
+    atomic_gradients[a].reset();
+  }
+  if (!is_enabled(f_cv_scalar) || !is_enabled(f_cv_collect_atom_ids)) {
+    return error_code;
+  }
+  for (size_t i = 0; i < cvcs.size(); i++) {
+    if (cvcs[i]->is_enabled() && !cvcs[i]->is_enabled(f_cvc_explicit_gradient)) {
+      return error_code;
+    }
+  }
+  for (size_t i = 0; i < cvcs.size(); i++) {
+    if (!cvcs[i]->is_enabled()) continue;
+    cvcs[i]->collect_gradients(atom_ids, atomic_gradients);
+  }
+  return error_code;
+}
+
+
 int colvar::collect_cvc_gradients()
 {
   size_t i;
@@ -1656,7 +1859,7 @@ int colvar::collect_cvc_total_forces()
                 cvm::to_str((cvcs[i])->total_force(),
                 cvm::cv_width, cvm::cv_prec)+".\n");
         // linear combination is assumed
-        ft += (cvcs[i])->total_force() * (cvcs[i])->sup_coeff / active_cvc_square_norm;
+        ft.axpy((cvcs[i])->sup_coeff / active_cvc_square_norm, (cvcs[i])->total_force());
       }
     }
 
@@ -1707,7 +1910,7 @@ int colvar::collect_cvc_Jacobians()
             cvm::to_str((cvcs[i])->Jacobian_derivative(),
             cvm::cv_width, cvm::cv_prec)+".\n");
       // linear combination is assumed
-      fj += (cvcs[i])->Jacobian_derivative() * (cvcs[i])->sup_coeff / active_cvc_square_norm;
+      fj.axpy((cvcs[i])->sup_coeff / active_cvc_square_norm, (cvcs[i])->Jacobian_derivative());
     }
     fj *= proxy->boltzmann() * proxy->target_temperature();
   }
@@ -1793,7 +1996,7 @@ int colvar::calc_colvar_properties()
 }
 
 
-cvm::real colvar::update_forces_energy()
+cvm::real colvar::update_forces_energy(bool batch_extended)
 {
   if (cvm::debug())
     cvm::log("Updating colvar \""+this->name+"\".\n");
@@ -1824,7 +2027,7 @@ cvm::real colvar::update_forces_energy()
   // At this point f is the force f from external biases that will be applied to the
   // extended variable if there is one
   if (is_enabled(f_cv_extended_Lagrangian) && cvm::proxy->simulation_running()) {
-    update_extended_Lagrangian();
+    update_extended_Lagrangian(batch_extended);
   }
 
   if (!is_enabled(f_cv_external)) {
@@ -1839,7 +2042,7 @@ cvm::real colvar::update_forces_energy()
 }
 
 
-void colvar::update_extended_Lagrangian()
+void colvar::update_extended_Lagrangian(bool batch_extended)
 {
   if (cvm::debug()) {
     cvm::log("Updating extended-Lagrangian degree of freedom.\n");
@@ -1892,11 +2095,12 @@ void colvar::update_extended_Lagrangian()
     // f: - initially, external biasing force
     //    - after this code block, colvar force to be applied to atomic coordinates
     //      ie. spring force (fb_actual will be added just below)
-    f_system = (-0.5 * ext_force_k) * this->dist2_lgrad(x_ext, x);
-    f        = -1.0 * f_system;
+    f_system = this->dist2_lgrad(x_ext, x);
+    f_system *= -0.5 * ext_force_k;
     // Coupling force will be applied to atomic coords impulse-style
     // over an inner timestep of the back-end integrator
-    f *= cvm::real(time_step_factor);
+    f = f_system;
+    f *= -1.0 * cvm::real(time_step_factor);
   }
   f_ext += f_system;
 
@@ -1915,6 +2119,20 @@ void colvar::update_extended_Lagrangian()
   prev_x_ext = x_ext;
   prev_v_ext = v_ext;
 
+  if (batch_extended) {
+    // Potential energy at t; the integration itself is done for all colvars
+    // at once, and the kinetic energy set, by colvarmodule
+    potential_energy = 0.5 * ext_force_k * this->dist2(x_ext, x);
+    kinetic_energy = 0.0;
+    bool const thermostat = is_enabled(f_cv_Langevin);
+    cvm::main()->add_extended_Lagrangian_batch(this, x_ext.real_value, v_ext.real_value,
+                                               f_ext.real_value, ext_mass, dt,
+                                               thermostat ? cvm::exp(- 1.0 * dt * ext_gamma) : 1.0,
+                                               thermostat ? ext_sigma / ext_mass : 0.0,
+                                               thermostat);
+    return;
+  }
+
   // BAOA (GSD) integrator as formulated in https://doi.org/10.1021/acs.jctc.2c00585
   // starting from x_t, f_t, v_(t-1/2)
   // Variation: the velocity step is split in two to estimate the kinetic energy at time t
@@ -1923,10 +2141,10 @@ void colvar::update_extended_Lagrangian()
 
   // [B] Eq. (10a) split into two half-steps
   // would reduce to leapfrog when gamma = 0 if this was the reported velocity
-  v_ext  += 0.5 * dt * f_ext / ext_mass;
+  v_ext.axpy(0.5 * dt / ext_mass, f_ext);
 
   // Kinetic energy at t
-  kinetic_energy = 0.5 * ext_mass * v_ext * v_ext;
+  kinetic_energy = 0.5 * ext_mass * v_ext.norm2();
 
   // Potential energy at t
   potential_energy = 0.5 * ext_force_k * this->dist2(x_ext, x);
@@ -1934,22 +2152,38 @@ void colvar::update_extended_Lagrangian()
   // Total energy will lag behind position by one timestep
   // (current kinetic energy is not accessible before the next force calculation)
 
-  v_ext  += 0.5 * dt * f_ext / ext_mass;
+  v_ext.axpy(0.5 * dt / ext_mass, f_ext);
   // Final v_ext lags behind x_ext by half a timestep
 
   // [A] Half step in position (10b)
-  x_ext += dt * v_ext / 2.0;
+  x_ext.axpy(0.5 * dt, v_ext);
 
   // [O] leap to v_(i+1/2) (10c)
   if (is_enabled(f_cv_Langevin)) {
     colvarvalue rnd(x);
     rnd.set_random();
     // ext_sigma has been computed at init time according to (10c)
-    v_ext = cvm::exp(- 1.0 * dt * ext_gamma) * v_ext + ext_sigma * rnd / ext_mass;
+    v_ext = cvm::exp(- 1.0 * dt * ext_gamma) * v_ext;
+    v_ext.axpy(ext_sigma / ext_mass, rnd);
   }
   // [A] Second half step in position (10d)
-  x_ext  += dt * v_ext / 2.0;
+  x_ext.axpy(0.5 * dt, v_ext);
+
+  finish_extended_Lagrangian();
+}
+
+
+void colvar::set_extended_Lagrangian_state(cvm::real x_new, cvm::real v_new, cvm::real kinetic)
+{
+  x_ext.real_value = x_new;
+  v_ext.real_value = v_new;
+  kinetic_energy = kinetic;
+  finish_extended_Lagrangian();
+}
+
 
+void colvar::finish_extended_Lagrangian()
+{
   cvm::real delta = 0; // Length of overshoot past either reflecting boundary
   if ((is_enabled(f_cv_reflecting_lower_boundary) && (delta = x_ext - lower_boundary) < 0) ||
       (is_enabled(f_cv_reflecting_upper_boundary) && (delta = x_ext - upper_boundary) > 0)) {
@@ -2000,7 +2234,23 @@ void colvar::communicate_forces()
     cvm::log("Force to be applied: " + cvm::to_str(f) + "\n");
   }
 
-  if (is_enabled(f_cv_scripted)) {
+  if (gradients_deferred) {
+    if (f.norm2() == 0.0) {
+      // Nothing to apply: the gradients are not needed
+      return;
+    }
+    // Computed by colvarmodule::calc_deferred_gradients()
+    gradients_deferred = false;
+  }
+
+  if (scalar_single_cvc) {
+
+    // the colvar force is the force on its only component
+    if (cvcs[0]->is_enabled()) {
+      cvcs[0]->apply_force(f);
+    }
+
+  } else if (is_enabled(f_cv_scripted)) {
     std::vector<cvm::matrix2d<cvm::real> > func_grads;
     func_grads.reserve(cvcs.size());
     for (i = 0; i < cvcs.size(); i++) {
@@ -2031,21 +2281,23 @@ void colvar::communicate_forces()
 #ifdef LEPTON
   } else if (is_enabled(f_cv_custom_function)) {
 
-    size_t r = 0; // index in the vector of variable references
-    size_t e = 0; // index of the gradient evaluator
+    size_t r = 0; // index of the evaluator input
+
+    // Feed cvc values to the evaluator, then compute all derivatives at once
+    for (size_t k = 0; k < cvcs.size(); k++) {
+      for (size_t l = 0; l < cvcs[k]->value().size(); l++) {
+        custom_function_evaluator->input(r++) = cvcs[k]->value()[l];
+      }
+    }
+    custom_function_evaluator->evaluate();
+
+    size_t e = x.size(); // index of the derivative among the evaluator outputs
 
     for (i = 0; i < cvcs.size(); i++) {  // gradient with respect to cvc i
       cvm::matrix2d<cvm::real> jacobian (x.size(), cvcs[i]->value().size());
       for (size_t j = 0; j < cvcs[i]->value().size(); j++) { // j-th element
         for (size_t c = 0; c < x.size(); c++) { // derivative of scalar element c of the colvarvalue
-
-          // Feed cvc values to the evaluator
-          for (size_t k = 0; k < cvcs.size(); k++) { //
-            for (size_t l = 0; l < cvcs[k]->value().size(); l++) {
-              *(grad_eval_var_refs[r++]) = cvcs[k]->value()[l];
-            }
-          }
-          jacobian[c][j] = gradient_evaluators[e++]->evaluate();
+          jacobian[c][j] = custom_function_evaluator->output(e++);
         }
       }
       // cvc force is colvar force times colvar/cvc Jacobian
@@ -2672,6 +2924,7 @@ int colvar::write_output_files()
 
   if (is_enabled(f_cv_corrfunc)) {
     if (acf.size()) {
+      add_pending_acf_samples();
       if (acf_outfile.size() == 0) {
         acf_outfile = std::string(cvm::output_prefix()+"."+this->name+
                                   ".corrfunc.dat");
@@ -2712,31 +2965,101 @@ int colvar::analyze()
 }
 
 
-inline void history_add_value(size_t const           &history_length,
-                              std::list<colvarvalue> &history,
-                              colvarvalue const      &new_value)
-{
-  history.push_front(new_value);
-  if (history.size() > history_length)
-    history.pop_back();
+namespace {
+
+  /// \brief Append to features all products of degree components out of d
+  /// (each combination once, with its multiplicity times coeff as weight),
+  /// so that the weighted sum of the products of the features of two vectors
+  /// equals coeff times the power of their scalar product
+  void add_product_features(size_t d, int degree, cvm::real coeff,
+                            std::vector<std::vector<int> > &features,
+                            std::vector<cvm::real> &weights)
+  {
+    std::vector<int> indices(degree, 0);
+    while (true) {
+      // Multinomial coefficient of this combination
+      cvm::real weight = coeff;
+      int run = 1;
+      for (int k = 1; k <= degree; k++) {
+        weight *= cvm::real(k);
+        if (k < degree && indices[k] == indices[k-1]) {
+          run++;
+        } else {
+          for (int r = 2; r <= run; r++) weight /= cvm::real(r);
+          run = 1;
+        }
+      }
+      features.push_back(indices);
+      weights.push_back(weight);
+      // Next non-decreasing sequence of indices
+      int k = degree - 1;
+      while (k >= 0 && size_t(indices[k]) == d - 1) k--;
+      if (k < 0) break;
+      indices[k]++;
+      for (int l = k + 1; l < degree; l++) indices[l] = indices[k];
+    }
+  }
+
 }
 
 
-inline void history_incr(std::list< std::list<colvarvalue> >           &history,
-                         std::list< std::list<colvarvalue> >::iterator &history_p)
+int colvar::init_acf_features(colvarvalue const &v)
 {
-  if ((++history_p) == history.end())
-    history_p = history.begin();
+  acf_feature_components.clear();
+  acf_feature_weights.clear();
+  acf_unit_values = false;
+  acf_const_term = 0.0;
+
+  size_t const d = v.size();
+  bool const quaternion = (v.type() == colvarvalue::type_quaternion) ||
+    (v.type() == colvarvalue::type_quaternionderiv);
+
+  // Express the term between two values as a polynomial of their scalar
+  // product s, whose powers are sums of products of features
+  switch (acf_type) {
+  case acf_vel:
+  case acf_coor:
+    if (quaternion) {
+      // Cosine between the two orientations: 2 s^2 - 1
+      add_product_features(d, 2, 2.0, acf_feature_components, acf_feature_weights);
+      acf_const_term = -1.0;
+    } else {
+      add_product_features(d, 1, 1.0, acf_feature_components, acf_feature_weights);
+    }
+    break;
+  case acf_p2coor:
+    if (v.type() == colvarvalue::type_scalar) {
+      return cvm::error("Error: cannot calculate Legendre polynomials "
+                        "for scalar variables.\n", COLVARS_INPUT_ERROR);
+    }
+    if (quaternion) {
+      // P2 of the cosine 2 s^2 - 1: 6 s^4 - 6 s^2 + 1
+      add_product_features(d, 4, 6.0, acf_feature_components, acf_feature_weights);
+      add_product_features(d, 2, -6.0, acf_feature_components, acf_feature_weights);
+      acf_const_term = 1.0;
+    } else {
+      acf_unit_values = (v.type() == colvarvalue::type_3vector) ||
+        (v.type() == colvarvalue::type_vector);
+      add_product_features(d, 2, 1.5, acf_feature_components, acf_feature_weights);
+      acf_const_term = -0.5;
+    }
+    break;
+  case acf_notset:
+  default:
+    break;
+  }
+
+  return COLVARS_OK;
 }
 
 
 int colvar::calc_acf()
 {
-  // using here an acf_stride-long list of vectors for either
-  // coordinates (acf_x_history) or velocities (acf_v_history); each vector can
-  // contain up to acf_length values, which are contiguous in memory
-  // representation but separated by acf_stride in the time series;
-  // the pointer to each vector is changed at every step
+  // All samples are stored in acf_history, each as the list of features
+  // defined by init_acf_features(); every sample that follows at least
+  // acf_stride*(acf_offset+acf_length) others contributes one frame to the
+  // ACF, and its products with the previous samples are added in blocks,
+  // computing the correlation of each block with the preceding ones by FFT
 
   colvar const *cfcv = cvm::colvar_by_name(acf_colvar_name);
   if (cfcv == NULL) {
@@ -2744,7 +3067,7 @@ int colvar::calc_acf()
                       "\" is not defined at this time.\n", COLVARS_INPUT_ERROR);
   }
 
-  if (acf_x_history.empty() && acf_v_history.empty()) {
+  if (acf_history.capacity() == 0) {
 
     // first-step operations
 
@@ -2762,57 +3085,35 @@ int colvar::calc_acf()
     if (acf.size() < acf_length+1)
       acf.resize(acf_length+1, 0.0);
 
-    size_t i;
-    switch (acf_type) {
-
-    case acf_vel:
-      // allocate space for the velocities history
-      for (i = 0; i < acf_stride; i++) {
-        acf_v_history.push_back(std::list<colvarvalue>());
-      }
-      acf_v_history_p = acf_v_history.begin();
-      break;
-
-    case acf_coor:
-    case acf_p2coor:
-      // allocate space for the coordinates history
-      for (i = 0; i < acf_stride; i++) {
-        acf_x_history.push_back(std::list<colvarvalue>());
-      }
-      acf_x_history_p = acf_x_history.begin();
-      break;
-
-    case acf_notset:
-    default:
-      break;
+    int error_code = init_acf_features((acf_type == acf_vel) ?
+                                       cfcv->velocity() : cfcv->value());
+    if (error_code != COLVARS_OK) {
+      return error_code;
     }
 
+    // Hold at least as many new samples as there are previous ones to
+    // correlate with, so that the cost of the FFTs per sample stays small
+    size_t const max_lag = acf_stride * (acf_offset + acf_length);
+    acf_history.reset(max_lag + std::max(max_lag, size_t(1024)),
+                      acf_feature_weights.size());
+    acf_num_pending = 0;
+    acf_num_samples = 0;
+
   } else if (cvm::step_relative() > prev_timestep) {
 
     switch (acf_type) {
 
     case acf_vel:
-
-      calc_vel_acf((*acf_v_history_p), cfcv->velocity());
-      history_add_value(acf_length+acf_offset, *acf_v_history_p,
-                        cfcv->velocity());
-      history_incr(acf_v_history, acf_v_history_p);
+      add_acf_sample(cfcv->velocity(), cfcv->velocity().norm2());
       break;
 
     case acf_coor:
-
-      calc_coor_acf((*acf_x_history_p), cfcv->value());
-      history_add_value(acf_length+acf_offset, *acf_x_history_p,
-                        cfcv->value());
-      history_incr(acf_x_history, acf_x_history_p);
+      add_acf_sample(cfcv->value(), x.norm2());
       break;
 
     case acf_p2coor:
-
-      calc_p2coor_acf((*acf_x_history_p), cfcv->value());
-      history_add_value(acf_length+acf_offset, *acf_x_history_p,
-                        cfcv->value());
-      history_incr(acf_x_history, acf_x_history_p);
+      // value of P2(0) = 1
+      add_acf_sample(cfcv->value(), 1.0);
       break;
 
     case acf_notset:
@@ -2825,70 +3126,76 @@ int colvar::calc_acf()
 }
 
 
-void colvar::calc_vel_acf(std::list<colvarvalue> &v_list,
-                          colvarvalue const      &v)
+void colvar::add_acf_sample(colvarvalue const &v, cvm::real self_term)
 {
-  // loop over stored velocities and add to the ACF, but only if the
-  // length is sufficient to hold an entire row of ACF values
-  if (v_list.size() >= acf_length+acf_offset) {
-    std::list<colvarvalue>::iterator  vs_i = v_list.begin();
-    std::vector<cvm::real>::iterator acf_i = acf.begin();
-
-    for (size_t i = 0; i < acf_offset; i++)
-      ++vs_i;
-
-    // current vel with itself
-    *(acf_i) += v.norm2();
-    ++acf_i;
-
-    // inner products of previous velocities with current (acf_i and
-    // vs_i are updated)
-    colvarvalue::inner_opt(v, vs_i, v_list.end(), acf_i);
+  cvm::real const scale = acf_unit_values ? 1.0 / cvm::sqrt(v.norm2()) : 1.0;
+  cvm::real *features = acf_history.push();
+  for (size_t f = 0; f < acf_feature_components.size(); f++) {
+    cvm::real product = 1.0;
+    for (size_t k = 0; k < acf_feature_components[f].size(); k++) {
+      product *= v[acf_feature_components[f][k]] * scale;
+    }
+    features[f] = product;
+  }
 
+  size_t const max_lag = acf_stride * (acf_offset + acf_length);
+  if (acf_num_samples >= max_lag) {
+    acf[0] += self_term;
     acf_nframes++;
+    acf_num_pending++;
   }
-}
+  acf_num_samples++;
 
-
-void colvar::calc_coor_acf(std::list<colvarvalue> &x_list,
-                           colvarvalue const &x_now)
-{
-  // same as above but for coordinates
-  if (x_list.size() >= acf_length+acf_offset) {
-    std::list<colvarvalue>::iterator  xs_i = x_list.begin();
-    std::vector<cvm::real>::iterator acf_i = acf.begin();
-
-    for (size_t i = 0; i < acf_offset; i++)
-      ++xs_i;
-
-    *(acf_i++) += x.norm2();
-
-    colvarvalue::inner_opt(x_now, xs_i, x_list.end(), acf_i);
-
-    acf_nframes++;
+  if (acf_num_pending + max_lag == acf_history.capacity()) {
+    add_pending_acf_samples();
   }
 }
 
 
-void colvar::calc_p2coor_acf(std::list<colvarvalue> &x_list,
-                             colvarvalue const &x_now)
+void colvar::add_pending_acf_samples()
 {
-  // same as above but with second order Legendre polynomial instead
-  // of just the scalar product
-  if (x_list.size() >= acf_length+acf_offset) {
-    std::list<colvarvalue>::iterator  xs_i = x_list.begin();
-    std::vector<cvm::real>::iterator acf_i = acf.begin();
+  if (acf_num_pending == 0) {
+    return;
+  }
 
-    for (size_t i = 0; i < acf_offset; i++)
-      ++xs_i;
+  // Correlate the block of the P pending samples with the window of the
+  // last P+T samples, where T is the largest lag:
+  // r(s) = sum_i block[i] * window[i+s], and the lag is T-s
+  size_t const num_block = acf_num_pending;
+  size_t const max_lag = acf_stride * (acf_offset + acf_length);
+  size_t const num_window = num_block + max_lag;
+  size_t const first = acf_history.size() - num_window;
+  size_t n = 1;
+  while (n < num_window) n *= 2;
 
-    // value of P2(0) = 1
-    *(acf_i++) += 1.0;
+  typedef std::complex<cvm::real> complex_t;
+  std::vector<complex_t> z(n), spectrum(n, complex_t(0.0));
 
-    colvarvalue::p2leg_opt(x_now, xs_i, x_list.end(), acf_i);
+  for (size_t f = 0; f < acf_feature_weights.size(); f++) {
+    // Transform block and window together, as the real and imaginary parts
+    for (size_t i = 0; i < n; i++) {
+      cvm::real const b = (i < num_block) ? acf_history[first + max_lag + i][f] : 0.0;
+      cvm::real const w = (i < num_window) ? acf_history[first + i][f] : 0.0;
+      z[i] = complex_t(b, w);
+    }
+    FFT::transform(z, false);
+    for (size_t k = 0; k < n; k++) {
+      complex_t const zk = z[k];
+      complex_t const zc = std::conj(z[(n - k) % n]);
+      complex_t const block_k = 0.5 * (zk + zc);
+      complex_t const window_k = complex_t(0.0, -0.5) * (zk - zc);
+      spectrum[k] += acf_feature_weights[f] * std::conj(block_k) * window_k;
+    }
+  }
+  FFT::transform(spectrum, true);
 
-    acf_nframes++;
+  for (size_t j = 1; j <= acf_length; j++) {
+    size_t const lag = acf_stride * (acf_offset + j);
+    acf[j] += spectrum[max_lag - lag].real() / cvm::real(n) +
+      acf_const_term * cvm::real(num_block);
   }
+
+  acf_num_pending = 0;
 }
 
 
@@ -2950,33 +3257,94 @@ int colvar::write_acf(std::ostream &os)
 }
 
 
+bool colvar::runave_euclidean() const
+{
+  if (is_enabled(f_cv_periodic) ||
+      (is_enabled(f_cv_homogeneous) && cvcs[0]->is_enabled(f_cvc_periodic))) {
+    return false;
+  }
+  switch (value().type()) {
+  case colvarvalue::type_scalar:
+  case colvarvalue::type_vector:
+    return true;
+  case colvarvalue::type_3vector:
+    // Distance vectors may be wrapped by the minimum-image convention
+    return !(is_enabled(f_cv_homogeneous) &&
+             cvcs[0]->is_enabled(f_cvc_pbc_minimum_image));
+  default:
+    return false;
+  }
+}
+
+
 int colvar::calc_runave()
 {
   int error_code = COLVARS_OK;
   colvarproxy *proxy = cvm::main()->proxy;
 
-  if (x_history.empty()) {
+  if (runave_history.capacity() == 0) {
 
     runave.type(value().type());
     runave.reset();
 
-    // first-step operationsf
+    // first-step operations
 
     if (cvm::debug())
       cvm::log("Colvar \""+this->name+
                 "\": initializing running average calculation.\n");
 
-    acf_nframes = 0;
-
-    x_history.push_back(std::list<colvarvalue>());
-    x_history_p = x_history.begin();
+    runave_history.reset(std::max(runave_length, size_t(1)));
+    runave_mean.assign(value().size(), 0.0);
+    runave_m2 = 0.0;
+    runave_num_updates = 0;
 
   } else {
 
     if ( (cvm::step_relative() % runave_stride) == 0 &&
          (cvm::step_relative() > prev_timestep) ) {
 
-      if ((*x_history_p).size() >= runave_length-1) {
+      // Update the mean and the sum of squared deviations of the window
+      size_t const d = runave_mean.size();
+      if (runave_history.full()) {
+        // Replace the oldest value
+        colvarvalue const &x_oldest = *(runave_history[0]);
+        cvm::real const n = cvm::real(runave_history.size());
+        for (size_t c = 0; c < d; c++) {
+          cvm::real const mean_old = runave_mean[c];
+          cvm::real const delta = x[c] - x_oldest[c];
+          runave_mean[c] += delta / n;
+          runave_m2 += delta * (x[c] - runave_mean[c] + x_oldest[c] - mean_old);
+        }
+      } else {
+        cvm::real const n = cvm::real(runave_history.size() + 1);
+        for (size_t c = 0; c < d; c++) {
+          cvm::real const delta = x[c] - runave_mean[c];
+          runave_mean[c] += delta / n;
+          runave_m2 += delta * (x[c] - runave_mean[c]);
+        }
+      }
+      *(runave_history.push()) = x;
+
+      // Limit the accumulation of round-off errors
+      if (++runave_num_updates >= runave_history.capacity()) {
+        size_t const n = runave_history.size();
+        std::fill(runave_mean.begin(), runave_mean.end(), 0.0);
+        for (size_t i = 0; i < n; i++) {
+          for (size_t c = 0; c < d; c++) {
+            runave_mean[c] += (*(runave_history[i]))[c] / cvm::real(n);
+          }
+        }
+        runave_m2 = 0.0;
+        for (size_t i = 0; i < n; i++) {
+          for (size_t c = 0; c < d; c++) {
+            cvm::real const delta = (*(runave_history[i]))[c] - runave_mean[c];
+            runave_m2 += delta * delta;
+          }
+        }
+        runave_num_updates = 0;
+      }
+
+      if (runave_history.full()) {
 
         if (runave_outfile.size() == 0) {
           runave_outfile = std::string(cvm::output_prefix()+"."+
@@ -2997,21 +3365,22 @@ int colvar::calc_runave()
         }
 
         runave = x;
-        std::list<colvarvalue>::iterator xs_i;
-        for (xs_i = (*x_history_p).begin();
-             xs_i != (*x_history_p).end(); ++xs_i) {
-          runave += (*xs_i);
+        for (size_t c = 0; c < d; c++) {
+          runave[c] = runave_mean[c];
         }
-        runave *= 1.0 / cvm::real(runave_length);
         runave.apply_constraints();
 
         runave_variance = 0.0;
-        runave_variance += this->dist2(x, runave);
-        for (xs_i = (*x_history_p).begin();
-             xs_i != (*x_history_p).end(); ++xs_i) {
-          runave_variance += this->dist2(x, (*xs_i));
+        if (runave_length > 1) {
+          if (runave_euclidean()) {
+            runave_variance = std::max(runave_m2, cvm::real(0.0));
+          } else {
+            for (size_t i = 0; i < runave_history.size(); i++) {
+              runave_variance += this->dist2(*(runave_history[i]), runave);
+            }
+          }
+          runave_variance *= 1.0 / cvm::real(runave_length-1);
         }
-        runave_variance *= 1.0 / cvm::real(runave_length-1);
 
         if (runave_outfile.size() > 0) {
           std::ostream &runave_os =
@@ -3022,8 +3391,6 @@ int colvar::calc_runave()
                     << cvm::sqrt(runave_variance) << "\n";
         }
       }
-
-      history_add_value(runave_length, *x_history_p, x);
     }
   }
 
@@ -17,6 +17,7 @@
 #include <memory>
 
 #include "colvarmodule.h"
+#include "colvarmodule_utils.h"
 #include "colvarvalue.h"
 #include "colvarparse.h"
 #include "colvardeps.h"
@@ -314,6 +315,18 @@ public:
   int calc_cvc_values(int first, size_t num_cvcs);
   /// \brief Same as \link colvar::calc_cvc_values \endlink but for gradients
   int calc_cvc_gradients(int first, size_t num_cvcs);
+  /// \brief Whether the gradients of the CVCs are only computed after the
+  /// force is known, and only if it is nonzero (see
+  /// colvarmodule::defer_gradients)
+  bool defer_gradients() const;
+  /// \brief Compute the gradients of the given subset of CVCs if these were
+  /// deferred at this step and the applied force is nonzero; the module
+  /// calls this for all active CVCs before communicate_forces()
+  int calc_deferred_gradients(int first, size_t num_cvcs);
+  /// \brief Compute any deferred gradients regardless of the applied force,
+  /// and collect them into atomic_gradients when possible (used to access
+  /// the gradients outside of the force calculation)
+  int update_atomic_gradients();
   /// \brief Same as \link colvar::calc_cvc_values \endlink but for total forces
   int calc_cvc_total_force(int first, size_t num_cvcs);
   /// \brief Same as \link colvar::calc_cvc_values \endlink but for Jacobian derivatives/forces
@@ -355,10 +368,22 @@ public:
   /// equations of motion of internal degrees of freedom; see also
   /// colvar::communicate_forces()
   /// return colvar energy if extended Lagrandian active
-  cvm::real update_forces_energy();
+  /// \param batch_extended If true, the extended-Lagrangian coordinate is only
+  /// queued for colvarmodule::integrate_extended_Lagrangian_batch(), which the
+  /// caller must then run (only colvarmodule::update_colvar_forces() does)
+  cvm::real update_forces_energy(bool batch_extended = false);
 
   /// \brief Integrate equations of motion of extended Lagrangian coordinate if needed
-  void update_extended_Lagrangian();
+  /// (or queue it for the batched integration, see update_forces_energy())
+  void update_extended_Lagrangian(bool batch_extended = false);
+
+  /// \brief Receive the extended-Lagrangian coordinate integrated by
+  /// colvarmodule::integrate_extended_Lagrangian_batch(), then apply boundaries
+  void set_extended_Lagrangian_state(cvm::real x_new, cvm::real v_new, cvm::real kinetic);
+
+  /// \brief Apply reflecting boundaries, constraints and wrapping to the
+  /// newly integrated extended-Lagrangian coordinate
+  void finish_extended_Lagrangian();
 
   /// \brief Communicate forces (previously calculated in
   /// colvar::update()) to the external degrees of freedom
@@ -399,6 +424,15 @@ protected:
   /// Update the sum of square coefficients for active cvcs
   void update_active_cvc_square_norm();
 
+  /// \brief Set at setup when the colvar is made of a single scalar CVC with
+  /// unit coefficient and exponent: its value and force are then passed
+  /// through as real numbers, without going through the linear combination
+  bool scalar_single_cvc = false;
+
+  /// \brief Whether the gradients of the active CVCs were not computed
+  /// together with their values at this step (see defer_gradients())
+  bool gradients_deferred = false;
+
   /// \brief Absolute timestep number when this colvar was last updated
   cvm::step_number prev_timestep;
 
@@ -423,6 +457,10 @@ public:
     return n_active_cvcs;
   }
 
+  /// \brief Time taken by each active CVC at its last calculation on a
+  /// thread, used to schedule the most expensive first
+  std::vector<cvm::real> smp_cvc_costs;
+
   /// \brief Use the internal metrics (as from \link colvar::cvc
   /// \endlink objects) to calculate square distances and gradients
   ///
@@ -502,19 +540,6 @@ protected:
   /// True if a state file was just read
   bool                   after_restart;
 
-  /// Time series of values and velocities used in correlation
-  /// functions
-  std::list< std::list<colvarvalue> > acf_x_history, acf_v_history;
-  /// Time series of values and velocities used in correlation
-  /// functions (pointers)x
-  std::list< std::list<colvarvalue> >::iterator acf_x_history_p, acf_v_history_p;
-
-  /// Time series of values and velocities used in running averages
-  std::list< std::list<colvarvalue> > x_history;
-  /// Time series of values and velocities used in correlation
-  /// functions (pointers)x
-  std::list< std::list<colvarvalue> >::iterator x_history_p;
-
   /// \brief Collective variable with which the correlation is
   /// calculated (default: itself)
   std::string            acf_colvar_name;
@@ -549,19 +574,34 @@ protected:
   /// Type of autocorrelation function (ACF)
   acf_type_e             acf_type;
 
-  /// \brief Velocity ACF, scalar product between v(0) and v(t)
-  void calc_vel_acf(std::list<colvarvalue> &v_history,
-                    colvarvalue const      &v);
-
-  /// \brief Coordinate ACF, scalar product between x(0) and x(t)
-  /// (does not work with scalar numbers)
-  void calc_coor_acf(std::list<colvarvalue> &x_history,
-                     colvarvalue const      &x);
-
-  /// \brief Coordinate ACF, second order Legendre polynomial between
-  /// x(0) and x(t) (does not work with scalar numbers)
-  void calc_p2coor_acf(std::list<colvarvalue> &x_history,
-                       colvarvalue const      &x);
+  /// \brief Recent values (or velocities) of the correlated variable, as
+  /// records of acf_feature_weights.size() features: the last
+  /// acf_stride*(acf_offset+acf_length) samples, followed by
+  /// acf_num_pending samples not yet added to the ACF
+  ring_buffer<cvm::real> acf_history;
+  /// Number of samples in acf_history that are not yet added to the ACF
+  size_t                 acf_num_pending = 0;
+  /// Total number of samples collected for the ACF
+  size_t                 acf_num_samples = 0;
+  /// \brief Indices of the value components whose product gives each
+  /// feature; the ACF term between two samples is the weighted sum over
+  /// features of their products, plus acf_const_term
+  std::vector<std::vector<int> > acf_feature_components;
+  /// Weight of each feature in the ACF
+  std::vector<cvm::real> acf_feature_weights;
+  /// Constant part of the ACF term between two samples
+  cvm::real              acf_const_term = 0.0;
+  /// Whether values are normalized before computing their features
+  bool                   acf_unit_values = false;
+
+  /// Define the features of the ACF for values like v
+  int init_acf_features(colvarvalue const &v);
+  /// Store the features of a new sample, and add its contribution to the ACF
+  /// at t = 0
+  void add_acf_sample(colvarvalue const &v, cvm::real self_term);
+  /// \brief Add the pending samples to the ACF, using their correlation
+  /// with the previous ones computed by FFT
+  void add_pending_acf_samples();
 
   /// Calculate the auto-correlation function (ACF)
   int calc_acf();
@@ -578,6 +618,18 @@ protected:
   colvarvalue    runave;
   /// Current value of the square deviation from the running average
   cvm::real      runave_variance = 0.0;
+  /// Values within the running average window
+  ring_buffer<colvarvalue> runave_history;
+  /// Mean of the components of the values in the window
+  std::vector<cvm::real> runave_mean;
+  /// Sum of the squared deviations of the values in the window from their mean
+  cvm::real      runave_m2 = 0.0;
+  /// Number of window updates since runave_mean and runave_m2 were last
+  /// computed from scratch
+  size_t         runave_num_updates = 0;
+  /// \brief Whether dist2() is the Euclidean distance between the components
+  /// of the values, so that the variance follows from runave_m2
+  bool runave_euclidean() const;
 
   /// Calculate the running average and its standard deviation
   int calc_runave();
@@ -680,18 +732,114 @@ protected:
   std::vector<const colvarvalue *> sorted_cvc_values;
 
 #ifdef LEPTON
-  /// Vector of evaluators for custom functions using Lepton
-  std::vector<Lepton::CompiledExpression *> value_evaluators;
+  /// \brief Evaluator of several Lepton expressions of the same variables,
+  /// flattened into one array of instructions where subexpressions that
+  /// are shared between expressions (e.g. a function and its derivatives)
+  /// are only computed once
+  class lepton_evaluator {
+  public:
+
+    /// Constructor; inputs are numbered in the order of variable_names
+    lepton_evaluator(std::vector<std::string> const &variable_names);
+
+    /// Destructor
+    ~lepton_evaluator();
+
+    lepton_evaluator(lepton_evaluator const &) = delete;
+    lepton_evaluator &operator = (lepton_evaluator const &) = delete;
+
+    /// \brief Append an expression (optimized first) to the outputs; all
+    /// outputs added before it can still be evaluated without it
+    /// \returns The index of the new output
+    size_t add_expression(Lepton::ParsedExpression const &expression);
+
+    /// Whether the given output depends on the given input
+    bool uses_input(size_t output, size_t input) const
+    {
+      return used_inputs[output][input];
+    }
+
+    /// Number of outputs
+    size_t num_outputs() const
+    {
+      return output_slots.size();
+    }
+
+    /// Modifiable value of an input variable
+    cvm::real &input(size_t i)
+    {
+      return values[i];
+    }
+
+    /// Compute the first n outputs (all of them by default)
+    void evaluate(size_t n);
+
+    /// Compute all outputs
+    void evaluate()
+    {
+      evaluate(num_outputs());
+    }
+
+    /// Value of an output after the last evaluation
+    cvm::real output(size_t i) const
+    {
+      return values[output_slots[i]];
+    }
+
+  protected:
+
+    /// Flatten the tree starting at node, returning the slot of its result
+    size_t add_node(Lepton::ExpressionTreeNode const &node, std::vector<bool> &used);
+
+    /// Slot holding the given constant
+    size_t constant_slot(cvm::real value);
+
+    /// Names of the input variables
+    std::vector<std::string> variable_names;
+
+    /// Inputs, followed by constants and intermediate results
+    std::vector<cvm::real> values;
+
+    /// Slots of the already defined constants
+    std::map<cvm::real, size_t> constant_slots;
+
+    /// Id of the Lepton operation of each instruction
+    std::vector<int> op_ids;
+
+    /// Copy of the Lepton operation of each instruction
+    std::vector<Lepton::Operation *> ops;
 
-  /// Vector of evaluators for gradients of custom functions
-  std::vector<Lepton::CompiledExpression *> gradient_evaluators;
+    /// Constant parameter (if any) of each instruction's operation
+    std::vector<cvm::real> op_params;
 
-  /// Vector of references to cvc values to be passed to Lepton evaluators
-  std::vector<double *> value_eval_var_refs;
-  std::vector<double *> grad_eval_var_refs;
+    /// Slot where each instruction stores its result
+    std::vector<size_t> result_slots;
 
-  /// Unused value that is written to when a variable simplifies out of a Lepton expression
-  double dev_null;
+    /// Range of each instruction's arguments within arg_slots
+    std::vector<size_t> arg_offsets;
+
+    /// Slots of the arguments of all instructions
+    std::vector<size_t> arg_slots;
+
+    /// Instructions indexed by operation id and argument slots, for reuse
+    std::map<std::pair<int, std::vector<size_t>>, std::vector<size_t>> op_index;
+
+    /// Slot of each output
+    std::vector<size_t> output_slots;
+
+    /// Number of instructions needed to compute each output and the preceding ones
+    std::vector<size_t> output_num_ops;
+
+    /// Inputs used by each output
+    std::vector<std::vector<bool>> used_inputs;
+
+    /// Arguments of the operation being evaluated through Lepton
+    std::vector<double> op_args;
+  };
+
+  /// \brief Evaluator of the custom functions (first x.size() outputs)
+  /// followed by their derivatives
+  std::unique_ptr<lepton_evaluator> custom_function_evaluator;
 #endif
 
   /// A global mapping of cvc names to the cvc constructors
@@ -760,8 +908,11 @@ inline colvarvalue const & colvar::total_force() const
 
 inline void colvar::add_bias_force(colvarvalue const &force)
 {
-  check_enabled(f_cv_gradient,
-                std::string("applying a force to the variable \""+name+"\""));
+  if (!is_enabled(f_cv_gradient)) {
+    // Only build the error message when it is needed
+    check_enabled(f_cv_gradient,
+                  std::string("applying a force to the variable \""+name+"\""));
+  }
   if (cvm::debug()) {
     cvm::log("Adding biasing force "+cvm::to_str(force)+" to colvar \""+name+"\".\n");
   }
@@ -42,95 +42,84 @@ namespace UIestimator {
             int i;
 
             this->lowerboundary = lowerboundary_input;
-            this->upperboundary = upperboundary_input;
             this->width = width_input;
             this->dimension = lowerboundary_input.size();
             this->y_size = y_size_input;     // keep in mind the internal (spare) matrix is stored in diagonal form
-            this->y_total_size = int(cvm::pow(double(y_size_input), double(dimension)) + EPSILON);
 
             // the range of the matrix is [lowerboundary, upperboundary]
+            x_size.resize(dimension);
+            x_stride.resize(dimension);
+            y_stride.resize(dimension);
             x_total_size = 1;
-            for (i = 0; i < dimension; i++) {
-                x_size.push_back(int((upperboundary_input[i] - lowerboundary_input[i]) / width_input[i] + EPSILON));
+            y_total_size = 1;
+            for (i = dimension - 1; i >= 0; i--) {
+                x_size[i] = int((upperboundary_input[i] - lowerboundary_input[i]) / width_input[i] + EPSILON);
+                x_stride[i] = x_total_size;
                 x_total_size *= x_size[i];
+                y_stride[i] = y_total_size;
+                y_total_size *= y_size;
             }
 
-            // initialize the internal matrix
-            matrix.reserve(x_total_size);
-            for (i = 0; i < x_total_size; i++) {
-                matrix.push_back(std::vector<int>(y_total_size, 0));
-            }
-
-            temp.resize(dimension);
+            // initialize the internal matrix: one row of y_total_size elements for each x
+            matrix.assign(size_t(x_total_size) * size_t(y_total_size), 0);
         }
 
-        int get_value(const std::vector<double> & x, const std::vector<double> & y) {
-            return matrix[convert_x(x)][convert_y(x, y)];
+        int get_value(const std::vector<double> & x, const std::vector<double> & y) const {
+            return matrix[index(x, y)];
         }
 
         void set_value(const std::vector<double> & x, const std::vector<double> & y, const int value) {
-            matrix[convert_x(x)][convert_y(x,y)] = value;
+            matrix[index(x, y)] = value;
         }
 
         void increase_value(const std::vector<double> & x, const std::vector<double> & y, const int value) {
-            matrix[convert_x(x)][convert_y(x,y)] += value;
+            matrix[index(x, y)] += value;
+        }
+
+        int get_x_total_size() const { return x_total_size; }
+        int get_y_total_size() const { return y_total_size; }
+        std::vector<int> const & get_x_size() const { return x_size; }
+        std::vector<int> const & get_y_stride() const { return y_stride; }
+
+        // the distribution of y for the x bin with the given internal index
+        int const * row(size_t ix) const {
+            return &matrix[ix * size_t(y_total_size)];
         }
 
     private:
         std::vector<double> lowerboundary;
-        std::vector<double> upperboundary;
         std::vector<double> width;
         int dimension;
         std::vector<int> x_size;       // the size of x in each dimension
+        std::vector<int> x_stride;     // the distance between consecutive x values in each dimension
+        std::vector<int> y_stride;     // the distance between consecutive y values in each dimension
         int x_total_size;              // the size of x of the internal matrix
         int y_size;                    // the size of y in each dimension
         int y_total_size;              // the size of y of the internal matrix
 
-        std::vector<std::vector<int> > matrix;  // the internal matrix
-
-        std::vector<int> temp;         // this vector is used in convert_x and convert_y to save computational resource
+        std::vector<int> matrix;       // the internal matrix, stored contiguously
 
-        int convert_x(const std::vector<double> & x) {       // convert real x value to its interal index
-
-            int i, j;
-
-            for (i = 0; i < dimension; i++) {
-                temp[i] = int((x[i] - lowerboundary[i]) / width[i] + EPSILON);
-            }
+        size_t index(const std::vector<double> & x, const std::vector<double> & y) const {
+            return size_t(convert_x(x)) * size_t(y_total_size) + size_t(convert_y(x, y));
+        }
 
+        int convert_x(const std::vector<double> & x) const {       // convert real x value to its interal index
             int index = 0;
-            for (i = 0; i < dimension; i++) {
-                if (i + 1 < dimension) {
-                    int x_temp = 1;
-                    for (j = i + 1; j < dimension; j++)
-                        x_temp *= x_size[j];
-                    index += temp[i] * x_temp;
-                }
-                else
-                    index += temp[i];
+            for (int i = 0; i < dimension; i++) {
+                index += int((x[i] - lowerboundary[i]) / width[i] + EPSILON) * x_stride[i];
             }
             return index;
         }
 
-        int convert_y(const std::vector<double> & x, const std::vector<double> & y) {       // convert real y value to its interal index
-
-            int i;
-
-            for (i = 0; i < dimension; i++) {
-                temp[i] = int(round((round(y[i] / width[i] + EPSILON) - round(x[i] / width[i] + EPSILON)) + (y_size - 1) / 2 + EPSILON));
-            }
-
+        int convert_y(const std::vector<double> & x, const std::vector<double> & y) const {       // convert real y value to its interal index
             int index = 0;
-            for (i = 0; i < dimension; i++) {
-                if (i + 1 < dimension)
-                    index += temp[i] * int(cvm::pow(double(y_size), double(dimension - i - 1)) + EPSILON);
-                else
-                    index += temp[i];
+            for (int i = 0; i < dimension; i++) {
+                index += int(round((round(y[i] / width[i] + EPSILON) - round(x[i] / width[i] + EPSILON)) + (y_size - 1) / 2 + EPSILON)) * y_stride[i];
             }
             return index;
         }
 
-        double round(double r) {
+        static double round(double r) {
             return (r > 0.0) ? floor(r + 0.5) : ceil(r - 0.5);
         }
     };
@@ -150,19 +139,21 @@ namespace UIestimator {
             this->width = width_input;
             this->dimension = lowerboundary_input.size();
 
+            lowerboundary.resize(dimension);
+            x_size.resize(dimension);
+            x_stride.resize(dimension);
             x_total_size = 1;
-            for (int i = 0; i < dimension; i++) {
-                this->lowerboundary.push_back(lowerboundary_input[i] - (y_size_input - 1) / 2 * width_input[i] - EPSILON);
-                this->upperboundary.push_back(upperboundary_input[i] + (y_size_input - 1) / 2 * width_input[i] + EPSILON);
+            for (int i = dimension - 1; i >= 0; i--) {
+                this->lowerboundary[i] = lowerboundary_input[i] - (y_size_input - 1) / 2 * width_input[i] - EPSILON;
+                double const upperboundary = upperboundary_input[i] + (y_size_input - 1) / 2 * width_input[i] + EPSILON;
 
-                x_size.push_back(int((this->upperboundary[i] - this->lowerboundary[i]) / this->width[i] + EPSILON));
+                x_size[i] = int((upperboundary - this->lowerboundary[i]) / this->width[i] + EPSILON);
+                x_stride[i] = x_total_size;
                 x_total_size *= x_size[i];
             }
 
             // initialize the internal vector
             vector.resize(x_total_size, default_value);
-
-            temp.resize(dimension);
         }
 
         T & get_value(const std::vector<double> & x) {
@@ -177,39 +168,30 @@ namespace UIestimator {
             vector[convert_x(x)] += value;
         }
 
+        // internal index of x, shared by all vectors with the same boundaries
+        int convert_x(const std::vector<double> & x) const {       // convert real x value to its interal index
+            int index = 0;
+            for (int i = 0; i < dimension; i++) {
+                index += int((x[i] - lowerboundary[i]) / width[i] + EPSILON) * x_stride[i];
+            }
+            return index;
+        }
+
+        T & operator [] (size_t index) { return vector[index]; }
+        T const & operator [] (size_t index) const { return vector[index]; }
+
+        size_t size() const { return vector.size(); }
+        std::vector<int> const & get_x_stride() const { return x_stride; }
+
     private:
         std::vector<double> lowerboundary;
-        std::vector<double> upperboundary;
         std::vector<double> width;
         int dimension;
         std::vector<int> x_size;       // the size of x in each dimension
+        std::vector<int> x_stride;     // the distance between consecutive x values in each dimension
         int x_total_size;              // the size of x of the internal matrix
 
         std::vector<T> vector;  // the internal vector
-
-        std::vector<int> temp;         // this vector is used in convert_x and convert_y to save computational resource
-
-        int convert_x(const std::vector<double> & x) {       // convert real x value to its interal index
-
-            int i, j;
-
-            for (i = 0; i < dimension; i++) {
-                temp[i] = int((x[i] - lowerboundary[i]) / width[i] + EPSILON);
-            }
-
-            int index = 0;
-            for (i = 0; i < dimension; i++) {
-                if (i + 1 < dimension) {
-                    int x_temp = 1;
-                    for (j = i + 1; j < dimension; j++)
-                        x_temp *= x_size[j];
-                    index += temp[i] * x_temp;
-                }
-                else
-                    index += temp[i];
-            }
-            return index;
-        }
     };
 
     class UIestimator {     // the implemension of UI estimator
@@ -259,6 +241,7 @@ namespace UIestimator {
 
             written = false;
             written_1D = false;
+            record = false;
 
             if (dimension == 1) {
                 std::vector<double> upperboundary_temp = upperboundary;
@@ -306,38 +289,36 @@ namespace UIestimator {
         bool update(cvm::step_number /* step */,
                     std::vector<double> x, std::vector<double> y) {
 
-            int i;
+            if (record) {
+                recorded.insert(recorded.end(), x.begin(), x.end());
+                recorded.insert(recorded.end(), y.begin(), y.end());
+            }
+            return add_sample(x, y);
+        }
 
-            for (i = 0; i < dimension; i++) {
-                // for dihedral RC, it is possible that x = 179 and y = -179, should correct it
-                // may have problem, need to fix
-                if (x[i] > 150 && y[i] < -150) {
-                    y[i] += 360;
-                }
-                if (x[i] < -150 && y[i] > 150) {
-                    y[i] -= 360;
-                }
+        // record the samples passed to update(), so that they can be merged into other estimators
+        void set_record_samples(bool flag) {
+            record = flag;
+            if (!record) recorded.clear();
+        }
 
-                if (x[i] < lowerboundary[i] - EXTENDED_X_SIZE * width[i] + EPSILON || x[i] > upperboundary[i] + EXTENDED_X_SIZE * width[i] - EPSILON \
-                    || y[i] - x[i] < -HALF_Y_SIZE * width[i] + EPSILON || y[i] - x[i] > HALF_Y_SIZE * width[i] - EPSILON \
-                    || y[i] - lowerboundary[i] < -HALF_Y_SIZE * width[i] + EPSILON || y[i] - upperboundary[i] > HALF_Y_SIZE * width[i] - EPSILON)
-                    return false;
-            }
+        // samples recorded since the last call to clear_recorded_samples(): x and y values for each
+        std::vector<double> const & recorded_samples() const {
+            return recorded;
+        }
 
-            for (i = 0; i < dimension; i++) {
-                sum_x[i].increase_value(y, x[i]);
-                sum_x_square[i].increase_value(y, x[i] * x[i]);
-            }
-            count_y.increase_value(y, 1);
+        void clear_recorded_samples() {
+            recorded.clear();
+        }
 
-            for (i = 0; i < dimension; i++) {
-                // adapt colvars precision
-                if (x[i] < lowerboundary[i] + EPSILON || x[i] > upperboundary[i] - EPSILON)
-                    return false;
+        // add samples recorded by another estimator with the same boundaries
+        void merge_samples(const double *samples, size_t num_samples) {
+            std::vector<double> x(dimension), y(dimension);
+            for (size_t n = 0; n < num_samples; n++, samples += 2 * dimension) {
+                x.assign(samples, samples + dimension);
+                y.assign(samples + dimension, samples + 2 * dimension);
+                add_sample(x, y);
             }
-            distribution_x_y.increase_value(x, y, 1);
-
-            return true;
         }
 
         // update the output_filename
@@ -378,33 +359,88 @@ namespace UIestimator {
         bool written;
         bool written_1D;
 
+        bool record;                       // whether samples are being recorded
+        std::vector<double> recorded;      // the recorded samples
+
+        bool add_sample(std::vector<double> & x, std::vector<double> & y) {
+
+            int i;
+
+            for (i = 0; i < dimension; i++) {
+                // for dihedral RC, it is possible that x = 179 and y = -179, should correct it
+                // may have problem, need to fix
+                if (x[i] > 150 && y[i] < -150) {
+                    y[i] += 360;
+                }
+                if (x[i] < -150 && y[i] > 150) {
+                    y[i] -= 360;
+                }
+
+                if (x[i] < lowerboundary[i] - EXTENDED_X_SIZE * width[i] + EPSILON || x[i] > upperboundary[i] + EXTENDED_X_SIZE * width[i] - EPSILON \
+                    || y[i] - x[i] < -HALF_Y_SIZE * width[i] + EPSILON || y[i] - x[i] > HALF_Y_SIZE * width[i] - EPSILON \
+                    || y[i] - lowerboundary[i] < -HALF_Y_SIZE * width[i] + EPSILON || y[i] - upperboundary[i] > HALF_Y_SIZE * width[i] - EPSILON)
+                    return false;
+            }
+
+            // all accumulators of y share the same internal index
+            size_t const iy = count_y.convert_x(y);
+            for (i = 0; i < dimension; i++) {
+                sum_x[i][iy] += x[i];
+                sum_x_square[i][iy] += x[i] * x[i];
+            }
+            count_y[iy] += 1;
+
+            for (i = 0; i < dimension; i++) {
+                // adapt colvars precision
+                if (x[i] < lowerboundary[i] + EPSILON || x[i] > upperboundary[i] - EPSILON)
+                    return false;
+            }
+            distribution_x_y.increase_value(x, y, 1);
+
+            return true;
+        }
+
     public:
         // calculate gradients from the internal variables
         void calc_pmf() {
             colvarproxy *proxy = cvm::main()->proxy;
 
             int norm;
-            int i, j, k;
+            int i, k;
+            size_t n;
 
-            std::vector<double> loop_flag(dimension, 0);
-            for (i = 0; i < dimension; i++) {
-                loop_flag[i] = lowerboundary[i] - HALF_Y_SIZE * width[i];
+            for (n = 0; n < count_y.size(); n++) {
+                norm = count_y[n] > 0 ? count_y[n] : 1;
+                for (k = 0; k < dimension; k++) {
+                    x_av[k][n] = sum_x[k][n] / norm;
+                    sigma_square[k][n] = sum_x_square[k][n] / norm - x_av[k][n] * x_av[k][n];
+                }
             }
 
+            // neighborhood of each x: offsets of y in the distribution matrix
+            // and in the y vectors, and the difference x - y
+            std::vector<int> const & x_size = distribution_x_y.get_x_size();
+            std::vector<int> const & y_stride = distribution_x_y.get_y_stride();
+            std::vector<int> const & v_stride = count_y.get_x_stride();
+            std::vector<int> y_offsets, v_offsets;
+            std::vector<double> diff_x_y;
+            std::vector<int> iy(dimension, 0);
             i = 0;
             while (i >= 0) {
-                norm = count_y.get_value(loop_flag) > 0 ? count_y.get_value(loop_flag) : 1;
-                for (j = 0; j < dimension; j++) {
-                    x_av[j].set_value(loop_flag, sum_x[j].get_value(loop_flag) / norm);
-                    sigma_square[j].set_value(loop_flag, sum_x_square[j].get_value(loop_flag) / norm - x_av[j].get_value(loop_flag) * x_av[j].get_value(loop_flag));
+                int y_offset = 0, v_offset = 0;
+                for (k = 0; k < dimension; k++) {
+                    y_offset += iy[k] * y_stride[k];
+                    v_offset += iy[k] * v_stride[k];
+                    diff_x_y.push_back((HALF_Y_SIZE - iy[k]) * width[k]);
                 }
+                y_offsets.push_back(y_offset);
+                v_offsets.push_back(v_offset);
 
-                // iterate over any dimensions
+                // iterate over any dimensions, from x - HALF_Y_SIZE to x + HALF_Y_SIZE - 1
                 i = dimension - 1;
                 while (i >= 0) {
-                    loop_flag[i] += width[i];
-                    if (loop_flag[i] > upperboundary[i] + HALF_Y_SIZE * width[i] - width[i] + EPSILON) {
-                        loop_flag[i] = lowerboundary[i] - HALF_Y_SIZE * width[i];
+                    if (++iy[i] == 2 * HALF_Y_SIZE) {
+                        iy[i] = 0;
                         i--;
                     }
                     else
@@ -415,65 +451,47 @@ namespace UIestimator {
             // double integration
             std::vector<double> av(dimension, 0);
             std::vector<double> diff_av(dimension, 0);
+            std::vector<double> grad_temp(dimension, 0);
+            std::vector<double> center(dimension, 0);
+            std::vector<int> ix(dimension, 0);
 
-            std::vector<double> loop_flag_x(dimension, 0);
-            std::vector<double> loop_flag_y(dimension, 0);
-            for (i = 0; i < dimension; i++) {
-                loop_flag_x[i] = lowerboundary[i];
-                loop_flag_y[i] = loop_flag_x[i] - HALF_Y_SIZE * width[i];
-            }
-
-            i = 0;
-            while (i >= 0) {
-                norm = 0;
+            for (int x_index = 0; x_index < distribution_x_y.get_x_total_size(); x_index++) {
+                int const * const dist = distribution_x_y.row(x_index);
+                int v_base = 0;
                 for (k = 0; k < dimension; k++) {
                     av[k] = 0;
                     diff_av[k] = 0;
-                    loop_flag_y[k] = loop_flag_x[k] - HALF_Y_SIZE * width[k];
+                    center[k] = lowerboundary[k] + (ix[k] + 0.5) * width[k];
+                    v_base += ix[k] * v_stride[k];
                 }
 
-                j = 0;
-                while (j >= 0) {
-                    norm += distribution_x_y.get_value(loop_flag_x, loop_flag_y);
+                norm = 0;
+                for (n = 0; n < y_offsets.size(); n++) {
+                    int const n_x_y = dist[y_offsets[n]];
+                    if (n_x_y == 0) continue;
+                    size_t const v = v_base + v_offsets[n];
+                    norm += n_x_y;
                     for (k = 0; k < dimension; k++) {
-                        if (sigma_square[k].get_value(loop_flag_y) > EPSILON || sigma_square[k].get_value(loop_flag_y) < -EPSILON)
-                            av[k] += distribution_x_y.get_value(loop_flag_x, loop_flag_y) * ( (loop_flag_x[k] + 0.5 * width[k]) - x_av[k].get_value(loop_flag_y)) / sigma_square[k].get_value(loop_flag_y);
+                        if (sigma_square[k][v] > EPSILON || sigma_square[k][v] < -EPSILON)
+                            av[k] += n_x_y * (center[k] - x_av[k][v]) / sigma_square[k][v];
 
-                        diff_av[k] += distribution_x_y.get_value(loop_flag_x, loop_flag_y) * (loop_flag_x[k] - loop_flag_y[k]);
-                    }
-
-                    // iterate over any dimensions
-                    j = dimension - 1;
-                    while (j >= 0) {
-                        loop_flag_y[j] += width[j];
-                        if (loop_flag_y[j] > loop_flag_x[j] + HALF_Y_SIZE * width[j] - width[j] + EPSILON) {
-                            loop_flag_y[j] = loop_flag_x[j] - HALF_Y_SIZE * width[j];
-                            j--;
-                        }
-                        else
-                            break;
+                        diff_av[k] += n_x_y * diff_x_y[n * dimension + k];
                     }
                 }
 
-                std::vector<double> grad_temp(dimension, 0);
                 for (k = 0; k < dimension; k++) {
                     diff_av[k] /= (norm > 0 ? norm : 1);
                     av[k] = proxy->boltzmann() * temperature * av[k] / (norm > 0 ? norm : 1);
                     grad_temp[k] = av[k] - krestr[k] * diff_av[k];
                 }
-                grad.set_value(loop_flag_x, grad_temp);
-                count.set_value(loop_flag_x, norm);
+                grad[x_index] = grad_temp;
+                count[x_index] = norm;
 
                 // iterate over any dimensions
-                i = dimension - 1;
-                while (i >= 0) {
-                    loop_flag_x[i] += width[i];
-                    if (loop_flag_x[i] > upperboundary[i] - width[i] + EPSILON) {
-                        loop_flag_x[i] = lowerboundary[i];
-                        i--;
-                    }
-                    else
+                for (i = dimension - 1; i >= 0; i--) {
+                    if (++ix[i] < x_size[i])
                         break;
+                    ix[i] = 0;
                 }
             }
         }
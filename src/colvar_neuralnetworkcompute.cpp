@@ -7,6 +7,7 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 
@@ -135,6 +136,8 @@ void denseLayer::readFromFile(const std::string& weights_file, const std::string
     // parse weights file
     m_weights.clear();
     m_biases.clear();
+    m_input_size = 0;
+    m_output_size = 0;
     std::string line;
     colvarproxy *proxy = cvm::main()->proxy;
     auto &ifs_weights = proxy->input_stream(weights_file, "weights file");
@@ -145,15 +148,20 @@ void denseLayer::readFromFile(const std::string& weights_file, const std::string
         std::vector<std::string> splitted_data;
         colvarparse::split_string(line, std::string{" "}, splitted_data);
         if (splitted_data.size() > 0) {
-            std::vector<double> weights_tmp(splitted_data.size());
+            // each line holds the weights of one output node, all lines must have the same length
+            if (m_output_size == 0) {
+                m_input_size = splitted_data.size();
+            } else if (splitted_data.size() != m_input_size) {
+                throw std::runtime_error("Inconsistent number of weights in line " + std::to_string(m_output_size + 1) + " of file " + weights_file);
+            }
             for (size_t i = 0; i < splitted_data.size(); ++i) {
                 try {
-                    weights_tmp[i] = std::stod(splitted_data[i]);
+                    m_weights.push_back(std::stod(splitted_data[i]));
                 } catch (...) {
                     throw std::runtime_error("Cannot convert " + splitted_data[i] + " to a number while reading file " + weights_file);
                 }
             }
-            m_weights.push_back(weights_tmp);
+            ++m_output_size;
         }
     }
     proxy->close_input_stream(weights_file);
@@ -178,8 +186,9 @@ void denseLayer::readFromFile(const std::string& weights_file, const std::string
     }
     proxy->close_input_stream(biases_file);
 
-    m_input_size = m_weights[0].size();
-    m_output_size = m_weights.size();
+    if (m_output_size == 0) {
+        throw std::runtime_error("No weights found in file " + weights_file);
+    }
 }
 
 void denseLayer::setActivationFunction(const std::function<double(double)>& f, const std::function<double(double)>& df) {
@@ -188,37 +197,76 @@ void denseLayer::setActivationFunction(const std::function<double(double)>& f, c
 }
 
 void denseLayer::compute(const std::vector<double>& input, std::vector<double>& output) const {
-    for (size_t i = 0; i < m_output_size; ++i) {
-        output[i] = 0;
+    const double* w_i = m_weights.data();
+    for (size_t i = 0; i < m_output_size; ++i, w_i += m_input_size) {
+        double sum_with_bias = 0;
         for (size_t j = 0; j < m_input_size; ++j) {
-            output[i] += input[j] * m_weights[i][j];
+            sum_with_bias += input[j] * w_i[j];
         }
-        output[i] += m_biases[i];
+        sum_with_bias += m_biases[i];
 #ifdef LEPTON
         if (m_use_custom_activation) {
-            output[i] = m_custom_activation_function.evaluate(output[i]);
+            output[i] = m_custom_activation_function.evaluate(sum_with_bias);
         } else {
 #endif
-            output[i] = m_activation_function(output[i]);
+            output[i] = m_activation_function(sum_with_bias);
 #ifdef LEPTON
         }
 #endif
     }
 }
 
+void denseLayer::compute(const std::vector<double>& input, std::vector<double>& output, std::vector<double>& activation_derivative) const {
+    const double* w_i = m_weights.data();
+    for (size_t i = 0; i < m_output_size; ++i, w_i += m_input_size) {
+        double sum_with_bias = 0;
+        for (size_t j = 0; j < m_input_size; ++j) {
+            sum_with_bias += input[j] * w_i[j];
+        }
+        sum_with_bias += m_biases[i];
+#ifdef LEPTON
+        if (m_use_custom_activation) {
+            output[i] = m_custom_activation_function.evaluate(sum_with_bias);
+            activation_derivative[i] = m_custom_activation_function.derivative(sum_with_bias);
+        } else {
+#endif
+            output[i] = m_activation_function(sum_with_bias);
+            activation_derivative[i] = m_activation_function_derivative(sum_with_bias);
+#ifdef LEPTON
+        }
+#endif
+    }
+}
+
+void denseLayer::backPropagate(const std::vector<double>& output_grad, const std::vector<double>& activation_derivative, std::vector<double>& input_grad) const {
+    for (size_t j = 0; j < m_input_size; ++j) {
+        input_grad[j] = 0;
+    }
+    // accumulate rows of the weights, so that the matrix is traversed contiguously
+    const double* w_i = m_weights.data();
+    for (size_t i = 0; i < m_output_size; ++i, w_i += m_input_size) {
+        const double factor = output_grad[i] * activation_derivative[i];
+        if (factor == 0) continue;
+        for (size_t j = 0; j < m_input_size; ++j) {
+            input_grad[j] += factor * w_i[j];
+        }
+    }
+}
+
 double denseLayer::computeGradientElement(const std::vector<double>& input, const size_t i, const size_t j) const {
+    const double* w_i = m_weights.data() + i * m_input_size;
     double sum_with_bias = 0;
     for (size_t j_in = 0; j_in < m_input_size; ++j_in) {
-        sum_with_bias += input[j_in] * m_weights[i][j_in];
+        sum_with_bias += input[j_in] * w_i[j_in];
     }
     sum_with_bias += m_biases[i];
 #ifdef LEPTON
     if (m_use_custom_activation) {
-        const double grad_ij = m_custom_activation_function.derivative(sum_with_bias) * m_weights[i][j];
+        const double grad_ij = m_custom_activation_function.derivative(sum_with_bias) * w_i[j];
         return grad_ij;
     } else {
 #endif
-        const double grad_ij = m_activation_function_derivative(sum_with_bias) * m_weights[i][j];
+        const double grad_ij = m_activation_function_derivative(sum_with_bias) * w_i[j];
         return grad_ij;
 #ifdef LEPTON
     }
@@ -226,35 +274,44 @@ double denseLayer::computeGradientElement(const std::vector<double>& input, cons
 }
 
 void denseLayer::computeGradient(const std::vector<double>& input, std::vector<std::vector<double>>& output_grad) const {
-    for (size_t j = 0; j < m_input_size; ++j) {
-        for (size_t i = 0; i < m_output_size; ++i) {
-            output_grad[i][j] = computeGradientElement(input, i, j);
+    std::vector<double> output(m_output_size), activation_derivative(m_output_size);
+    compute(input, output, activation_derivative);
+    const double* w_i = m_weights.data();
+    for (size_t i = 0; i < m_output_size; ++i, w_i += m_input_size) {
+        for (size_t j = 0; j < m_input_size; ++j) {
+            output_grad[i][j] = activation_derivative[i] * w_i[j];
         }
     }
 }
 
 neuralNetworkCompute::neuralNetworkCompute(const std::vector<denseLayer>& dense_layers): m_dense_layers(dense_layers) {
-    m_layers_output.resize(m_dense_layers.size());
-    m_grads_tmp.resize(m_dense_layers.size());
-    for (size_t i_layer = 0; i_layer < m_layers_output.size(); ++i_layer) {
-        m_layers_output[i_layer].assign(m_dense_layers[i_layer].getOutputSize(), 0);
-        m_grads_tmp[i_layer].assign(m_dense_layers[i_layer].getOutputSize(), std::vector<double>(m_dense_layers[i_layer].getInputSize(), 0));
+    for (size_t i_layer = 0; i_layer < m_dense_layers.size(); ++i_layer) {
+        addLayerBuffers(m_dense_layers[i_layer]);
+    }
+}
+
+void neuralNetworkCompute::addLayerBuffers(const denseLayer& layer) {
+    m_layers_output.push_back(std::vector<double>(layer.getOutputSize(), 0));
+    m_layers_derivative.push_back(std::vector<double>(layer.getOutputSize(), 0));
+    const size_t width = std::max(layer.getInputSize(), layer.getOutputSize());
+    if (m_backward_grad.size() < width) {
+        m_backward_grad.resize(width);
+        m_backward_grad_next.resize(width);
     }
+    m_chained_grad.assign(layer.getOutputSize() * m_dense_layers.front().getInputSize(), 0);
 }
 
 bool neuralNetworkCompute::addDenseLayer(const denseLayer& layer) {
     if (m_dense_layers.empty()) {
         // add layer to this ann directly if m_dense_layers is empty
         m_dense_layers.push_back(layer);
-        m_layers_output.push_back(std::vector<double>(layer.getOutputSize()));
-        m_grads_tmp.push_back(std::vector<std::vector<double>>(layer.getOutputSize(), std::vector<double>(layer.getInputSize(), 0)));
+        addLayerBuffers(layer);
         return true;
     } else {
         // otherwise, we need to check if the output of last layer in m_dense_layers matches the input of layer to be added
         if (m_dense_layers.back().getOutputSize() == layer.getInputSize()) {
             m_dense_layers.push_back(layer);
-            m_layers_output.push_back(std::vector<double>(layer.getOutputSize()));
-            m_grads_tmp.push_back(std::vector<std::vector<double>>(layer.getOutputSize(), std::vector<double>(layer.getInputSize(), 0)));
+            addLayerBuffers(layer);
             return true;
         } else {
             return false;
@@ -262,49 +319,37 @@ bool neuralNetworkCompute::addDenseLayer(const denseLayer& layer) {
     }
 }
 
-std::vector<std::vector<double>> neuralNetworkCompute::multiply_matrix(const std::vector<std::vector<double>>& A, const std::vector<std::vector<double>>& B) {
-    const size_t m = A.size();
-    const size_t n = B.size();
-    if (A[0].size() != n) {
-        std::cerr << "Error on multiplying matrices!\n";
-    }
-    const size_t t = B[0].size();
-    std::vector<std::vector<double>> C(m, std::vector<double>(t, 0.0));
-    for (size_t i = 0; i < m; ++i) {
-        for (size_t k = 0; k < n; ++k) {
-            const auto tmp = A[i][k];
-            auto& C_i = C[i];
-            auto& B_k = B[k];
-            for (size_t j = 0; j < t; ++j) {
-                C_i[j] += tmp * B_k[j];
-            }
-        }
+void neuralNetworkCompute::backPropagate(const size_t i) {
+    // start from the unit vector of the i-th output, and go through the layers in reverse
+    std::fill(m_backward_grad.begin(), m_backward_grad.end(), 0.0);
+    m_backward_grad[i] = 1.0;
+    for (size_t i_layer = m_dense_layers.size(); i_layer-- > 0; ) {
+        m_dense_layers[i_layer].backPropagate(m_backward_grad, m_layers_derivative[i_layer], m_backward_grad_next);
+        m_backward_grad.swap(m_backward_grad_next);
     }
-    return C;
+    const size_t input_size = m_dense_layers.front().getInputSize();
+    std::copy(m_backward_grad.begin(), m_backward_grad.begin() + input_size, m_chained_grad.begin() + i * input_size);
 }
 
-void neuralNetworkCompute::compute() {
+void neuralNetworkCompute::compute(const size_t i) {
     if (m_dense_layers.empty()) {
         return;
     }
     size_t i_layer;
-    m_dense_layers[0].compute(m_input, m_layers_output[0]);
+    m_dense_layers[0].compute(m_input, m_layers_output[0], m_layers_derivative[0]);
     for (i_layer = 1; i_layer < m_dense_layers.size(); ++i_layer) {
-        m_dense_layers[i_layer].compute(m_layers_output[i_layer - 1], m_layers_output[i_layer]);
+        m_dense_layers[i_layer].compute(m_layers_output[i_layer - 1], m_layers_output[i_layer], m_layers_derivative[i_layer]);
     }
-    // gradients of each layer
-    m_dense_layers[0].computeGradient(m_input, m_grads_tmp[0]);
-    for (i_layer = 1; i_layer < m_dense_layers.size(); ++i_layer) {
-        m_dense_layers[i_layer].computeGradient(m_layers_output[i_layer - 1], m_grads_tmp[i_layer]);
+    backPropagate(i);
+}
+
+void neuralNetworkCompute::compute() {
+    if (m_dense_layers.empty()) {
+        return;
     }
-    // chain rule
-    if (m_dense_layers.size() > 1) {
-        m_chained_grad = multiply_matrix(m_grads_tmp[1], m_grads_tmp[0]);
-        for (i_layer = 2; i_layer < m_dense_layers.size(); ++i_layer) {
-            m_chained_grad = multiply_matrix(m_grads_tmp[i_layer], m_chained_grad);
-        }
-    } else {
-        m_chained_grad = m_grads_tmp[0];
+    compute(0);
+    for (size_t i = 1; i < m_dense_layers.back().getOutputSize(); ++i) {
+        backPropagate(i);
     }
 }
 }
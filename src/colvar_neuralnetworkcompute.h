@@ -66,8 +66,8 @@ private:
 #else
     static const bool m_use_custom_activation = false;
 #endif
-    /// weights[i][j] is the weight of the i-th output and the j-th input
-    std::vector<std::vector<double>> m_weights;
+    /// weights[i*m_input_size+j] is the weight of the i-th output and the j-th input (row-major)
+    std::vector<double> m_weights;
     /// bias of each node
     std::vector<double> m_biases;
 public:
@@ -92,6 +92,14 @@ public:
     void setActivationFunction(const std::function<double(double)>& f, const std::function<double(double)>& df);
     /// compute the value of this layer
     void compute(const std::vector<double>& input, std::vector<double>& output) const;
+    /// compute the value of this layer, and the derivative of the activation function of each output node
+    void compute(const std::vector<double>& input, std::vector<double>& output, std::vector<double>& activation_derivative) const;
+    /*! @brief  compute the gradient wrt the input of a function of the output (vector-Jacobian product)
+     *  @param[in]  output_grad            gradient of the function wrt the output of this layer
+     *  @param[in]  activation_derivative  as computed by compute()
+     *  @param[out] input_grad             gradient of the function wrt the input of this layer
+     */
+    void backPropagate(const std::vector<double>& output_grad, const std::vector<double>& activation_derivative, std::vector<double>& input_grad) const;
     /// compute the gradient of i-th output wrt j-th input
     double computeGradientElement(const std::vector<double>& input, const size_t i, const size_t j) const;
     /// output[i][j] is the gradient of i-th output wrt j-th input
@@ -106,7 +114,7 @@ public:
     }
     /// getter for weights and biases
     double getWeight(size_t i, size_t j) const {
-        return m_weights[i][j];
+        return m_weights[i * m_input_size + j];
     }
     double getBias(size_t i) const {
         return m_biases[i];
@@ -120,11 +128,18 @@ private:
     std::vector<double> m_input;
     /// temporary output for each layer, useful to speedup the gradients' calculation
     std::vector<std::vector<double>> m_layers_output;
-    std::vector<std::vector<std::vector<double>>> m_grads_tmp;
-    std::vector<std::vector<double>> m_chained_grad;
+    /// derivative of the activation function at each node of each layer
+    std::vector<std::vector<double>> m_layers_derivative;
+    /// buffers for the gradients propagated backward through the layers
+    std::vector<double> m_backward_grad;
+    std::vector<double> m_backward_grad_next;
+    /// m_chained_grad[i*input_size+j] is the gradient of the i-th output wrt the j-th input
+    std::vector<double> m_chained_grad;
 private:
-    /// helper function: multiply two matrix constructed from 2D vector
-    static std::vector<std::vector<double>> multiply_matrix(const std::vector<std::vector<double>>& A, const std::vector<std::vector<double>>& B);
+    /// helper function: allocate the buffers for the last added layer
+    void addLayerBuffers(const denseLayer& layer);
+    /// helper function: compute the gradient of the i-th output wrt the inputs by backpropagation
+    void backPropagate(const size_t i);
 public:
     neuralNetworkCompute(): m_dense_layers(0), m_layers_output(0) {}
     neuralNetworkCompute(const std::vector<denseLayer>& dense_layers);
@@ -134,8 +149,10 @@ public:
     std::vector<double>& input() {return m_input;}
     /// compute the values and the gradients of all output nodes
     void compute();
+    /// compute the values of all output nodes, and the gradient of the i-th only
+    void compute(const size_t i);
     double getOutput(const size_t i) const {return m_layers_output.back()[i];}
-    double getGradient(const size_t i, const size_t j) const {return m_chained_grad[i][j];}
+    double getGradient(const size_t i, const size_t j) const {return m_chained_grad[i * m_dense_layers.front().getInputSize() + j];}
     /// get a specified layer
     const denseLayer& getLayer(const size_t i) const {return m_dense_layers[i];}
     /// get the number of layers
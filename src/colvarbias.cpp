@@ -1025,10 +1025,10 @@ int colvarbias_ti::write_output_files()
 
   if (is_enabled(f_cvb_write_ti_samples)) {
     std::string const ti_count_file_name(ti_output_prefix+".ti.count");
-    error_code |= ti_count->write_multicol(ti_count_file_name, "TI count file");
+    error_code |= ti_count->write_file(ti_count_file_name, "TI count file");
 
     std::string const ti_grad_file_name(ti_output_prefix+".ti.force");
-    error_code |= ti_avg_forces->write_multicol(ti_grad_file_name, "TI gradient file");
+    error_code |= ti_avg_forces->write_file(ti_grad_file_name, "TI gradient file");
   }
 
   if (is_enabled(f_cvb_write_ti_pmf)) {
@@ -7,6 +7,7 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <cstring>
 #include <iostream>
 
 #include "colvarmodule.h"
@@ -19,6 +20,8 @@ colvarbias_abf::colvarbias_abf(char const *key)
     b_UI_estimator(false),
     b_CZAR_estimator(false),
     pabf_freq(0),
+    pabf_integrate_async(false),
+    integrate_solver(integrate_potential::conjugate_gradient),
     system_force(NULL)
 {
 }
@@ -225,10 +228,21 @@ int colvarbias_abf::init(std::string const &conf)
     // Parameters for integrating initial (and final) gradient data
     get_keyval(conf, "integrateMaxIterations", integrate_iterations, 10000, colvarparse::parse_silent);
     get_keyval(conf, "integrateTol", integrate_tol, 1e-6, colvarparse::parse_silent);
+    std::string solver_str;
+    get_keyval(conf, "integrateSolver", solver_str, std::string("cg"));
+    if (integrate_potential::parse_solver(solver_str, integrate_solver) != COLVARS_OK) {
+      return COLVARS_INPUT_ERROR;
+    }
+    if (pmf->set_solver(integrate_solver) != COLVARS_OK) {
+      return COLVARS_INPUT_ERROR;
+    }
+    if (czar_pmf) czar_pmf->set_solver(integrate_solver);
+    if (local_pmf) local_pmf->set_solver(integrate_solver);
     // Projected ABF, updating the integrated PMF on the fly
     get_keyval(conf, "pABFintegrateFreq", pabf_freq, 0, colvarparse::parse_silent);
     get_keyval(conf, "pABFintegrateMaxIterations", pabf_integrate_iterations, 100, colvarparse::parse_silent);
     get_keyval(conf, "pABFintegrateTol", pabf_integrate_tol, 1e-4, colvarparse::parse_silent);
+    get_keyval(conf, "pABFintegrateAsync", pabf_integrate_async, false, colvarparse::parse_silent);
   }
 
   if (b_CZAR_estimator && shared_on && cvm::main()->proxy->replica_index() == 0) {
@@ -238,6 +252,7 @@ int colvarbias_abf::init(std::string const &conf)
     global_z_gradients.reset(new colvar_grid_gradient(colvars, global_z_samples));
     global_czar_gradients.reset(new colvar_grid_gradient(colvars));
     global_czar_pmf.reset(new integrate_potential(colvars, global_czar_gradients));
+    global_czar_pmf->set_solver(integrate_solver);
   } else {
     // otherwise they are just aliases for the local CZAR grids
     global_z_samples = z_samples;
@@ -249,10 +264,6 @@ int colvarbias_abf::init(std::string const &conf)
   // For shared ABF, we store a second set of grids.
   // This used to be only if "shared" was defined,
   // but now we allow calling share externally (e.g. from Tcl).
-  if (b_CZAR_estimator) {
-    z_samples_in.reset(new colvar_grid_count(colvars));
-    z_gradients_in.reset(new colvar_grid_gradient(colvars, z_samples_in));
-  }
   last_samples.reset(new colvar_grid_count(colvars));
   last_gradients.reset(new colvar_grid_gradient(colvars, last_samples));
   // Any data collected after now is new for shared ABF purposes
@@ -270,11 +281,6 @@ int colvarbias_abf::init(std::string const &conf)
     get_keyval(conf, "UIestimator", b_UI_estimator, false);
 
     if (b_UI_estimator) {
-      if (shared_on) {
-        cvm::error("Error: UI estimator is not available for multiple-walker (shared) ABF.\n");
-        b_UI_estimator = false;
-        return COLVARS_ERROR;
-      }
       cvm::main()->cite_feature("Umbrella-integration eABF estimator");
       std::vector<double> UI_lowerboundary;
       std::vector<double> UI_upperboundary;
@@ -298,6 +304,8 @@ int colvarbias_abf::init(std::string const &conf)
                                          UI_restart,                    // whether restart from a .count and a .grad file
                                          input_prefix,   // the prefixes of input files
                                          proxy->target_temperature());
+      // In shared ABF, samples are recorded to be sent to the other replicas
+      eabf_UI.set_record_samples(shared_on);
     }
   }
 
@@ -362,12 +370,24 @@ int colvarbias_abf::update()
         }
       }
 
-      if ( pabf_freq && cvm::step_relative() % pabf_freq == 0 ) {
+      if ( pabf_freq ) {
         cvm::real err;
-        int iter = pmf->integrate(integrate_iterations, integrate_tol, err);
-        if ( iter == integrate_iterations ) {
-          cvm::log("Warning: PMF integration did not converge to " + cvm::to_str(integrate_tol)
-            + " in " + cvm::to_str(integrate_iterations)
+        int iter = 0;
+        bool updated = false;
+        if ( pabf_integrate_async ) {
+          // Apply the result of the previous update as soon as it is available
+          updated = pmf->integrate_async_collect(false, iter, err);
+          if ( cvm::step_relative() % pabf_freq == 0 && !pmf->integrate_async_pending() ) {
+            // Solve from a snapshot of the current divergence
+            pmf->integrate_async(pabf_integrate_iterations, pabf_integrate_tol);
+          }
+        } else if ( cvm::step_relative() % pabf_freq == 0 ) {
+          iter = pmf->integrate(pabf_integrate_iterations, pabf_integrate_tol, err);
+          updated = true;
+        }
+        if ( updated && iter == pabf_integrate_iterations ) {
+          cvm::log("Warning: PMF integration did not converge to " + cvm::to_str(pabf_integrate_tol)
+            + " in " + cvm::to_str(pabf_integrate_iterations)
             + " steps. Residual error: " +  cvm::to_str(err));
         }
       }
@@ -551,85 +571,72 @@ int colvarbias_abf::replica_share() {
     local_samples.reset(new colvar_grid_count(colvars));
     local_gradients.reset(new colvar_grid_gradient(colvars, local_samples));
     local_pmf.reset(new integrate_potential(colvars, local_gradients));
+    local_pmf->set_solver(integrate_solver);
   }
-  // Calculate the delta gradient and count for the local replica
-  last_gradients->delta_grid(*gradients);
-  // Add the delta gradient and count to the accumulated local data
-  local_gradients->add_grid(*last_gradients);
-
-  last_samples->delta_grid(*samples);
-  local_samples->add_grid(*last_samples);
-
 
-  // Count of data items.
-  size_t samples_n = samples->raw_data_num();
-  size_t gradients_n = gradients->raw_data_num();
+  size_t const num_bins = samples->raw_data_num();
+  size_t const mult = gradients->multiplicity();
 
-  size_t samp_start = gradients_n * sizeof(cvm::real);
-  int msg_total = samples_n * sizeof(size_t) + samp_start;
-  char* msg_data = new char[msg_total];
-
-  if (cvm::main()->proxy->replica_index() == 0) {
-    int p;
-    // Replica 0 collects the delta gradient and count from the others.
-    for (p = 1; p < proxy->num_replicas(); p++) {
-      // Receive the deltas.
-      if (proxy->replica_comm_recv(msg_data, msg_total, p) != msg_total) {
-        cvm::error("Error getting shared ABF data from replica.");
-        return COLVARS_ERROR;
-      }
-
-      // Map the deltas from the others into the grids.
-      // Re-use last_gradients as temp array, erasing its contents each time
-      last_gradients->raw_data_in((cvm::real*)(&msg_data[0]));
-      // Combine the delta gradient and count of the other replicas
-      // with Replica 0's current state (including its delta).
-      gradients->add_grid(*last_gradients);
-
-      last_samples->raw_data_in((size_t*)(&msg_data[samp_start]));
-      samples->add_grid(*last_samples);
+  // Bins where this replica has collected data since the last sharing step
+  std::vector<size_t> changed;
+  for (size_t i = 0; i < num_bins; i++) {
+    bool bin_changed = (samples->data.get(i) != last_samples->data.get(i));
+    for (size_t k = 0; (k < mult) && !bin_changed; k++) {
+      bin_changed = (gradients->data.get(i * mult + k) != last_gradients->data.get(i * mult + k));
     }
+    if (bin_changed) changed.push_back(i);
+  }
 
-    // Now we must send the combined gradient to the other replicas.
-    gradients->raw_data_out((cvm::real*)(&msg_data[0]));
-    samples->raw_data_out((size_t*)(&msg_data[samp_start]));
+  // A replica whose last shared state may differ from the others' reports all
+  // bins as changed, so that the whole grids are exchanged
+  std::vector<size_t> num_changed;
+  if (proxy->replica_comm_allgather(shared_synced ? changed.size() : num_bins, num_changed) !=
+      COLVARS_OK) {
+    return cvm::error("Error: shared ABF: could not combine data from replicas.\n",
+                      COLVARS_ERROR);
+  }
+  size_t total_changed = 0;
+  for (size_t p = 0; p < num_changed.size(); p++) {
+    total_changed += num_changed[p];
+  }
 
-    for (p = 1; p < proxy->num_replicas(); p++) {
-      if (proxy->replica_comm_send(msg_data, msg_total, p) != msg_total) {
-        cvm::error("Error sending shared ABF data to replica.");
-        return COLVARS_ERROR;
-      }
-    }
+  if (total_changed < num_bins) {
+
+    // Gathering the changed bins of all replicas is cheaper than summing the
+    // whole grids
+    int const error_code = replica_share_sparse(changed, num_changed);
+    if (error_code != COLVARS_OK) return error_code;
 
   } else {
-    // All other replicas send their delta gradient and count.
-    // Cast the raw char data to the gradient and samples.
-    last_gradients->raw_data_out((cvm::real*)(&msg_data[0]));
-    last_samples->raw_data_out((size_t*)(&msg_data[samp_start]));
 
-    if (proxy->replica_comm_send(msg_data, msg_total, 0) != msg_total) {
-      cvm::error("Error sending shared ABF data to replica.");
-      return COLVARS_ERROR;
+    // Calculate the delta gradient and count for the local replica
+    last_gradients->delta_grid(*gradients);
+    // Add the delta gradient and count to the accumulated local data
+    local_gradients->add_grid(*last_gradients);
+
+    last_samples->delta_grid(*samples);
+    local_samples->add_grid(*last_samples);
+
+    // Replica 0 contributes its current state (including its delta), the others
+    // only their deltas: the sum, known to all replicas, is the combined state
+    bool const root = (proxy->replica_index() == 0);
+    if ((gradients->replicas_sum(root ? *gradients : *last_gradients) != COLVARS_OK) ||
+        (samples->replicas_sum(root ? *samples : *last_samples) != COLVARS_OK)) {
+      return cvm::error("Error: shared ABF: could not combine data from replicas.\n",
+                        COLVARS_ERROR);
     }
-    // We now receive the combined gradient from Replica 0.
-    if (proxy->replica_comm_recv(msg_data, msg_total, 0) != msg_total) {
-      cvm::error("Error getting shared ABF data from replica 0.");
-      return COLVARS_ERROR;
-    }
-    // We sync to the combined gradient computed by Replica 0.
-    gradients->raw_data_in((cvm::real*)(&msg_data[0]));
-    samples->raw_data_in((size_t*)(&msg_data[samp_start]));
+
+    // Copy the current gradient and count values into last.
+    last_gradients->copy_grid(*gradients);
+    last_samples->copy_grid(*samples);
+    shared_synced = true;
   }
 
-  // Without a barrier it's possible that one replica starts
-  // share 2 when other replicas haven't finished share 1.
-  proxy->replica_comm_barrier();
-  // Done syncing the replicas.
-  delete[] msg_data;
+  if (b_UI_estimator) {
+    int const error_code = replica_share_UI();
+    if (error_code != COLVARS_OK) return error_code;
+  }
 
-  // Copy the current gradient and count values into last.
-  last_gradients->copy_grid(*gradients);
-  last_samples->copy_grid(*samples);
   shared_last_step = cvm::step_absolute();
 
   cvm::log("RMSD btw. local and global ABF gradients: " + cvm::to_str(gradients->grid_rmsd(*local_gradients)));
@@ -650,21 +657,136 @@ int colvarbias_abf::replica_share() {
 }
 
 
-int colvarbias_abf::replica_share_CZAR() {
+int colvarbias_abf::replica_share_sparse(std::vector<size_t> const &changed,
+                                         std::vector<size_t> const &num_changed)
+{
   colvarproxy *proxy = cvm::main()->proxy;
+  size_t const mult = gradients->multiplicity();
+
+  // Each record contains the bin index, the count delta and the gradient deltas
+  size_t const record_size = 2 * sizeof(size_t) + mult * sizeof(cvm::real);
+
+  std::vector<char> send_buffer(changed.size() * record_size);
+  char *record = send_buffer.data();
+  for (size_t j = 0; j < changed.size(); j++, record += record_size) {
+    size_t const i = changed[j];
+    size_t const delta_count = samples->data.get(i) - last_samples->data.get(i);
+    local_samples->data.add(i, delta_count);
+    std::memcpy(record, &i, sizeof(size_t));
+    std::memcpy(record + sizeof(size_t), &delta_count, sizeof(size_t));
+    for (size_t k = 0; k < mult; k++) {
+      cvm::real const delta_grad =
+        gradients->data.get(i * mult + k) - last_gradients->data.get(i * mult + k);
+      local_gradients->data.add(i * mult + k, delta_grad);
+      std::memcpy(record + 2 * sizeof(size_t) + k * sizeof(cvm::real), &delta_grad,
+                  sizeof(cvm::real));
+    }
+  }
 
-  cvm::log("shared eABF: Gathering CZAR gradient and samples from replicas at step "+cvm::to_str(cvm::step_absolute()) );
+  std::vector<int> recv_lens(num_changed.size());
+  size_t total_changed = 0;
+  for (size_t p = 0; p < num_changed.size(); p++) {
+    recv_lens[p] = static_cast<int>(num_changed[p] * record_size);
+    total_changed += num_changed[p];
+  }
+  std::vector<char> recv_buffer(total_changed * record_size);
+  if (proxy->replica_comm_allgatherv(send_buffer.data(), recv_lens, recv_buffer.data()) !=
+      COLVARS_OK) {
+    return cvm::error("Error: shared ABF: could not combine data from replicas.\n",
+                      COLVARS_ERROR);
+  }
+
+  // Add all changes to the last shared state, in order of replica index so
+  // that the result is the same on all replicas
+  record = recv_buffer.data();
+  for (size_t j = 0; j < total_changed; j++, record += record_size) {
+    size_t i, delta_count;
+    std::memcpy(&i, record, sizeof(size_t));
+    std::memcpy(&delta_count, record + sizeof(size_t), sizeof(size_t));
+    last_samples->data.add(i, delta_count);
+    for (size_t k = 0; k < mult; k++) {
+      cvm::real delta_grad;
+      std::memcpy(&delta_grad, record + 2 * sizeof(size_t) + k * sizeof(cvm::real),
+                  sizeof(cvm::real));
+      last_gradients->data.add(i * mult + k, delta_grad);
+    }
+  }
+
+  // Bins that did not change anywhere are already equal to the shared state
+  record = recv_buffer.data();
+  for (size_t j = 0; j < total_changed; j++, record += record_size) {
+    size_t i;
+    std::memcpy(&i, record, sizeof(size_t));
+    samples->data.set(i, last_samples->data.get(i));
+    for (size_t k = 0; k < mult; k++) {
+      gradients->data.set(i * mult + k, last_gradients->data.get(i * mult + k));
+    }
+  }
+
+  return COLVARS_OK;
+}
+
+
+int colvarbias_abf::replica_share_UI()
+{
+  colvarproxy *proxy = cvm::main()->proxy;
+
+  std::vector<double> const &samples_UI = eabf_UI.recorded_samples();
+  std::vector<int> recv_lens;
+  if (proxy->replica_comm_allgather(static_cast<int>(samples_UI.size() * sizeof(double)),
+                                    recv_lens) != COLVARS_OK) {
+    return cvm::error("Error: shared ABF: could not combine UI estimator data from replicas.\n",
+                      COLVARS_ERROR);
+  }
+  size_t total_len = 0;
+  for (size_t p = 0; p < recv_lens.size(); p++) {
+    total_len += recv_lens[p];
+  }
+  std::vector<double> all_samples(total_len / sizeof(double));
+  if (proxy->replica_comm_allgatherv(reinterpret_cast<char const *>(samples_UI.data()), recv_lens,
+                                     reinterpret_cast<char *>(all_samples.data())) != COLVARS_OK) {
+    return cvm::error("Error: shared ABF: could not combine UI estimator data from replicas.\n",
+                      COLVARS_ERROR);
+  }
+
+  // Add the samples of the other replicas, in order of replica index
+  size_t const sample_size = 2 * num_variables();
+  size_t offset = 0;
+  for (size_t p = 0; p < recv_lens.size(); p++) {
+    size_t const num_samples = recv_lens[p] / (sample_size * sizeof(double));
+    if (static_cast<int>(p) != proxy->replica_index()) {
+      eabf_UI.merge_samples(all_samples.data() + offset, num_samples);
+    }
+    offset += num_samples * sample_size;
+  }
+
+  eabf_UI.clear_recorded_samples();
+  // If sharing was enabled by a script, samples are recorded from now on
+  eabf_UI.set_record_samples(true);
+  return COLVARS_OK;
+}
 
-  // Count of data items.
-  size_t samples_n = z_samples->raw_data_num();
-  size_t gradients_n = z_gradients->raw_data_num();
 
-  size_t samp_start = gradients_n*sizeof(cvm::real);
-  int msg_total = samples_n*sizeof(size_t) + samp_start;
-  char* msg_data = new char[msg_total];
+int colvarbias_abf::replica_share_CZAR() {
+  colvarproxy *proxy = cvm::main()->proxy;
 
-  if (cvm::main()->proxy->replica_index() == 0) {
-     if (!global_z_samples) {
+  cvm::log("shared eABF: Gathering CZAR gradient and samples from replicas at step "+cvm::to_str(cvm::step_absolute()) );
+
+  // Sum the z gradient and count of all replicas
+  std::vector<cvm::real> z_gradients_data;
+  std::vector<size_t> z_samples_data;
+  z_gradients->raw_data_out(z_gradients_data);
+  z_samples->raw_data_out(z_samples_data);
+  if ((proxy->replica_comm_allreduce_sum(z_gradients_data.data(), z_gradients_data.size()) !=
+       COLVARS_OK) ||
+      (proxy->replica_comm_allreduce_sum(z_samples_data.data(), z_samples_data.size()) !=
+       COLVARS_OK)) {
+    return cvm::error("Error: shared eABF: could not combine CZAR data from replicas.\n",
+                      COLVARS_ERROR);
+  }
+
+  if (proxy->replica_index() == 0) {
+    if (!global_z_samples) {
       // We arrive here if sharing has just been enabled by a script
       // Allocate grids for collective data, on replica 0 only
       // overriding CZAR grids that are equal to local ones by default
@@ -672,46 +794,12 @@ int colvarbias_abf::replica_share_CZAR() {
       global_z_gradients.reset(new colvar_grid_gradient(colvars, global_z_samples));
       global_czar_gradients.reset(new colvar_grid_gradient(colvars));
       global_czar_pmf.reset(new integrate_potential(colvars, global_czar_gradients));
+      global_czar_pmf->set_solver(integrate_solver);
     }
-
-    // Start with data from replica 0
-    global_z_gradients->copy_grid(*z_gradients);
-    global_z_samples->copy_grid(*z_samples);
-
-    int p;
-    // Replica 0 collects the gradient and count from the others.
-    for (p = 1; p < proxy->num_replicas(); p++) {
-      if (proxy->replica_comm_recv(msg_data, msg_total, p) != msg_total) {
-        cvm::error("Error getting shared ABF data from replica.");
-        return COLVARS_ERROR;
-      }
-
-      // Map the deltas from the others into the grids.
-      // Re-use z_gradients_in, erasing its contents each time
-      z_gradients_in->raw_data_in((cvm::real*)(&msg_data[0]));
-      z_samples_in->raw_data_in((size_t*)(&msg_data[samp_start]));
-
-      // Combine the new gradient and count of the other replicas
-      // with Replica 0's current state
-      global_z_gradients->add_grid(*z_gradients_in);
-      global_z_samples->add_grid(*z_samples_in);
-    }
-  } else {
-    // All other replicas send their current z gradient and z count.
-    z_gradients->raw_data_out((cvm::real*)(&msg_data[0]));
-    z_samples->raw_data_out((size_t*)(&msg_data[samp_start]));
-    if (proxy->replica_comm_send(msg_data, msg_total, 0) != msg_total) {
-      cvm::error("Error sending shared ABF data to replica.");
-      return COLVARS_ERROR;
-    }
+    global_z_gradients->raw_data_in(z_gradients_data);
+    global_z_samples->raw_data_in(z_samples_data);
   }
 
-  // Without a barrier it's possible that one replica starts
-  // share 2 when other replicas haven't finished share 1.
-  proxy->replica_comm_barrier();
-  // Done syncing the replicas.
-  delete[] msg_data;
-
   return COLVARS_OK;
 }
 
@@ -734,7 +822,11 @@ template <class T> int colvarbias_abf::write_grid_to_file(T const *grid,
   if (!os) {
     return cvm::error("Error opening file " + filename + " for writing.\n", COLVARS_ERROR | COLVARS_FILE_ERROR);
   }
-  grid->write_multicol(os);
+  if (close && cvm::binary_grid_files) {
+    grid->write_binary(os);
+  } else {
+    grid->write_multicol(os);
+  }
   if (close) {
     cvm::proxy->close_output_stream(filename);
   } else {
@@ -820,7 +912,7 @@ void colvarbias_abf::write_gradients_samples(const std::string &prefix, bool clo
     // Update the CZAR estimator of gradients, except at step 0
     // in which case we preserve any existing data (e.g. read via inputPrefix, used to join strata in stratified eABF)
     if (cvm::step_relative() > 0) {
-      for (std::vector<int> iz_bin = czar_gradients_out->new_index();
+      for (colvar_grid_index iz_bin = czar_gradients_out->new_index();
             czar_gradients_out->index_ok(iz_bin); czar_gradients_out->incr(iz_bin)) {
         for (size_t n = 0; n < czar_gradients_out->multiplicity(); n++) {
           czar_gradients_out->set_value(iz_bin, z_gradients_out->value_output(iz_bin, n)
@@ -892,6 +984,7 @@ int colvarbias_abf::read_gradients_samples()
     if (shared_on) {
       last_gradients->copy_grid(*gradients);
       last_samples->copy_grid(*samples);
+      shared_synced = false;
     }
     if (b_CZAR_estimator) {
       // Read eABF z-averaged data for CZAR
@@ -903,7 +996,7 @@ int colvarbias_abf::read_gradients_samples()
 
   if (b_CZAR_estimator) {
     // Now copy real CZAR gradients (divided by total count) to the final grid
-    for (std::vector<int> ix = czar_gradients->new_index();
+    for (colvar_grid_index ix = czar_gradients->new_index();
           czar_gradients->index_ok(ix); czar_gradients->incr(ix)) {
       for (size_t n = 0; n < czar_gradients->multiplicity(); n++) {
         czar_gradients->set_value(ix, czar_gradients_in->value_output(ix, n), n);
@@ -1020,6 +1113,7 @@ template <typename IST> IST &colvarbias_abf::read_state_data_template_(IST &is)
     last_gradients->copy_grid(*gradients);
     last_samples->copy_grid(*samples);
     shared_last_step = cvm::step_absolute();
+    shared_synced = false;
   }
 
   return is;
@@ -1090,7 +1184,7 @@ int colvarbias_abf::calc_energy(std::vector<colvarvalue> const *values)
     // Use simple estimate: neglect effect of fullSamples,
     // return value at center of bin
     if (pmf) {
-      std::vector<int> curr_bin = values ?
+      colvar_grid_index curr_bin = values ?
         pmf->get_colvars_index(*values) :
         pmf->get_colvars_index();
       pmf->set_zero_minimum();
@@ -1109,13 +1203,13 @@ int colvarbias_abf::calc_energy(std::vector<colvarvalue> const *values)
   // Integrate the gradient up to the home bin.
   cvm::real sum = 0.0;
   for (int i = 0; i < home; i++) {
-    std::vector<int> ix(1,i);
+    colvar_grid_index ix(1, i);
     // Include the smoothing factor if necessary.
     sum += gradients->value_output_smoothed(ix, true) * gradients->widths[0];
   }
 
   // Integrate the gradient up to the current position in the home interval, a fractional portion of a bin.
-  std::vector<int> ix(1,home);
+  colvar_grid_index ix(1, home);
   cvm::real frac = gradients->current_bin_scalar_fraction(0);
   sum += gradients->value_output_smoothed(ix, true) * gradients->widths[0] * frac;
 
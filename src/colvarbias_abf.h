@@ -78,6 +78,10 @@ private:
   int       pabf_integrate_iterations;
   /// Tolerance for integrating PMF at on-the-fly pABF updates
   cvm::real pabf_integrate_tol;
+  /// Integrate the pABF PMF on a helper thread, applying the result when ready
+  bool      pabf_integrate_async;
+  /// Method used to solve the Poisson equation for the PMF
+  integrate_potential::solver_type integrate_solver;
 
   /// Cap the biasing force to be applied? (option maxForce)
   bool                    cap_force;
@@ -125,9 +129,24 @@ private:
   size_t  shared_freq;
   cvm::step_number shared_last_step;
 
+  /// \brief Whether last_gradients and last_samples are known to be the same on
+  /// all replicas (i.e. a full exchange has occurred since they were set)
+  bool shared_synced = false;
+
   // Share between replicas -- may be called independently of update
   int replica_share() override;
 
+  /// \brief Exchange only the bins that changed on some replica since the last
+  /// sharing step, adding all changes to the last shared state
+  /// \param changed Bins changed on this replica
+  /// \param num_changed Number of bins changed on each replica
+  int replica_share_sparse(std::vector<size_t> const &changed,
+                           std::vector<size_t> const &num_changed);
+
+  /// \brief Send the UI estimator samples collected on this replica since the
+  /// last sharing step to all other replicas, and add theirs
+  int replica_share_UI();
+
   // Share data needed for CZAR between replicas - called before output only
   int replica_share_CZAR();
 
@@ -137,9 +156,6 @@ private:
   // Data just after the last share (start of cycle) in shared ABF
   std::unique_ptr<colvar_grid_gradient> last_gradients;
   std::shared_ptr<colvar_grid_count>    last_samples;
-  // eABF/CZAR local data last shared
-  std::unique_ptr<colvar_grid_gradient> z_gradients_in;
-  std::shared_ptr<colvar_grid_count>    z_samples_in;
   // ABF data from local replica only in shared ABF
   std::shared_ptr<colvar_grid_gradient> local_gradients;
   std::shared_ptr<colvar_grid_count>    local_samples;
@@ -183,7 +183,7 @@ int colvarbias_histogram::write_output_files()
 
   if (out_name.size() && out_name != "none") {
     cvm::log("Writing the histogram file \""+out_name+"\".\n");
-    error_code |= grid->write_multicol(out_name, "histogram output file");
+    error_code |= grid->write_file(out_name, "histogram output file");
   }
 
   if (out_name_dx.size() && out_name_dx != "none") {
@@ -207,7 +207,7 @@ int colvarbias_reweightaMD::write_exponential_reweighted_pmf(
     if (!grad_grid_os) {
       return COLVARS_FILE_ERROR;
     }
-    for (std::vector<int> ix = grad_grid_exp_avg->new_index();
+    for (colvar_grid_index ix = grad_grid_exp_avg->new_index();
           grad_grid_exp_avg->index_ok(ix); grad_grid_exp_avg->incr(ix)) {
       for (size_t n = 0; n < grad_grid_exp_avg->multiplicity(); n++) {
         grad_grid_exp_avg->set_value(
@@ -246,7 +246,7 @@ int colvarbias_reweightaMD::write_cumulant_expansion_pmf(
     if (!grad_grid_os) {
       return COLVARS_FILE_ERROR;
     }
-    for (std::vector<int> ix = grad_grid_cumulant->new_index();
+    for (colvar_grid_index ix = grad_grid_cumulant->new_index();
           grad_grid_cumulant->index_ok(ix); grad_grid_cumulant->incr(ix)) {
       for (size_t n = 0; n < grad_grid_cumulant->multiplicity(); n++) {
         grad_grid_cumulant->set_value(
@@ -30,6 +30,7 @@ colvarbias_meta::colvarbias_meta(char const *key)
 
   use_grids = true;
   grids_freq = 0;
+  grids_interpolation = colvar_grid_stencil::nearest;
   rebin_grids = false;
   hills_energy = NULL;
   hills_energy_gradients = NULL;
@@ -124,6 +125,25 @@ int colvarbias_meta::init(std::string const &conf)
     }
 
     get_keyval(conf, "gridsUpdateFrequency", grids_freq, grids_freq);
+
+    std::string interpolation_str;
+    get_keyval(conf, "gridsInterpolation", interpolation_str, std::string("none"));
+    interpolation_str = to_lower_cppstr(interpolation_str);
+    if (interpolation_str == "none") {
+      grids_interpolation = colvar_grid_stencil::nearest;
+    } else if (interpolation_str == "linear") {
+      grids_interpolation = colvar_grid_stencil::linear;
+    } else if (interpolation_str == "cubic") {
+      if (num_variables() > 2) {
+        return cvm::error("Error: cubic interpolation of the grids is only "
+                          "available for one or two variables.\n",
+                          COLVARS_NOT_IMPLEMENTED);
+      }
+      grids_interpolation = colvar_grid_stencil::cubic;
+    } else {
+      return cvm::error("Error: invalid value \""+interpolation_str+
+                        "\" for gridsInterpolation.\n", COLVARS_INPUT_ERROR);
+    }
     get_keyval(conf, "rebinGrids", rebin_grids, rebin_grids);
 
     expand_grids = false;
@@ -585,7 +605,7 @@ int colvarbias_meta::update_bias()
     if (well_tempered) {
       cvm::real hills_energy_sum_here = 0.0;
       if (use_grids) {
-        std::vector<int> curr_bin = hills_energy->get_colvars_index();
+        colvar_grid_index curr_bin = hills_energy->get_colvars_index();
         hills_energy_sum_here = hills_energy->value(curr_bin);
       } else {
         calc_hills(new_hills_begin, hills.end(), hills_energy_sum_here, NULL);
@@ -656,28 +676,24 @@ int colvarbias_meta::calc_energy(std::vector<colvarvalue> const *values)
   }
 
   bool index_ok = false;
-  std::vector<int> curr_bin;
 
   if (use_grids) {
-
-    curr_bin = values ?
-      hills_energy->get_colvars_index(*values) :
-      hills_energy->get_colvars_index();
-
-    index_ok = hills_energy->index_ok(curr_bin);
-
+    index_ok = hills_energy->interpolation_stencil(values, grids_interpolation,
+                                                   grids_stencil);
   }
 
   if ( index_ok ) {
     // index is within the grid: get the energy from there
     for (ir = 0; ir < replicas.size(); ir++) {
 
-      bias_energy += replicas[ir]->hills_energy->value(curr_bin);
+      bias_energy += replicas[ir]->hills_energy->value(grids_stencil);
       if (cvm::debug()) {
         cvm::log("Metadynamics bias \""+this->name+"\""+
                  ((comm != single_replica) ? ", replica \""+replica_id+"\"" : "")+
                  ": current coordinates on the grid: "+
-                 cvm::to_str(curr_bin)+".\n");
+                 cvm::to_str(std::vector<int>(values ?
+                                              hills_energy->get_colvars_index(*values) :
+                                              hills_energy->get_colvars_index()))+".\n");
         cvm::log("Grid energy = "+cvm::to_str(bias_energy)+".\n");
       }
     }
@@ -718,24 +734,21 @@ int colvarbias_meta::calc_forces(std::vector<colvarvalue> const *values)
   }
 
   bool index_ok = false;
-  std::vector<int> curr_bin;
 
   if (use_grids) {
-
-    curr_bin = values ?
-      hills_energy->get_colvars_index(*values) :
-      hills_energy->get_colvars_index();
-
-    index_ok = hills_energy->index_ok(curr_bin);
-
+    index_ok = hills_energy->interpolation_stencil(values, grids_interpolation,
+                                                   grids_stencil);
   }
 
   if ( index_ok ) {
+    cvm::real gradient[colvar_grid_index::max_size];
     for (ir = 0; ir < replicas.size(); ir++) {
-      cvm::real const *f = &(replicas[ir]->hills_energy_gradients->value(curr_bin));
+      colvar_grid_gradient const *g = replicas[ir]->hills_energy_gradients;
+      std::fill(gradient, gradient + num_variables(), 0.0);
+      g->add_vector_value(grids_stencil, gradient);
       for (ic = 0; ic < num_variables(); ic++) {
         // the gradients are stored, not the forces
-        colvar_forces[ic].real_value += -1.0 * f[ic];
+        colvar_forces[ic].real_value += -1.0 * gradient[ic];
       }
     }
   } else {
@@ -829,9 +842,8 @@ void colvarbias_meta::calc_hills_force(size_t const &i,
       if (h->value() == 0.0) continue;
       colvarvalue const &center = h->centers[i];
       cvm::real const sigma = h->sigmas[i];
-      forces[i].real_value +=
-        ( h->weight() * h->value() * (0.5 / (sigma*sigma)) *
-          (variables(i)->dist2_lgrad(x, center)).real_value );
+      cvm::real const coeff = h->weight() * h->value() * (0.5 / (sigma*sigma));
+      forces[i].real_value += coeff * (variables(i)->dist2_lgrad(x, center)).real_value;
     }
     break;
 
@@ -842,9 +854,8 @@ void colvarbias_meta::calc_hills_force(size_t const &i,
       if (h->value() == 0.0) continue;
       colvarvalue const &center = h->centers[i];
       cvm::real const sigma = h->sigmas[i];
-      forces[i].rvector_value +=
-        ( h->weight() * h->value() * (0.5 / (sigma*sigma)) *
-          (variables(i)->dist2_lgrad(x, center)).rvector_value );
+      cvm::real const coeff = h->weight() * h->value() * (0.5 / (sigma*sigma));
+      forces[i].rvector_value += coeff * (variables(i)->dist2_lgrad(x, center)).rvector_value;
     }
     break;
 
@@ -854,9 +865,8 @@ void colvarbias_meta::calc_hills_force(size_t const &i,
       if (h->value() == 0.0) continue;
       colvarvalue const &center = h->centers[i];
       cvm::real const sigma = h->sigmas[i];
-      forces[i].quaternion_value +=
-        ( h->weight() * h->value() * (0.5 / (sigma*sigma)) *
-          (variables(i)->dist2_lgrad(x, center)).quaternion_value );
+      cvm::real const coeff = h->weight() * h->value() * (0.5 / (sigma*sigma));
+      forces[i].quaternion_value += coeff * (variables(i)->dist2_lgrad(x, center)).quaternion_value;
     }
     break;
 
@@ -865,9 +875,9 @@ void colvarbias_meta::calc_hills_force(size_t const &i,
       if (h->value() == 0.0) continue;
       colvarvalue const &center = h->centers[i];
       cvm::real const sigma = h->sigmas[i];
-      forces[i].vector1d_value +=
-        ( h->weight() * h->value() * (0.5 / (sigma*sigma)) *
-          (variables(i)->dist2_lgrad(x, center)).vector1d_value );
+      cvm::real const coeff = h->weight() * h->value() * (0.5 / (sigma*sigma));
+      forces[i].vector1d_value.axpy(coeff,
+                                    (variables(i)->dist2_lgrad(x, center)).vector1d_value);
     }
     break;
 
@@ -899,8 +909,8 @@ void colvarbias_meta::project_hills(colvarbias_meta::hill_iter  h_first,
   std::vector<colvarvalue> new_colvar_values(num_variables());
   std::vector<cvm::real> colvar_forces_scalar(num_variables());
 
-  std::vector<int> he_ix = he->new_index();
-  std::vector<int> hg_ix = (hg != NULL) ? hg->new_index() : std::vector<int> (0);
+  colvar_grid_index he_ix = he->new_index();
+  colvar_grid_index hg_ix = (hg != NULL) ? hg->new_index() : colvar_grid_index();
   cvm::real hills_energy_here = 0.0;
   std::vector<colvarvalue> hills_forces_here(num_variables(), 0.0);
 
@@ -1945,7 +1955,7 @@ void colvarbias_meta::write_pmf()
                                       (dump_fes_save ?
                                        "."+cvm::to_str(cvm::step_absolute()) : "") +
                                       ".pmf");
-      pmf->write_multicol(fes_file_name, "PMF file");
+      pmf->write_file(fes_file_name, "PMF file");
     }
   }
 
@@ -1981,7 +1991,7 @@ void colvarbias_meta::write_pmf()
                                     (dump_fes_save ?
                                      "."+cvm::to_str(cvm::step_absolute()) : "") +
                                     ".pmf");
-    pmf->write_multicol(fes_file_name, "partial PMF file");
+    pmf->write_file(fes_file_name, "partial PMF file");
   }
 
   delete pmf;
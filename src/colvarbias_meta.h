@@ -184,6 +184,13 @@ protected:
   /// \brief How often the hills should be projected onto the grids
   size_t     grids_freq;
 
+  /// \brief How grid values are interpolated at the current colvar values
+  colvar_grid_stencil::interpolation_type grids_interpolation;
+
+  /// \brief Grid points and weights used to interpolate the grids (reused
+  /// across steps to avoid reallocating it)
+  colvar_grid_stencil grids_stencil;
+
   /// Keep hills in the restart file (e.g. to accurately rebin later)
   bool       keep_hills;
 
@@ -26,6 +26,8 @@
 #include "colvars_memstream.h"
 #include "colvargrid.h"
 
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <iomanip>
 #include <ios>
@@ -53,6 +55,7 @@ colvarbias_opes::colvarbias_opes(char const *key):
   m_work(0), comm(single_replica), m_num_walkers(1),
   m_num_threads(1), m_nlker(0), m_traj_output_frequency(0),
   m_traj_line(traj_line{0}), m_is_first_step(true),
+  m_kernels_journal(false), m_journal_generation(0), m_journal_size(0),
   m_pmf_grid_on(false), m_reweight_grid(nullptr),
   m_pmf_grid(nullptr), m_pmf_hist_freq(0), m_pmf_shared(true),
   m_explore(false)
@@ -105,6 +108,20 @@ int colvarbias_opes::init(const std::string& conf) {
   get_keyval(conf, "gaussianSigma", m_sigma0, std::vector<cvm::real>(num_variables()));
   m_av_cv.assign(num_variables(), 0);
   m_av_M2.assign(num_variables(), 0);
+  m_cv_period.assign(num_variables(), 0);
+  m_cv_custom_dist.assign(num_variables(), false);
+  for (size_t i = 0; i < num_variables(); ++i) {
+    if (variables(i)->is_enabled(f_cv_periodic)) {
+      if (variables(i)->is_enabled(f_cv_scripted) || variables(i)->is_enabled(f_cv_custom_function)) {
+        m_cv_custom_dist[i] = true;
+      } else {
+        m_cv_period[i] = variables(i)->period;
+      }
+    }
+  }
+  m_kernels.reset(num_variables());
+  m_saved_kernels.reset(num_variables());
+  m_max_sigma.assign(num_variables(), 0);
   if (m_adaptive_sigma) {
     get_keyval(conf, "adaptiveSigmaStride", m_adaptive_sigma_stride, 0);
     if (inf_biasfactor) {
@@ -270,8 +287,10 @@ int colvarbias_opes::init(const std::string& conf) {
   m_traj_line.rct = m_kbt * cvm::logn(m_sum_weights / m_counter);
   m_traj_line.zed = m_zed;
   m_traj_line.neff = (1 + m_sum_weights) * (1 + m_sum_weights) / (1 + m_sum_weights2);
-  m_traj_line.nker = m_kernels.size();
+  m_traj_line.nker = m_kernels.count();
   get_keyval(conf, "printTrajectoryFrequency", m_traj_output_frequency, cvm::cv_traj_freq);
+  get_keyval(conf, "kernelsJournal", m_kernels_journal, false);
+  m_kernels.track_changes(m_kernels_journal);
   m_cv.resize(num_variables(), 0);
   showInfo();
   return error_code;
@@ -344,13 +363,274 @@ void colvarbias_opes::showInfo() const {
   }
 }
 
+namespace {
+  /// Number of kernels processed together by the vectorizable loops
+  constexpr size_t kernel_block_size = 128;
+  /// Kernels begin, begin+1, ... of a kernel array
+  struct contiguous_kernel_index {
+    size_t begin;
+    size_t operator[](size_t j) const { return begin + j; }
+  };
+  /// Kernels listed by their indices (e.g. in the neighbor list)
+  struct listed_kernel_index {
+    const size_t *index;
+    size_t operator[](size_t j) const { return index[j]; }
+  };
+  /// \brief Layout of the kernels journal, in the byte order of the machine
+  /// that wrote it:
+  /// - 8 bytes: the characters "COLVOPES"
+  /// - uint32: format version (currently 1)
+  /// - uint32: 0x01020304 (to detect a different byte order)
+  /// - uint32: number of variables (nd)
+  /// - uint32: zero
+  /// - uint64: generation of the journal
+  /// - any number of records, each made of uint64 kernel identifier, uint64
+  ///   removed flag (0 or 1), float64 height, nd float64 centers and nd
+  ///   float64 sigmas; the last record of each kernel supersedes the others
+  struct kernels_journal_format {
+    static const char *magic() { return "COLVOPES"; }
+    static constexpr size_t magic_size = 8;
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t byte_order_mark = 0x01020304;
+    static constexpr size_t header_size = 32;
+    static size_t record_size(size_t nd) { return 8 * (3 + 2 * nd); }
+  };
+}
+
+void colvarbias_opes::kernel_array::reset(size_t num_dims) {
+  m_height.clear();
+  m_center.assign(num_dims, std::vector<cvm::real>());
+  m_sigma.assign(num_dims, std::vector<cvm::real>());
+  m_inv_sigma.assign(num_dims, std::vector<cvm::real>());
+  m_removed.clear();
+  m_num_removed = 0;
+  m_id.clear();
+  m_next_id = 0;
+  m_changed.clear();
+}
+
+void colvarbias_opes::kernel_array::clear() {
+  reset(m_center.size());
+}
+
+void colvarbias_opes::kernel_array::push_back(const kernel& G) {
+  push_back(G, m_next_id);
+}
+
+void colvarbias_opes::kernel_array::push_back(const kernel& G, size_t id) {
+  m_id.push_back(id);
+  m_next_id = id + 1;
+  if (m_track_changes) m_changed.push_back(id);
+  m_height.push_back(G.m_height);
+  for (size_t i = 0; i < m_center.size(); ++i) {
+    m_center[i].push_back(G.m_center[i]);
+    m_sigma[i].push_back(G.m_sigma[i]);
+    m_inv_sigma[i].push_back(1.0 / G.m_sigma[i]);
+  }
+  m_removed.push_back(false);
+}
+
+void colvarbias_opes::kernel_array::remove(size_t k) {
+  if (m_track_changes) m_changed.push_back(m_id[k]);
+  m_height[k] = 0;
+  m_removed[k] = true;
+  ++m_num_removed;
+}
+
+void colvarbias_opes::kernel_array::compact(std::vector<size_t>& new_index) {
+  new_index.assign(size(), size());
+  size_t n = 0;
+  for (size_t k = 0; k < size(); ++k) {
+    if (m_removed[k]) continue;
+    new_index[k] = n;
+    m_id[n] = m_id[k];
+    m_height[n] = m_height[k];
+    for (size_t i = 0; i < m_center.size(); ++i) {
+      m_center[i][n] = m_center[i][k];
+      m_sigma[i][n] = m_sigma[i][k];
+      m_inv_sigma[i][n] = m_inv_sigma[i][k];
+    }
+    ++n;
+  }
+  m_id.resize(n);
+  m_height.resize(n);
+  for (size_t i = 0; i < m_center.size(); ++i) {
+    m_center[i].resize(n);
+    m_sigma[i].resize(n);
+    m_inv_sigma[i].resize(n);
+  }
+  m_removed.assign(n, false);
+  m_num_removed = 0;
+}
+
+colvarbias_opes::kernel colvarbias_opes::kernel_array::get(size_t k) const {
+  kernel G;
+  G.m_height = m_height[k];
+  G.m_center.resize(m_center.size());
+  G.m_sigma.resize(m_center.size());
+  for (size_t i = 0; i < m_center.size(); ++i) {
+    G.m_center[i] = m_center[i][k];
+    G.m_sigma[i] = m_sigma[i][k];
+  }
+  return G;
+}
+
+void colvarbias_opes::kernel_array::set(size_t k, const kernel& G) {
+  if (m_track_changes) m_changed.push_back(m_id[k]);
+  m_height[k] = G.m_height;
+  for (size_t i = 0; i < m_center.size(); ++i) {
+    m_center[i][k] = G.m_center[i];
+    m_sigma[i][k] = G.m_sigma[i];
+    m_inv_sigma[i][k] = 1.0 / G.m_sigma[i];
+  }
+}
+
+void colvarbias_opes::kernel_array::get_center(size_t k, std::vector<cvm::real>& x) const {
+  x.resize(m_center.size());
+  for (size_t i = 0; i < m_center.size(); ++i) {
+    x[i] = m_center[i][k];
+  }
+}
+
+size_t colvarbias_opes::kernel_array::find(size_t id) const {
+  const auto it = std::lower_bound(m_id.begin(), m_id.end(), id);
+  return (it != m_id.end() && *it == id) ? (it - m_id.begin()) : size();
+}
+
+void colvarbias_opes::kernel_array::take_changes(std::vector<size_t>& ids) {
+  ids.swap(m_changed);
+  m_changed.clear();
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+void colvarbias_opes::kernel_buckets::reset(
+  const std::vector<cvm::real>& widths, const std::vector<cvm::real>& periods) {
+  m_widths = widths;
+  m_num_periodic_buckets.assign(widths.size(), 0);
+  for (size_t i = 0; i < widths.size(); ++i) {
+    if (periods[i] > 0) {
+      // Fit an integer number of buckets in one period
+      m_num_periodic_buckets[i] = std::max(1, static_cast<int>(cvm::floor(periods[i] / widths[i])));
+      m_widths[i] = periods[i] / m_num_periodic_buckets[i];
+    }
+  }
+  m_buckets.clear();
+}
+
+size_t colvarbias_opes::kernel_buckets::bucket_hash::operator()(const colvar_grid_index& b) const {
+  size_t h = 0;
+  for (size_t i = 0; i < b.size(); ++i) {
+    h ^= std::hash<int>()(b[i]) + 0x9e3779b9 + (h << 6) + (h >> 2);
+  }
+  return h;
+}
+
+colvar_grid_index colvarbias_opes::kernel_buckets::bucket(const std::vector<cvm::real>& x) const {
+  // Bound the coordinates along non-periodic variables, so that their
+  // differences fit in an int
+  const cvm::real max_coord = 1 << 28;
+  colvar_grid_index b(m_widths.size());
+  for (size_t i = 0; i < m_widths.size(); ++i) {
+    const cvm::real t = cvm::floor(x[i] / m_widths[i]);
+    const int n = m_num_periodic_buckets[i];
+    if (n > 0) {
+      b[i] = static_cast<int>(t - n * cvm::floor(t / n));
+      if (b[i] >= n) b[i] = 0;
+    } else {
+      b[i] = static_cast<int>(std::max(-max_coord, std::min(max_coord, t)));
+    }
+  }
+  return b;
+}
+
+void colvarbias_opes::kernel_buckets::insert(size_t k, const std::vector<cvm::real>& x) {
+  m_buckets[bucket(x)].push_back(k);
+}
+
+void colvarbias_opes::kernel_buckets::remove(size_t k, const std::vector<cvm::real>& x) {
+  auto it = m_buckets.find(bucket(x));
+  if (it == m_buckets.end()) return;
+  std::vector<size_t>& kernels = it->second;
+  auto it_k = std::find(kernels.begin(), kernels.end(), k);
+  if (it_k == kernels.end()) return;
+  *it_k = kernels.back();
+  kernels.pop_back();
+  if (kernels.empty()) {
+    m_buckets.erase(it);
+  }
+}
+
+bool colvarbias_opes::kernel_buckets::query(
+  const std::vector<cvm::real>& x, const std::vector<cvm::real>& range,
+  std::vector<size_t>& candidates) const {
+  if (m_buckets.empty()) return true;
+  const size_t nd = m_widths.size();
+  const colvar_grid_index center = bucket(x);
+  // Number of buckets to visit on each side along each variable
+  colvar_grid_index reach(nd);
+  cvm::real num_visited = 1;
+  for (size_t i = 0; i < nd; ++i) {
+    reach[i] = static_cast<int>(std::min(cvm::real(1 << 28), cvm::floor(range[i] / m_widths[i]) + 1));
+    const int n = m_num_periodic_buckets[i];
+    num_visited *= (n > 0) ? std::min(n, 2 * reach[i] + 1) : (2 * reach[i] + 1);
+  }
+  if (num_visited > m_buckets.size()) {
+    // Fewer buckets are occupied than those in range
+    return false;
+  }
+  // Coordinates of the buckets in range along each variable
+  std::vector<std::vector<int>> coords(nd);
+  for (size_t i = 0; i < nd; ++i) {
+    const int n = m_num_periodic_buckets[i];
+    if (n > 0 && 2 * reach[i] + 1 >= n) {
+      for (int c = 0; c < n; ++c) {
+        coords[i].push_back(c);
+      }
+    } else {
+      for (int c = center[i] - reach[i]; c <= center[i] + reach[i]; ++c) {
+        coords[i].push_back((n > 0) ? ((c % n) + n) % n : c);
+      }
+    }
+  }
+  colvar_grid_index b(nd), pos(nd, 0);
+  while (true) {
+    for (size_t i = 0; i < nd; ++i) {
+      b[i] = coords[i][pos[i]];
+    }
+    auto it = m_buckets.find(b);
+    if (it != m_buckets.end()) {
+      candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+    }
+    size_t i = 0;
+    for ( ; i < nd; ++i) {
+      if (++pos[i] < static_cast<int>(coords[i].size())) break;
+      pos[i] = 0;
+    }
+    if (i == nd) break;
+  }
+  return true;
+}
+
+cvm::real colvarbias_opes::cvDist(size_t i, cvm::real x, cvm::real c) const {
+  if (m_cv_custom_dist[i]) {
+    return 0.5 * variables(i)->dist2_lgrad(x, c).real_value;
+  }
+  // Same as colvar::cvc::dist2_lgrad(), without the virtual function calls
+  cvm::real diff = x - c;
+  if (m_cv_period[i] > 0) {
+    diff -= cvm::floor(diff / m_cv_period[i] + 0.5) * m_cv_period[i];
+  }
+  return diff;
+}
+
 cvm::real colvarbias_opes::evaluateKernel(
   const colvarbias_opes::kernel& G,
   const std::vector<cvm::real>& x) const {
   cvm::real norm2 = 0;
   for (size_t i = 0; i < num_variables(); ++i) {
-    const cvm::real dist2_i = variables(i)->dist2(G.m_center[i], x[i]) / (G.m_sigma[i] * G.m_sigma[i]);
-    norm2 += dist2_i;
+    const cvm::real dist_i = cvDist(i, x[i], G.m_center[i]) / G.m_sigma[i];
+    norm2 += dist_i * dist_i;
     if (norm2 >= m_cutoff2) {
       return 0;
     }
@@ -358,144 +638,176 @@ cvm::real colvarbias_opes::evaluateKernel(
   return G.m_height * (std::exp(-0.5 * norm2) - m_val_at_cutoff);
 }
 
-cvm::real colvarbias_opes::evaluateKernel(
-  const colvarbias_opes::kernel& G,
-  const std::vector<cvm::real>& x,
-  std::vector<cvm::real>& accumulated_derivative,
-  std::vector<cvm::real>& dist) const {
-  cvm::real norm2 = 0;
+template <typename Index>
+void colvarbias_opes::kernelsNorm2(
+  const std::vector<cvm::real>& x, const Index& kernel_index,
+  size_t n, cvm::real *norm2) const {
+  for (size_t j = 0; j < n; ++j) {
+    norm2[j] = 0;
+  }
+  // One pass per variable over contiguous centers and widths; the periodic
+  // and non-periodic cases are kept separate to allow vectorization
   for (size_t i = 0; i < num_variables(); ++i) {
-    dist[i] = 0.5 * variables(i)->dist2_lgrad(x[i], G.m_center[i]) / G.m_sigma[i];
-    norm2 += dist[i] * dist[i];
-    if (norm2 >= m_cutoff2) {
-      return 0;
+    const cvm::real *center = m_kernels.centers(i);
+    const cvm::real *inv_sigma = m_kernels.inv_sigmas(i);
+    const cvm::real x_i = x[i];
+    const cvm::real period = m_cv_period[i];
+    if (m_cv_custom_dist[i]) {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        const cvm::real dist = cvDist(i, x_i, center[k]) * inv_sigma[k];
+        norm2[j] += dist * dist;
+      }
+    } else if (period > 0) {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        cvm::real diff = x_i - center[k];
+        diff -= cvm::floor(diff / period + 0.5) * period;
+        const cvm::real dist = diff * inv_sigma[k];
+        norm2[j] += dist * dist;
+      }
+    } else {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        const cvm::real dist = (x_i - center[k]) * inv_sigma[k];
+        norm2[j] += dist * dist;
+      }
     }
   }
-  const cvm::real val = G.m_height * (std::exp(-0.5 * norm2) - m_val_at_cutoff);
+}
+
+template <typename Index>
+cvm::real colvarbias_opes::evaluateKernelBlock(
+  const std::vector<cvm::real>& x, const Index& kernel_index,
+  size_t n, cvm::real *accumulated_derivative) const {
+  cvm::real norm2[kernel_block_size];
+  cvm::real val[kernel_block_size];
+  kernelsNorm2(x, kernel_index, n, norm2);
+  const cvm::real *height = m_kernels.heights();
+  cvm::real sum = 0;
+  for (size_t j = 0; j < n; ++j) {
+    val[j] = 0;
+    if (norm2[j] < m_cutoff2) {
+      val[j] = height[kernel_index[j]] * (std::exp(-0.5 * norm2[j]) - m_val_at_cutoff);
+    }
+    sum += val[j];
+  }
+  if (accumulated_derivative == nullptr) {
+    return sum;
+  }
   // The derivative of norm2 with respect to x
   for (size_t i = 0; i < num_variables(); ++i) {
-    accumulated_derivative[i] -= val * dist[i] / G.m_sigma[i];
+    const cvm::real *center = m_kernels.centers(i);
+    const cvm::real *inv_sigma = m_kernels.inv_sigmas(i);
+    const cvm::real x_i = x[i];
+    const cvm::real period = m_cv_period[i];
+    cvm::real der_i = accumulated_derivative[i];
+    if (m_cv_custom_dist[i]) {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        der_i -= val[j] * cvDist(i, x_i, center[k]) * inv_sigma[k] * inv_sigma[k];
+      }
+    } else if (period > 0) {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        cvm::real diff = x_i - center[k];
+        diff -= cvm::floor(diff / period + 0.5) * period;
+        der_i -= val[j] * diff * inv_sigma[k] * inv_sigma[k];
+      }
+    } else {
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = kernel_index[j];
+        der_i -= val[j] * (x_i - center[k]) * inv_sigma[k] * inv_sigma[k];
+      }
+    }
+    accumulated_derivative[i] = der_i;
   }
-  return val;
+  return sum;
 }
 
-cvm::real colvarbias_opes::getProbAndDerivatives(
-  const std::vector<cvm::real>& cv, std::vector<cvm::real>& der_prob) const {
-  double prob = 0.0;
-  std::vector<cvm::real> dist(num_variables(), 0);
-  if (!m_nlist) {
-    if (m_num_threads == 1 || m_kernels.size() < 2 * m_num_threads) {
-      for (size_t k = 0; k < m_kernels.size(); ++k) {
-        prob += evaluateKernel(m_kernels[k], cv, der_prob, dist);
-      }
+cvm::real colvarbias_opes::evaluateKernels(
+  const std::vector<cvm::real>& x, size_t begin, size_t end,
+  const size_t *index, cvm::real *accumulated_derivative) const {
+  cvm::real sum = 0;
+  for (size_t b = begin; b < end; b += kernel_block_size) {
+    const size_t n = std::min(end - b, kernel_block_size);
+    if (index) {
+      sum += evaluateKernelBlock(x, listed_kernel_index{index + b}, n, accumulated_derivative);
     } else {
-#if defined(_OPENMP)
-      #pragma omp parallel num_threads(m_num_threads)
-      {
-        std::vector<cvm::real> omp_deriv(der_prob.size(), 0);
-        std::vector<cvm::real> tmp_dist(num_variables());
-        #pragma omp for reduction(+:prob) nowait
-        for (int k = 0; k < static_cast<int>(m_kernels.size()); ++k) {
-          prob += evaluateKernel(m_kernels[k], cv, omp_deriv, tmp_dist);
-        }
-        #pragma omp critical
-        for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-          der_prob[i]+=omp_deriv[i];
-        }
-        #pragma omp single
-        for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-          dist[i] = tmp_dist[i];
-        }
-      }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-      // TODO: Test this once fine-grained parallelization is enabled
-      std::vector<std::vector<cvm::real>> derivs(m_num_threads, std::vector<cvm::real>(num_variables(), 0));
-      std::vector<std::vector<cvm::real>> dists(m_num_threads, std::vector<cvm::real>(num_variables(), 0));
-      auto worker = [&](int start, int end, void* result){
-        const int tid = cvm::proxy->smp_thread_id();
-        double tmp_prob = 0;
-        for (int i = start; i <= end; ++i) {
-          tmp_prob += evaluateKernel(m_kernels[i], cv, derivs[tid], dists[tid]);
-        }
-        *(double *)result = tmp_prob;
-      };
-      const size_t numChunks = m_kernels.size();
-      const size_t lowerRange = 0;
-      const size_t upperRange = numChunks - 1;
-      CkLoop_Parallelize(
-        numChunks, lowerRange, upperRange,
-        worker, &prob, CKLOOP_DOUBLE_SUM, NULL);
-      for (size_t i = 0; i < num_variables(); ++i) {
-        for (size_t j = 0; j < m_num_threads; ++j) {
-          if (j == 0) dist[i] = dists[j][i];
-          der_prob[i] += derivs[j][i];
-        }
-      }
-#else
-      cvm::error("multiple threads required in OPES, but this binary is not linked with a supported threading library.\n");
-#endif
+      sum += evaluateKernelBlock(x, contiguous_kernel_index{b}, n, accumulated_derivative);
+    }
+  }
+  return sum;
+}
+
+template <typename BlockSum>
+void colvarbias_opes::sumBlocks(
+  size_t num_blocks, size_t num_values,
+  const BlockSum& block_sum, cvm::real *result) const {
+  if (num_blocks == 0) return;
+  std::vector<cvm::real> partial(num_blocks * num_values, 0);
+  auto sum_block = [&](size_t b) {
+    block_sum(b, partial.data() + b * num_values);
+  };
+  if (m_num_threads == 1 || num_blocks < 2) {
+    for (size_t b = 0; b < num_blocks; ++b) {
+      sum_block(b);
     }
   } else {
-    if (m_num_threads == 1 || m_nlist_index.size() < 2 * m_num_threads) {
-      for (size_t nk = 0; nk < m_nlist_index.size(); ++nk) {
-        const size_t k = m_nlist_index[nk];
-        prob += evaluateKernel(m_kernels[k], cv, der_prob, dist);
-      }
-    } else {
 #if defined(_OPENMP)
-      #pragma omp parallel num_threads(m_num_threads)
-      {
-        std::vector<cvm::real> omp_deriv(der_prob.size(), 0);
-        std::vector<cvm::real> tmp_dist(num_variables());
-        #pragma omp for reduction(+:prob) nowait
-        for (int nk = 0; nk < static_cast<int>(m_nlist_index.size()); ++nk) {
-          const size_t k = m_nlist_index[nk];
-          prob += evaluateKernel(m_kernels[k], cv, omp_deriv, tmp_dist);
-        }
-        #pragma omp critical
-        for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-          der_prob[i]+=omp_deriv[i];
-        }
-        #pragma omp single
-        for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-          dist[i] = tmp_dist[i];
-        }
-      }
+    #pragma omp parallel for num_threads(m_num_threads) schedule(static)
+    for (int b = 0; b < static_cast<int>(num_blocks); ++b) {
+      sum_block(b);
+    }
 #elif defined(CMK_SMP) && defined(USE_CKLOOP)
-      // TODO: Test this once fine-grained parallelization is enabled
-      std::vector<std::vector<cvm::real>> derivs(m_num_threads, std::vector<cvm::real>(num_variables(), 0));
-      std::vector<std::vector<cvm::real>> dists(m_num_threads, std::vector<cvm::real>(num_variables(), 0));
-      auto worker = [&](int start, int end, void* result){
-        const int tid = cvm::proxy->smp_thread_id();
-        double tmp_prob = 0;
-        for (int i = start; i <= end; ++i) {
-          const size_t k = m_nlist_index[i];
-          tmp_prob += evaluateKernel(m_kernels[k], cv, derivs[tid], dists[tid]);
-        }
-        *(double *)result = tmp_prob;
-      };
-      const size_t numChunks = m_nlist_index.size();
-      const size_t lowerRange = 0;
-      const size_t upperRange = numChunks - 1;
-      CkLoop_Parallelize(
-        numChunks, lowerRange, upperRange,
-        worker, &prob, CKLOOP_DOUBLE_SUM, NULL);
-      for (size_t i = 0; i < num_variables(); ++i) {
-        for (size_t j = 0; j < m_num_threads; ++j) {
-          if (j == 0) dist[i] = dists[j][i];
-          der_prob[i] += derivs[j][i];
-        }
+    // TODO: Test this once fine-grained parallelization is enabled
+    auto worker = [&](int start, int end, void* unused) {
+      for (int b = start; b <= end; ++b) {
+        sum_block(b);
       }
+    };
+    const size_t numChunks = num_blocks;
+    const size_t lowerRange = 0;
+    const size_t upperRange = numChunks - 1;
+    CkLoop_Parallelize(
+      numChunks, lowerRange, upperRange,
+      worker, NULL, CKLOOP_NONE, NULL);
 #else
-      cvm::error("multiple threads required in OPES, but this binary is not linked with a supported threading library.\n");
+    cvm::error("multiple threads required in OPES, but this binary is not linked with a supported threading library.\n");
 #endif
+  }
+  // Pairwise reduction: at each level, block b accumulates block b + width
+  for (size_t width = 1; width < num_blocks; width *= 2) {
+    for (size_t b = 0; b + width < num_blocks; b += 2 * width) {
+      cvm::real *sum = partial.data() + b * num_values;
+      const cvm::real *other = partial.data() + (b + width) * num_values;
+      for (size_t j = 0; j < num_values; ++j) {
+        sum[j] += other[j];
+      }
     }
   }
-  prob /= m_kdenorm;
+  for (size_t j = 0; j < num_values; ++j) {
+    result[j] += partial[j];
+  }
+}
+
+cvm::real colvarbias_opes::getProbAndDerivatives(
+  const std::vector<cvm::real>& cv, std::vector<cvm::real>& der_prob) const {
+  // Either all kernels or those in the neighbor list
+  const size_t num_kernels = m_nlist ? m_nlist_index.size() : m_kernels.size();
+  const size_t *index = m_nlist ? m_nlist_index.data() : nullptr;
+  const size_t num_blocks = (num_kernels + kernel_block_size - 1) / kernel_block_size;
+  // The probability, followed by its derivatives
+  std::vector<cvm::real> sum(num_variables() + 1, 0);
+  sumBlocks(num_blocks, sum.size(), [&](size_t b, cvm::real *block_sum) {
+    const size_t begin = b * kernel_block_size;
+    const size_t end = std::min(begin + kernel_block_size, num_kernels);
+    block_sum[0] = evaluateKernels(cv, begin, end, index, block_sum + 1);
+  }, sum.data());
   for (size_t i = 0; i < num_variables(); ++i) {
-    der_prob[i] /= m_kdenorm;
+    der_prob[i] += sum[i + 1] / m_kdenorm;
   }
-  return prob;
+  return sum[0] / m_kdenorm;
 }
 
 int colvarbias_opes::calculate_opes() {
@@ -549,73 +861,19 @@ int colvarbias_opes::update_opes() {
   if (cvm::step_absolute() % m_pace == 0) {
     m_old_kdenorm = m_kdenorm;
     m_delta_kernels.clear();
-    const size_t old_nker = m_kernels.size();
+    const size_t old_nker = m_kernels.count();
     // TODO: how could I account for extra biases in Colvars?
     const cvm::real log_weight = bias_energy / m_kbt;
     cvm::real height = cvm::exp(log_weight);
     cvm::real sum_heights = height;
     cvm::real sum_heights2 = height * height;
     if (m_num_walkers > 1) {
-      std::vector<cvm::real> replica_sum_heights(cvm::proxy->num_replicas() - 1, 0);
-      // Send all sum_heights to PE 0
-      if (cvm::proxy->replica_index() == 0) {
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_recv((char*)&(replica_sum_heights[p - 1]), sizeof(cvm::real), p) != sizeof(cvm::real)) {
-            return cvm::error("Error: receiving sum of weights from replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_send((char*)&sum_heights, sizeof(cvm::real), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error: sending sum of weights to replica 0.");
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // PE 0 sum all sum_heights and broadcast
-      if (cvm::proxy->replica_index() == 0) {
-        for (auto it = replica_sum_heights.begin(); it != replica_sum_heights.end(); ++it) {
-          sum_heights += (*it);
-        }
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)&sum_heights, sizeof(cvm::real), p) != sizeof(cvm::real)) {
-            return cvm::error("Error: sending sum of weights to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_recv((char*)&sum_heights, sizeof(cvm::real), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error: receiving sum of weights from replica 0.");
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // Send all sum_heights2 to PE 0
-      std::vector<cvm::real> replica_sum_heights2(cvm::proxy->num_replicas() - 1, 0);
-      if (cvm::proxy->replica_index() == 0) {
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_recv((char*)&(replica_sum_heights2[p - 1]), sizeof(cvm::real), p) != sizeof(cvm::real)) {
-            return cvm::error("Error: getting sum of weights2 from replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_send((char*)&sum_heights2, sizeof(cvm::real), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error: sending sum of weights2 from replica.");
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // PE 0 sum all sum_heights2 and broadcast
-      if (cvm::proxy->replica_index() == 0) {
-        for (auto it = replica_sum_heights2.begin(); it != replica_sum_heights2.end(); ++it) {
-          sum_heights2 += (*it);
-        }
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)&sum_heights2, sizeof(cvm::real), p) != sizeof(cvm::real)) {
-            return cvm::error("Error: sending sum of weights2 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_recv((char*)&sum_heights2, sizeof(cvm::real), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error: receiving sum of weights2 from replica.");
-        }
+      cvm::real sums[2] = {sum_heights, sum_heights2};
+      if (cvm::proxy->replica_comm_allreduce_sum(sums, 2) != COLVARS_OK) {
+        return cvm::error("Error: summing the weights over replicas.\n");
       }
-      cvm::proxy->replica_comm_barrier();
+      sum_heights = sums[0];
+      sum_heights2 = sums[1];
     }
     m_counter += m_num_walkers;
     m_sum_weights += sum_heights;
@@ -696,211 +954,29 @@ int colvarbias_opes::update_opes() {
     if (m_num_walkers == 1) {
       addKernel(height, m_cv, sigma, log_weight);
     } else {
-      std::vector<cvm::real> all_height(m_num_walkers, 0.0);
-      std::vector<cvm::real> all_center(m_num_walkers * num_variables(), 0.0);
-      std::vector<cvm::real> all_sigma(m_num_walkers * num_variables(), 0.0);
-      std::vector<cvm::real> all_logweight(m_num_walkers, 0.0);
-      const int my_replica = cvm::proxy->replica_index();
-
-      // Allgather of heights
-      if (my_replica == 0) {
-        all_height[0] = height;
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_recv((char*)&(all_height[p]), sizeof(decltype(all_height)::value_type), p) != sizeof(decltype(all_height)::value_type)) {
-            return cvm::error("Error: on receiving height on replica 0 from replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_send((char*)&height, sizeof(decltype(height)), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error: on sending height to replica 0 from replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // Broadcast heights
-      if (my_replica == 0) {
-        const int send_size = sizeof(decltype(all_height)::value_type) * all_height.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)all_height.data(), send_size, p) != send_size) {
-            return cvm::error("Error: on sending heights from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int recv_size = sizeof(decltype(all_height)::value_type) * all_height.size();
-        if (cvm::proxy->replica_comm_recv((char*)all_height.data(), recv_size, 0) != recv_size) {
-          return cvm::error("Error: on receiving heights from replica 0 to replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-
-      // Allgather of centers
-      if (my_replica == 0) {
-        std::copy(m_cv.begin(), m_cv.end(), all_center.begin());
-        const int recv_size = sizeof(decltype(m_cv)::value_type) * m_cv.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          cvm::real* recv_start_ptr = &(all_center[p * m_cv.size()]);
-          if (cvm::proxy->replica_comm_recv((char*)recv_start_ptr, recv_size, p) != recv_size) {
-            return cvm::error("Error on receiving centers from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int send_size = sizeof(decltype(m_cv)::value_type) * m_cv.size();
-        if (cvm::proxy->replica_comm_send((char*)m_cv.data(), send_size, 0) != send_size) {
-          return cvm::error("Error on sending centers to replica 0 from replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // Broadcast centers
-      if (my_replica == 0) {
-        const int send_size = sizeof(decltype(all_center)::value_type) * all_center.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)all_center.data(), send_size, p) != send_size) {
-            return cvm::error("Error on sending centers from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int recv_size = sizeof(decltype(all_center)::value_type) * all_center.size();
-        if (cvm::proxy->replica_comm_recv((char*)all_center.data(), recv_size, 0) != recv_size) {
-          return cvm::error("Error on receiving centers from replica 0 to replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-
-      // Allgather of sigmas
-      if (my_replica == 0) {
-        std::copy(sigma.begin(), sigma.end(), all_sigma.begin());
-        const int recv_size = sizeof(decltype(sigma)::value_type) * sigma.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          cvm::real* recv_start_ptr = &(all_sigma[p * m_cv.size()]);
-          if (cvm::proxy->replica_comm_recv((char*)recv_start_ptr, recv_size, p) != recv_size) {
-            return cvm::error("Error on receiving sigmas from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int send_size = sizeof(decltype(sigma)::value_type) * sigma.size();
-        if (cvm::proxy->replica_comm_send((char*)sigma.data(), send_size, 0) != send_size) {
-          return cvm::error("Error on sending sigmas to replica 0 from replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // Broadcast sigmas
-      if (my_replica == 0) {
-        const int send_size = sizeof(decltype(all_sigma)::value_type) * all_sigma.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)all_sigma.data(), send_size, p) != send_size) {
-            return cvm::error("Error on sending sigmas from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int recv_size = sizeof(decltype(all_sigma)::value_type) * all_sigma.size();
-        if (cvm::proxy->replica_comm_recv((char*)all_sigma.data(), recv_size, 0) != recv_size) {
-          return cvm::error("Error on receiving sigmas from replica 0 to replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-
-      // Allgather of logweights
-      if (my_replica == 0) {
-        all_logweight[0] = log_weight;
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_recv((char*)&(all_logweight[p]), sizeof(decltype(all_logweight)::value_type), p) != sizeof(decltype(all_logweight)::value_type)) {
-            return cvm::error("Error on receiving log_weight on replica 0 from replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        if (cvm::proxy->replica_comm_send((char*)&log_weight, sizeof(decltype(log_weight)), 0) != sizeof(cvm::real)) {
-          return cvm::error("Error on sending log_weight to replica 0 from replica " + cvm::to_str(my_replica));
-        }
-      }
-      cvm::proxy->replica_comm_barrier();
-      // Broadcast log_weight
-      if (my_replica == 0) {
-        const int send_size = sizeof(decltype(all_logweight)::value_type) * all_logweight.size();
-        for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-          if (cvm::proxy->replica_comm_send((char*)all_logweight.data(), send_size, p) != send_size) {
-            return cvm::error("Error on sending log_weight from replica 0 to replica " + cvm::to_str(p));
-          }
-        }
-      } else {
-        const int recv_size = sizeof(decltype(all_logweight)::value_type) * all_logweight.size();
-        if (cvm::proxy->replica_comm_recv((char*)all_logweight.data(), recv_size, 0) != recv_size) {
-          return cvm::error("Error on receiving log_weight from replica 0 to replica " + cvm::to_str(my_replica));
-        }
+      // Exchange the new kernels of all replicas in a single collective
+      // operation: each replica contributes height, log-weight, center and sigma
+      const size_t ncv = num_variables();
+      const size_t kernel_size = 2 + 2 * ncv;
+      std::vector<cvm::real> kernel_data(kernel_size);
+      kernel_data[0] = height;
+      kernel_data[1] = log_weight;
+      std::copy(m_cv.begin(), m_cv.end(), kernel_data.begin() + 2);
+      std::copy(sigma.begin(), sigma.end(), kernel_data.begin() + 2 + ncv);
+      std::vector<cvm::real> all_kernel_data(m_num_walkers * kernel_size);
+      const int kernel_bytes = sizeof(cvm::real) * kernel_size;
+      if (cvm::proxy->replica_comm_allgather(reinterpret_cast<char const *>(kernel_data.data()), kernel_bytes,
+                                             reinterpret_cast<char *>(all_kernel_data.data())) != COLVARS_OK) {
+        return cvm::error("Error: exchanging new kernels between replicas.\n");
       }
-      cvm::proxy->replica_comm_barrier();
 
       if (m_nlist) {
-        std::vector<int> all_nlist_size(m_num_walkers);
-        const int my_replica = cvm::proxy->replica_index();
-        // Get the size of the neighbor list of each replica
-        if (my_replica == 0) {
-          all_nlist_size[0] = m_nlist_index.size();
-          for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-            if (cvm::proxy->replica_comm_recv((char*)&(all_nlist_size[p]), sizeof(int), p) != sizeof(int)) {
-              return cvm::error("Error on receiving neighbor list size from replica " + cvm::to_str(p));
-            }
-          }
-        } else {
-          const int nlist_size = m_nlist_index.size();
-          if (cvm::proxy->replica_comm_send((char*)&nlist_size, sizeof(int), 0) != sizeof(int)) {
-            return cvm::error("Error on sending neighbor list size from replica " + cvm::to_str(my_replica));
-          }
+        // Merge the neighbor lists of all replicas
+        std::vector<size_t> all_nlist_index;
+        if (cvm::proxy->replica_comm_allgatherv(m_nlist_index, all_nlist_index) != COLVARS_OK) {
+          return cvm::error("Error: exchanging neighbor lists between replicas.\n");
         }
-        cvm::proxy->replica_comm_barrier();
-        // Broadcast the neighbor list sizes to all replicas
-        if (my_replica == 0) {
-          const int send_size = sizeof(int) * all_nlist_size.size();
-          for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-            if (cvm::proxy->replica_comm_send((char*)all_nlist_size.data(), send_size, p) != send_size) {
-              return cvm::error("Error on sending neighbor list sizes from replica 0 to replica " + cvm::to_str(p));
-            }
-          }
-        } else {
-          const int recv_size = sizeof(int) * all_nlist_size.size();
-          if (cvm::proxy->replica_comm_recv((char*)all_nlist_size.data(), recv_size, 0) != recv_size) {
-            return cvm::error("Error on receiving neighbor list sizes to replica " + cvm::to_str(my_replica));
-          }
-        }
-        cvm::proxy->replica_comm_barrier();
-        // Gather all neighbor lists from replicas
-        const int tot_size = std::accumulate(all_nlist_size.begin(), all_nlist_size.end(), 0);
-        if (tot_size > 0) {
-          // Allgatherv all neighbor lists from replicas
-          std::vector<size_t> all_nlist_index(tot_size);
-          if (my_replica == 0) {
-            std::vector<int> recv_start(m_num_walkers);
-            // Accumulative sum
-            recv_start[0] = 0;
-            std::partial_sum(all_nlist_size.begin(), all_nlist_size.end() - 1, recv_start.begin() + 1);
-            std::copy(m_nlist_index.begin(), m_nlist_index.end(), all_nlist_index.begin());
-            for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-              size_t* recv_start_ptr = &(all_nlist_index[recv_start[p]]);
-              const int recv_size = all_nlist_size[p] * sizeof(decltype(all_nlist_index)::value_type);
-              if (cvm::proxy->replica_comm_recv((char*)recv_start_ptr, recv_size, p) != recv_size) {
-                return cvm::error("Error on receiving neighbor list from replica " + cvm::to_str(p));
-              }
-            }
-          } else {
-            const int send_size = sizeof(decltype(m_nlist_index)::value_type) * m_nlist_index.size();
-            if (cvm::proxy->replica_comm_send((char*)m_nlist_index.data(), send_size, 0) != send_size) {
-              return cvm::error("Error on sending neighbor list from replica " + cvm::to_str(my_replica));
-            }
-          }
-          cvm::proxy->replica_comm_barrier();
-          // Broadcast the neighbor list
-          if (my_replica == 0) {
-            const int send_size = sizeof(decltype(all_nlist_index)::value_type) * tot_size;
-            for (int p = 1; p < cvm::proxy->num_replicas(); ++p) {
-              if (cvm::proxy->replica_comm_send((char*)all_nlist_index.data(), send_size, p) != send_size) {
-                return cvm::error("Error on sending total neighbor list to replica " + cvm::to_str(p));
-              }
-            }
-          } else {
-            const int recv_size = sizeof(decltype(all_nlist_index)::value_type) * tot_size;
-            if (cvm::proxy->replica_comm_recv((char*)all_nlist_index.data(), recv_size, 0) != recv_size) {
-              return cvm::error("Error on receiving total neighbor list on replica " + cvm::to_str(my_replica));
-            }
-          }
-          cvm::proxy->replica_comm_barrier();
+        if (all_nlist_index.size() > 0) {
           // Deduplicate and sort the merged neighbor list
           std::unordered_set<size_t> all_nlist_index_set;
           for (auto it = all_nlist_index.cbegin(); it != all_nlist_index.cend(); ++it) {
@@ -911,16 +987,13 @@ int colvarbias_opes::update_opes() {
         }
       }
       for (size_t w = 0; w < m_num_walkers; ++w) {
-        std::vector<cvm::real> center_w(
-          all_center.begin() + num_variables() * w,
-          all_center.begin() + num_variables() * (w + 1));
-        std::vector<cvm::real> sigma_w(
-          all_sigma.begin() + num_variables() * w,
-          all_sigma.begin() + num_variables() * (w + 1));
-        addKernel(all_height[w], center_w, sigma_w, all_logweight[w]);
+        std::vector<cvm::real>::const_iterator const kernel_w = all_kernel_data.begin() + kernel_size * w;
+        std::vector<cvm::real> center_w(kernel_w + 2, kernel_w + 2 + ncv);
+        std::vector<cvm::real> sigma_w(kernel_w + 2 + ncv, kernel_w + kernel_size);
+        addKernel(kernel_w[0], center_w, sigma_w, kernel_w[1]);
       }
     }
-    m_nker = m_kernels.size();
+    m_nker = m_kernels.count();
     m_traj_line.nker = m_nker;
     if (m_nlist) {
       m_nlker = m_nlist_index.size();
@@ -931,188 +1004,76 @@ int colvarbias_opes::update_opes() {
     }
     if (!m_no_zed) {
       cvm::real sum_uprob = 0;
-      const size_t ks = m_kernels.size();
+      const size_t ks = m_kernels.count();
+      // Slots of removed kernels have zero height, and are skipped as centers
+      const size_t num_slots = m_kernels.size();
       const size_t ds = m_delta_kernels.size();
       const int num_parallel = 1; // Always 1
       const bool few_kernels = (ks * ks < (3 * ks * ds + 2 * ds * ds * num_parallel + 100));
       if (few_kernels) {
-        if (m_num_threads == 1) {
-          for (size_t k = 0; k < m_kernels.size(); ++k) {
-            for (size_t kk = 0; kk < m_kernels.size(); ++kk) {
-              sum_uprob += evaluateKernel(m_kernels[kk], m_kernels[k].m_center);
-            }
+        // Sum of all kernels at the centers of the kernels begin..end-1
+        auto uprob = [&](size_t begin, size_t end) {
+          cvm::real sum = 0;
+          std::vector<cvm::real> center_k(num_variables());
+          for (size_t k = begin; k < end; ++k) {
+            if (m_kernels.removed(k)) continue;
+            m_kernels.get_center(k, center_k);
+            sum += evaluateKernels(center_k, 0, num_slots);
           }
-        } else {
-#if defined(_OPENMP)
-          #pragma omp parallel num_threads(m_num_threads)
-          {
-            #pragma omp for reduction(+:sum_uprob) nowait
-            for (int k = 0; k < static_cast<int>(m_kernels.size()); ++k) {
-              for (int kk = 0; kk < static_cast<int>(m_kernels.size()); ++kk) {
-                sum_uprob += evaluateKernel(m_kernels[kk], m_kernels[k].m_center);
-              }
-            }
-          }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-          // TODO: Does this work??
-          auto worker = [&](int start, int end, void* result) {
-            double tmp_prob = 0;
-            for (int i = start; i <= end; ++i) {
-              for (size_t kk = 0; kk < m_kernels.size(); ++kk) {
-                tmp_prob += evaluateKernel(m_kernels[kk], m_kernels[i].m_center);
-              }
-            }
-            *(double *)result = tmp_prob;
-          };
-          const size_t numChunks = m_kernels.size();
-          const size_t lowerRange = 0;
-          const size_t upperRange = numChunks - 1;
-          CkLoop_Parallelize(
-            numChunks, lowerRange, upperRange,
-            worker, &sum_uprob, CKLOOP_DOUBLE_SUM, NULL);
-#else
-          cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
-#endif
-        }
+          return sum;
+        };
+        const size_t num_blocks = (num_slots + kernel_block_size - 1) / kernel_block_size;
+        sumBlocks(num_blocks, 1, [&](size_t b, cvm::real *block_sum) {
+          const size_t begin = b * kernel_block_size;
+          block_sum[0] = uprob(begin, std::min(begin + kernel_block_size, num_slots));
+        }, &sum_uprob);
         if (num_parallel > 1) {
           return cvm::error("Unimplemented feature: OPES in parallel running.\n");
         }
       } else {
         cvm::real delta_sum_uprob = 0;
-        if (!m_nlist) {
-          if (m_num_threads == 1) {
-            for (size_t i = 0; i < m_kernels.size(); ++i) {
-              for (size_t d = 0; d < m_delta_kernels.size(); ++d) {
-                const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                delta_sum_uprob += evaluateKernel(m_delta_kernels[d], m_kernels[i].m_center) + sign * evaluateKernel(m_kernels[i], m_delta_kernels[d].m_center);
-              }
+        // Either all kernels or those in the neighbor list
+        const size_t num_kernels = m_nlist ? m_nlist_index.size() : num_slots;
+        const size_t *index = m_nlist ? m_nlist_index.data() : nullptr;
+        // Change in the sum of the kernels begin..end-1 at each other's
+        // centers, due to the kernels added and removed in this step
+        auto delta_uprob = [&](size_t begin, size_t end) {
+          cvm::real sum = 0;
+          std::vector<cvm::real> center_k(num_variables());
+          for (size_t i = begin; i < end; ++i) {
+            const size_t k = index ? index[i] : i;
+            if (m_kernels.removed(k)) continue;
+            m_kernels.get_center(k, center_k);
+            for (size_t d = 0; d < ds; ++d) {
+              sum += evaluateKernel(m_delta_kernels[d], center_k);
             }
-          } else {
-#if defined(_OPENMP)
-            #pragma omp parallel num_threads(m_num_threads)
-            {
-              #pragma omp for reduction(+:delta_sum_uprob) nowait
-              for (int i = 0; i < static_cast<int>(m_kernels.size()); ++i) {
-                for (int d = 0; d < static_cast<int>(m_delta_kernels.size()); ++d) {
-                  const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                  delta_sum_uprob += evaluateKernel(m_delta_kernels[d], m_kernels[i].m_center) + sign * evaluateKernel(m_kernels[i], m_delta_kernels[d].m_center);
-                }
-              }
-            }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-            auto worker = [&](int start, int end, void* result) {
-              double tmp_prob = 0;
-              for (int i = start; i <= end; ++i) {
-                for (size_t d = 0; d < m_delta_kernels.size(); ++d) {
-                  const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                  tmp_prob += evaluateKernel(m_delta_kernels[d], m_kernels[i].m_center) + sign * evaluateKernel(m_kernels[i], m_delta_kernels[d].m_center);
-                }
-              }
-              *(double *)result = tmp_prob;
-            };
-            const size_t numChunks = m_kernels.size();
-            const size_t lowerRange = 0;
-            const size_t upperRange = numChunks - 1;
-            CkLoop_Parallelize(
-              numChunks, lowerRange, upperRange,
-              worker, &delta_sum_uprob, CKLOOP_DOUBLE_SUM, NULL);
-#else
-            cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
-#endif
           }
-        } else {
-          if (m_num_threads == 1) {
-            for (size_t i = 0; i < m_nlist_index.size(); ++i) {
-              const size_t k = m_nlist_index[i];
-              for (size_t d = 0; d < m_delta_kernels.size(); ++d) {
-                const double sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                delta_sum_uprob += evaluateKernel(m_delta_kernels[d], m_kernels[k].m_center) + sign * evaluateKernel(m_kernels[k], m_delta_kernels[d].m_center);
-              }
-            }
-          } else {
-#if defined(_OPENMP)
-            #pragma omp parallel num_threads(m_num_threads)
-            {
-              #pragma omp for reduction(+:delta_sum_uprob) nowait
-              for (int i = 0; i < static_cast<int>(m_nlist_index.size()); ++i) {
-                const size_t k = m_nlist_index[i];
-                for (int d = 0; d < static_cast<int>(m_delta_kernels.size()); ++d) {
-                  const double sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                  delta_sum_uprob += evaluateKernel(m_delta_kernels[d], m_kernels[k].m_center) + sign * evaluateKernel(m_kernels[k], m_delta_kernels[d].m_center);
-                }
-              }
-            }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-            auto worker = [&](int start, int end, void* result) {
-              double tmp_prob = 0;
-              for (int i = start; i <= end; ++i) {
-                const size_t k = m_nlist_index[i];
-                for (size_t d = 0; d < m_delta_kernels.size(); ++d) {
-                  const double sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                  tmp_prob += evaluateKernel(m_delta_kernels[d], m_kernels[k].m_center) + sign * evaluateKernel(m_kernels[k], m_delta_kernels[d].m_center);
-                }
-              }
-              *(double *)result = tmp_prob;
-            };
-            const size_t numChunks = m_nlist_index.size();
-            const size_t lowerRange = 0;
-            const size_t upperRange = numChunks - 1;
-            CkLoop_Parallelize(
-              numChunks, lowerRange, upperRange,
-              worker, &delta_sum_uprob, CKLOOP_DOUBLE_SUM, NULL);
-#else
-            cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
-#endif
+          for (size_t d = 0; d < ds; ++d) {
+            const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
+            sum += sign * evaluateKernels(m_delta_kernels[d].m_center, begin, end, index);
           }
-        }
+          return sum;
+        };
+        const size_t num_blocks = (num_kernels + kernel_block_size - 1) / kernel_block_size;
+        sumBlocks(num_blocks, 1, [&](size_t b, cvm::real *block_sum) {
+          const size_t begin = b * kernel_block_size;
+          block_sum[0] = delta_uprob(begin, std::min(begin + kernel_block_size, num_kernels));
+        }, &delta_sum_uprob);
         if (num_parallel > 1) {
           return cvm::error("Unimplemented feature: OPES in parallel running.\n");
         }
-        if (m_num_threads == 1) {
-          for (size_t d = 0; d < m_delta_kernels.size(); ++d) {
-            for (size_t dd = 0; dd < m_delta_kernels.size(); ++dd) {
-              const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-              delta_sum_uprob -= sign *evaluateKernel(m_delta_kernels[dd], m_delta_kernels[d].m_center);
-            }
-          }
-        } else {
-#if defined(_OPENMP)
-          #pragma omp parallel num_threads(m_num_threads)
-          {
-            #pragma omp for reduction(+:delta_sum_uprob)
-            for (int d = 0; d < static_cast<int>(m_delta_kernels.size()); ++d) {
-              for (int dd = 0; dd < static_cast<int>(m_delta_kernels.size()); ++dd) {
-                const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                delta_sum_uprob -= sign * evaluateKernel(m_delta_kernels[dd], m_delta_kernels[d].m_center);
-              }
-            }
+        // Remove the double counting of the changed kernels at each other's centers
+        cvm::real delta_delta_uprob = 0;
+        sumBlocks(ds, 1, [&](size_t d, cvm::real *block_sum) {
+          const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
+          for (size_t dd = 0; dd < ds; ++dd) {
+            block_sum[0] += sign * evaluateKernel(m_delta_kernels[dd], m_delta_kernels[d].m_center);
           }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-          auto worker = [&](int start, int end, void* result) {
-            double tmp_prob = 0;
-            for (int d = start; d <= end; ++d) {
-              for (size_t dd = 0; dd < m_delta_kernels.size(); ++dd) {
-                const int sign = m_delta_kernels[d].m_height < 0 ? -1 : 1;
-                tmp_prob += sign * evaluateKernel(m_delta_kernels[dd], m_delta_kernels[d].m_center);
-              }
-            }
-            *(double *)result = tmp_prob;
-          };
-          const size_t numChunks = m_delta_kernels.size();
-          const size_t lowerRange = 0;
-          const size_t upperRange = numChunks - 1;
-          double tmp = 0;
-          CkLoop_Parallelize(
-            numChunks, lowerRange, upperRange,
-            worker, &tmp, CKLOOP_DOUBLE_SUM, NULL);
-          delta_sum_uprob -= tmp;
-#else
-          cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
-#endif
-        }
+        }, &delta_delta_uprob);
+        delta_sum_uprob -= delta_delta_uprob;
         sum_uprob = m_zed * m_old_kdenorm * old_nker + delta_sum_uprob;
       }
-      m_zed = sum_uprob / m_kdenorm / m_kernels.size();
+      m_zed = sum_uprob / m_kdenorm / m_kernels.count();
       m_traj_line.zed = m_zed;
     }
     if (m_calc_work) {
@@ -1126,13 +1087,17 @@ int colvarbias_opes::update_opes() {
   return COLVARS_OK;
 }
 
-void colvarbias_opes::save_state() {
+int colvarbias_opes::save_state() {
   if (cvm::step_absolute() % cvm::restart_out_freq == 0) {
     m_saved_zed = m_zed;
     m_saved_sum_weights = m_sum_weights;
     m_saved_sum_weights2 = m_sum_weights2;
+    if (m_kernels_journal) {
+      return writeKernelsJournal();
+    }
     m_saved_kernels = m_kernels;
   }
+  return COLVARS_OK;
 }
 
 int colvarbias_opes::update() {
@@ -1145,7 +1110,7 @@ int colvarbias_opes::update() {
   //       the PLUMED implementation is correct for step 0, so I save the
   //       data after calculate() that does not modify the internal state
   //       of the bias.
-  save_state();
+  error_code |= save_state();
   if (error_code != COLVARS_OK) return error_code;
   if (m_is_first_step) {
     // NOTE: Colvars does not allow chainned biases, so I have to implement
@@ -1166,7 +1131,7 @@ int colvarbias_opes::update() {
 int colvarbias_opes::collectSampleToPMFGrid() {
   if (m_reweight_grid) {
     // Get the bin index
-    std::vector<int> bin(m_pmf_cvs.size(), 0);
+    colvar_grid_index bin(m_pmf_cvs.size(), 0);
     for (size_t i = 0; i < m_pmf_cvs.size(); ++i) {
       bin[i] = m_reweight_grid->current_bin_scalar(i);
     }
@@ -1228,25 +1193,36 @@ template <typename OST> OST& colvarbias_opes::write_state_data_template_(OST &os
       printFieldReal("av_M2_" + variables(i)->name, m_av_M2[i]);
     }
   }
-  printFieldULL("num_hills", m_saved_kernels.size());
-  write_state_data_key(os, "hills", false);
-  if (formatted) os << "{\n";
-  for (size_t k = 0; k < m_saved_kernels.size(); ++k) {
-    if (formatted) os << "{ ";
-    os << k;
-    if (formatted) os << " ";
-    for (size_t i = 0; i < num_variables(); ++i) {
-      os << m_saved_kernels[k].m_center[i];
-      if (formatted) os << " ";
-    }
-    for (size_t i = 0; i < num_variables(); ++i) {
-      os << m_saved_kernels[k].m_sigma[i];
+  if (m_kernels_journal && !m_journal_filename.empty()) {
+    // The kernels are in the journal written at the last checkpoint
+    printFieldString("kernels_journal", m_journal_filename);
+    printFieldULL("journal_generation", m_journal_generation);
+    printFieldULL("journal_size", m_journal_size);
+  } else {
+    // Without a journal yet, write the kernels saved together with the
+    // other fields above
+    const kernel_array& saved_kernels = m_saved_kernels;
+    printFieldULL("num_hills", saved_kernels.count());
+    write_state_data_key(os, "hills", false);
+    if (formatted) os << "{\n";
+    for (size_t k = 0, num_written = 0; k < saved_kernels.size(); ++k) {
+      if (saved_kernels.removed(k)) continue;
+      if (formatted) os << "{ ";
+      os << num_written++;
       if (formatted) os << " ";
+      for (size_t i = 0; i < num_variables(); ++i) {
+        os << saved_kernels.center(k, i);
+        if (formatted) os << " ";
+      }
+      for (size_t i = 0; i < num_variables(); ++i) {
+        os << saved_kernels.sigma(k, i);
+        if (formatted) os << " ";
+      }
+      os << saved_kernels.height(k);
+      if (formatted) os << " }\n";
     }
-    os << m_saved_kernels[k].m_height;
-    if (formatted) os << " }\n";
+    if (formatted) os << "}\n";
   }
-  if (formatted) os << "}\n";
   if (formatted) os.setf(f);
   if (m_pmf_grid_on) {
     write_state_data_key(os, "probability_grid");
@@ -1361,41 +1337,60 @@ template <typename IST> IST& colvarbias_opes::read_state_data_template_(IST &is)
       readFieldReal("av_M2_" + variables(i)->name, m_av_M2[i]);
     }
   }
-  unsigned long long kernel_size = 0;
-  readFieldULL("num_hills", kernel_size);
-  if (kernel_size > 0) m_kernels.resize(kernel_size);
-  read_state_data_key(is, "hills");
-  auto consume = [&](const std::string& expected_token){
-    if (formatted) {
-      std::string field;
-      is >> field;
-      if (field.compare(expected_token) != 0) {
-        throw std::runtime_error("Expect " + expected_token + " but got " + field + "\n");
+  std::string kernels_field;
+  is >> kernels_field;
+  if (kernels_field == "kernels_journal") {
+    std::string journal_filename;
+    unsigned long long journal_generation = 0, journal_size = 0;
+    is >> journal_filename;
+    readFieldULL("journal_generation", journal_generation);
+    readFieldULL("journal_size", journal_size);
+    if (readKernelsJournal(journal_filename, journal_generation, journal_size) != COLVARS_OK) {
+      throw std::runtime_error("Cannot read the kernels journal \"" + journal_filename + "\"\n");
+    }
+  } else if (kernels_field == "num_hills") {
+    unsigned long long kernel_size = 0;
+    is >> kernel_size;
+    if (kernel_size > 0) m_kernels.clear();
+    read_state_data_key(is, "hills");
+    auto consume = [&](const std::string& expected_token){
+      if (formatted) {
+        std::string field;
+        is >> field;
+        if (field.compare(expected_token) != 0) {
+          throw std::runtime_error("Expect " + expected_token + " but got " + field + "\n");
+        }
       }
-    }
-  };
-  consume("{");
-  for (size_t k = 0; k < m_kernels.size(); ++k) {
+    };
     consume("{");
-    unsigned long long tmp_k = 0;
-    is >> tmp_k;
-    if (formatted && k != tmp_k) {
-      throw std::runtime_error("Corrupt hill data\n");
-    }
-    kernel current_kernel;
-    current_kernel.m_center.resize(num_variables());
-    current_kernel.m_sigma.resize(num_variables());
-    for (size_t i = 0; i < num_variables(); ++i) {
-      is >> current_kernel.m_center[i];
-    }
-    for (size_t i = 0; i < num_variables(); ++i) {
-      is >> current_kernel.m_sigma[i];
+    for (size_t k = 0; k < kernel_size; ++k) {
+      consume("{");
+      unsigned long long tmp_k = 0;
+      is >> tmp_k;
+      if (formatted && k != tmp_k) {
+        throw std::runtime_error("Corrupt hill data\n");
+      }
+      kernel current_kernel;
+      current_kernel.m_center.resize(num_variables());
+      current_kernel.m_sigma.resize(num_variables());
+      for (size_t i = 0; i < num_variables(); ++i) {
+        is >> current_kernel.m_center[i];
+      }
+      for (size_t i = 0; i < num_variables(); ++i) {
+        is >> current_kernel.m_sigma[i];
+      }
+      is >> current_kernel.m_height;
+      m_kernels.push_back(current_kernel);
+      consume("}");
     }
-    is >> current_kernel.m_height;
-    m_kernels[k] = current_kernel;
     consume("}");
+  } else {
+    throw std::runtime_error("Expect field \"num_hills\" or \"kernels_journal\", but got \"" + kernels_field + "\"\n");
+  }
+  if (m_kernels_journal) {
+    // Start a new journal with the kernels just read at the next checkpoint
+    cvm::proxy->close_output_stream(traj_file_name(".kernels.journal"));
   }
-  consume("}");
   if (m_pmf_grid_on) {
     read_state_data_key(is, "probability_grid");
     m_reweight_grid->read_raw(is);
@@ -1404,7 +1399,9 @@ template <typename IST> IST& colvarbias_opes::read_state_data_template_(IST &is)
   m_traj_line.rct = m_kbt * cvm::logn(m_sum_weights / m_counter);
   m_traj_line.zed = m_zed;
   m_traj_line.neff = (1 + m_sum_weights) * (1 + m_sum_weights) / (1 + m_sum_weights2);
-  m_traj_line.nker = m_kernels.size();
+  m_traj_line.nker = m_kernels.count();
+  m_kernel_buckets = kernel_buckets();
+  setupKernelBuckets();
   showInfo();
   return is;
 }
@@ -1453,44 +1450,244 @@ void colvarbias_opes::addKernel(const double height, const std::vector<cvm::real
     size_t taker_k = getMergeableKernel(center, m_kernels.size());
     if (taker_k < m_kernels.size()) {
       no_match = false;
-      m_delta_kernels.emplace_back(-1 * m_kernels[taker_k].m_height, m_kernels[taker_k].m_center, m_kernels[taker_k].m_sigma);
-      mergeKernels(m_kernels[taker_k], kernel(height, center, sigma));
-      m_delta_kernels.push_back(m_kernels[taker_k]);
+      kernel taker = m_kernels.get(taker_k);
+      m_delta_kernels.emplace_back(-1 * taker.m_height, taker.m_center, taker.m_sigma);
+      if (m_kernel_buckets.defined()) m_kernel_buckets.remove(taker_k, taker.m_center);
+      mergeKernels(taker, kernel(height, center, sigma));
+      m_kernels.set(taker_k, taker);
+      if (m_kernel_buckets.defined()) m_kernel_buckets.insert(taker_k, taker.m_center);
+      updateMaxSigma(taker.m_sigma);
+      m_delta_kernels.push_back(taker);
       if (m_recursive_merge) {
         size_t giver_k = taker_k;
-        taker_k = getMergeableKernel(m_kernels[giver_k].m_center, giver_k);
+        taker_k = getMergeableKernel(taker.m_center, giver_k);
         while (taker_k < m_kernels.size()) {
           m_delta_kernels.pop_back();
-          m_delta_kernels.emplace_back(-1 * m_kernels[taker_k].m_height, m_kernels[taker_k].m_center, m_kernels[taker_k].m_sigma);
+          taker = m_kernels.get(taker_k);
+          m_delta_kernels.emplace_back(-1 * taker.m_height, taker.m_center, taker.m_sigma);
           if (taker_k > giver_k) std::swap(taker_k, giver_k);
-          mergeKernels(m_kernels[taker_k], m_kernels[giver_k]);
-          m_delta_kernels.push_back(m_kernels[taker_k]);
-          m_kernels.erase(m_kernels.begin() + giver_k);
-          if (m_nlist) {
-            size_t giver_nk = 0;
-            bool found_giver = false;
-            for (size_t nk = 0; nk < m_nlist_index.size(); ++nk) {
-              if (found_giver) m_nlist_index[nk]--;
-              if (m_nlist_index[nk] == giver_k) {
-                giver_nk = nk;
-                found_giver = true;
-              }
-            }
-            if (found_giver == false) {
-              cvm::error("problem with merging and nlist\n");
-            }
-            m_nlist_index.erase(m_nlist_index.begin() + giver_nk);
-          }
+          taker = m_kernels.get(taker_k);
+          if (m_kernel_buckets.defined()) m_kernel_buckets.remove(taker_k, taker.m_center);
+          mergeKernels(taker, m_kernels.get(giver_k));
+          m_kernels.set(taker_k, taker);
+          if (m_kernel_buckets.defined()) m_kernel_buckets.insert(taker_k, taker.m_center);
+          updateMaxSigma(taker.m_sigma);
+          m_delta_kernels.push_back(taker);
+          // The other kernels keep their indices until the next compaction
+          removeKernel(giver_k);
           giver_k = taker_k;
-          taker_k = getMergeableKernel(m_kernels[giver_k].m_center, giver_k);
+          taker_k = getMergeableKernel(taker.m_center, giver_k);
         }
       }
     }
   }
   if (no_match) {
-    m_kernels.emplace_back(height, center, sigma);
+    m_kernels.push_back(kernel(height, center, sigma));
     m_delta_kernels.emplace_back(height, center, sigma);
     if (m_nlist) m_nlist_index.push_back(m_kernels.size() - 1);
+    updateMaxSigma(sigma);
+    if (m_kernel_buckets.defined()) {
+      m_kernel_buckets.insert(m_kernels.size() - 1, center);
+    } else {
+      setupKernelBuckets();
+    }
+  }
+  // Reclaim the slots of merged kernels once they are a sizable fraction
+  if (m_kernels.num_removed() > m_kernels.size() / 4) {
+    compactKernels();
+  }
+}
+
+void colvarbias_opes::updateMaxSigma(const std::vector<cvm::real>& sigma) {
+  for (size_t i = 0; i < num_variables(); ++i) {
+    m_max_sigma[i] = std::max(m_max_sigma[i], sigma[i]);
+  }
+}
+
+void colvarbias_opes::removeKernel(size_t k) {
+  if (m_kernel_buckets.defined()) {
+    std::vector<cvm::real> center;
+    m_kernels.get_center(k, center);
+    m_kernel_buckets.remove(k, center);
+  }
+  m_kernels.remove(k);
+  if (m_nlist) {
+    // The neighbor list is sorted
+    auto it = std::lower_bound(m_nlist_index.begin(), m_nlist_index.end(), k);
+    if (it == m_nlist_index.end() || *it != k) {
+      cvm::error("problem with merging and nlist\n");
+    } else {
+      m_nlist_index.erase(it);
+    }
+  }
+}
+
+void colvarbias_opes::compactKernels() {
+  std::vector<size_t> new_index;
+  m_kernels.compact(new_index);
+  for (size_t nk = 0; nk < m_nlist_index.size(); ++nk) {
+    m_nlist_index[nk] = new_index[m_nlist_index[nk]];
+  }
+  setupKernelBuckets();
+}
+
+int colvarbias_opes::writeKernelsJournal() {
+  std::vector<size_t> changed;
+  m_kernels.take_changes(changed);
+  const std::string filename = traj_file_name(".kernels.journal");
+  const size_t record_size = kernels_journal_format::record_size(num_variables());
+  const size_t full_size = kernels_journal_format::header_size + m_kernels.count() * record_size;
+  // Start a new journal in each run, and whenever most of its records are
+  // superseded by later ones
+  const bool rewrite = !cvm::proxy->output_stream_exists(filename) ||
+                       (m_journal_size + changed.size() * record_size > 2 * full_size);
+  if (rewrite) {
+    cvm::proxy->close_output_stream(filename);
+  }
+  std::ostream& os = cvm::proxy->output_stream(filename, "OPES kernels journal");
+  if (!os) return COLVARS_FILE_ERROR;
+  std::vector<double> values(1 + 2 * num_variables());
+  auto write_record = [&](size_t id, size_t k) {
+    const uint64_t fields[2] = {id, (k == m_kernels.size() || m_kernels.removed(k)) ? 1U : 0U};
+    std::fill(values.begin(), values.end(), 0);
+    if (fields[1] == 0) {
+      values[0] = m_kernels.height(k);
+      for (size_t i = 0; i < num_variables(); ++i) {
+        values[1 + i] = m_kernels.center(k, i);
+        values[1 + num_variables() + i] = m_kernels.sigma(k, i);
+      }
+    }
+    os.write(reinterpret_cast<const char *>(fields), sizeof(fields));
+    os.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+  };
+  if (rewrite) {
+    const uint32_t header[4] = {kernels_journal_format::version,
+                                kernels_journal_format::byte_order_mark,
+                                static_cast<uint32_t>(num_variables()), 0};
+    const uint64_t generation = ++m_journal_generation;
+    os.write(kernels_journal_format::magic(), kernels_journal_format::magic_size);
+    os.write(reinterpret_cast<const char *>(header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(&generation), sizeof(generation));
+    for (size_t k = 0; k < m_kernels.size(); ++k) {
+      if (m_kernels.removed(k)) continue;
+      write_record(m_kernels.id(k), k);
+    }
+    m_journal_size = full_size;
+  } else {
+    for (size_t j = 0; j < changed.size(); ++j) {
+      write_record(changed[j], m_kernels.find(changed[j]));
+    }
+    m_journal_size += changed.size() * record_size;
+  }
+  m_journal_filename = filename;
+  if (!os) {
+    return cvm::error("Error: cannot write to the OPES kernels journal \"" + filename + "\".\n",
+                      COLVARS_FILE_ERROR);
+  }
+  return cvm::proxy->flush_output_stream(filename);
+}
+
+int colvarbias_opes::readKernelsJournal(const std::string& filename, size_t generation, size_t size) {
+  colvarproxy_mapped_file file;
+  if (file.open(filename) != COLVARS_OK) {
+    return cvm::error("Error: cannot open the OPES kernels journal \"" + filename + "\".\n",
+                      COLVARS_FILE_ERROR);
+  }
+  const size_t nd = num_variables();
+  const size_t record_size = kernels_journal_format::record_size(nd);
+  const char *data = file.data();
+  if (size > file.size() || size < kernels_journal_format::header_size ||
+      (size - kernels_journal_format::header_size) % record_size != 0 ||
+      std::memcmp(data, kernels_journal_format::magic(), kernels_journal_format::magic_size) != 0) {
+    return cvm::error("Error: the OPES kernels journal \"" + filename +
+                      "\" is truncated or invalid.\n", COLVARS_INPUT_ERROR);
+  }
+  uint32_t header[4];
+  uint64_t file_generation = 0;
+  std::memcpy(header, data + kernels_journal_format::magic_size, sizeof(header));
+  std::memcpy(&file_generation, data + kernels_journal_format::magic_size + sizeof(header),
+              sizeof(file_generation));
+  if (header[0] != kernels_journal_format::version ||
+      header[1] != kernels_journal_format::byte_order_mark || header[2] != nd) {
+    return cvm::error("Error: the OPES kernels journal \"" + filename +
+                      "\" has an unsupported version or byte order, or a different "
+                      "number of variables.\n", COLVARS_INPUT_ERROR);
+  }
+  if (file_generation != generation) {
+    return cvm::error("Error: the OPES kernels journal \"" + filename +
+                      "\" has been rewritten since the state file was saved.\n",
+                      COLVARS_INPUT_ERROR);
+  }
+  const char *records = data + kernels_journal_format::header_size;
+  const size_t num_records = (size - kernels_journal_format::header_size) / record_size;
+  // Find the last record of each kernel
+  uint64_t fields[2];
+  std::vector<size_t> last_record;
+  for (size_t r = 0; r < num_records; ++r) {
+    std::memcpy(fields, records + r * record_size, sizeof(fields));
+    if (fields[0] >= last_record.size()) {
+      last_record.resize(fields[0] + 1, num_records);
+    }
+    last_record[fields[0]] = r;
+  }
+  // Add the kernels that were not removed, sorted by identifier
+  m_kernels.clear();
+  kernel G;
+  G.m_center.resize(nd);
+  G.m_sigma.resize(nd);
+  std::vector<double> values(1 + 2 * nd);
+  for (size_t id = 0; id < last_record.size(); ++id) {
+    if (last_record[id] == num_records) continue;
+    const char *record = records + last_record[id] * record_size;
+    std::memcpy(fields, record, sizeof(fields));
+    if (fields[1] != 0) continue;
+    std::memcpy(values.data(), record + sizeof(fields), values.size() * sizeof(double));
+    G.m_height = values[0];
+    for (size_t i = 0; i < nd; ++i) {
+      G.m_center[i] = values[1 + i];
+      G.m_sigma[i] = values[1 + nd + i];
+    }
+    m_kernels.push_back(G, id);
+  }
+  m_journal_filename = filename;
+  m_journal_generation = generation;
+  m_journal_size = size;
+  cvm::log("Read " + cvm::to_str(m_kernels.count()) + " kernels from " +
+           cvm::to_str(num_records) + " records of the journal \"" + filename + "\".\n");
+  return COLVARS_OK;
+}
+
+void colvarbias_opes::setupKernelBuckets() {
+  std::vector<cvm::real> center;
+  for (size_t k = 0; k < m_kernels.size(); ++k) {
+    if (m_kernels.removed(k)) continue;
+    updateMaxSigma(m_kernels.get(k).m_sigma);
+  }
+  // The index is only needed to merge kernels or to build neighbor lists,
+  // and bucket coordinates are limited to the dimensions of a grid index
+  if ((m_compression_threshold2 == 0 && !m_nlist) || m_kernels.empty() ||
+      num_variables() > colvar_grid_index::max_size) {
+    return;
+  }
+  if (!m_kernel_buckets.defined()) {
+    // Buckets as wide as the merging distance of the first kernel
+    size_t k0 = 0;
+    while (m_kernels.removed(k0)) ++k0;
+    const cvm::real factor = m_compression_threshold > 0 ? m_compression_threshold : 1.0;
+    std::vector<cvm::real> widths(num_variables()), periods(num_variables(), 0);
+    for (size_t i = 0; i < num_variables(); ++i) {
+      widths[i] = factor * m_kernels.sigma(k0, i);
+      if (variables(i)->is_enabled(f_cv_periodic)) {
+        periods[i] = variables(i)->period;
+      }
+    }
+    m_kernel_buckets.reset(widths, periods);
+  }
+  m_kernel_buckets.clear();
+  for (size_t k = 0; k < m_kernels.size(); ++k) {
+    if (m_kernels.removed(k)) continue;
+    m_kernels.get_center(k, center);
+    m_kernel_buckets.insert(k, center);
   }
 }
 
@@ -1522,158 +1719,94 @@ size_t colvarbias_opes::getMergeableKernel(const std::vector<cvm::real>& giver_c
   size_t min_k = m_kernels.size();
   cvm::real min_norm2 = m_compression_threshold2;
   const int num_parallel = 1;
-  if (!m_nlist) {
-    if (m_num_threads == 1) {
-      for (size_t k = 0; k < m_kernels.size(); ++k) {
-        if (k == giver_k) continue;
-        double norm2 = 0;
-        for (size_t i = 0; i < num_variables(); ++i) {
-          norm2 += variables(i)->dist2(giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-          if (norm2 >= min_norm2) break;
-        }
-        if (norm2 < min_norm2) {
-          min_norm2 = norm2;
-          min_k = k;
-        }
+  // Either all kernels or those in the neighbor list
+  const size_t num_kernels = m_nlist ? m_nlist_index.size() : m_kernels.size();
+  const size_t *index = m_nlist ? m_nlist_index.data() : nullptr;
+  // Whether kernel k at distance norm2 is closer than min_k; ties go to the
+  // lowest index, so that the result does not depend on the search order
+  auto closer = [&](size_t k, cvm::real norm2, size_t min_k, cvm::real min_norm2) {
+    return (norm2 < min_norm2) ||
+      ((norm2 == min_norm2) && (min_k < m_kernels.size()) && (k < min_k));
+  };
+  // Update min_k and min_norm2 with the closest among the kernels begin..end-1
+  auto find_closest = [&](size_t begin, size_t end, size_t& min_k, cvm::real& min_norm2) {
+    cvm::real norm2[kernel_block_size];
+    for (size_t b = begin; b < end; b += kernel_block_size) {
+      const size_t n = std::min(end - b, kernel_block_size);
+      if (index) {
+        kernelsNorm2(giver_center, listed_kernel_index{index + b}, n, norm2);
+      } else {
+        kernelsNorm2(giver_center, contiguous_kernel_index{b}, n, norm2);
       }
-    } else {
-#if defined(_OPENMP)
-      #pragma omp parallel num_threads(m_num_threads)
-      {
-        int min_k_omp = min_k;
-        cvm::real min_norm2_omp = m_compression_threshold2;
-        #pragma omp for nowait
-        for (int k = 0; k < static_cast<int>(m_kernels.size()); ++k) {
-          if (k == static_cast<int>(giver_k)) continue;
-          double norm2 = 0;
-          for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-            norm2 += variables(i)->dist2( giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-            if (norm2 >= min_norm2_omp) break;
-          }
-          if (norm2 < min_norm2_omp) {
-            min_norm2_omp = norm2;
-            min_k_omp = k;
-          }
-        }
-        #pragma omp critical
-        {
-          if (min_norm2_omp < min_norm2) {
-            min_norm2 = min_norm2_omp;
-            min_k = min_k_omp;
-          }
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = index ? index[b + j] : b + j;
+        if (k != giver_k && closer(k, norm2[j], min_k, min_norm2) && !m_kernels.removed(k)) {
+          min_norm2 = norm2[j];
+          min_k = k;
         }
       }
-#elif defined(CMK_SMP) && defined(USE_CKLOOP)
-      // NOTE: No existing reduction type for finding the minimum, so I have
-      //       to use such a workaround.
-      std::vector<size_t> min_k_smp(m_num_threads, min_k);
-      std::vector<cvm::real> min_norm2_smp(m_num_threads, m_compression_threshold2);
-      auto worker = [&](int start, int end, void* unused) {
-        const int tid = cvm::proxy->smp_thread_id();
-        for (int k = start; k <= end; ++k) {
-          if (k == giver_k) continue;
-          double norm2 = 0;
-          for (size_t j = 0; j < num_variables(); ++j) {
-            norm2 += variables(i)->dist2( giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-            if (norm2 >= min_norm2_smp[tid]) break;
-          }
-          if (norm2 < min_norm2_smp[tid]) {
-            min_norm2_smp[tid] = norm2;
-            min_k_smp[tid] = k;
-          }
-        }
-      };
-      const size_t numChunks = m_kernels.size();
-      const size_t lowerRange = 0;
-      const size_t upperRange = numChunks - 1;
-      CkLoop_Parallelize(
-        numChunks, lowerRange, upperRange,
-        worker, NULL, CKLOOP_NONE, NULL);
-      const auto it_min = std::min_element(min_norm2_smp.begin(), min_norm2_smp.end());
-      min_norm2 = *it_min;
-      min_k = min_k_smp[std::distance(min_norm2_smp.begin(), it_min)];
-#else
-      cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
-#endif
     }
-  } else {
-    if (m_num_threads == 1) {
-      // size_t min_k_omp = min_k;
-      // cvm::real min_norm2_omp = m_compression_threshold2;
-      for (size_t nk = 0; nk < m_nlist_index.size(); ++nk) {
-        const size_t k = m_nlist_index[nk];
+  };
+  std::vector<size_t> candidates;
+  std::vector<cvm::real> range(num_variables());
+  for (size_t i = 0; i < num_variables(); ++i) {
+    range[i] = m_compression_threshold * m_max_sigma[i];
+  }
+  // Only the kernels near the giver need to be checked (the neighbor list,
+  // when used, is already short enough to be scanned)
+  if (m_kernel_buckets.defined() && !m_nlist &&
+      m_kernel_buckets.query(giver_center, range, candidates)) {
+    cvm::real norm2[kernel_block_size];
+    for (size_t b = 0; b < candidates.size(); b += kernel_block_size) {
+      const size_t n = std::min(candidates.size() - b, kernel_block_size);
+      kernelsNorm2(giver_center, listed_kernel_index{candidates.data() + b}, n, norm2);
+      for (size_t j = 0; j < n; ++j) {
+        const size_t k = candidates[b + j];
         if (k == giver_k) continue;
-        double norm2 = 0;
-        for (size_t i = 0; i < num_variables(); ++i) {
-          norm2 += variables(i)->dist2(giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-          if (norm2 >= min_norm2) break;
-        }
-        if (norm2 < min_norm2) {
-          min_norm2 = norm2;
+        if (closer(k, norm2[j], min_k, min_norm2)) {
+          min_norm2 = norm2[j];
           min_k = k;
         }
       }
-    } else {
+    }
+  } else if (m_num_threads == 1 || num_kernels < 2 * m_num_threads) {
+    find_closest(0, num_kernels, min_k, min_norm2);
+  } else {
+    // Find the closest kernel within each block, then combine the blocks in
+    // order, so that the result does not depend on the number of threads
+    const size_t num_blocks = (num_kernels + kernel_block_size - 1) / kernel_block_size;
+    std::vector<size_t> min_k_block(num_blocks, min_k);
+    std::vector<cvm::real> min_norm2_block(num_blocks, min_norm2);
+    auto find_closest_block = [&](size_t b) {
+      const size_t begin = b * kernel_block_size;
+      find_closest(begin, std::min(begin + kernel_block_size, num_kernels),
+                   min_k_block[b], min_norm2_block[b]);
+    };
 #if defined(_OPENMP)
-      #pragma omp parallel num_threads(m_num_threads)
-      {
-        size_t min_k_omp = min_k;
-        cvm::real min_norm2_omp = m_compression_threshold2;
-        #pragma omp for nowait
-        for (int nk = 0; nk < static_cast<int>(m_nlist_index.size()); ++nk) {
-          const size_t k = m_nlist_index[nk];
-          if (k == giver_k) continue;
-          double norm2 = 0;
-          for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-            norm2 += variables(i)->dist2(giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-            if (norm2 >= min_norm2_omp) break;
-          }
-          if (norm2 < min_norm2_omp) {
-            min_norm2_omp = norm2;
-            min_k_omp = k;
-          }
-        }
-        #pragma omp critical
-        {
-          if (min_norm2_omp < min_norm2) {
-            min_norm2 = min_norm2_omp;
-            min_k = min_k_omp;
-          }
-        }
-      }
+    #pragma omp parallel for num_threads(m_num_threads)
+    for (int b = 0; b < static_cast<int>(num_blocks); ++b) {
+      find_closest_block(b);
+    }
 #elif defined(CMK_SMP) && defined(USE_CKLOOP)
-      // NOTE: No existing reduction type for finding the minimum, so I have
-      //       to use such a workaround.
-      std::vector<size_t> min_k_smp(m_num_threads, min_k);
-      std::vector<cvm::real> min_norm2_smp(m_num_threads, m_compression_threshold2);
-      auto worker = [&](int start, int end, void* unused) {
-        const int tid = cvm::proxy->smp_thread_id();
-        for (int nk = start; nk <= end; ++nk) {
-          const size_t k = m_nlist_index[nk];
-          if (k == giver_k) continue;
-          double norm2 = 0;
-          for (size_t j = 0; j < num_variables(); ++j) {
-            norm2 += variables(i)->dist2( giver_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-            if (norm2 >= min_norm2_smp[tid]) break;
-          }
-          if (norm2 < min_norm2_smp[tid]) {
-            min_norm2_smp[tid] = norm2;
-            min_k_smp[tid] = k;
-          }
-        }
-      };
-      const size_t numChunks = m_nlist_index.size();
-      const size_t lowerRange = 0;
-      const size_t upperRange = numChunks - 1;
-      CkLoop_Parallelize(
-        numChunks, lowerRange, upperRange,
-        worker, NULL, CKLOOP_NONE, NULL);
-      const auto it_min = std::min_element(min_norm2_smp.begin(), min_norm2_smp.end());
-      min_norm2 = *it_min;
-      min_k = min_k_smp[std::distance(min_norm2_smp.begin(), it_min)];
+    auto worker = [&](int start, int end, void* unused) {
+      for (int b = start; b <= end; ++b) {
+        find_closest_block(b);
+      }
+    };
+    const size_t numChunks = num_blocks;
+    const size_t lowerRange = 0;
+    const size_t upperRange = numChunks - 1;
+    CkLoop_Parallelize(
+      numChunks, lowerRange, upperRange,
+      worker, NULL, CKLOOP_NONE, NULL);
 #else
-      cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
+    cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
 #endif
+    for (size_t b = 0; b < num_blocks; ++b) {
+      if (closer(min_k_block[b], min_norm2_block[b], min_k, min_norm2)) {
+        min_norm2 = min_norm2_block[b];
+        min_k = min_k_block[b];
+      }
     }
   }
   if (num_parallel > 1) {
@@ -1794,10 +1927,10 @@ void hist_to_pmf(const cvm::real kbt, const std::unique_ptr<colvar_grid_scalar>&
   // Get the sum of probabilities of all grids
   cvm::real norm_factor = 0;
   cvm::real max_prob = 0;
-  auto& prob_data = hist->data;
-  for (auto it = prob_data.begin(); it != prob_data.end(); ++it) {
-    norm_factor += (*it);
-    if ((*it) > max_prob) max_prob = (*it);
+  auto const& prob_data = hist->data;
+  for (size_t i = 0; i < prob_data.size(); ++i) {
+    norm_factor += prob_data[i];
+    if (prob_data[i] > max_prob) max_prob = prob_data[i];
   }
   if (norm_factor > 0) {
     const cvm::real min_pmf = (max_prob > 0) ? -1.0 * kbt * cvm::logn(max_prob / norm_factor) : 0;
@@ -1807,7 +1940,7 @@ void hist_to_pmf(const cvm::real kbt, const std::unique_ptr<colvar_grid_scalar>&
         pmf_data[i] = -1.0 * kbt * cvm::logn(prob_data[i] / norm_factor) - min_pmf;
       }
     }
-    auto max_pmf = *std::max_element(pmf_data.begin(), pmf_data.end());
+    auto const max_pmf = pmf->maximum_value();
     for (size_t i = 0; i < pmf_data.size(); ++i) {
       if (!(prob_data[i] > 0)) {
         pmf_data[i] = max_pmf;
@@ -1817,47 +1950,17 @@ void hist_to_pmf(const cvm::real kbt, const std::unique_ptr<colvar_grid_scalar>&
 }
 
 int colvarbias_opes::computePMF() {
-  // Multiple replica: collect all samples from other replicas
+  // Multiple replica: sum the samples of all replicas, on every replica
   if (comm == multiple_replicas && m_pmf_shared) {
-    const size_t samples_n = m_reweight_grid->raw_data_num();
-    const int msg_size = samples_n * sizeof(cvm::real);
-    std::vector<cvm::real> buffer;
-    if (cvm::main()->proxy->replica_index() == 0) {
-      buffer.resize(samples_n * (cvm::proxy->num_replicas() - 1));
-      for (int p = 1; p < cvm::proxy->num_replicas(); p++) {
-        const size_t start_pos = (p - 1) * samples_n;
-        if (cvm::proxy->replica_comm_recv((char*)&(buffer[start_pos]), msg_size, p) != msg_size) {
-          return cvm::error("Error getting shared OPES reweighting histogram from replica " + cvm::to_str(p));
-        }
-      }
-    } else {
-      if (cvm::proxy->replica_comm_send((char*)(&(m_reweight_grid->data[0])), msg_size, 0) != msg_size) {
-        return cvm::error("Error sending shared OPES reweighting histogram from replica " + cvm::to_str(cvm::main()->proxy->replica_index()));
-      }
-    }
-    cvm::proxy->replica_comm_barrier();
-    // Broadcast m_reweight_grid to all replicas
-    auto& global_data = m_global_reweight_grid->data;
-    if (cvm::main()->proxy->replica_index() == 0) {
-      global_data = m_reweight_grid->data;
-      // Sum the samples on PE 0
-      for (int p = 1; p < cvm::proxy->num_replicas(); p++) {
-        const size_t start_pos = (p - 1) * samples_n;
-        for (size_t i = 0 ; i < samples_n; ++i) {
-          global_data[i] += buffer[start_pos+i];
-        }
-      }
+    if (m_global_reweight_grid->replicas_sum(*m_reweight_grid) != COLVARS_OK) {
+      return cvm::error("Error combining shared OPES reweighting histograms from replicas.\n",
+                        COLVARS_ERROR);
     }
   }
   // Get the sum of probabilities of all grids
   hist_to_pmf(m_kbt, m_reweight_grid, m_pmf_grid);
   if (comm == multiple_replicas && m_pmf_shared) {
-    if (cvm::main()->proxy->replica_index() == 0) {
-      hist_to_pmf(m_kbt, m_global_reweight_grid, m_global_pmf_grid);
-    }
-  }
-  if (comm == multiple_replicas) {
-    cvm::proxy->replica_comm_barrier();
+    hist_to_pmf(m_kbt, m_global_reweight_grid, m_global_pmf_grid);
   }
   return COLVARS_OK;
 }
@@ -1867,7 +1970,11 @@ int colvarbias_opes::writePMF(const std::unique_ptr<colvar_grid_scalar>& pmf_gri
   if (!os) {
     return COLVARS_FILE_ERROR;
   }
-  pmf_grid->write_multicol(os);
+  if (!keep_open && cvm::binary_grid_files) {
+    pmf_grid->write_binary(os);
+  } else {
+    pmf_grid->write_multicol(os);
+  }
   if (!keep_open) {
     cvm::proxy->close_output_stream(filename);
   } else {
@@ -1899,30 +2006,50 @@ void colvarbias_opes::updateNlist(const std::vector<cvm::real>& center) {
   if (m_kernels.empty()) return;
   m_nlist_center = center;
   m_nlist_index.clear();
-  if (m_num_threads == 1 || m_kernels.size() < 2 * m_num_threads) {
-    for (size_t k = 0; k < m_kernels.size(); ++k) {
-      cvm::real norm2_k = 0;
-      for (size_t i = 0; i < num_variables(); ++i) {
-        norm2_k += variables(i)->dist2(m_nlist_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
+  const cvm::real nlist_cutoff2 = m_nlist_param[0] * m_cutoff2;
+  // Append to selected the neighbors among the kernels begin..end-1
+  auto find_neighbors = [&](size_t begin, size_t end, std::vector<size_t>& selected) {
+    cvm::real norm2[kernel_block_size];
+    for (size_t b = begin; b < end; b += kernel_block_size) {
+      const size_t n = std::min(end - b, kernel_block_size);
+      kernelsNorm2(m_nlist_center, contiguous_kernel_index{b}, n, norm2);
+      for (size_t j = 0; j < n; ++j) {
+        if (norm2[j] <= nlist_cutoff2 && !m_kernels.removed(b + j)) {
+          selected.push_back(b + j);
+        }
       }
-      if (norm2_k <= m_nlist_param[0] * m_cutoff2) {
-        m_nlist_index.push_back(k);
+    }
+  };
+  std::vector<size_t> candidates;
+  std::vector<cvm::real> range(num_variables());
+  for (size_t i = 0; i < num_variables(); ++i) {
+    range[i] = cvm::sqrt(nlist_cutoff2) * m_max_sigma[i];
+  }
+  // Only the kernels near the center need to be checked
+  if (m_kernel_buckets.defined() &&
+      m_kernel_buckets.query(m_nlist_center, range, candidates)) {
+    cvm::real norm2[kernel_block_size];
+    for (size_t b = 0; b < candidates.size(); b += kernel_block_size) {
+      const size_t n = std::min(candidates.size() - b, kernel_block_size);
+      kernelsNorm2(m_nlist_center, listed_kernel_index{candidates.data() + b}, n, norm2);
+      for (size_t j = 0; j < n; ++j) {
+        if (norm2[j] <= nlist_cutoff2) {
+          m_nlist_index.push_back(candidates[b + j]);
+        }
       }
     }
+  } else if (m_num_threads == 1 || m_kernels.size() < 2 * m_num_threads) {
+    find_neighbors(0, m_kernels.size(), m_nlist_index);
   } else {
 #if defined (_OPENMP)
+    const int num_blocks = (m_kernels.size() + kernel_block_size - 1) / kernel_block_size;
     #pragma omp parallel num_threads(m_num_threads)
     {
       std::vector<size_t> private_nlist_index;
       #pragma omp for nowait
-      for (int k = 0; k < static_cast<int>(m_kernels.size()); ++k) {
-        cvm::real norm2_k = 0;
-        for (int i = 0; i < static_cast<int>(num_variables()); ++i) {
-          norm2_k += variables(i)->dist2(m_nlist_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-        }
-        if (norm2_k <= m_nlist_param[0] * m_cutoff2) {
-          private_nlist_index.push_back(static_cast<size_t>(k));
-        }
+      for (int b = 0; b < num_blocks; ++b) {
+        const size_t begin = b * kernel_block_size;
+        find_neighbors(begin, std::min(begin + kernel_block_size, m_kernels.size()), private_nlist_index);
       }
       #pragma omp critical
       m_nlist_index.insert(m_nlist_index.end(), private_nlist_index.begin(), private_nlist_index.end());
@@ -1931,15 +2058,7 @@ void colvarbias_opes::updateNlist(const std::vector<cvm::real>& center) {
     std::vector<std::vector<size_t>> private_nlist_index(m_num_threads);
     auto worker = [&](int start, int end, void* unused){
       const int tid = cvm::proxy->smp_thread_id();
-      for (int k = start; k <= end; ++k) {
-        cvm::real norm2_k = 0;
-        for (size_t i = 0; i < num_variables(); ++i) {
-          norm2_k += variables(i)->dist2(m_nlist_center[i], m_kernels[k].m_center[i]) / (m_kernels[k].m_sigma[i] * m_kernels[k].m_sigma[i]);
-        }
-        if (norm2_k <= m_nlist_param[0] * m_cutoff2) {
-          private_nlist_index[tid].push_back(k);
-        }
-      }
+      find_neighbors(start, end + 1, private_nlist_index[tid]);
     };
     const size_t numChunks = m_kernels.size();
     const size_t lowerRange = 0;
@@ -1948,24 +2067,27 @@ void colvarbias_opes::updateNlist(const std::vector<cvm::real>& center) {
       numChunks, lowerRange, upperRange,
       worker, NULL, CKLOOP_NONE, NULL);
     for (size_t j = 0; j < m_num_threads; ++j) {
-      m_nlist_index.insert(m_nlist_index.end(), private_nlist_index[i].begin(), private_nlist_index.end());
+      m_nlist_index.insert(m_nlist_index.end(), private_nlist_index[j].begin(), private_nlist_index[j].end());
     }
 #else
     cvm::error("OPES cannot run because this binary is not linked with a supported threading library.\n");
 #endif
-    if (m_recursive_merge) {
-      std::sort(m_nlist_index.begin(), m_nlist_index.end());
-    }
   }
+  // Keep the neighbor list sorted, to look up kernels when merging
+  std::sort(m_nlist_index.begin(), m_nlist_index.end());
   std::vector<cvm::real> dev2(num_variables(), 0);
   for (size_t k = 0; k < m_nlist_index.size(); ++k) {
     for (size_t i = 0; i < num_variables(); ++i) {
-      dev2[i] += variables(i)->dist2(m_nlist_center[i], m_kernels[m_nlist_index[k]].m_center[i]);
+      const cvm::real diff_i = cvDist(i, m_nlist_center[i], m_kernels.center(m_nlist_index[k], i));
+      dev2[i] += diff_i * diff_i;
     }
   }
   for (size_t i = 0; i < num_variables(); ++i) {
     if (m_nlist_index.empty()) {
-      m_nlist_dev2[i] = m_kernels.back().m_sigma[i] * m_kernels.back().m_sigma[i];
+      size_t last_k = m_kernels.size() - 1;
+      while (m_kernels.removed(last_k)) --last_k;
+      const cvm::real sigma_i = m_kernels.sigma(last_k, i);
+      m_nlist_dev2[i] = sigma_i * sigma_i;
     } else {
       m_nlist_dev2[i] = dev2[i] / m_nlist_index.size();
     }
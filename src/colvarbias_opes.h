@@ -23,9 +23,11 @@
 +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
 
 #include "colvarbias.h"
+#include "colvargrid.h"
 
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 // OPES_METAD implementation: swiped from OPESmetad.cpp of PLUMED
 class colvarbias_opes: public colvarbias {
@@ -40,6 +42,102 @@ public:
            const std::vector<cvm::real>& s):
       m_height(h), m_center(c), m_sigma(s) {}
   };
+  /// \brief Storage of many kernels as one flat array per dimension
+  /// (heights, centers and inverse widths), so that the loops over kernels
+  /// access contiguous memory and can be vectorized
+  class kernel_array {
+  public:
+    /// Remove all kernels and set the number of dimensions
+    void reset(size_t num_dims);
+    /// Number of slots, including those of removed kernels
+    size_t size() const { return m_height.size(); }
+    /// Number of kernels, excluding the removed ones
+    size_t count() const { return m_height.size() - m_num_removed; }
+    /// Whether there are no kernels
+    bool empty() const { return count() == 0; }
+    /// Remove all kernels
+    void clear();
+    /// Append a kernel, with the next unused identifier
+    void push_back(const kernel& G);
+    /// Append a kernel with the given identifier (larger than all others)
+    void push_back(const kernel& G, size_t id);
+    /// \brief Remove the k-th kernel, keeping the indices of the others: its
+    /// slot is kept with a zero height, so that sums over all slots are unchanged
+    void remove(size_t k);
+    /// Whether the k-th kernel was removed
+    bool removed(size_t k) const { return m_removed[k]; }
+    /// Number of removed kernels whose slots have not been reclaimed
+    size_t num_removed() const { return m_num_removed; }
+    /// \brief Reclaim the slots of the removed kernels; new_index is set to
+    /// the new index of each old slot (or to the number of slots if removed)
+    void compact(std::vector<size_t>& new_index);
+    /// Copy of the k-th kernel
+    kernel get(size_t k) const;
+    /// Replace the k-th kernel
+    void set(size_t k, const kernel& G);
+    /// Copy the center of the k-th kernel into x
+    void get_center(size_t k, std::vector<cvm::real>& x) const;
+    /// \brief Identifier of the k-th kernel: identifiers increase with k,
+    /// and are not changed by compact()
+    size_t id(size_t k) const { return m_id[k]; }
+    /// Index of the kernel with the given identifier (size() if not found)
+    size_t find(size_t id) const;
+    /// Whether to record the identifiers of added, replaced or removed kernels
+    void track_changes(bool flag) { m_track_changes = flag; }
+    /// \brief Move the identifiers of the kernels changed since the previous
+    /// call into ids (sorted, without duplicates)
+    void take_changes(std::vector<size_t>& ids);
+    cvm::real height(size_t k) const { return m_height[k]; }
+    cvm::real center(size_t k, size_t i) const { return m_center[i][k]; }
+    cvm::real sigma(size_t k, size_t i) const { return m_sigma[i][k]; }
+    const cvm::real *heights() const { return m_height.data(); }
+    const cvm::real *centers(size_t i) const { return m_center[i].data(); }
+    const cvm::real *inv_sigmas(size_t i) const { return m_inv_sigma[i].data(); }
+  private:
+    std::vector<cvm::real> m_height;
+    std::vector<std::vector<cvm::real>> m_center;
+    std::vector<std::vector<cvm::real>> m_sigma;
+    std::vector<std::vector<cvm::real>> m_inv_sigma;
+    std::vector<bool> m_removed;
+    size_t m_num_removed = 0;
+    std::vector<size_t> m_id;
+    size_t m_next_id = 0;
+    bool m_track_changes = false;
+    std::vector<size_t> m_changed;
+  };
+  /// \brief Spatial index of kernel centers: kernels are sorted into the
+  /// buckets of a regular grid in CV space (wrapped along periodic
+  /// variables), so that a query only visits the buckets near a point
+  class kernel_buckets {
+  public:
+    /// \brief Set the bucket widths and the periods (zero if not periodic)
+    /// of the variables, and remove all kernels
+    void reset(const std::vector<cvm::real>& widths, const std::vector<cvm::real>& periods);
+    /// Whether the buckets have been set up
+    bool defined() const { return !m_widths.empty(); }
+    /// Remove all kernels
+    void clear() { m_buckets.clear(); }
+    /// Add the k-th kernel, centered at x
+    void insert(size_t k, const std::vector<cvm::real>& x);
+    /// Remove the k-th kernel, centered at x
+    void remove(size_t k, const std::vector<cvm::real>& x);
+    /// \brief Append to candidates all kernels whose centers may be within
+    /// range[i] of x along each variable i (and possibly a few more); returns
+    /// false without doing so if the range spans more buckets than are
+    /// occupied, in which case a linear search over all kernels is cheaper
+    bool query(const std::vector<cvm::real>& x, const std::vector<cvm::real>& range,
+               std::vector<size_t>& candidates) const;
+  private:
+    /// Bucket containing x
+    colvar_grid_index bucket(const std::vector<cvm::real>& x) const;
+    struct bucket_hash {
+      size_t operator()(const colvar_grid_index& b) const;
+    };
+    std::vector<cvm::real> m_widths;
+    /// Number of buckets along each periodic variable (zero if not periodic)
+    std::vector<int> m_num_periodic_buckets;
+    std::unordered_map<colvar_grid_index, std::vector<size_t>, bucket_hash> m_buckets;
+  };
   /// Communication between different replicas
   enum Communication {
     /// One replica (default)
@@ -66,15 +164,43 @@ public:
 private:
   int update_opes();
   int calculate_opes();
-  void save_state();
+  int save_state();
+  /// \brief Add to result[0..num_values-1] the sums computed by
+  /// block_sum(b, block_result) over the blocks b = 0..num_blocks-1: blocks
+  /// are spread over the threads, and their sums combined in a fixed order,
+  /// so that the result does not depend on the number of threads
+  template <typename BlockSum>
+  void sumBlocks(size_t num_blocks, size_t num_values, const BlockSum& block_sum, cvm::real *result) const;
   cvm::real getProbAndDerivatives(const std::vector<cvm::real>& cv, std::vector<cvm::real>& der_prob) const;
   cvm::real evaluateKernel(const kernel& G, const std::vector<cvm::real>& x) const;
-  cvm::real evaluateKernel(const kernel& G, const std::vector<cvm::real>& x, std::vector<cvm::real>& accumulated_derivative, std::vector<cvm::real>& dist) const;
+  /// \brief Sum of the kernels begin..end-1 of m_kernels (or index[begin..end-1]
+  /// if index is not NULL) at x; if accumulated_derivative is not NULL, the
+  /// derivatives of the sum with respect to x are added to it
+  cvm::real evaluateKernels(const std::vector<cvm::real>& x, size_t begin, size_t end, const size_t *index = nullptr, cvm::real *accumulated_derivative = nullptr) const;
+  /// Same as evaluateKernels() over a block of n kernels of m_kernels
+  template <typename Index> cvm::real evaluateKernelBlock(const std::vector<cvm::real>& x, const Index& kernel_index, size_t n, cvm::real *accumulated_derivative) const;
+  /// Squared distances, in units of the widths, between x and n kernels of m_kernels
+  template <typename Index> void kernelsNorm2(const std::vector<cvm::real>& x, const Index& kernel_index, size_t n, cvm::real *norm2) const;
+  /// Displacement x - c along the i-th variable
+  cvm::real cvDist(size_t i, cvm::real x, cvm::real c) const;
   void addKernel(const double height, const std::vector<cvm::real>& center, const std::vector<cvm::real>& sigma, const double logweight);
   void addKernel(const double height, const std::vector<cvm::real>& center, const std::vector<cvm::real>& sigma);
   size_t getMergeableKernel(const std::vector<cvm::real>& giver_center, const size_t giver_k) const;
   void mergeKernels(kernel& k1, const kernel& k2) const;
   void updateNlist(const std::vector<cvm::real>& center);
+  /// Remove the k-th kernel from m_kernels, the spatial index and the neighbor list
+  void removeKernel(size_t k);
+  /// Reclaim the slots of removed kernels, renumbering the neighbor list
+  void compactKernels();
+  /// Set up the spatial index of the kernels (if used) and fill it
+  void setupKernelBuckets();
+  /// Update m_max_sigma with the widths of a new or modified kernel
+  void updateMaxSigma(const std::vector<cvm::real>& sigma);
+  /// \brief Append the kernels changed since the previous checkpoint to the
+  /// kernels journal, or rewrite it if needed
+  int writeKernelsJournal();
+  /// Replace all kernels with those in the first size bytes of a journal
+  int readKernelsJournal(const std::string& filename, size_t generation, size_t size);
   struct traj_line {
     double rct;
     double zed;
@@ -124,8 +250,17 @@ private:
   cvm::real m_val_at_cutoff;
   cvm::real m_rct;
   cvm::real m_neff;
-  std::vector<kernel> m_kernels;
+  kernel_array m_kernels;
   std::vector<kernel> m_delta_kernels;
+  /// Period of each variable, or zero if the variable is not periodic
+  std::vector<cvm::real> m_cv_period;
+  /// Whether the displacement along each variable must be computed by the
+  /// colvar itself (periodic scripted or custom functions)
+  std::vector<bool> m_cv_custom_dist;
+  /// Spatial index of the kernel centers, used to find mergeable kernels and neighbors
+  kernel_buckets m_kernel_buckets;
+  /// Upper bound of the widths of the kernels along each variable
+  std::vector<cvm::real> m_max_sigma;
   std::vector<cvm::real> m_av_cv;
   std::vector<cvm::real> m_av_M2;
   std::ostringstream m_kernels_output;
@@ -159,6 +294,15 @@ private:
   decltype(m_sum_weights) m_saved_sum_weights;
   decltype(m_sum_weights2) m_saved_sum_weights2;
   decltype(m_kernels) m_saved_kernels;
+  /// Whether the kernels are checkpointed in a binary journal, instead of
+  /// being copied into m_saved_kernels and written to the state file
+  bool m_kernels_journal;
+  /// Journal holding the kernels of the last checkpoint (empty if none yet)
+  std::string m_journal_filename;
+  /// Generation of the journal, incremented each time it is rewritten
+  size_t m_journal_generation;
+  /// Size in bytes of the journal at the last checkpoint
+  size_t m_journal_size;
   // PMF grid from reweighting
   bool m_pmf_grid_on;
   std::vector<colvar*> m_pmf_cvs;
@@ -1355,8 +1355,10 @@ int colvarbias_restraint_histogram::init(std::string const &conf)
   ref_p.resize(nbins_round);
   p_diff.resize(nbins_round);
 
+  std::vector<cvm::real> ref_p_values(ref_p.size(), 0.0);
   bool const inline_ref_p =
-    get_keyval(conf, "refHistogram", ref_p.data_array(), ref_p.data_array());
+    get_keyval(conf, "refHistogram", ref_p_values, ref_p_values);
+  ref_p = cvm::vector1d<cvm::real>(ref_p_values.size(), ref_p_values.data());
   std::string ref_p_file;
   get_keyval(conf, "refHistogramFile", ref_p_file, std::string(""));
   if (ref_p_file.size()) {
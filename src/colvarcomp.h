@@ -813,6 +813,10 @@ public:
   /// Workhorse function
   template<int flags> void main_loop(bool **pairlist_elem);
 
+  /// \brief Version of main_loop() over all pairs, split into tasks over
+  /// consecutive ranges of group1 atoms that may run on different threads
+  template<int flags> void main_loop_tasks(bool **pairlist_elem, int num_tasks);
+
 };
 
 
@@ -1344,15 +1348,11 @@ class colvar::customColvar
 protected:
     bool use_custom_function = false;
 #ifdef LEPTON
-    /// Vector of evaluators for custom functions using Lepton
-    std::vector<Lepton::CompiledExpression *> value_evaluators;
-    /// Vector of evaluators for gradients of custom functions
-    std::vector<Lepton::CompiledExpression *> gradient_evaluators;
-    /// Vector of references to cvc values to be passed to Lepton evaluators
-    std::vector<double *> value_eval_var_refs;
-    std::vector<double *> grad_eval_var_refs;
-    /// Unused value that is written to when a variable simplifies out of a Lepton expression
-    double dev_null = 0.0;
+    /// \brief Evaluator of the custom functions (first x.size() outputs)
+    /// followed by their derivatives
+    std::unique_ptr<colvar::lepton_evaluator> custom_function_evaluator;
+    /// Set the inputs used by the derivatives and compute all of them
+    void evaluate_derivatives();
 #endif
 public:
     customColvar();
@@ -176,9 +176,8 @@ int colvar::customColvar::init(std::string const &conf)
     std::string expr_in, expr;
     size_t pos = 0; // current position in config string
 #ifdef LEPTON
+    std::vector<std::string> exprs;
     std::vector<Lepton::ParsedExpression> pexprs;
-    Lepton::ParsedExpression pexpr;
-    double *ref;
 #endif
     if (key_lookup(conf, "customFunction", &expr_in, &pos)) {
 #ifdef LEPTON
@@ -189,56 +188,48 @@ int colvar::customColvar::init(std::string const &conf)
             if (cvm::debug())
                 cvm::log("Parsing expression \"" + expr + "\".\n");
             try {
-                pexpr = Lepton::Parser::parse(expr);
-                pexprs.push_back(pexpr);
+                pexprs.push_back(Lepton::Parser::parse(expr));
+                exprs.push_back(expr);
             } catch (...) {
                 return cvm::error("Error parsing expression \"" + expr + "\".\n", COLVARS_INPUT_ERROR);
             }
-            try {
-                value_evaluators.push_back(new Lepton::CompiledExpression(pexpr.createCompiledExpression()));
-                // Define variables for cvc values
-                for (size_t i = 0; i < cv.size(); ++i) {
-                    for (size_t j = 0; j < cv[i]->value().size(); ++j) {
-                        std::string vn = cv[i]->name + (cv[i]->value().size() > 1 ? cvm::to_str(j+1) : "");
-                        try {
-                            ref = &value_evaluators.back()->getVariableReference(vn);
-                        } catch (...) {
-                            ref = &dev_null;
-                            cvm::log("Warning: Variable " + vn + " is absent from expression \"" + expr + "\".\n");
-                        }
-                        value_eval_var_refs.push_back(ref);
-                    }
-                }
-            } catch (...) {
-                return cvm::error("Error compiling expression \"" + expr + "\".\n", COLVARS_INPUT_ERROR);
-            }
         } while (key_lookup(conf, "customFunction", &expr_in, &pos));
-        // Now define derivative with respect to each scalar sub-component
+        if (pexprs.size() == 0) {
+            return cvm::error("Error: no custom function defined.\n", COLVARS_INPUT_ERROR);
+        }
+        // Define variables for cvc values
+        std::vector<std::string> variable_names;
         for (size_t i = 0; i < cv.size(); ++i) {
             for (size_t j = 0; j < cv[i]->value().size(); ++j) {
-                std::string vn = cv[i]->name + (cv[i]->value().size() > 1 ? cvm::to_str(j+1) : "");
-                for (size_t c = 0; c < pexprs.size(); ++c) {
-                    gradient_evaluators.push_back(new Lepton::CompiledExpression(pexprs[c].differentiate(vn).createCompiledExpression()));
-                    for (size_t k = 0; k < cv.size(); ++k) {
-                        for (size_t l = 0; l < cv[k]->value().size(); l++) {
-                            std::string vvn = cv[k]->name + (cv[k]->value().size() > 1 ? cvm::to_str(l+1) : "");
-                            try {
-                                ref = &gradient_evaluators.back()->getVariableReference(vvn);
-                            } catch (...) {
-                                cvm::log("Warning: Variable " + vvn + " is absent from derivative of \"" + expr + "\" wrt " + vn + ".\n");
-                                ref = &dev_null;
-                            }
-                            grad_eval_var_refs.push_back(ref);
-                        }
-                    }
+                variable_names.push_back(cv[i]->name + (cv[i]->value().size() > 1 ? cvm::to_str(j+1) : ""));
+            }
+        }
+        custom_function_evaluator.reset(new colvar::lepton_evaluator(variable_names));
+        for (size_t c = 0; c < pexprs.size(); ++c) {
+            try {
+                custom_function_evaluator->add_expression(pexprs[c]);
+            } catch (...) {
+                return cvm::error("Error compiling expression \"" + exprs[c] + "\".\n", COLVARS_INPUT_ERROR);
+            }
+            for (size_t v = 0; v < variable_names.size(); ++v) {
+                if (!custom_function_evaluator->uses_input(c, v)) {
+                    cvm::log("Warning: Variable " + variable_names[v] + " is absent from expression \"" + exprs[c] + "\".\n");
                 }
             }
         }
-        if (value_evaluators.size() == 0) {
-            return cvm::error("Error: no custom function defined.\n", COLVARS_INPUT_ERROR);
+        // Now define derivative with respect to each scalar sub-component
+        for (size_t v = 0; v < variable_names.size(); ++v) {
+            for (size_t c = 0; c < pexprs.size(); ++c) {
+                try {
+                    custom_function_evaluator->add_expression(pexprs[c].differentiate(variable_names[v]));
+                } catch (...) {
+                    return cvm::error("Error compiling derivative of expression \"" + exprs[c] + "\" wrt " + variable_names[v] + ".\n", COLVARS_INPUT_ERROR);
+                }
+            }
         }
-        if (value_evaluators.size() != 1) {
+        if (pexprs.size() != 1) {
             x.type(colvarvalue::type_vector);
+            x.vector1d_value.resize(pexprs.size());
         } else {
             x.type(colvarvalue::type_scalar);
         }
@@ -257,14 +248,6 @@ int colvar::customColvar::init(std::string const &conf)
 }
 
 colvar::customColvar::~customColvar() {
-#ifdef LEPTON
-    for (size_t i = 0; i < value_evaluators.size(); ++i) {
-        if (value_evaluators[i] != nullptr) delete value_evaluators[i];
-    }
-    for (size_t i = 0; i < gradient_evaluators.size(); ++i) {
-        if (gradient_evaluators[i] != nullptr) delete gradient_evaluators[i];
-    }
-#endif
 }
 
 void colvar::customColvar::calc_value() {
@@ -277,18 +260,20 @@ void colvar::customColvar::calc_value() {
         }
         x.reset();
         size_t l = 0;
-        for (size_t i = 0; i < x.size(); ++i) {
-            for (size_t i_cv = 0; i_cv < cv.size(); ++i_cv) {
-                const colvarvalue& current_cv_value = cv[i_cv]->value();
-                for (size_t j_elem = 0; j_elem < current_cv_value.size(); ++j_elem) {
-                    if (current_cv_value.type() == colvarvalue::type_scalar) {
-                        *(value_eval_var_refs[l++]) = cv[i_cv]->sup_coeff * (cvm::pow(current_cv_value.real_value, cv[i_cv]->sup_np));
-                    } else {
-                        *(value_eval_var_refs[l++]) = cv[i_cv]->sup_coeff * current_cv_value[j_elem];
-                    }
+        for (size_t i_cv = 0; i_cv < cv.size(); ++i_cv) {
+            const colvarvalue& current_cv_value = cv[i_cv]->value();
+            for (size_t j_elem = 0; j_elem < current_cv_value.size(); ++j_elem) {
+                if (current_cv_value.type() == colvarvalue::type_scalar) {
+                    custom_function_evaluator->input(l++) = cv[i_cv]->sup_coeff * (cvm::pow(current_cv_value.real_value, cv[i_cv]->sup_np));
+                } else {
+                    custom_function_evaluator->input(l++) = cv[i_cv]->sup_coeff * current_cv_value[j_elem];
                 }
             }
-            x[i] = value_evaluators[i]->evaluate();
+        }
+        // Only the values are needed here, not the derivatives
+        custom_function_evaluator->evaluate(x.size());
+        for (size_t i = 0; i < x.size(); ++i) {
+            x[i] = custom_function_evaluator->output(i);
         }
 #else
         cvm::error("customFunction requires the Lepton library, but it is not enabled during compilation.\n"
@@ -298,13 +283,27 @@ void colvar::customColvar::calc_value() {
     }
 }
 
+#ifdef LEPTON
+void colvar::customColvar::evaluate_derivatives() {
+    // All derivatives are evaluated at once, feeding the same values to each
+    size_t r = 0;
+    for (size_t k = 0; k < cv.size(); ++k) {
+        const cvm::real factor_polynomial_k = getPolynomialFactorOfCVGradient(k);
+        for (size_t l = 0; l < cv[k]->value().size(); ++l) {
+            custom_function_evaluator->input(r++) = factor_polynomial_k * cv[k]->value()[l];
+        }
+    }
+    custom_function_evaluator->evaluate();
+}
+#endif
+
 void colvar::customColvar::calc_gradients() {
     if (!use_custom_function) {
         colvar::linearCombination::calc_gradients();
     } else {
 #ifdef LEPTON
-        size_t r = 0; // index in the vector of variable references
-        size_t e = 0; // index of the gradient evaluator
+        evaluate_derivatives();
+        size_t e = x.size(); // index of the derivative among the evaluator outputs
         for (size_t i_cv = 0; i_cv < cv.size(); ++i_cv) { // for each CV
             cv[i_cv]->calc_gradients();
             if (cv[i_cv]->is_enabled(f_cvc_explicit_gradient)) {
@@ -312,13 +311,7 @@ void colvar::customColvar::calc_gradients() {
                 const cvm::real factor_polynomial = getPolynomialFactorOfCVGradient(i_cv);
                 for (size_t j_elem = 0; j_elem < current_cv_value.size(); ++j_elem) { // for each element in this CV
                     for (size_t c = 0; c < x.size(); ++c) { // for each custom function expression
-                        for (size_t k = 0; k < cv.size(); ++k) { // this is required since we need to feed all CV values to this expression
-                            const cvm::real factor_polynomial_k = getPolynomialFactorOfCVGradient(k);
-                            for (size_t l = 0; l < cv[k]->value().size(); ++l) {
-                                *(grad_eval_var_refs[r++]) = factor_polynomial_k * cv[k]->value()[l];
-                            }
-                        }
-                        const double expr_grad = gradient_evaluators[e++]->evaluate();
+                        const double expr_grad = custom_function_evaluator->output(e++);
                         for (size_t k_ag = 0 ; k_ag < cv[i_cv]->atom_groups.size(); ++k_ag) {
                             for (size_t l_atom = 0; l_atom < (cv[i_cv]->atom_groups)[k_ag]->size(); ++l_atom) {
                                 (*(cv[i_cv]->atom_groups)[k_ag])[l_atom].grad = expr_grad * factor_polynomial * (*(cv[i_cv]->atom_groups)[k_ag])[l_atom].grad;
@@ -326,6 +319,9 @@ void colvar::customColvar::calc_gradients() {
                         }
                     }
                 }
+            } else {
+                // Skip the derivatives with respect to this CV, as apply_force() does
+                e += cv[i_cv]->value().size() * x.size();
             }
         }
 #else
@@ -341,8 +337,8 @@ void colvar::customColvar::apply_force(colvarvalue const &force) {
         colvar::linearCombination::apply_force(force);
     } else {
 #ifdef LEPTON
-        size_t r = 0; // index in the vector of variable references
-        size_t e = 0; // index of the gradient evaluator
+        evaluate_derivatives();
+        size_t e = x.size(); // index of the derivative among the evaluator outputs
         for (size_t i_cv = 0; i_cv < cv.size(); ++i_cv) {
             // If this CV us explicit gradients, then atomic gradients is already calculated
             // We can apply the force to atom groups directly
@@ -350,6 +346,8 @@ void colvar::customColvar::apply_force(colvarvalue const &force) {
                 for (size_t k_ag = 0 ; k_ag < cv[i_cv]->atom_groups.size(); ++k_ag) {
                     (cv[i_cv]->atom_groups)[k_ag]->apply_colvar_force(force.real_value);
                 }
+                // Skip the derivatives with respect to this CV
+                e += cv[i_cv]->value().size() * x.size();
             } else {
                 const colvarvalue& current_cv_value = cv[i_cv]->value();
                 colvarvalue cv_force(current_cv_value);
@@ -357,13 +355,7 @@ void colvar::customColvar::apply_force(colvarvalue const &force) {
                 const cvm::real factor_polynomial = getPolynomialFactorOfCVGradient(i_cv);
                 for (size_t j_elem = 0; j_elem < current_cv_value.size(); ++j_elem) {
                     for (size_t c = 0; c < x.size(); ++c) {
-                        for (size_t k = 0; k < cv.size(); ++k) {
-                            const cvm::real factor_polynomial_k = getPolynomialFactorOfCVGradient(k);
-                            for (size_t l = 0; l < cv[k]->value().size(); ++l) {
-                                *(grad_eval_var_refs[r++]) = factor_polynomial_k * cv[k]->value()[l];
-                            }
-                        }
-                        cv_force[j_elem] += factor_polynomial * gradient_evaluators[e++]->evaluate() * force.real_value;
+                        cv_force[j_elem] += factor_polynomial * custom_function_evaluator->output(e++) * force.real_value;
                     }
                 }
                 cv[i_cv]->apply_force(cv_force);
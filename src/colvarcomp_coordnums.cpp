@@ -7,8 +7,11 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <algorithm>
+
 #include "colvarmodule.h"
 #include "colvaratoms.h"
+#include "colvarproxy.h"
 #include "colvarvalue.h"
 #include "colvar.h"
 #include "colvarcomp.h"
@@ -207,6 +210,17 @@ template<int flags> void colvar::coordnum::main_loop(bool **pairlist_elem)
       group2->set_weighted_gradient(group2_com_atom.grad);
     }
   } else {
+    // Split large loops into tasks; their number depends only on the number
+    // of pairs, so that the result is the same with any number of threads
+    size_t const num_pairs = group1->size() * group2->size();
+    size_t const min_pairs_per_task = 16384;
+    int const num_tasks = static_cast<int>(std::min(std::min(num_pairs / min_pairs_per_task,
+                                                             size_t(16)),
+                                                    group1->size()));
+    if (num_tasks > 1) {
+      main_loop_tasks<flags>(pairlist_elem, num_tasks);
+      return;
+    }
     for (cvm::atom_iter ai1 = group1->begin(); ai1 != group1->end(); ai1++) {
       for (cvm::atom_iter ai2 = group2->begin(); ai2 != group2->end(); ai2++) {
         x.real_value += switching_function<flags>(r0, r0_vec, en, ed,
@@ -219,6 +233,54 @@ template<int flags> void colvar::coordnum::main_loop(bool **pairlist_elem)
 }
 
 
+template<int flags> void colvar::coordnum::main_loop_tasks(bool **pairlist_elem,
+                                                           int num_tasks)
+{
+  size_t const n1 = group1->size();
+  size_t const n2 = group2->size();
+  bool *const pairlist_start = pairlist_elem ? *pairlist_elem : NULL;
+
+  // Each task accumulates the gradients of its group1 atoms directly, and
+  // those of group2 in its own buffer
+  std::vector<cvm::real> sums(num_tasks, 0.0);
+  std::vector<cvm::rvector> group2_grads((flags & ef_gradients) ? num_tasks * n2 : 0,
+                                         cvm::rvector(0.0));
+
+  cvm::main()->proxy->smp_subtasks(num_tasks, [&](int t) {
+    size_t const first = (n1 * t) / num_tasks;
+    size_t const last = (n1 * (t + 1)) / num_tasks;
+    bool *elem = pairlist_start ? pairlist_start + first * n2 : NULL;
+    bool **elem_ptr = pairlist_start ? &elem : NULL;
+    cvm::atom a2;
+    cvm::real sum = 0.0;
+    for (size_t i1 = first; i1 < last; i1++) {
+      cvm::atom &a1 = (*group1)[i1];
+      for (size_t i2 = 0; i2 < n2; i2++) {
+        a2.pos = (*group2)[i2].pos;
+        a2.grad = cvm::rvector(0.0);
+        sum += switching_function<flags>(r0, r0_vec, en, ed, a1, a2, elem_ptr, tolerance);
+        if (flags & ef_gradients) {
+          group2_grads[t * n2 + i2] += a2.grad;
+        }
+      }
+    }
+    sums[t] = sum;
+  });
+
+  for (int t = 0; t < num_tasks; t++) {
+    x.real_value += sums[t];
+    if (flags & ef_gradients) {
+      for (size_t i2 = 0; i2 < n2; i2++) {
+        (*group2)[i2].grad += group2_grads[t * n2 + i2];
+      }
+    }
+  }
+  if (pairlist_elem) {
+    *pairlist_elem = pairlist_start + n1 * n2;
+  }
+}
+
+
 template<int compute_flags> int colvar::coordnum::compute_coordnum()
 {
   bool const use_pairlist = (pairlist != NULL);
@@ -145,6 +145,12 @@ int colvar::neuralNetwork::init(std::string const &conf)
             return cvm::error("Error: error on adding a new dense layer.\n", COLVARS_INPUT_ERROR);
         }
     }
+    if ((nn->getNumberOfLayers() == 0) ||
+        (m_output_index >= nn->getLayer(nn->getNumberOfLayers() - 1).getOutputSize())) {
+        return cvm::error("Error: output_component " + cvm::to_str(m_output_index) +
+                          " is out of range for the last layer of the network.\n",
+                          COLVARS_INPUT_ERROR);
+    }
     nn->input().resize(cv.size());
     return error_code;
 }
@@ -165,7 +171,8 @@ void colvar::neuralNetwork::calc_value() {
             return;
         }
     }
-    nn->compute();
+    // only the gradient of the selected output is needed
+    nn->compute(m_output_index);
     x = nn->getOutput(m_output_index);
 }
 
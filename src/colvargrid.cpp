@@ -7,7 +7,12 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <atomic>
+#include <complex>
+#include <cstring>
 #include <ctime>
+#include <iostream>
+#include <thread>
 
 #include "colvarmodule.h"
 #include "colvarvalue.h"
@@ -18,6 +23,42 @@
 
 
 
+bool colvar_grid_binary_format::detect(char const *buffer, size_t size)
+{
+  return (size >= magic_size) && (std::memcmp(buffer, magic(), magic_size) == 0);
+}
+
+
+bool colvar_grid_binary_format::detect(std::istream &is)
+{
+  char buffer[magic_size];
+  auto const pos = is.tellg();
+  is.read(buffer, magic_size);
+  bool const result = (is.gcount() == std::streamsize(magic_size)) &&
+    detect(buffer, magic_size);
+  is.clear();
+  is.seekg(pos);
+  return result;
+}
+
+
+// The binary I/O and replica functions are not wrapped by the derived classes:
+// instantiate them here for the grid types in use
+#define COLVARS_INSTANTIATE_GRID_FUNCTIONS(T)                                  \
+  template std::ostream &colvar_grid<T>::write_binary(std::ostream &) const;   \
+  template int colvar_grid<T>::write_binary(std::string const &,               \
+                                            std::string) const;                \
+  template int colvar_grid<T>::read_binary(char const *, size_t, bool);       \
+  template int colvar_grid<T>::read_binary(std::string const &, std::string,   \
+                                           bool);                              \
+  template int colvar_grid<T>::write_file(std::string const &,                 \
+                                          std::string) const;                  \
+  template int colvar_grid<T>::replicas_sum(colvar_grid<T> const &);
+
+COLVARS_INSTANTIATE_GRID_FUNCTIONS(size_t)
+COLVARS_INSTANTIATE_GRID_FUNCTIONS(cvm::real)
+
+
 colvar_grid_count::colvar_grid_count()
   : colvar_grid<size_t>()
 {
@@ -526,7 +567,7 @@ void colvar_grid_gradient::write_1D_integral(std::ostream &os)
     corr = 0.0;
   }
 
-  for (std::vector<int> ix = new_index(); index_ok(ix); incr(ix)) {
+  for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix)) {
 
     if (samples) {
       size_t const samples_here = samples->value(ix);
@@ -574,11 +615,11 @@ cvm::real colvar_grid_gradient::grid_rmsd(colvar_grid_gradient const &other_grid
   }
 
   cvm::real sum2 = 0.0;
-  std::vector<int> ix;
-  size_t imult;
-  for (ix = new_index(); index_ok(ix); incr(ix)) {
+  size_t const np = nt / mult;
+  size_t ip, imult;
+  for (ip = 0; ip < np; ip++) {
     for (imult = 0; imult < this->multiplicity(); imult++) {
-      cvm::real d = this->value_output(ix, imult) - other_grid.value_output(ix, imult);
+      cvm::real d = this->value_output_flat(ip, imult) - other_grid.value_output_flat(ip, imult);
       sum2 += d*d;
     }
   }
@@ -589,11 +630,16 @@ cvm::real colvar_grid_gradient::grid_rmsd(colvar_grid_gradient const &other_grid
 integrate_potential::integrate_potential(std::vector<colvar *> &colvars, std::shared_ptr<colvar_grid_gradient> gradients)
   : colvar_grid_scalar(colvars, true),
     b_smoothed(false),
-    gradients(gradients)
+    gradients(gradients),
+    solver(conjugate_gradient),
+    use_threads(false)
 {
   // parent class colvar_grid_scalar is constructed with margin option set to true
   // hence PMF grid is wider than gradient grid if non-PBC
 
+  // The Poisson solver operates on a contiguous array
+  data.set_sparse(false);
+
   if (nd > 1) {
     cvm::main()->cite_feature("Poisson integration of 2D/3D free energy surfaces");
     divergence.resize(nt);
@@ -619,7 +665,9 @@ integrate_potential::integrate_potential(std::vector<colvar *> &colvars, std::sh
 
 integrate_potential::integrate_potential(std::shared_ptr<colvar_grid_gradient> gradients)
   : b_smoothed(false),
-    gradients(gradients)
+    gradients(gradients),
+    solver(conjugate_gradient),
+    use_threads(false)
 {
   nd = gradients->num_variables();
   nx = gradients->number_of_points_vec();
@@ -641,10 +689,36 @@ integrate_potential::integrate_potential(std::shared_ptr<colvar_grid_gradient> g
 }
 
 
+struct integrate_potential::async_integration {
+  std::thread thread;
+  std::atomic<bool> done{false};
+  std::vector<cvm::real> rhs, sol;
+  int iter = 0;
+  cvm::real err = 0.0;
+};
+
+
+integrate_potential::~integrate_potential()
+{
+  if (async_job && async_job->thread.joinable()) {
+    async_job->thread.join();
+  }
+}
+
+
 int integrate_potential::integrate(const int itmax, const cvm::real &tol, cvm::real & err, bool verbose)
 {
   int iter = 0;
 
+  if (async_job) {
+    // Start from the result of the pending asynchronous integration
+    integrate_async_collect(true, iter, err);
+    iter = 0;
+  }
+
+  // Use threads only for grids large enough to offset their overhead
+  use_threads = (nt >= 4096) && (cvm::proxy->check_smp_enabled() == COLVARS_OK);
+
   if (nd == 1) {
 
     cvm::real sum = 0.0;
@@ -654,7 +728,7 @@ int integrate_potential::integrate(const int itmax, const cvm::real &tol, cvm::r
     } else {
       corr = 0.0;
     }
-    std::vector<int> ix;
+    colvar_grid_index ix;
     // Iterate over valid indices in gradient grid
     for (ix = new_index(); gradients->index_ok(ix); incr(ix)) {
       set_value(ix, sum);
@@ -669,9 +743,19 @@ int integrate_potential::integrate(const int itmax, const cvm::real &tol, cvm::r
 
   } else if (nd <= 3) {
 
-    nr_linbcg_sym(divergence, data, tol, itmax, iter, err);
-    if (verbose)
-      cvm::log("Integrated in " + cvm::to_str(iter) + " steps, error: " + cvm::to_str(err));
+    if (solver == fft) {
+      err = fft_solve(divergence, data.dense_vector());
+      iter = 1;
+      if (verbose)
+        cvm::log("Integrated by FFT, error: " + cvm::to_str(err));
+    } else {
+      if ((solver == multigrid) && mg_levels.empty()) {
+        setup_multigrid();
+      }
+      nr_linbcg_sym(divergence, data.dense_vector(), tol, itmax, iter, err);
+      if (verbose)
+        cvm::log("Integrated in " + cvm::to_str(iter) + " steps, error: " + cvm::to_str(err));
+    }
 
   } else {
     cvm::error("Cannot integrate PMF in dimension > 3\n");
@@ -681,18 +765,75 @@ int integrate_potential::integrate(const int itmax, const cvm::real &tol, cvm::r
 }
 
 
+int integrate_potential::integrate_async(const int itmax, const cvm::real &tol)
+{
+  if (async_job) {
+    return cvm::error("Error: an asynchronous integration is already in progress.\n",
+                      COLVARS_BUG_ERROR);
+  }
+  if ((nd == 1) || (nd > 3)) {
+    cvm::real err;
+    integrate(itmax, tol, err, false);
+    return cvm::get_error();
+  }
+
+  if ((solver == multigrid) && mg_levels.empty()) {
+    setup_multigrid();
+  }
+  // The helper thread runs alongside the MD engine: do not spawn more threads
+  use_threads = false;
+
+  async_job.reset(new async_integration);
+  async_integration *job = async_job.get();
+  job->rhs = divergence;
+  job->sol = data.dense_vector();
+  try {
+    job->thread = std::thread([this, job, itmax, tol]() {
+      if (solver == fft) {
+        job->err = fft_solve(job->rhs, job->sol);
+        job->iter = 1;
+      } else {
+        nr_linbcg_sym(job->rhs, job->sol, tol, itmax, job->iter, job->err);
+      }
+      job->done = true;
+    });
+  } catch (std::system_error const &) {
+    // Threads are not available: integrate now
+    async_job.reset();
+    cvm::real err;
+    integrate(itmax, tol, err, false);
+  }
+  return cvm::get_error();
+}
+
+
+bool integrate_potential::integrate_async_collect(bool wait, int &iter, cvm::real &err)
+{
+  if (!async_job || (!wait && !async_job->done)) {
+    return false;
+  }
+  async_job->thread.join();
+  data.dense_vector().swap(async_job->sol);
+  iter = async_job->iter;
+  err = async_job->err;
+  async_job.reset();
+  has_data = true;
+  return true;
+}
+
+
 void integrate_potential::set_div()
 {
   if (nd == 1) return;
-  for (std::vector<int> ix = new_index(); index_ok(ix); incr(ix)) {
+  for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix)) {
     update_div_local(ix);
   }
 }
 
 
-void integrate_potential::update_div_neighbors(const std::vector<int> &ix0)
+void integrate_potential::update_div_neighbors(colvar_grid_index const &ix0)
 {
-  std::vector<int> ix(ix0);
+  colvar_grid_index ix(ix0);
   int i, j, k;
 
   // If not periodic, expanded grid ensures that upper neighbors of ix0 are valid grid points
@@ -728,7 +869,7 @@ void integrate_potential::update_div_neighbors(const std::vector<int> &ix0)
 }
 
 
-void integrate_potential::get_grad(cvm::real * g, std::vector<int> &ix)
+void integrate_potential::get_grad(cvm::real * g, colvar_grid_index &ix)
 {
   size_t i;
   bool edge = gradients->wrap_detect_edge(ix); // Detect edge if non-PBC
@@ -744,11 +885,11 @@ void integrate_potential::get_grad(cvm::real * g, std::vector<int> &ix)
 }
 
 
-void integrate_potential::update_div_local(const std::vector<int> &ix0)
+void integrate_potential::update_div_local(colvar_grid_index const &ix0)
 {
   const size_t linear_index = address(ix0);
   int i, j, k;
-  std::vector<int> ix = ix0;
+  colvar_grid_index ix = ix0;
 
   if (nd == 2) {
     // gradients at grid points surrounding the current scalar grid point
@@ -822,23 +963,25 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
     // with the y (and z) contributions
 
 
-    // All x components except on x edges
-    index = h; // Skip first column
+    // All x components except on x edges (skip first column)
 
     // Halve the term on y edges (if any) to preserve symmetry of the Laplacian matrix
     // (Long Chen, Finite Difference Methods, UCI, 2017)
     fact = periodic[1] ? 1.0 : 0.5;
 
-    for (i=1; i<w-1; i++) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (int ip=1; ip<w-1; ip++) {
       // Full range of j, but factor may change on y edges (j == 0 and j == h-1)
-      LA[index] = fact * ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-      index++;
-      for (j=1; j<h-1; j++) {
-        LA[index] = ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-        index++;
+      size_t ind = h * static_cast<size_t>(ip);
+      LA[ind] = fact * ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
+      ind++;
+      for (int jp=1; jp<h-1; jp++) {
+        LA[ind] = ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
+        ind++;
       }
-      LA[index] = fact * ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-      index++;
+      LA[ind] = fact * ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
     }
     // Edges along x (x components only)
     index = 0L; // Follows left edge
@@ -881,19 +1024,19 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
     }
 
     // Now adding all y components
-    // All y components except on y edges
-    index = 1; // Skip first element (in first row)
+    // All y components except on y edges (skip first element in each row)
 
-    fact = periodic[0] ? 1.0 : 0.5; // for i == 0
-    for (i=0; i<w; i++) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (int ip=0; ip<w; ip++) {
       // Factor of 1/2 on x edges if non-periodic
-      if (i == 1) fact = 1.0;
-      if (i == w - 1) fact = periodic[0] ? 1.0 : 0.5;
-      for (j=1; j<h-1; j++) {
-        LA[index] += fact * ffy * (A[index + ym] + A[index + yp] - 2.0 * A[index]);
-        index++;
+      cvm::real const fact_i = ((ip == 0 || ip == w - 1) && !periodic[0]) ? 0.5 : 1.0;
+      size_t ind = h * static_cast<size_t>(ip) + 1;
+      for (int jp=1; jp<h-1; jp++) {
+        LA[ind] += fact_i * ffy * (A[ind + ym] + A[ind + yp] - 2.0 * A[ind]);
+        ind++;
       }
-      index += 2; // skip the edges and move to next column
     }
     // Edges along y (y components only)
     index = 0L; // Follows bottom edge
@@ -962,23 +1105,21 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
     cvm::real ifacty = 1 / facty;
     cvm::real ifactz = 1 / factz;
 
-    // All x components except on x edges
-    index = d * static_cast<size_t>(h); // Skip left slab
-    fact = facty * factz;
-    for (i=1; i<w-1; i++) {
-      for (j=0; j<d; j++) { // full range of y
-        if (j == 1) fact *= ifacty;
-        if (j == d-1) fact *= facty;
-        LA[index] = fact * ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-        index++;
-        fact *= ifactz;
-        for (k=1; k<h-1; k++) { // full range of z
-          LA[index] = fact * ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-          index++;
+    // All x components except on x edges (skip left slab)
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (int ip=1; ip<w-1; ip++) {
+      for (int jp=0; jp<d; jp++) { // full range of y
+        cvm::real const fact_j = (jp == 0 || jp == d-1) ? facty : 1.0;
+        size_t ind = (static_cast<size_t>(ip) * d + jp) * h;
+        LA[ind] = fact_j * factz * ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
+        ind++;
+        for (int kp=1; kp<h-1; kp++) { // full range of z
+          LA[ind] = fact_j * ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
+          ind++;
         }
-        fact *= factz;
-        LA[index] = fact * ffx * (A[index + xm] + A[index + xp] - 2.0 * A[index]);
-        index++;
+        LA[ind] = fact_j * factz * ffx * (A[ind + xm] + A[ind + xp] - 2.0 * A[ind]);
       }
     }
     // Edges along x (x components only)
@@ -1036,25 +1177,23 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
     }
 
     // Now adding all y components
-    // All y components except on y edges
-    index = h; // Skip first column (in front slab)
-    fact = factx * factz;
-    for (i=0; i<w; i++) { // full range of x
-      if (i == 1) fact *= ifactx;
-      if (i == w-1) fact *= factx;
-      for (j=1; j<d-1; j++) {
-        LA[index] += fact * ffy * (A[index + ym] + A[index + yp] - 2.0 * A[index]);
-        index++;
-        fact *= ifactz;
-        for (k=1; k<h-1; k++) {
-          LA[index] += fact * ffy * (A[index + ym] + A[index + yp] - 2.0 * A[index]);
-          index++;
+    // All y components except on y edges (skip first column in front slab)
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (int ip=0; ip<w; ip++) { // full range of x
+      cvm::real const fact_i = (ip == 0 || ip == w-1) ? factx : 1.0;
+      size_t ind = static_cast<size_t>(ip) * d * h + h;
+      for (int jp=1; jp<d-1; jp++) {
+        LA[ind] += fact_i * factz * ffy * (A[ind + ym] + A[ind + yp] - 2.0 * A[ind]);
+        ind++;
+        for (int kp=1; kp<h-1; kp++) {
+          LA[ind] += fact_i * ffy * (A[ind + ym] + A[ind + yp] - 2.0 * A[ind]);
+          ind++;
         }
-        fact *= factz;
-        LA[index] += fact * ffy * (A[index + ym] + A[index + yp] - 2.0 * A[index]);
-        index++;
+        LA[ind] += fact_i * factz * ffy * (A[ind + ym] + A[ind + yp] - 2.0 * A[ind]);
+        ind++;
       }
-      index += 2 * h; // skip columns in front and back slabs
     }
     // Edges along y (y components only)
     index = 0L; // Follows front slab
@@ -1115,31 +1254,20 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
     }
 
   // Now adding all z components
-    // All z components except on z edges
-    index = 1; // Skip first element (in bottom slab)
-    fact = factx * facty;
-    for (i=0; i<w; i++) { // full range of x
-      if (i == 1) fact *= ifactx;
-      if (i == w-1) fact *= factx;
-      for (k=1; k<h-1; k++) {
-        LA[index] += fact * ffz * (A[index + zm] + A[index + zp] - 2.0 * A[index]);
-        index++;
-      }
-      fact *= ifacty;
-      index += 2; // skip edge slabs
-      for (j=1; j<d-1; j++) { // full range of y
-        for (k=1; k<h-1; k++) {
-          LA[index] += fact * ffz * (A[index + zm] + A[index + zp] - 2.0 * A[index]);
-          index++;
+    // All z components except on z edges (skip first element in each column)
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (int ip=0; ip<w; ip++) { // full range of x
+      cvm::real const fact_i = (ip == 0 || ip == w-1) ? factx : 1.0;
+      for (int jp=0; jp<d; jp++) { // full range of y
+        cvm::real const fact_ij = (jp == 0 || jp == d-1) ? fact_i * facty : fact_i;
+        size_t ind = (static_cast<size_t>(ip) * d + jp) * h + 1;
+        for (int kp=1; kp<h-1; kp++) {
+          LA[ind] += fact_ij * ffz * (A[ind + zm] + A[ind + zp] - 2.0 * A[ind]);
+          ind++;
         }
-        index += 2; // skip edge slabs
-      }
-      fact *= facty;
-      for (k=1; k<h-1; k++) {
-        LA[index] += fact * ffz * (A[index + zm] + A[index + zp] - 2.0 * A[index]);
-        index++;
       }
-      index += 2; // skip edge slabs
     }
     // Edges along z (z components onlz)
     index = 0; // Follows bottom slab
@@ -1198,15 +1326,378 @@ void integrate_potential::atimes(const std::vector<cvm::real> &A, std::vector<cv
 }
 
 
-/*
-/// Inversion of preconditioner matrix (e.g. diagonal of the Laplacian)
+int integrate_potential::parse_solver(std::string const &name, solver_type &s)
+{
+  std::string const name_lc = colvarparse::to_lower_cppstr(name);
+  if (name_lc == "cg") {
+    s = conjugate_gradient;
+  } else if (name_lc == "multigrid") {
+    s = multigrid;
+  } else if (name_lc == "fft") {
+    s = fft;
+  } else {
+    return cvm::error("Error: invalid Poisson solver \"" + name +
+                      "\"; valid choices are cg, multigrid and fft.\n", COLVARS_INPUT_ERROR);
+  }
+  return COLVARS_OK;
+}
+
+
+int integrate_potential::set_solver(solver_type s)
+{
+  if (s == fft) {
+    for (size_t i = 0; i < nd; i++) {
+      if (!periodic[i]) {
+        return cvm::error("Error: the FFT Poisson solver requires all variables to be "
+                          "periodic.\n", COLVARS_INPUT_ERROR);
+      }
+    }
+  }
+  solver = s;
+  return COLVARS_OK;
+}
+
+
+void integrate_potential::setup_multigrid()
+{
+  mg_levels.clear();
+  mg_levels.resize(1);
+
+  // The operator of the finest level reproduces atimes() (with the opposite sign):
+  // links along dimension d have weight 1/widths[d]^2, halved for each other
+  // dimension along which the point lies on a non-periodic edge
+  {
+    multigrid_level &level = mg_levels[0];
+    level.nx = nx;
+    level.periodic = periodic;
+    level.weights.assign(nd, std::vector<cvm::real>(nt, 0.0));
+    std::vector<int> ix(nd, 0);
+    for (size_t p = 0; p < size_t(nt); p++) {
+      cvm::real edge_factor = 1.0;
+      for (size_t e = 0; e < nd; e++) {
+        if (!periodic[e] && (ix[e] == 0 || ix[e] == nx[e] - 1)) edge_factor *= 0.5;
+      }
+      for (size_t d = 0; d < nd; d++) {
+        if (nx[d] < 2) continue;
+        if (!periodic[d] && (ix[d] == nx[d] - 1)) continue;
+        cvm::real f = edge_factor;
+        if (!periodic[d] && (ix[d] == 0 || ix[d] == nx[d] - 1)) f *= 2.0;
+        level.weights[d][p] = f / (widths[d] * widths[d]);
+      }
+      for (int d = int(nd) - 1; d >= 0; d--) {
+        if (++ix[d] < nx[d]) break;
+        ix[d] = 0;
+      }
+    }
+  }
+
+  while (true) {
+    multigrid_level &fine = mg_levels.back();
+
+    // Sum of the link weights of each point
+    size_t const n_fine = fine.weights[0].size();
+    fine.diagonal.assign(n_fine, 0.0);
+    fine.rhs.resize(n_fine);
+    fine.sol.resize(n_fine);
+    fine.tmp.resize(n_fine);
+    size_t stride = n_fine;
+    for (size_t d = 0; d < nd; d++) {
+      size_t const n = fine.nx[d];
+      stride /= n;
+      size_t const last = fine.periodic[d] ? n : n - 1;
+      for (size_t base = 0; base < n_fine; base += n * stride) {
+        for (size_t i = 0; i < last; i++) {
+          size_t const j = (i + 1 == n) ? 0 : i + 1;
+          for (size_t s = 0; s < stride; s++) {
+            size_t const p = base + i * stride + s, q = base + j * stride + s;
+            fine.diagonal[p] += fine.weights[d][p];
+            fine.diagonal[q] += fine.weights[d][p];
+          }
+        }
+      }
+    }
+
+    // Aggregate pairs of neighboring points along each dimension longer than 2
+    std::vector<int> nx_coarse(nd);
+    size_t n_coarse = 1;
+    bool coarsened = false;
+    for (size_t d = 0; d < nd; d++) {
+      nx_coarse[d] = (fine.nx[d] > 2) ? (fine.nx[d] + 1) / 2 : fine.nx[d];
+      if (nx_coarse[d] != fine.nx[d]) coarsened = true;
+      n_coarse *= nx_coarse[d];
+    }
+    if ((n_fine <= 256) || !coarsened) break;
+
+    fine.coarse_index.resize(n_fine);
+    std::vector<int> ix(nd, 0);
+    for (size_t p = 0; p < n_fine; p++) {
+      size_t ic = 0;
+      for (size_t d = 0; d < nd; d++) {
+        ic = ic * nx_coarse[d] + ((nx_coarse[d] != fine.nx[d]) ? ix[d] / 2 : ix[d]);
+      }
+      fine.coarse_index[p] = ic;
+      for (int d = int(nd) - 1; d >= 0; d--) {
+        if (++ix[d] < fine.nx[d]) break;
+        ix[d] = 0;
+      }
+    }
+
+    // Galerkin coarse operator: links between aggregates sum the weights of
+    // the links between their points
+    multigrid_level coarse;
+    coarse.nx = nx_coarse;
+    coarse.periodic = fine.periodic;
+    coarse.weights.assign(nd, std::vector<cvm::real>(n_coarse, 0.0));
+    stride = n_fine;
+    for (size_t d = 0; d < nd; d++) {
+      size_t const n = fine.nx[d];
+      stride /= n;
+      size_t const last = fine.periodic[d] ? n : n - 1;
+      for (size_t base = 0; base < n_fine; base += n * stride) {
+        for (size_t i = 0; i < last; i++) {
+          size_t const j = (i + 1 == n) ? 0 : i + 1;
+          for (size_t s = 0; s < stride; s++) {
+            size_t const p = base + i * stride + s, q = base + j * stride + s;
+            if (fine.coarse_index[p] != fine.coarse_index[q]) {
+              coarse.weights[d][fine.coarse_index[p]] += fine.weights[d][p];
+            }
+          }
+        }
+      }
+    }
+    mg_levels.push_back(coarse);
+  }
+
+  // Dense Cholesky factorization of the coarsest operator, shifted by a
+  // multiple of the all-ones matrix to make it positive definite
+  multigrid_level &coarsest = mg_levels.back();
+  size_t const n = coarsest.diagonal.size();
+  std::vector<cvm::real> unit(n, 0.0), column(n);
+  mg_coarse_factor.assign(n * n, 0.0);
+  cvm::real shift = 0.0;
+  for (size_t i = 0; i < n; i++) shift += coarsest.diagonal[i];
+  shift /= cvm::real(n * n);
+  for (size_t i = 0; i < n; i++) {
+    unit[i] = 1.0;
+    multigrid_apply(coarsest, unit, column);
+    unit[i] = 0.0;
+    for (size_t j = 0; j < n; j++) {
+      mg_coarse_factor[j * n + i] = column[j] + shift;
+    }
+  }
+  for (size_t j = 0; j < n; j++) {
+    cvm::real sum = mg_coarse_factor[j * n + j];
+    for (size_t k = 0; k < j; k++) sum -= mg_coarse_factor[j * n + k] * mg_coarse_factor[j * n + k];
+    cvm::real const pivot = cvm::sqrt(sum > 0.0 ? sum : 1.0e-300);
+    mg_coarse_factor[j * n + j] = pivot;
+    for (size_t i = j + 1; i < n; i++) {
+      cvm::real sum_i = mg_coarse_factor[i * n + j];
+      for (size_t k = 0; k < j; k++) sum_i -= mg_coarse_factor[i * n + k] * mg_coarse_factor[j * n + k];
+      mg_coarse_factor[i * n + j] = sum_i / pivot;
+    }
+  }
+
+  if (cvm::debug()) {
+    cvm::log("Multigrid preconditioner with " + cvm::to_str(mg_levels.size()) +
+             " levels; coarsest level has " + cvm::to_str(n) + " points.\n");
+  }
+}
+
+
+void integrate_potential::multigrid_apply(multigrid_level const &level,
+                                          std::vector<cvm::real> const &x,
+                                          std::vector<cvm::real> &y) const
+{
+  size_t const n_points = level.diagonal.size();
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+  for (long p = 0; p < long(n_points); p++) {
+    y[p] = level.diagonal[p] * x[p];
+  }
+  size_t stride = n_points;
+  for (size_t d = 0; d < nd; d++) {
+    size_t const n = level.nx[d];
+    stride /= n;
+    bool const per = level.periodic[d];
+    std::vector<cvm::real> const &w = level.weights[d];
+    // Each row is a line of points with the same coordinate along d
+    long const num_rows = n_points / stride;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (long row = 0; row < num_rows; row++) {
+      size_t const i = row % n;
+      size_t const base = (row / n) * n * stride;
+      size_t const start = base + i * stride;
+      if (per || (i + 1 < n)) {
+        size_t const up = base + ((i + 1 == n) ? 0 : i + 1) * stride;
+        for (size_t s = 0; s < stride; s++) {
+          y[start + s] -= w[start + s] * x[up + s];
+        }
+      }
+      if (per || (i > 0)) {
+        size_t const down = base + ((i == 0) ? n - 1 : i - 1) * stride;
+        for (size_t s = 0; s < stride; s++) {
+          y[start + s] -= w[down + s] * x[down + s];
+        }
+      }
+    }
+  }
+}
+
+
+void integrate_potential::multigrid_smooth(multigrid_level &level, int sweeps, bool zero_guess)
+{
+  cvm::real const omega = 2.0 / 3.0;
+  size_t const n_points = level.diagonal.size();
+  for (int sweep = 0; sweep < sweeps; sweep++) {
+    if (zero_guess && (sweep == 0)) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+      for (long p = 0; p < long(n_points); p++) {
+        level.sol[p] = omega * level.rhs[p] / level.diagonal[p];
+      }
+      continue;
+    }
+    multigrid_apply(level, level.sol, level.tmp);
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (long p = 0; p < long(n_points); p++) {
+      level.sol[p] += omega * (level.rhs[p] - level.tmp[p]) / level.diagonal[p];
+    }
+  }
+}
+
+
+void integrate_potential::multigrid_vcycle(size_t ilevel)
+{
+  multigrid_level &level = mg_levels[ilevel];
+  size_t const n_points = level.diagonal.size();
+
+  if (ilevel + 1 == mg_levels.size()) {
+    // Coarsest level: forward and back substitution
+    std::vector<cvm::real> &x = level.sol;
+    for (size_t i = 0; i < n_points; i++) {
+      cvm::real sum = level.rhs[i];
+      for (size_t k = 0; k < i; k++) sum -= mg_coarse_factor[i * n_points + k] * x[k];
+      x[i] = sum / mg_coarse_factor[i * n_points + i];
+    }
+    for (size_t i = n_points; i-- > 0; ) {
+      cvm::real sum = x[i];
+      for (size_t k = i + 1; k < n_points; k++) sum -= mg_coarse_factor[k * n_points + i] * x[k];
+      x[i] = sum / mg_coarse_factor[i * n_points + i];
+    }
+    return;
+  }
+
+  // Pre-smoothing and restriction of the residual
+  int const sweeps = 2;
+  multigrid_smooth(level, sweeps, true);
+  multigrid_apply(level, level.sol, level.tmp);
+  multigrid_level &coarse = mg_levels[ilevel + 1];
+  std::fill(coarse.rhs.begin(), coarse.rhs.end(), 0.0);
+  for (size_t p = 0; p < n_points; p++) {
+    coarse.rhs[level.coarse_index[p]] += level.rhs[p] - level.tmp[p];
+  }
+
+  multigrid_vcycle(ilevel + 1);
+
+  // Prolongation of the correction and post-smoothing; the Galerkin operator
+  // of piecewise-constant aggregates is about twice too stiff for smooth
+  // functions, hence the over-correction
+  cvm::real const over_correction = 1.8;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+  for (long p = 0; p < long(n_points); p++) {
+    level.sol[p] += over_correction * coarse.sol[level.coarse_index[p]];
+  }
+  multigrid_smooth(level, sweeps, false);
+}
+
+
 void integrate_potential::asolve(const std::vector<cvm::real> &b, std::vector<cvm::real> &x)
 {
-  for (size_t i=0; i<int(nt); i++) {
-    x[i] = b[i] * inv_lap_diag[i]; // Jacobi preconditioner - little benefit in tests so far
+  // The multigrid levels represent minus the Laplacian
+  multigrid_level &level = mg_levels[0];
+  for (size_t i = 0; i < size_t(nt); i++) level.rhs[i] = -b[i];
+  multigrid_vcycle(0);
+  for (size_t i = 0; i < size_t(nt); i++) x[i] = level.sol[i];
+}
+
+
+namespace {
+
+  /// \brief Sum term(i) for i in [0, n), optionally using multiple threads; the
+  /// partial sums of fixed-size blocks are added in order, so that the result
+  /// does not depend on the number of threads
+  template <typename F>
+  cvm::real sum_blocks(size_t n, bool use_threads, F const &term)
+  {
+    size_t const block_size = 4096;
+    long const num_blocks = (n + block_size - 1) / block_size;
+    std::vector<cvm::real> partial(num_blocks, 0.0);
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (long ib = 0; ib < num_blocks; ib++) {
+      size_t const end = std::min(n, (ib + 1) * block_size);
+      cvm::real sum = 0.0;
+      for (size_t i = ib * block_size; i < end; i++) {
+        sum += term(i);
+      }
+      partial[ib] = sum;
+    }
+    cvm::real result = 0.0;
+    for (long ib = 0; ib < num_blocks; ib++) {
+      result += partial[ib];
+    }
+    return result;
   }
-  return;
-}*/
+
+}
+
+
+cvm::real integrate_potential::fft_solve(const std::vector<cvm::real> &b, std::vector<cvm::real> &x)
+{
+  std::vector<std::complex<cvm::real>> a(b.begin(), b.end());
+  FFT::transform_nd(a, nx, false);
+
+  // Eigenvalues of the periodic Laplacian along each dimension
+  std::vector<std::vector<cvm::real>> eigenvalues(nd);
+  for (size_t d = 0; d < nd; d++) {
+    eigenvalues[d].resize(nx[d]);
+    for (int k = 0; k < nx[d]; k++) {
+      eigenvalues[d][k] = (2.0 * cvm::cos(2.0 * PI * k / nx[d]) - 2.0) / (widths[d] * widths[d]);
+    }
+  }
+  std::vector<int> ix(nd, 0);
+  for (size_t p = 0; p < a.size(); p++) {
+    cvm::real lambda = 0.0;
+    for (size_t d = 0; d < nd; d++) lambda += eigenvalues[d][ix[d]];
+    // The constant component is undetermined: set it to zero
+    a[p] = (p == 0) ? std::complex<cvm::real>(0.0) : a[p] / lambda;
+    for (int d = int(nd) - 1; d >= 0; d--) {
+      if (++ix[d] < nx[d]) break;
+      ix[d] = 0;
+    }
+  }
+
+  FFT::transform_nd(a, nx, true);
+  for (size_t i = 0; i < a.size(); i++) {
+    x[i] = a[i].real() / cvm::real(a.size());
+  }
+
+  cvm::real const bnrm = l2norm(b);
+  if (bnrm < 1.0e-14) return 0.0;
+  std::vector<cvm::real> r(nt);
+  atimes(x, r);
+  for (size_t i = 0; i < size_t(nt); i++) r[i] = b[i] - r[i];
+  return l2norm(r) / bnrm;
+}
 
 
 // b : RHS of equation
@@ -1217,46 +1708,47 @@ void integrate_potential::nr_linbcg_sym(const std::vector<cvm::real> &b, std::ve
 {
   cvm::real ak,akden,bk,bkden,bknum,bnrm;
   const cvm::real EPS=1.0e-14;
-  int j;
+  long const n = nt;
   std::vector<cvm::real> p(nt), r(nt), z(nt);
+  bool const precon = (solver == multigrid);
 
   iter=0;
   atimes(x,r);
-  for (j=0;j<int(nt);j++) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+  for (long j=0;j<n;j++) {
     r[j]=b[j]-r[j];
   }
   bnrm=l2norm(b);
   if (bnrm < EPS) {
     return; // Target is zero, will break relative error calc
   }
-//   asolve(r,z); // precon
+  if (precon) asolve(r,z);
   bkden = 1.0;
   while (iter < itmax) {
     ++iter;
-    for (bknum=0.0,j=0;j<int(nt);j++) {
-      bknum += r[j]*r[j];  // precon: z[j]*r[j]
-    }
-    if (iter == 1) {
-      for (j=0;j<int(nt);j++) {
-        p[j] = r[j];  // precon: p[j] = z[j]
-      }
-    } else {
-      bk=bknum/bkden;
-      for (j=0;j<int(nt);j++) {
-        p[j] = bk*p[j] + r[j];  // precon:  bk*p[j] + z[j]
-      }
+    std::vector<cvm::real> const &zr = precon ? z : r;
+    bknum = sum_blocks(n, use_threads, [&](size_t j) { return zr[j]*r[j]; });
+    bk = (iter == 1) ? 0.0 : bknum/bkden;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (long j=0;j<n;j++) {
+      p[j] = bk*p[j] + zr[j];
     }
     bkden = bknum;
     atimes(p,z);
-    for (akden=0.0,j=0;j<int(nt);j++) {
-      akden += z[j]*p[j];
-    }
+    akden = sum_blocks(n, use_threads, [&](size_t j) { return z[j]*p[j]; });
     ak = bknum/akden;
-    for (j=0;j<int(nt);j++) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static) if (use_threads)
+#endif
+    for (long j=0;j<n;j++) {
       x[j] += ak*p[j];
       r[j] -= ak*z[j];
     }
-//     asolve(r,z);  // precon
+    if (precon) asolve(r,z);
     err = l2norm(r)/bnrm;
     if (cvm::debug())
       std::cout << "iter=" << std::setw(4) << iter+1 << std::setw(12) << err << std::endl;
@@ -1267,9 +1759,5 @@ void integrate_potential::nr_linbcg_sym(const std::vector<cvm::real> &b, std::ve
 
 cvm::real integrate_potential::l2norm(const std::vector<cvm::real> &x)
 {
-  size_t i;
-  cvm::real sum = 0.0;
-  for (i=0;i<x.size();i++)
-    sum += x[i]*x[i];
-  return sqrt(sum);
+  return sqrt(sum_blocks(x.size(), use_threads, [&x](size_t i) { return x[i]*x[i]; }));
 }
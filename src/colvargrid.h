@@ -10,8 +10,12 @@
 #ifndef COLVARGRID_H
 #define COLVARGRID_H
 
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
 #include <iosfwd>
 #include <memory>
+#include <vector>
 
 #include "colvar.h"
 #include "colvarmodule.h"
@@ -19,6 +23,415 @@
 #include "colvarparse.h"
 
 
+/// \brief Layout of binary grid files
+///
+/// All fields are written in the byte order of the machine that wrote the file:
+/// - 8 bytes: the characters "COLVGRID"
+/// - uint32: format version (currently 1)
+/// - uint32: 0x01020304 (to detect a different byte order)
+/// - uint32: type of the values (0 = float64, 1 = uint64)
+/// - uint32: number of dimensions (nd)
+/// - uint64: number of values at each grid point (multiplicity)
+/// - for each dimension: float64 lower boundary, float64 width,
+///   int64 number of points, int64 periodic flag (0 or 1)
+/// - the values at all grid points, in the same order as the lines of a
+///   multicolumn file (the last dimension varies the fastest)
+///
+/// The values thus start at an offset that is a multiple of 8 bytes.
+struct colvar_grid_binary_format {
+
+  /// Characters at the beginning of the file
+  static char const *magic()
+  {
+    return "COLVGRID";
+  }
+
+  /// Number of characters at the beginning of the file
+  static size_t const magic_size = 8;
+
+  /// Current version of the format
+  static uint32_t const version = 1;
+
+  /// Used to check that the file was written with the same byte order
+  static uint32_t const byte_order_mark = 0x01020304;
+
+  /// Size of the header, excluding the per-dimension records
+  static size_t const header_size = 32;
+
+  /// Size of the header record for each dimension
+  static size_t const dimension_size = 32;
+
+  /// Whether the given buffer begins with a binary grid header
+  static bool detect(char const *buffer, size_t size);
+
+  /// Whether the stream (at its current position) contains a binary grid
+  static bool detect(std::istream &is);
+};
+
+
+/// \brief Multi-dimensional index of a grid point
+///
+/// Stores up to max_size integers inline, so that it can be created, copied
+/// and incremented without allocating memory; it converts implicitly from
+/// and to std::vector<int> for use by existing code.
+class colvar_grid_index {
+
+public:
+
+  /// Maximum number of dimensions
+  static size_t const max_size = 8;
+
+  typedef int value_type;
+  typedef int *iterator;
+  typedef int const *const_iterator;
+
+  colvar_grid_index() : nd(0) {}
+
+  /// Index with n dimensions, all set to value
+  explicit colvar_grid_index(size_t n, int value = 0) : nd(0)
+  {
+    resize(n, value);
+  }
+
+  colvar_grid_index(std::initializer_list<int> l) : nd(0)
+  {
+    resize(l.size());
+    std::copy(l.begin(), l.begin() + nd, ix);
+  }
+
+  colvar_grid_index(std::vector<int> const &v) : nd(0)
+  {
+    resize(v.size());
+    std::copy(v.begin(), v.begin() + nd, ix);
+  }
+
+  operator std::vector<int>() const
+  {
+    return std::vector<int>(begin(), end());
+  }
+
+  inline size_t size() const
+  {
+    return nd;
+  }
+
+  inline void resize(size_t n, int value = 0)
+  {
+    if (n > max_size) {
+      cvm::error("Error: grid indices are limited to "+cvm::to_str(size_t(max_size))+
+                 " dimensions.\n", COLVARS_BUG_ERROR);
+      n = max_size;
+    }
+    for (size_t i = nd; i < n; i++) ix[i] = value;
+    nd = n;
+  }
+
+  inline int &operator [] (size_t i)
+  {
+    return ix[i];
+  }
+
+  inline int const &operator [] (size_t i) const
+  {
+    return ix[i];
+  }
+
+  inline int &back()
+  {
+    return ix[nd-1];
+  }
+
+  inline int const &back() const
+  {
+    return ix[nd-1];
+  }
+
+  inline iterator begin() { return ix; }
+  inline iterator end() { return ix + nd; }
+  inline const_iterator begin() const { return ix; }
+  inline const_iterator end() const { return ix + nd; }
+
+  inline bool operator == (colvar_grid_index const &other) const
+  {
+    return (nd == other.nd) && std::equal(begin(), end(), other.begin());
+  }
+
+  inline bool operator != (colvar_grid_index const &other) const
+  {
+    return !(*this == other);
+  }
+
+protected:
+
+  /// Number of dimensions
+  size_t nd;
+
+  /// Values along each dimension
+  int ix[max_size];
+};
+
+
+/// \brief Grid points and weights used to interpolate a function of the
+/// colvars between the centers of the bins of a colvar_grid
+///
+/// Points are identified by their address divided by the multiplicity, so
+/// that the same stencil can be applied to grids with the same geometry but
+/// different multiplicity (e.g. an energy grid and its gradient grid).
+class colvar_grid_stencil {
+
+public:
+
+  /// Interpolation schemes
+  enum interpolation_type {
+    /// Value of the bin that contains the point
+    nearest,
+    /// Multilinear interpolation between the 2^nd surrounding bin centers
+    linear,
+    /// Cubic (Catmull-Rom) interpolation between the 4^nd surrounding bin
+    /// centers (only for grids of one or two dimensions)
+    cubic
+  };
+
+  /// Number of points
+  inline size_t size() const
+  {
+    return points.size();
+  }
+
+  /// Indices of the points
+  std::vector<size_t> points;
+
+  /// Weights of the points (they sum to one)
+  std::vector<cvm::real> weights;
+};
+
+
+/// \brief Container for the values of a colvar_grid
+///
+/// Values are stored either in a contiguous array (default), or in a table of
+/// fixed-size tiles, each of which is only allocated when one of its elements
+/// is first modified; elements of unallocated tiles read as the fill value.
+/// The latter allows grids spanning a large hyper-rectangle to use memory
+/// only in the regions that are actually sampled.
+template <class T> class colvar_grid_storage {
+
+public:
+
+  /// Number of elements in each tile (as a power of 2)
+  static size_t const tile_bits = 10;
+
+  /// Number of elements in each tile
+  static size_t const tile_size = (size_t(1) << tile_bits);
+
+  colvar_grid_storage() : n(0), sparse_on(false), fill() {}
+
+  colvar_grid_storage(colvar_grid_storage<T> const &s)
+  {
+    *this = s;
+  }
+
+  colvar_grid_storage<T> &operator = (colvar_grid_storage<T> const &s)
+  {
+    if (this == &s) return *this;
+    n = s.n;
+    sparse_on = s.sparse_on;
+    fill = s.fill;
+    dense = s.dense;
+    tiles.clear();
+    tiles.resize(s.tiles.size());
+    for (size_t it = 0; it < tiles.size(); it++) {
+      if (s.tiles[it]) {
+        tiles[it].reset(new T[tile_size]);
+        std::copy(s.tiles[it].get(), s.tiles[it].get() + tile_size, tiles[it].get());
+      }
+    }
+    return *this;
+  }
+
+  /// Number of elements
+  inline size_t size() const
+  {
+    return n;
+  }
+
+  /// Whether tiled (sparse) storage is in use
+  inline bool sparse() const
+  {
+    return sparse_on;
+  }
+
+  /// Switch between dense and sparse storage, preserving the current values
+  void set_sparse(bool b)
+  {
+    if (b == sparse_on) return;
+    if (b) {
+      std::vector<T> values;
+      values.swap(dense);
+      sparse_on = true;
+      allocate_tiles();
+      for (size_t i = 0; i < n; i++) set(i, values[i]);
+    } else {
+      std::vector<T> values(n);
+      for (size_t i = 0; i < n; i++) values[i] = (*this)[i];
+      tiles.clear();
+      sparse_on = false;
+      dense.swap(values);
+    }
+  }
+
+  /// Remove all elements (but keep the storage mode)
+  void clear()
+  {
+    n = 0;
+    dense.clear();
+    tiles.clear();
+  }
+
+  /// Reserve memory for n_in elements (dense storage only)
+  void reserve(size_t n_in)
+  {
+    if (!sparse_on) dense.reserve(n_in);
+  }
+
+  /// Resize to n_in elements, all equal to t
+  void assign(size_t n_in, T const &t)
+  {
+    n = n_in;
+    fill = t;
+    if (sparse_on) {
+      tiles.clear();
+      allocate_tiles();
+    } else {
+      dense.assign(n, t);
+    }
+  }
+
+  /// Writable reference to element i (allocates its tile if needed)
+  inline T &operator [] (size_t i)
+  {
+    if (!sparse_on) return dense[i];
+    std::unique_ptr<T[]> &tile = tiles[i >> tile_bits];
+    if (!tile) alloc_tile(tile);
+    return tile[i & (tile_size - 1)];
+  }
+
+  /// Read-only reference to element i
+  inline T const &operator [] (size_t i) const
+  {
+    if (!sparse_on) return dense[i];
+    std::unique_ptr<T[]> const &tile = tiles[i >> tile_bits];
+    return tile ? tile[i & (tile_size - 1)] : fill;
+  }
+
+  /// Read-only reference to element i (also for non-const storage objects)
+  inline T const &get(size_t i) const
+  {
+    return (*this)[i];
+  }
+
+  /// Assign element i, without allocating its tile if t equals the fill value
+  inline void set(size_t i, T const &t)
+  {
+    if (sparse_on && !tiles[i >> tile_bits] && (t == fill)) return;
+    (*this)[i] = t;
+  }
+
+  /// Increment element i, without allocating its tile if t is zero
+  inline void add(size_t i, T const &t)
+  {
+    if (sparse_on && !tiles[i >> tile_bits] && (t == T())) return;
+    (*this)[i] += t;
+  }
+
+  /// Whether the element i is stored in memory (always true for dense storage)
+  inline bool allocated(size_t i) const
+  {
+    return !sparse_on || tiles[i >> tile_bits];
+  }
+
+  /// Value of the elements that are not stored in memory
+  inline T const &fill_value() const
+  {
+    return fill;
+  }
+
+  /// Number of elements currently stored in memory
+  size_t num_allocated() const
+  {
+    if (!sparse_on) return n;
+    size_t result = 0;
+    for (size_t it = 0; it < tiles.size(); it++) {
+      if (tiles[it]) result += tile_size;
+    }
+    return result;
+  }
+
+  /// Apply f to each element (and to the fill value, if sparse)
+  template <class F> void transform(F f)
+  {
+    if (!sparse_on) {
+      for (size_t i = 0; i < n; i++) f(dense[i]);
+      return;
+    }
+    f(fill);
+    for (size_t it = 0; it < tiles.size(); it++) {
+      if (tiles[it]) {
+        for (size_t j = 0; j < tile_size; j++) f(tiles[it][j]);
+      }
+    }
+  }
+
+  /// Copy all elements into a contiguous array
+  void copy_to(T *out) const
+  {
+    for (size_t i = 0; i < n; i++) out[i] = (*this)[i];
+  }
+
+  /// Copy all elements from a contiguous array
+  void copy_from(T const *in)
+  {
+    for (size_t i = 0; i < n; i++) set(i, in[i]);
+  }
+
+  /// Contiguous array of all elements; converts to dense storage if needed
+  std::vector<T> &dense_vector()
+  {
+    set_sparse(false);
+    return dense;
+  }
+
+protected:
+
+  /// Number of elements
+  size_t n;
+
+  /// Whether tiled storage is in use
+  bool sparse_on;
+
+  /// Value of elements in unallocated tiles
+  T fill;
+
+  /// Dense storage
+  std::vector<T> dense;
+
+  /// Tiled storage
+  std::vector<std::unique_ptr<T[]>> tiles;
+
+  /// Size the table of tiles for the current number of elements
+  inline void allocate_tiles()
+  {
+    tiles.resize((n + tile_size - 1) >> tile_bits);
+  }
+
+  /// Allocate a tile and initialize it with the fill value
+  inline void alloc_tile(std::unique_ptr<T[]> &tile)
+  {
+    tile.reset(new T[tile_size]);
+    std::fill(tile.get(), tile.get() + tile_size, fill);
+  }
+};
+
+
 /// \brief Grid of values of a function of several collective
 /// variables \param T The data type
 ///
@@ -45,7 +458,7 @@ public: // TODO create accessors for these after all instantiations work
   size_t nt;
 
   /// Low-level array of values
-  std::vector<T> data;
+  colvar_grid_storage<T> data;
 
   /// Newly read data (used for count grids, when adding several grids read from disk)
   std::vector<size_t> new_data;
@@ -57,10 +470,25 @@ public: // TODO create accessors for these after all instantiations work
   std::vector<bool> use_actual_value;
 
   /// Get the low-level index corresponding to an index
-  inline size_t address(std::vector<int> const &ix) const
+  inline size_t address(colvar_grid_index const &ix) const
   {
+    switch (nd) {
+    case 1:
+      return address_nd<1>(ix);
+    case 2:
+      return address_nd<2>(ix);
+    default:
+      return address_nd<0>(ix);
+    }
+  }
+
+  /// \brief Implementation of address() for a grid of ND dimensions
+  /// (or of any dimension if ND is zero)
+  template <size_t ND> inline size_t address_nd(colvar_grid_index const &ix) const
+  {
+    size_t const n = (ND > 0) ? ND : nd;
     size_t addr = 0;
-    for (size_t i = 0; i < nd; i++) {
+    for (size_t i = 0; i < n; i++) {
       addr += ix[i]*static_cast<size_t>(nxc[i]);
       if (cvm::debug()) {
         if (ix[i] >= nx[i]) {
@@ -72,6 +500,18 @@ public: // TODO create accessors for these after all instantiations work
     return addr;
   }
 
+  /// \brief Get the low-level index of the point that is shift bins away from
+  /// ix along dimension n (wrapped if n is periodic), given the address of ix
+  inline size_t neighbor_address(colvar_grid_index const &ix, size_t addr,
+                                 size_t n, int shift) const
+  {
+    int i = ix[n] + shift;
+    if (periodic[n]) {
+      i = (i + nx[n]) % nx[n];
+    }
+    return addr - static_cast<size_t>(ix[n]) * nxc[n] + static_cast<size_t>(i) * nxc[n];
+  }
+
 public:
 
   /// Lower boundaries of the colvars in this grid
@@ -165,6 +605,12 @@ public:
     nx = nx_i;
     nd = nx.size();
 
+    if (nd > colvar_grid_index::max_size) {
+      return cvm::error("Error: grids with more than "+
+                        cvm::to_str(size_t(colvar_grid_index::max_size))+
+                        " dimensions are not supported.\n", COLVARS_NOT_IMPLEMENTED);
+    }
+
     nxc.resize(nd);
 
     // setup dimensions
@@ -233,7 +679,9 @@ public:
                                          widths(g.widths),
                                          has_parent_data(false),
                                          has_data(false)
-  {}
+  {
+    data.set_sparse(g.data.sparse());
+  }
 
   /// \brief Constructor from explicit grid sizes \param nx_i Number
   /// of grid points along each dimension \param t Initial value for
@@ -327,6 +775,7 @@ public:
     }
 
     this->init_from_boundaries();
+    data.set_sparse(cvm::sparse_grids);
     return this->setup();
   }
 
@@ -372,7 +821,7 @@ public:
 
   /// Wrap an index vector around periodic boundary conditions
   /// also checks validity of non-periodic indices
-  inline void wrap(std::vector<int> & ix) const
+  template <class IX> inline void wrap(IX &ix) const
   {
     for (size_t i = 0; i < nd; i++) {
       if (periodic[i]) {
@@ -380,7 +829,7 @@ public:
       } else {
         if (ix[i] < 0 || ix[i] >= nx[i]) {
           cvm::error("Trying to wrap illegal index vector (non-PBC) for a grid point: "
-                     + cvm::to_str(ix), COLVARS_BUG_ERROR);
+                     + cvm::to_str(std::vector<int>(ix.begin(), ix.end())), COLVARS_BUG_ERROR);
           return;
         }
       }
@@ -389,7 +838,7 @@ public:
 
   /// Wrap an index vector around periodic boundary conditions
   /// or detects edges if non-periodic
-  inline bool wrap_detect_edge(std::vector<int> & ix) const
+  template <class IX> inline bool wrap_detect_edge(IX &ix) const
   {
     bool edge = false;
     for (size_t i = 0; i < nd; i++) {
@@ -404,7 +853,7 @@ public:
 
   /// Wrap an index vector around periodic boundary conditions
   /// or brings back to nearest edge if non-periodic
-  inline bool wrap_to_edge(std::vector<int> & ix, std::vector<int> & edge_bin) const
+  template <class IX> inline bool wrap_to_edge(IX &ix, IX &edge_bin) const
   {
     bool edge = false;
     edge_bin = ix;
@@ -434,7 +883,7 @@ public:
   /// and assign first or last bin if out of boundaries
   inline int current_bin_flat_bound() const
   {
-    std::vector<int> index = new_index();
+    colvar_grid_index index = new_index();
     for (size_t i = 0; i < nd; i++) {
       index[i] = current_bin_scalar_bound(i);
     }
@@ -514,18 +963,18 @@ public:
   }
 
   /// Set the value at the point with index ix
-  inline void set_value(std::vector<int> const &ix,
+  inline void set_value(colvar_grid_index const &ix,
                         T const &t,
                         size_t const &imult = 0)
   {
-    data[this->address(ix)+imult] = t;
+    data.set(this->address(ix)+imult, t);
     has_data = true;
   }
 
   /// Set the value at the point with linear address i (for speed)
   inline void set_value(size_t i, T const &t)
   {
-    data[i] = t;
+    data.set(i, t);
   }
 
  /// Get the value at the point with linear address i (for speed)
@@ -555,7 +1004,7 @@ public:
     }
 
     for (size_t i = 0; i < data.size(); i++) {
-      data[i] = other_grid.data[i] - data[i];
+      data.set(i, other_grid.data[i] - data.get(i));
     }
     has_data = true;
   }
@@ -580,7 +1029,7 @@ public:
 
 
     for (size_t i = 0; i < data.size(); i++) {
-      data[i] = other_grid.data[i];
+      data.set(i, other_grid.data[i]);
     }
     has_data = true;
   }
@@ -589,30 +1038,49 @@ public:
   /// Put the results in "out_data".
   void raw_data_out(T* out_data) const
   {
-    for (size_t i = 0; i < data.size(); i++) out_data[i] = data[i];
+    data.copy_to(out_data);
   }
   void raw_data_out(std::vector<T>& out_data) const
   {
-    out_data = data;
+    out_data.resize(data.size());
+    data.copy_to(out_data.data());
   }
   /// \brief Input the data as they are represented in memory.
   void raw_data_in(const T* in_data)
   {
-    for (size_t i = 0; i < data.size(); i++) data[i] = in_data[i];
+    data.copy_from(in_data);
     has_data = true;
   }
   void raw_data_in(const std::vector<T>& in_data)
   {
-    data = in_data;
+    if (in_data.size() != data.size()) {
+      data.assign(in_data.size(), T());
+    }
+    data.copy_from(in_data.data());
     has_data = true;
   }
   /// \brief Size of the data as they are represented in memory.
   size_t raw_data_num() const { return data.size(); }
 
+  /// Maximum number of elements exchanged in each message by replicas_sum()
+  static size_t const replicas_sum_chunk_size = (size_t(1) << 20);
+
+  /// \brief Set this grid to the elementwise sum over all replicas of the
+  /// contribution grid (which may be this grid itself), leaving the result on
+  /// every replica; with sparse storage, only tiles allocated on at least one
+  /// replica are exchanged
+  int replicas_sum(colvar_grid<T> const &contribution);
+
+  /// Sum this grid over all replicas (see replicas_sum(colvar_grid<T> const &))
+  inline int replicas_sum()
+  {
+    return replicas_sum(*this);
+  }
+
 
   /// \brief Get the binned value indexed by ix, or the first of them
   /// if the multiplicity is larger than 1
-  inline T const & value(std::vector<int> const &ix,
+  inline T const & value(colvar_grid_index const &ix,
                          size_t const &imult = 0) const
   {
     return data[this->address(ix) + imult];
@@ -624,34 +1092,129 @@ public:
     return data[i];
   }
 
+  /// \brief Compute the stencil needed to interpolate the grid at the given
+  /// values of the colvars (or at their current values if values is NULL)
+  /// \returns False if the point falls outside the grid; the stencil is
+  /// clamped to the first or last bin centers near non-periodic boundaries
+  bool interpolation_stencil(std::vector<colvarvalue> const *values,
+                             colvar_grid_stencil::interpolation_type scheme,
+                             colvar_grid_stencil &stencil) const
+  {
+    size_t const np = (scheme == colvar_grid_stencil::cubic) ? 4 :
+      ((scheme == colvar_grid_stencil::linear) ? 2 : 1);
+    stencil.points.assign(1, 0);
+    stencil.weights.assign(1, 1.0);
+
+    for (size_t i = 0; i < nd; i++) {
+
+      cvm::real const x = values ? (*values)[i].real_value :
+        (use_actual_value[i] ? cv[i]->actual_value() : cv[i]->value()).real_value;
+      cvm::real const t = (x - lower_boundaries[i].real_value) / widths[i];
+      if ((t < 0.0) || (int(cvm::floor(t)) >= nx[i])) {
+        return false;
+      }
+
+      int ib[4];
+      cvm::real w[4];
+      if (np == 1) {
+        ib[0] = int(cvm::floor(t));
+        w[0] = 1.0;
+      } else {
+        // Bin centers are at half-integer values of t
+        int const i0 = int(cvm::floor(t - 0.5));
+        cvm::real const f = t - 0.5 - i0;
+        if (np == 2) {
+          ib[0] = i0;
+          ib[1] = i0 + 1;
+          w[0] = 1.0 - f;
+          w[1] = f;
+        } else {
+          cvm::real const f2 = f * f, f3 = f2 * f;
+          ib[0] = i0 - 1;
+          ib[1] = i0;
+          ib[2] = i0 + 1;
+          ib[3] = i0 + 2;
+          w[0] = 0.5 * (-f3 + 2.0 * f2 - f);
+          w[1] = 0.5 * (3.0 * f3 - 5.0 * f2 + 2.0);
+          w[2] = 0.5 * (-3.0 * f3 + 4.0 * f2 + f);
+          w[3] = 0.5 * (f3 - f2);
+        }
+        for (size_t k = 0; k < np; k++) {
+          if (periodic[i]) {
+            ib[k] = (ib[k] + nx[i]) % nx[i];
+          } else {
+            ib[k] = (ib[k] < 0) ? 0 : ((ib[k] >= nx[i]) ? nx[i] - 1 : ib[k]);
+          }
+        }
+      }
+
+      // Tensor product with the stencil of the previous dimensions; the
+      // first block is overwritten last, because it is also the source
+      size_t const n = stencil.points.size();
+      size_t const stride = nxc[i] / mult;
+      stencil.points.resize(n * np);
+      stencil.weights.resize(n * np);
+      for (size_t k = np; k-- > 0; ) {
+        for (size_t j = 0; j < n; j++) {
+          stencil.points[k * n + j] = stencil.points[j] + ib[k] * stride;
+          stencil.weights[k * n + j] = stencil.weights[j] * w[k];
+        }
+      }
+    }
+    return true;
+  }
+
+  /// \brief Interpolate the grid using a stencil computed by
+  /// interpolation_stencil() for this grid or one with the same geometry
+  inline T value(colvar_grid_stencil const &stencil,
+                 size_t const &imult = 0) const
+  {
+    T result = stencil.weights[0] * data[stencil.points[0] * mult + imult];
+    for (size_t j = 1; j < stencil.size(); j++) {
+      result += stencil.weights[j] * data[stencil.points[j] * mult + imult];
+    }
+    return result;
+  }
+
+  /// \brief Interpolate all the values at each grid point (multiplicity) using a
+  /// stencil computed by interpolation_stencil(), and add them times factor to v
+  inline void add_vector_value(colvar_grid_stencil const &stencil,
+                               T *v, cvm::real factor = 1.0) const
+  {
+    for (size_t j = 0; j < stencil.size(); j++) {
+      size_t const addr = stencil.points[j] * mult;
+      cvm::real const w = factor * stencil.weights[j];
+      for (size_t imult = 0; imult < mult; imult++) {
+        v[imult] += w * data[addr + imult];
+      }
+    }
+  }
+
   /// \brief Add a constant to all elements (fast loop)
   inline void add_constant(T const &t)
   {
-    for (size_t i = 0; i < nt; i++)
-      data[i] += t;
+    data.transform([&t](T &x) { x += t; });
     has_data = true;
   }
 
   /// \brief Multiply all elements by a scalar constant (fast loop)
   inline void multiply_constant(cvm::real const &a)
   {
-    for (size_t i = 0; i < nt; i++)
-      data[i] *= a;
+    data.transform([&a](T &x) { x *= a; });
   }
 
   /// \brief Assign values that are smaller than scalar constant the latter value (fast loop)
   inline void remove_small_values(cvm::real const &a)
   {
-    for (size_t i = 0; i < nt; i++)
-      if(data[i]<a) data[i] = a;
+    data.transform([&a](T &x) { if (x < a) x = a; });
   }
 
 
   /// \brief Get the bin indices corresponding to the provided values of
   /// the colvars
-  inline std::vector<int> const get_colvars_index(std::vector<colvarvalue> const &values) const
+  inline colvar_grid_index get_colvars_index(std::vector<colvarvalue> const &values) const
   {
-    std::vector<int> index = new_index();
+    colvar_grid_index index = new_index();
     for (size_t i = 0; i < nd; i++) {
       index[i] = value_to_bin_scalar(values[i], i);
     }
@@ -660,9 +1223,9 @@ public:
 
   /// \brief Get the bin indices corresponding to the current values
   /// of the colvars
-  inline std::vector<int> const get_colvars_index() const
+  inline colvar_grid_index get_colvars_index() const
   {
-    std::vector<int> index = new_index();
+    colvar_grid_index index = new_index();
     for (size_t i = 0; i < nd; i++) {
       index[i] = current_bin_scalar(i);
     }
@@ -671,9 +1234,9 @@ public:
 
   /// \brief Get the bin indices corresponding to the provided values of
   /// the colvars and assign first or last bin if out of boundaries
-  inline std::vector<int> const get_colvars_index_bound() const
+  inline colvar_grid_index get_colvars_index_bound() const
   {
-    std::vector<int> index = new_index();
+    colvar_grid_index index = new_index();
     for (size_t i = 0; i < nd; i++) {
       index[i] = current_bin_scalar_bound(i);
     }
@@ -726,8 +1289,8 @@ public:
     std::vector<colvarvalue> const &ogb = other_grid.lower_boundaries;
     std::vector<cvm::real> const &ogw   = other_grid.widths;
 
-    std::vector<int> ix = this->new_index();
-    std::vector<int> oix = other_grid.new_index();
+    colvar_grid_index ix = this->new_index();
+    colvar_grid_index oix = other_grid.new_index();
 
     if (cvm::debug())
       cvm::log("Remapping grid...\n");
@@ -766,19 +1329,19 @@ public:
     }
     if (scale_factor != 1.0)
       for (size_t i = 0; i < data.size(); i++) {
-        data[i] += static_cast<T>(scale_factor * other_grid.data[i]);
+        data.add(i, static_cast<T>(scale_factor * other_grid.data[i]));
       }
     else
       // skip multiplication if possible
       for (size_t i = 0; i < data.size(); i++) {
-        data[i] += other_grid.data[i];
+        data.add(i, other_grid.data[i]);
       }
     has_data = true;
   }
 
   /// \brief Return the value suitable for output purposes (so that it
   /// may be rescaled or manipulated without changing it permanently)
-  virtual T value_output(std::vector<int> const &ix,
+  virtual T value_output(colvar_grid_index const &ix,
                          size_t const &imult = 0) const
   {
     return value(ix, imult);
@@ -787,35 +1350,35 @@ public:
   /// \brief Get the value from a formatted output and transform it
   /// into the internal representation (the two may be different,
   /// e.g. when using colvar_grid_count)
-  virtual void value_input(std::vector<int> const &ix,
+  virtual void value_input(colvar_grid_index const &ix,
                            T const &t,
                            size_t const &imult = 0,
                            bool add = false)
   {
     if ( add )
-      data[address(ix) + imult] += t;
+      data.add(address(ix) + imult, t);
     else
-      data[address(ix) + imult] = t;
+      data.set(address(ix) + imult, t);
     has_data = true;
   }
 
 
   //   /// Get the pointer to the binned value indexed by ix
-  //   inline T const *value_p (std::vector<int> const &ix)
+  //   inline T const *value_p (colvar_grid_index const &ix)
   //   {
   //     return &(data[address (ix)]);
   //   }
 
   /// \brief Get the index corresponding to the "first" bin, to be
   /// used as the initial value for an index in looping
-  inline std::vector<int> const new_index() const
+  inline colvar_grid_index new_index() const
   {
-    return std::vector<int> (nd, 0);
+    return colvar_grid_index(nd);
   }
 
   /// \brief Check that the index is within range in each of the
   /// dimensions
-  inline bool index_ok(std::vector<int> const &ix) const
+  inline bool index_ok(colvar_grid_index const &ix) const
   {
     for (size_t i = 0; i < nd; i++) {
       if ( (ix[i] < 0) || (ix[i] >= int(nx[i])) )
@@ -826,9 +1389,27 @@ public:
 
   /// \brief Increment the index, in a way that will make it loop over
   /// the whole nd-dimensional array
-  inline void incr(std::vector<int> &ix) const
+  template <class IX> inline void incr(IX &ix) const
+  {
+    switch (ix.size()) {
+    case 1:
+      incr_nd<1>(ix);
+      break;
+    case 2:
+      incr_nd<2>(ix);
+      break;
+    default:
+      incr_nd<0>(ix);
+      break;
+    }
+  }
+
+  /// \brief Implementation of incr() for an index of ND dimensions
+  /// (or of any dimension if ND is zero)
+  template <size_t ND, class IX> inline void incr_nd(IX &ix) const
   {
-    for (int i = ix.size()-1; i >= 0; i--) {
+    int const n = (ND > 0) ? ND : ix.size();
+    for (int i = n-1; i >= 0; i--) {
 
       ix[i]++;
 
@@ -949,6 +1530,29 @@ public:
   /// Write the grid data without labels, as they are represented in memory
   int write_opendx(std::string const &filename,
                    std::string description = "grid file") const;
+
+  /// \brief Write grid in binary format (see colvar_grid_binary_format),
+  /// with the same values as write_multicol()
+  std::ostream & write_binary(std::ostream &os) const;
+
+  /// Write grid in binary format (see colvar_grid_binary_format)
+  int write_binary(std::string const &filename,
+                   std::string description = "grid file") const;
+
+  /// \brief Read a grid written by write_binary() from a buffer, incrementing
+  /// if add is true
+  int read_binary(char const *buffer, size_t size, bool add = false);
+
+  /// \brief Read a grid written by write_binary() from a file (memory-mapped
+  /// where possible), incrementing if add is true
+  int read_binary(std::string const &filename,
+                  std::string description = "grid file",
+                  bool add = false);
+
+  /// \brief Write a grid file in the format selected by the binaryGridFiles
+  /// option (binary or multicolumn)
+  int write_file(std::string const &filename,
+                 std::string description = "grid file") const;
 };
 
 
@@ -976,13 +1580,13 @@ public:
                     bool                   add_extra_bin = false);
 
   /// Increment the counter at given position
-  inline void incr_count(std::vector<int> const &ix)
+  inline void incr_count(colvar_grid_index const &ix)
   {
     ++(data[this->address(ix)]);
   }
 
   /// \brief Get the binned count indexed by ix from the newly read data
-  inline size_t const & new_value(std::vector<int> const &ix)
+  inline size_t const & new_value(colvar_grid_index const &ix)
   {
     return new_data[address(ix)];
   }
@@ -1045,20 +1649,20 @@ public:
                    std::string description = "grid file") const;
 
   /// Enter or add a value, but also handle parent grid
-  virtual void value_input(std::vector<int> const &ix,
+  virtual void value_input(colvar_grid_index const &ix,
                            size_t const &t,
                            size_t const &imult = 0,
                            bool add = false)
   {
     (void) imult;
     if (add) {
-      data[address(ix)] += t;
+      data.add(address(ix), t);
       if (this->has_parent_data) {
         // save newly read data for inputting parent grid
         new_data[address(ix)] = t;
       }
     } else {
-      data[address(ix)] = t;
+      data.set(address(ix), t);
     }
     has_data = true;
   }
@@ -1067,8 +1671,8 @@ public:
   /// Really a hypercube of length 2*radius + 1
   inline int local_sample_count(int radius)
   {
-    std::vector<int> ix0 = new_index();
-    std::vector<int> ix = new_index();
+    colvar_grid_index ix0 = new_index();
+    colvar_grid_index ix = new_index();
 
     for (size_t i = 0; i < nd; i++) {
       ix0[i] = current_bin_scalar_bound(i);
@@ -1143,31 +1747,15 @@ public:
   /// \brief Return the log-gradient from finite differences
   /// on the *same* grid for dimension n
   /// (colvar_grid_count)
-  inline cvm::real log_gradient_finite_diff(const std::vector<int> &ix0,
+  inline cvm::real log_gradient_finite_diff(colvar_grid_index const &ix0,
                                             int n = 0, int offset = 0)
   {
     cvm::real A0, A1, A2;
-    std::vector<int> ix = ix0;
+    size_t const addr = address(ix0);
 
-    // TODO this can be rewritten more concisely with wrap_edge()
-    if (periodic[n]) {
-      ix[n]--; wrap(ix);
-      A0 = value(ix) + offset;
-      ix = ix0;
-      ix[n]++; wrap(ix);
-      A1 = value(ix) + offset;
-      if (A0 * A1 == 0) {
-        return 0.; // can't handle empty bins
-      } else {
-        return (cvm::logn(A1) - cvm::logn(A0))
-          / (widths[n] * 2.);
-      }
-    } else if (ix[n] > 0 && ix[n] < nx[n]-1) { // not an edge
-      ix[n]--;
-      A0 = value(ix) + offset;
-      ix = ix0;
-      ix[n]++;
-      A1 = value(ix) + offset;
+    if (periodic[n] || (ix0[n] > 0 && ix0[n] < nx[n]-1)) { // not an edge
+      A0 = value(neighbor_address(ix0, addr, n, -1)) + offset;
+      A1 = value(neighbor_address(ix0, addr, n, 1)) + offset;
       if (A0 * A1 == 0) {
         return 0.; // can't handle empty bins
       } else {
@@ -1176,11 +1764,11 @@ public:
       }
     } else {
       // edge: use 2nd order derivative
-      int increment = (ix[n] == 0 ? 1 : -1);
+      int increment = (ix0[n] == 0 ? 1 : -1);
       // move right from left edge, or the other way around
-      A0 = value(ix) + offset;
-      ix[n] += increment; A1 = value(ix) + offset;
-      ix[n] += increment; A2 = value(ix) + offset;
+      A0 = value(addr) + offset;
+      A1 = value(neighbor_address(ix0, addr, n, increment)) + offset;
+      A2 = value(neighbor_address(ix0, addr, n, 2*increment)) + offset;
       if (A0 * A1 * A2 == 0) {
         return 0.; // can't handle empty bins
       } else {
@@ -1194,30 +1782,15 @@ public:
   /// \brief Return the gradient of discrete count from finite differences
   /// on the *same* grid for dimension n
   /// (colvar_grid_count)
-  inline cvm::real gradient_finite_diff(const std::vector<int> &ix0,
+  inline cvm::real gradient_finite_diff(colvar_grid_index const &ix0,
                                         int n = 0)
   {
     cvm::real A0, A1, A2;
-    std::vector<int> ix = ix0;
+    size_t const addr = address(ix0);
 
-    // FIXME this can be rewritten more concisely with wrap_edge()
-    if (periodic[n]) {
-      ix[n]--; wrap(ix);
-      A0 = value(ix);
-      ix = ix0;
-      ix[n]++; wrap(ix);
-      A1 = value(ix);
-      if (A0 * A1 == 0) {
-        return 0.; // can't handle empty bins
-      } else {
-        return (A1 - A0) / (widths[n] * 2.);
-      }
-    } else if (ix[n] > 0 && ix[n] < nx[n]-1) { // not an edge
-      ix[n]--;
-      A0 = value(ix);
-      ix = ix0;
-      ix[n]++;
-      A1 = value(ix);
+    if (periodic[n] || (ix0[n] > 0 && ix0[n] < nx[n]-1)) { // not an edge
+      A0 = value(neighbor_address(ix0, addr, n, -1));
+      A1 = value(neighbor_address(ix0, addr, n, 1));
       if (A0 * A1 == 0) {
         return 0.; // can't handle empty bins
       } else {
@@ -1225,11 +1798,11 @@ public:
       }
     } else {
       // edge: use 2nd order derivative
-      int increment = (ix[n] == 0 ? 1 : -1);
+      int increment = (ix0[n] == 0 ? 1 : -1);
       // move right from left edge, or the other way around
-      A0 = value(ix);
-      ix[n] += increment; A1 = value(ix);
-      ix[n] += increment; A2 = value(ix);
+      A0 = value(addr);
+      A1 = value(neighbor_address(ix0, addr, n, increment));
+      A2 = value(neighbor_address(ix0, addr, n, 2*increment));
       return (-1.5 * A0 + 2. * A1
           - 0.5 * A2) * increment / widths[n];
     }
@@ -1263,13 +1836,13 @@ public:
                      bool add_extra_bin = false);
 
   /// Accumulate the value
-  inline void acc_value(std::vector<int> const &ix,
+  inline void acc_value(colvar_grid_index const &ix,
                         cvm::real const &new_value,
                         size_t const &imult = 0)
   {
     (void) imult;
     // only legal value of imult here is 0
-    data[address(ix)] += new_value;
+    data.add(address(ix), new_value);
     if (samples)
       samples->incr_count(ix);
     has_data = true;
@@ -1336,10 +1909,10 @@ public:
   /// Input coordinates are those of gradient grid, shifted wrt scalar grid
   /// Should not be called on edges of scalar grid, provided the latter has margins
   /// wrt gradient grid
-  inline void vector_gradient_finite_diff( const std::vector<int> &ix0, std::vector<cvm::real> &grad)
+  inline void vector_gradient_finite_diff( colvar_grid_index const &ix0, std::vector<cvm::real> &grad)
   {
     cvm::real A0, A1;
-    std::vector<int> ix;
+    colvar_grid_index ix;
     size_t i, j, k, n;
 
     if (nd == 2) {
@@ -1389,31 +1962,15 @@ public:
   /// \brief Return the log-gradient from finite differences
   /// on the *same* grid for dimension n
   /// (colvar_grid_scalar)
-  inline cvm::real log_gradient_finite_diff(const std::vector<int> &ix0,
+  inline cvm::real log_gradient_finite_diff(colvar_grid_index const &ix0,
                                             int n = 0, int offset = 0)
   {
     cvm::real A0, A1, A2;
-    std::vector<int> ix = ix0;
+    size_t const addr = address(ix0);
 
-    // TODO this can be rewritten more concisely with wrap_edge()
-    if (periodic[n]) {
-      ix[n]--; wrap(ix);
-      A0 = value(ix) + offset;
-      ix = ix0;
-      ix[n]++; wrap(ix);
-      A1 = value(ix) + offset;
-      if (A0 * A1 == 0) {
-        return 0.; // can't handle empty bins
-      } else {
-        return (cvm::logn(A1) - cvm::logn(A0))
-          / (widths[n] * 2.);
-      }
-    } else if (ix[n] > 0 && ix[n] < nx[n]-1) { // not an edge
-      ix[n]--;
-      A0 = value(ix) + offset;
-      ix = ix0;
-      ix[n]++;
-      A1 = value(ix) + offset;
+    if (periodic[n] || (ix0[n] > 0 && ix0[n] < nx[n]-1)) { // not an edge
+      A0 = value(neighbor_address(ix0, addr, n, -1)) + offset;
+      A1 = value(neighbor_address(ix0, addr, n, 1)) + offset;
       if (A0 * A1 == 0) {
         return 0.; // can't handle empty bins
       } else {
@@ -1422,11 +1979,11 @@ public:
       }
     } else {
       // edge: use 2nd order derivative
-      int increment = (ix[n] == 0 ? 1 : -1);
+      int increment = (ix0[n] == 0 ? 1 : -1);
       // move right from left edge, or the other way around
-      A0 = value(ix) + offset;
-      ix[n] += increment; A1 = value(ix) + offset;
-      ix[n] += increment; A2 = value(ix) + offset;
+      A0 = value(addr) + offset;
+      A1 = value(neighbor_address(ix0, addr, n, increment)) + offset;
+      A2 = value(neighbor_address(ix0, addr, n, 2*increment)) + offset;
       if (A0 * A1 * A2 == 0) {
         return 0.; // can't handle empty bins
       } else {
@@ -1440,51 +1997,36 @@ public:
   /// \brief Return the gradient of discrete count from finite differences
   /// on the *same* grid for dimension n
   /// (colvar_grid_scalar)
-  inline cvm::real gradient_finite_diff(const std::vector<int> &ix0,
+  inline cvm::real gradient_finite_diff(colvar_grid_index const &ix0,
                                         int n = 0)
   {
     cvm::real A0, A1, A2;
-    std::vector<int> ix = ix0;
+    size_t const addr = address(ix0);
 
-    // FIXME this can be rewritten more concisely with wrap_edge()
-    if (periodic[n]) {
-      ix[n]--; wrap(ix);
-      A0 = value(ix);
-      ix = ix0;
-      ix[n]++; wrap(ix);
-      A1 = value(ix);
+    if (periodic[n] || (ix0[n] > 0 && ix0[n] < nx[n]-1)) { // not an edge
+      A0 = value(neighbor_address(ix0, addr, n, -1));
+      A1 = value(neighbor_address(ix0, addr, n, 1));
       if (A0 * A1 == 0) {
         return 0.; // can't handle empty bins
       } else {
         return (A1 - A0) / (widths[n] * 2.);
       }
-    } else if (ix[n] > 0 && ix[n] < nx[n]-1) { // not an edge
-      ix[n]--;
-      A0 = value(ix);
-      ix = ix0;
-      ix[n]++;
-      A1 = value(ix);
-      if (A0 * A1 == 0) {
-        return 0.; // can't handle empty bins
-      } else {
-        return cvm::real(A1 - A0) / (widths[n] * 2.);
-      }
     } else {
       // edge: use 2nd order derivative
-      int increment = (ix[n] == 0 ? 1 : -1);
+      int increment = (ix0[n] == 0 ? 1 : -1);
       // move right from left edge, or the other way around
-      A0 = value(ix);
-      ix[n] += increment; A1 = value(ix);
-      ix[n] += increment; A2 = value(ix);
-      return (-1.5 * cvm::real(A0) + 2. * cvm::real(A1)
-          - 0.5 * cvm::real(A2)) * increment / widths[n];
+      A0 = value(addr);
+      A1 = value(neighbor_address(ix0, addr, n, increment));
+      A2 = value(neighbor_address(ix0, addr, n, 2*increment));
+      return (-1.5 * A0 + 2. * A1
+          - 0.5 * A2) * increment / widths[n];
     }
   }
 
 
   /// \brief Return the value of the function at ix divided by its
   /// number of samples (if the count grid is defined)
-  virtual inline cvm::real value_output(std::vector<int> const &ix,
+  virtual inline cvm::real value_output(colvar_grid_index const &ix,
                                         size_t const &imult = 0) const override
   {
     int s;
@@ -1503,7 +2045,7 @@ public:
   }
 
   /// Enter or add value but also deal with count grid
-  virtual void value_input(std::vector<int> const &ix,
+  virtual void value_input(colvar_grid_index const &ix,
                            cvm::real const &new_value,
                            size_t const &imult = 0,
                            bool add = false) override
@@ -1515,14 +2057,14 @@ public:
     }
     if (add) {
       if (samples)
-        data[address(ix)] += new_value * samples->new_value(ix);
+        data.add(address(ix), new_value * samples->new_value(ix));
       else
-        data[address(ix)] += new_value;
+        data.add(address(ix), new_value);
     } else {
       if (samples)
-        data[address(ix)] = new_value * samples->value(ix);
+        data.set(address(ix), new_value * samples->value(ix));
       else
-        data[address(ix)] = new_value;
+        data.set(address(ix), new_value);
     }
     has_data = true;
   }
@@ -1640,15 +2182,15 @@ public:
                            std::string description = "grid file") const;
 
   /// \brief Get a vector with the binned value(s) indexed by ix, normalized if applicable
-  inline void vector_value(std::vector<int> const &ix, std::vector<cvm::real> &v) const
+  inline void vector_value(colvar_grid_index const &ix, std::vector<cvm::real> &v) const
   {
-    cvm::real const * p = &value(ix);
+    size_t const addr = address(ix);
     if (samples) {
       int count = samples->value(ix);
       if (count) {
         cvm::real invcount = 1.0 / count;
         for (size_t i = 0; i < mult; i++) {
-          v[i] = invcount * p[i];
+          v[i] = invcount * data[addr + i];
         }
       } else {
         for (size_t i = 0; i < mult; i++) {
@@ -1657,14 +2199,14 @@ public:
       }
     } else {
       for (size_t i = 0; i < mult; i++) {
-        v[i] = p[i];
+        v[i] = data[addr + i];
       }
     }
   }
 
 
   /// \brief Accumulate the value
-  inline void acc_value(std::vector<int> const &ix, std::vector<colvarvalue> const &values) {
+  inline void acc_value(colvar_grid_index const &ix, std::vector<colvarvalue> const &values) {
     for (size_t imult = 0; imult < mult; imult++) {
       data[address(ix) + imult] += values[imult].real_value;
     }
@@ -1674,7 +2216,7 @@ public:
 
   /// \brief Accumulate the gradient based on the force (i.e. sums the
   /// opposite of the force)
-  inline void acc_force(std::vector<int> const &ix, cvm::real const *forces) {
+  inline void acc_force(colvar_grid_index const &ix, cvm::real const *forces) {
     for (size_t imult = 0; imult < mult; imult++) {
       data[address(ix) + imult] -= forces[imult];
     }
@@ -1684,7 +2226,7 @@ public:
 
   /// \brief Return the value of the function at ix divided by its
   /// number of samples (if the count grid is defined)
-  virtual cvm::real value_output(std::vector<int> const &ix,
+  virtual cvm::real value_output(colvar_grid_index const &ix,
                                  size_t const &imult = 0) const override
   {
     int s;
@@ -1697,6 +2239,20 @@ public:
     }
   }
 
+  /// \brief Same as value_output(), but for the point with sequential number ip
+  /// (i.e. its address divided by the multiplicity), to loop over the whole grid
+  inline cvm::real value_output_flat(size_t ip, size_t imult = 0) const
+  {
+    int s;
+    if (samples) {
+      return ( (s = samples->value(ip)) > 0) ?
+        (data[ip * mult + imult] / cvm::real(s)) :
+        0.0;
+    } else {
+      return data[ip * mult + imult];
+    }
+  }
+
   /// Compute the inverse weight corresponding to smoothing factor as in ABF
   /// to normalize sums over steps into averages
   inline cvm::real smooth_inverse_weight(cvm::real weight)
@@ -1717,7 +2273,7 @@ public:
   /// number of samples (if the count grid is defined), possibly smoothed
   /// by a ramp function going from 0 to 1 between minSamples and fullSamples.
   /// Only makes sense if dimension is 1
-  virtual inline cvm::real value_output_smoothed(std::vector<int> const &ix, bool smoothed = true)
+  virtual inline cvm::real value_output_smoothed(colvar_grid_index const &ix, bool smoothed = true)
   {
     cvm::real weight, fact;
 
@@ -1733,13 +2289,13 @@ public:
       fact = weight > 0. ? 1. / weight : 0.;
     }
 
-    return fact * data[address(ix)];
+    return fact * data.get(address(ix));
   }
 
   /// \brief Obtain the vector value of the function at ix divided by its
   /// number of samples (if the count grid is defined), possibly smoothed
   /// by a ramp function going from 0 to 1 between minSamples and fullSamples.
-  inline void vector_value_smoothed(std::vector<int> const &ix, cvm::real *grad, bool smoothed = true)
+  inline void vector_value_smoothed(colvar_grid_index const &ix, cvm::real *grad, bool smoothed = true)
   {
     cvm::real weight, fact;
 
@@ -1755,7 +2311,7 @@ public:
       fact = weight > 0. ? 1. / weight : 0.;
     }
 
-    cvm::real *p = &(data[address(ix)]);
+    size_t const addr = address(ix);
 
     // Appease Clang analyzer, which likes to assume that mult is zero
     #ifdef __clang_analyzer__
@@ -1763,28 +2319,28 @@ public:
     #endif
 
     for (size_t imult = 0; imult < mult; imult++) {
-      grad[imult] = fact * p[imult];
+      grad[imult] = fact * data.get(addr + imult);
     }
   }
 
   /// \brief Get the value from a formatted output and transform it
   /// into the internal representation (it may have been rescaled or
   /// manipulated)
-  virtual void value_input(std::vector<int> const &ix,
+  virtual void value_input(colvar_grid_index const &ix,
                            cvm::real const &new_value,
                            size_t const &imult = 0,
                            bool add = false) override
   {
     if (add) {
       if (samples)
-        data[address(ix) + imult] += new_value * samples->new_value(ix);
+        data.add(address(ix) + imult, new_value * samples->new_value(ix));
       else
-        data[address(ix) + imult] += new_value;
+        data.add(address(ix) + imult, new_value);
     } else {
       if (samples)
-        data[address(ix) + imult] = new_value * samples->value(ix);
+        data.set(address(ix) + imult, new_value * samples->value(ix));
       else
-        data[address(ix) + imult] = new_value;
+        data.set(address(ix) + imult, new_value);
     }
     has_data = true;
   }
@@ -1798,7 +2354,7 @@ public:
     }
 
     cvm::real sum = 0.0;
-    for (std::vector<int> ix = new_index(); index_ok(ix); incr(ix)) {
+    for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix)) {
       sum += value_output_smoothed(ix, smoothed);
     }
 
@@ -1825,8 +2381,7 @@ class integrate_potential : public colvar_grid_scalar
 
   integrate_potential();
 
-  virtual ~integrate_potential()
-  {}
+  virtual ~integrate_potential();
 
   /// Constructor from a vector of colvars + gradient grid
   integrate_potential(std::vector<colvar *> &colvars, std::shared_ptr<colvar_grid_gradient> gradients);
@@ -1837,13 +2392,28 @@ class integrate_potential : public colvar_grid_scalar
   /// \brief Calculate potential from divergence (in 2D); return number of steps
   int integrate(const int itmax, const cvm::real & tol, cvm::real & err, bool verbose = true);
 
+  /// \brief Start integrating on a helper thread, from a snapshot of the current
+  /// divergence and using the current potential as initial guess
+  int integrate_async(const int itmax, const cvm::real &tol);
+
+  /// \brief Copy the result of the asynchronous integration into the grid, if
+  /// it is complete (or after waiting for it, if wait is true)
+  /// \return true if the grid was updated
+  bool integrate_async_collect(bool wait, int &iter, cvm::real &err);
+
+  /// Whether an asynchronous integration was started and not yet collected
+  inline bool integrate_async_pending() const
+  {
+    return bool(async_job);
+  }
+
   /// \brief Update matrix containing divergence and boundary conditions
   /// based on new gradient point value, in neighboring bins
-  void update_div_neighbors(const std::vector<int> &ix);
+  void update_div_neighbors(colvar_grid_index const &ix);
 
   /// \brief Update matrix containing divergence and boundary conditions
   /// called by update_div_neighbors and by colvarbias_abf::adiabatic_reweighting_update_gradient_pmf
-  void update_div_local(const std::vector<int> &ix);
+  void update_div_local(colvar_grid_index const &ix);
 
   /// \brief Set matrix containing divergence and boundary conditions
   /// based on complete gradient grid
@@ -1858,12 +2428,87 @@ class integrate_potential : public colvar_grid_scalar
   /// \brief Flag requesting the use of a smoothed version of the gradient (default: false)
   bool b_smoothed;
 
+  /// Methods to solve the Poisson equation in 2D and 3D
+  enum solver_type {
+    /// Conjugate gradient (default)
+    conjugate_gradient,
+    /// Conjugate gradient preconditioned by a multigrid V-cycle
+    multigrid,
+    /// Fast Fourier transform (only for grids periodic along all dimensions)
+    fft
+  };
+
+  /// Parse the name of a Poisson solver ("cg", "multigrid" or "fft")
+  static int parse_solver(std::string const &name, solver_type &s);
+
+  /// Select the Poisson solver; returns an error if it cannot be used for this grid
+  int set_solver(solver_type s);
+
+  /// Poisson solver currently in use
+  inline solver_type get_solver() const
+  {
+    return solver;
+  }
+
 
   protected:
 
   // Reference to gradient grid
   std::shared_ptr<colvar_grid_gradient> gradients;
 
+  /// Poisson solver in use
+  solver_type solver;
+
+  /// Whether the loops of the solvers are run by multiple threads
+  bool use_threads;
+
+  /// Helper thread and data of an asynchronous integration
+  struct async_integration;
+
+  /// Asynchronous integration in progress (if any)
+  std::unique_ptr<async_integration> async_job;
+
+  /// \brief Level of the multigrid hierarchy: the Laplacian is represented as
+  /// a weighted graph whose links join neighboring points along each dimension
+  struct multigrid_level {
+    /// Number of points along each dimension
+    std::vector<int> nx;
+    /// Periodicity along each dimension
+    std::vector<bool> periodic;
+    /// Weight of the link between each point and the next along each dimension
+    std::vector<std::vector<cvm::real>> weights;
+    /// Sum of the weights of the links of each point
+    std::vector<cvm::real> diagonal;
+    /// Index of the point of the next coarser level that contains each point
+    std::vector<size_t> coarse_index;
+    /// Right-hand side, solution and temporary arrays
+    std::vector<cvm::real> rhs, sol, tmp;
+  };
+
+  /// Multigrid hierarchy, from the grid itself (level 0) to the coarsest one
+  std::vector<multigrid_level> mg_levels;
+
+  /// \brief Cholesky factor of the matrix of the coarsest level (regularized
+  /// by a constant shift to remove its null space of constant vectors)
+  std::vector<cvm::real> mg_coarse_factor;
+
+  /// Build the multigrid hierarchy (depends only on the grid geometry)
+  void setup_multigrid();
+
+  /// Multiply by the (positive semi-definite) operator of a multigrid level
+  void multigrid_apply(multigrid_level const &level, std::vector<cvm::real> const &x,
+                       std::vector<cvm::real> &y) const;
+
+  /// Weighted Jacobi iterations on a multigrid level
+  void multigrid_smooth(multigrid_level &level, int sweeps, bool zero_guess);
+
+  /// Approximate solution of the system of a multigrid level by a V-cycle
+  void multigrid_vcycle(size_t ilevel);
+
+  /// \brief Solve the Poisson equation exactly by Fourier transform (fully
+  /// periodic grids only); returns the relative residual
+  cvm::real fft_solve(const std::vector<cvm::real> &b, std::vector<cvm::real> &x);
+
   /// Array holding divergence + boundary terms (modified Neumann) if not periodic
   std::vector<cvm::real> divergence;
 
@@ -1872,7 +2517,7 @@ class integrate_potential : public colvar_grid_scalar
   /// Obtain the gradient vector at given location ix, if available
   /// or zero if it is on the edge of the gradient grid
   /// ix gets wrapped in PBC
-  void get_grad(cvm::real * g, std::vector<int> &ix);
+  void get_grad(cvm::real * g, colvar_grid_index &ix);
 
   /// \brief Solve linear system based on CG, valid for symmetric matrices only
   void nr_linbcg_sym(const std::vector<cvm::real> &b, std::vector<cvm::real> &x,
@@ -1884,8 +2529,8 @@ class integrate_potential : public colvar_grid_scalar
   /// Multiplication by sparse matrix representing Lagrangian (or its transpose)
   void atimes(const std::vector<cvm::real> &x, std::vector<cvm::real> &r);
 
-//   /// Inversion of preconditioner matrix
-//   void asolve(const std::vector<cvm::real> &b, std::vector<cvm::real> &x);
+  /// Inversion of preconditioner matrix (multigrid V-cycle)
+  void asolve(const std::vector<cvm::real> &b, std::vector<cvm::real> &x);
 };
 
 #endif
@@ -12,11 +12,16 @@
 #ifndef COLVARGRID_DEF_H
 #define COLVARGRID_DEF_H
 
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <iterator>
+#include <limits>
+#include <type_traits>
 
 #include "colvarmodule.h"
 #include "colvarproxy.h"
+#include "colvarproxy_io.h"
 #include "colvar.h"
 #include "colvargrid.h"
 #include "colvars_memstream.h"
@@ -73,7 +78,7 @@ template <class T, class IST> IST &read_raw_template_(colvar_grid<T> &g, IST &is
 {
   auto const start_pos = is.tellg();
 
-  for (std::vector<int> ix = g.new_index(); g.index_ok(ix); g.incr(ix)) {
+  for (colvar_grid_index ix = g.new_index(); g.index_ok(ix); g.incr(ix)) {
     for (size_t imult = 0; imult < g.mult; imult++) {
       T new_value;
       if (is >> new_value) {
@@ -260,7 +265,16 @@ std::istream & colvar_grid<T>::read_multicol(std::istream &is, bool add)
   bool          remap;
   std::vector<T>        new_value;
   std::vector<int>      nx_read;
-  std::vector<int>      bin;
+  colvar_grid_index     bin;
+
+  if (colvar_grid_binary_format::detect(is)) {
+    std::string const buffer((std::istreambuf_iterator<char>(is)),
+                             std::istreambuf_iterator<char>());
+    if (read_binary(buffer.data(), buffer.size(), add) != COLVARS_OK) {
+      is.setstate(std::ios::failbit);
+    }
+    return is;
+  }
 
   if ( cv.size() > 0 && cv.size() != nd ) {
     cvm::error("Cannot read grid file: number of variables in file differs from number referenced by grid.\n");
@@ -335,7 +349,7 @@ std::istream & colvar_grid<T>::read_multicol(std::istream &is, bool add)
     }
   } else {
     // do not re-grid the data but assume the same grid is used
-    for (std::vector<int> ix = new_index(); index_ok(ix); incr(ix) ) {
+    for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix) ) {
       for (size_t i = 0; i < nd; i++ ) {
         is >> x;
       }
@@ -359,6 +373,14 @@ int colvar_grid<T>::read_multicol(std::string const &filename,
   if (!is) {
     return COLVARS_FILE_ERROR;
   }
+  if (colvar_grid_binary_format::detect(is)) {
+    colvarproxy_mapped_file file;
+    if (file.open(filename) == COLVARS_OK) {
+      cvm::main()->proxy->close_input_stream(filename);
+      return read_binary(file.data(), file.size(), add);
+    }
+    // Otherwise, the stream was not read from a file: use it instead
+  }
   if (colvar_grid<T>::read_multicol(is, add)) {
     cvm::main()->proxy->close_input_stream(filename);
     return COLVARS_OK;
@@ -387,7 +409,7 @@ std::ostream & colvar_grid<T>::write_multicol(std::ostream &os) const
        << periodic[i] << "\n";
   }
 
-  for (std::vector<int> ix = new_index(); index_ok(ix); incr(ix) ) {
+  for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix) ) {
 
     if (ix.back() == 0) {
       // if the last index is 0, add a new line to mark the new record
@@ -488,4 +510,293 @@ int colvar_grid<T>::write_opendx(std::string const &filename,
   return error_code;
 }
 
+
+template <class T>
+std::ostream & colvar_grid<T>::write_binary(std::ostream &os) const
+{
+  // Integer values (counts) are written as uint64, all others as float64
+  typedef typename std::conditional<std::is_integral<T>::value,
+                                    uint64_t, double>::type file_type;
+
+  uint32_t const header[4] = { colvar_grid_binary_format::version,
+                               colvar_grid_binary_format::byte_order_mark,
+                               std::is_integral<T>::value ? 1U : 0U,
+                               static_cast<uint32_t>(nd) };
+  uint64_t const mult_out = mult;
+  os.write(colvar_grid_binary_format::magic(), colvar_grid_binary_format::magic_size);
+  os.write(reinterpret_cast<char const *>(header), sizeof(header));
+  os.write(reinterpret_cast<char const *>(&mult_out), sizeof(mult_out));
+
+  for (size_t i = 0; i < nd; i++) {
+    double const dim_real[2] = { lower_boundaries[i].real_value, widths[i] };
+    int64_t const dim_int[2] = { nx[i], periodic[i] ? 1 : 0 };
+    os.write(reinterpret_cast<char const *>(dim_real), sizeof(dim_real));
+    os.write(reinterpret_cast<char const *>(dim_int), sizeof(dim_int));
+  }
+
+  // Write the values in a single pass, through a fixed-size buffer
+  size_t const buffer_size = 65536;
+  std::vector<file_type> buffer;
+  buffer.reserve(buffer_size + mult);
+  for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix)) {
+    for (size_t imult = 0; imult < mult; imult++) {
+      buffer.push_back(static_cast<file_type>(value_output(ix, imult)));
+    }
+    if (buffer.size() >= buffer_size) {
+      os.write(reinterpret_cast<char const *>(buffer.data()),
+               buffer.size() * sizeof(file_type));
+      buffer.clear();
+    }
+  }
+  if (buffer.size()) {
+    os.write(reinterpret_cast<char const *>(buffer.data()),
+             buffer.size() * sizeof(file_type));
+  }
+
+  return os;
+}
+
+
+template <class T>
+int colvar_grid<T>::write_binary(std::string const &filename,
+                                 std::string description) const
+{
+  int error_code = COLVARS_OK;
+  std::ostream &os = cvm::main()->proxy->output_stream(filename, description);
+  if (!os) {
+    return COLVARS_FILE_ERROR;
+  }
+  error_code |= colvar_grid<T>::write_binary(os) ? COLVARS_OK :
+    COLVARS_FILE_ERROR;
+  cvm::main()->proxy->close_output_stream(filename);
+  return error_code;
+}
+
+
+template <class T>
+int colvar_grid<T>::read_binary(char const *buffer, size_t size, bool add)
+{
+  typedef typename std::conditional<std::is_integral<T>::value,
+                                    uint64_t, double>::type file_type;
+
+  if (!colvar_grid_binary_format::detect(buffer, size) ||
+      (size < colvar_grid_binary_format::header_size)) {
+    return cvm::error("Error: invalid binary grid data.\n", COLVARS_INPUT_ERROR);
+  }
+
+  char const *p = buffer + colvar_grid_binary_format::magic_size;
+  uint32_t header[4];
+  uint64_t mult_in;
+  std::memcpy(header, p, sizeof(header));
+  p += sizeof(header);
+  std::memcpy(&mult_in, p, sizeof(mult_in));
+  p += sizeof(mult_in);
+
+  if (header[0] != colvar_grid_binary_format::version) {
+    return cvm::error("Error: unsupported version of binary grid data: " +
+                      cvm::to_str(static_cast<size_t>(header[0])) + ".\n", COLVARS_INPUT_ERROR);
+  }
+  if (header[1] != colvar_grid_binary_format::byte_order_mark) {
+    return cvm::error("Error: binary grid data was written on a machine with "
+                      "different byte order.\n", COLVARS_INPUT_ERROR);
+  }
+  if (header[2] != (std::is_integral<T>::value ? 1U : 0U)) {
+    return cvm::error("Error: binary grid data contains values of the wrong type.\n",
+                      COLVARS_INPUT_ERROR);
+  }
+  if ((header[3] != nd) || (mult_in != mult)) {
+    return cvm::error("Error reading grid: wrong number of collective variables "
+                      "or of values per grid point.\n", COLVARS_INPUT_ERROR);
+  }
+
+  size_t const data_offset = colvar_grid_binary_format::header_size +
+    nd * colvar_grid_binary_format::dimension_size;
+  if (size < data_offset) {
+    return cvm::error("Error: binary grid data is truncated.\n", COLVARS_INPUT_ERROR);
+  }
+
+  std::vector<cvm::real> lower_read(nd), width_read(nd);
+  std::vector<int> nx_read(nd);
+  size_t np_read = 1;
+  bool remap = false;
+  for (size_t i = 0; i < nd; i++) {
+    double dim_real[2];
+    int64_t dim_int[2];
+    std::memcpy(dim_real, p, sizeof(dim_real));
+    p += sizeof(dim_real);
+    std::memcpy(dim_int, p, sizeof(dim_int));
+    p += sizeof(dim_int);
+    lower_read[i] = dim_real[0];
+    width_read[i] = dim_real[1];
+    // Reject sizes that cannot be indexed, or whose product overflows
+    if ((dim_int[0] <= 0) || (dim_int[0] > std::numeric_limits<int>::max()) ||
+        (np_read > std::numeric_limits<size_t>::max() / static_cast<size_t>(dim_int[0]))) {
+      return cvm::error("Error: binary grid data has an invalid number of points (" +
+                        cvm::to_str(static_cast<long long>(dim_int[0])) + ") along colvar " +
+                        cvm::to_str(i+1) + ".\n", COLVARS_INPUT_ERROR);
+    }
+    nx_read[i] = static_cast<int>(dim_int[0]);
+    np_read *= static_cast<size_t>(nx_read[i]);
+    if ( (cvm::fabs(lower_read[i] - lower_boundaries[i].real_value) > 1.0e-10) ||
+         (cvm::fabs(width_read[i] - widths[i] ) > 1.0e-10) ||
+         (nx_read[i] != nx[i]) ) {
+      cvm::log("Warning: reading from different grid definition (colvar "
+               + cvm::to_str(i+1) + "); remapping data on new grid.\n");
+      remap = true;
+    }
+  }
+
+  // Compare the number of points rather than the number of bytes, so that
+  // the check itself cannot overflow
+  if ((mult == 0) || (np_read > (size - data_offset) / (mult * sizeof(file_type)))) {
+    return cvm::error("Error: binary grid data is truncated.\n", COLVARS_INPUT_ERROR);
+  }
+
+  if (this->has_parent_data && add) {
+    new_data.resize(data.size());
+  }
+
+  file_type value;
+
+  if (remap) {
+    // Assign each point of the file's grid to the bin containing its center
+    colvar_grid_index ix_read(nd), bin(nd);
+    for (size_t ip = 0; ip < np_read; ip++) {
+      for (size_t i = 0; i < nd; i++) {
+        bin[i] = value_to_bin_scalar(lower_read[i] + width_read[i] * (0.5 + ix_read[i]), i);
+      }
+      // Wrap points across PBCs, and ignore out of bounds points otherwise
+      wrap_detect_edge(bin);
+      for (size_t imult = 0; imult < mult; imult++) {
+        std::memcpy(&value, p, sizeof(file_type));
+        p += sizeof(file_type);
+        if (index_ok(bin)) {
+          value_input(bin, static_cast<T>(value), imult, add);
+        }
+      }
+      for (int i = nd-1; i >= 0; i--) {
+        if (++ix_read[i] < nx_read[i]) break;
+        ix_read[i] = 0;
+      }
+    }
+  } else {
+    for (colvar_grid_index ix = new_index(); index_ok(ix); incr(ix)) {
+      for (size_t imult = 0; imult < mult; imult++) {
+        std::memcpy(&value, p, sizeof(file_type));
+        p += sizeof(file_type);
+        value_input(ix, static_cast<T>(value), imult, add);
+      }
+    }
+  }
+
+  has_data = true;
+  return COLVARS_OK;
+}
+
+
+template <class T>
+int colvar_grid<T>::read_binary(std::string const &filename,
+                                std::string description,
+                                bool add)
+{
+  colvarproxy_mapped_file file;
+  if (file.open(filename) != COLVARS_OK) {
+    return cvm::error("Error: cannot read " + description + " \"" + filename + "\".\n",
+                      COLVARS_FILE_ERROR);
+  }
+  return read_binary(file.data(), file.size(), add);
+}
+
+
+template <class T>
+int colvar_grid<T>::write_file(std::string const &filename,
+                               std::string description) const
+{
+  if (cvm::binary_grid_files) {
+    return write_binary(filename, description);
+  }
+  return write_multicol(filename, description);
+}
+
+
+template <class T>
+int colvar_grid<T>::replicas_sum(colvar_grid<T> const &contribution)
+{
+  colvarproxy *proxy = cvm::main()->proxy;
+  size_t const n = contribution.data.size();
+  if (data.size() != n) {
+    return cvm::error("Error: cannot sum grids of different sizes across replicas.\n",
+                      COLVARS_BUG_ERROR);
+  }
+
+  size_t const tile_size = colvar_grid_storage<T>::tile_size;
+  size_t const num_tiles = (n + tile_size - 1) / tile_size;
+  size_t const chunk_size = replicas_sum_chunk_size;
+
+  // Tiles allocated on at least one replica: the others sum to zero and need
+  // not be exchanged.  This requires a zero fill value on every replica
+  // (dense grids mark all tiles as allocated), and all replicas must agree
+  // on it to issue the same sequence of collective calls.
+  size_t cannot_skip = (contribution.data.sparse() &&
+                        !(contribution.data.fill_value() == T())) ? 1 : 0;
+  if (proxy->replica_comm_allreduce_sum(&cannot_skip, 1) != COLVARS_OK) {
+    return cvm::error("Error: could not combine grid data from replicas.\n", COLVARS_ERROR);
+  }
+  std::vector<size_t> tiles_used;
+  bool const skip_tiles = (cannot_skip == 0);
+  if (skip_tiles) {
+    tiles_used.resize(num_tiles);
+    for (size_t it = 0; it < num_tiles; it++) {
+      tiles_used[it] = contribution.data.allocated(it * tile_size) ? 1 : 0;
+    }
+    for (size_t start = 0; start < num_tiles; start += chunk_size) {
+      size_t const count = std::min(chunk_size, num_tiles - start);
+      if (proxy->replica_comm_allreduce_sum(tiles_used.data() + start,
+                                            static_cast<int>(count)) != COLVARS_OK) {
+        return cvm::error("Error: could not combine grid data from replicas.\n",
+                          COLVARS_ERROR);
+      }
+    }
+  }
+
+  std::vector<T> buffer;
+  size_t begin = 0;
+  while (begin < n) {
+    // Find the next range of elements to exchange
+    size_t end = n;
+    if (skip_tiles) {
+      size_t it = begin / tile_size;
+      while ((it < num_tiles) && !tiles_used[it]) {
+        // Nobody has data here: reset the result to zero
+        size_t const tile_end = std::min((it + 1) * tile_size, n);
+        for (size_t i = it * tile_size; i < tile_end; i++) {
+          data.set(i, T());
+        }
+        it++;
+      }
+      begin = std::min(it * tile_size, n);
+      while ((it < num_tiles) && tiles_used[it]) it++;
+      end = std::min(it * tile_size, n);
+    }
+    end = std::min(end, begin + chunk_size);
+    if (begin == end) break;
+
+    buffer.resize(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      buffer[i - begin] = contribution.data.get(i);
+    }
+    if (proxy->replica_comm_allreduce_sum(buffer.data(), static_cast<int>(end - begin)) !=
+        COLVARS_OK) {
+      return cvm::error("Error: could not combine grid data from replicas.\n", COLVARS_ERROR);
+    }
+    for (size_t i = begin; i < end; i++) {
+      data.set(i, buffer[i - begin]);
+    }
+    begin = end;
+  }
+
+  has_data = true;
+  return COLVARS_OK;
+}
+
 #endif
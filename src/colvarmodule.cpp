@@ -7,6 +7,7 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <memory>
@@ -169,6 +170,12 @@ colvarmodule::colvarmodule(colvarproxy *proxy_in)
 
   colvarmodule::debug_gradients_step_size = 1.0e-07;
 
+  colvarmodule::sparse_grids = false;
+  colvarmodule::binary_grid_files = false;
+  colvarmodule::smp_task_graph = false;
+  colvarmodule::defer_gradients = false;
+  colvarmodule::batch_extended_Lagrangian = true;
+
   colvarmodule::rotation::monitor_crossings = false;
   colvarmodule::rotation::crossing_threshold = 1.0e-02;
 
@@ -423,6 +430,21 @@ int colvarmodule::parse_global_params(std::string const &conf)
                     colvarmodule::rotation::crossing_threshold,
                     colvarparse::parse_silent);
 
+  if (parse->get_keyval(conf, "smpTaskGraph", smp_task_graph, smp_task_graph)) {
+    if (smp_task_graph && (proxy->check_smp_enabled() != COLVARS_OK)) {
+      cvm::log("Warning: smpTaskGraph has no effect without SMP parallelism.\n");
+    }
+  }
+
+  parse->get_keyval(conf, "deferGradients", defer_gradients, defer_gradients);
+
+  parse->get_keyval(conf, "batchExtendedLagrangian", batch_extended_Lagrangian,
+                    batch_extended_Lagrangian);
+
+  parse->get_keyval(conf, "sparseGrids", sparse_grids, sparse_grids);
+
+  parse->get_keyval(conf, "binaryGridFiles", binary_grid_files, binary_grid_files);
+
   parse->get_keyval(conf, "colvarsTrajFrequency", cv_traj_freq, cv_traj_freq);
   parse->get_keyval(conf, "colvarsRestartFrequency",
                     restart_out_freq, restart_out_freq);
@@ -835,8 +857,12 @@ int colvarmodule::calc()
              cvm::to_str(cvm::step_absolute())+"\n");
   }
 
-  error_code |= calc_colvars();
-  error_code |= calc_biases();
+  if (smp_task_graph && (proxy->check_smp_enabled() == COLVARS_OK)) {
+    error_code |= calc_task_graph();
+  } else {
+    error_code |= calc_colvars();
+    error_code |= calc_biases();
+  }
   error_code |= update_colvar_forces();
 
   error_code |= analyze();
@@ -893,12 +919,8 @@ int colvarmodule::calc()
 }
 
 
-int colvarmodule::calc_colvars()
+int colvarmodule::update_active_colvars()
 {
-  if (cvm::debug())
-    cvm::log("Calculating collective variables.\n");
-  // calculate collective variables and their gradients
-
   // First, we need to decide which biases are awake
   // so they can activate colvars as needed
   std::vector<colvarbias *>::iterator bi;
@@ -913,7 +935,6 @@ int colvarmodule::calc_colvars()
     }
   }
 
-  int error_code = COLVARS_OK;
   std::vector<colvar *>::iterator cvi;
 
   // Determine which colvars are active at this iteration
@@ -935,41 +956,79 @@ int colvarmodule::calc_colvars()
     }
   }
 
-  // if SMP support is available, split up the work
-  if (proxy->check_smp_enabled() == COLVARS_OK) {
+  return COLVARS_OK;
+}
 
-    // first, calculate how much work (currently, how many active CVCs) each colvar has
 
-    variables_active_smp()->clear();
-    variables_active_smp_items()->clear();
+int colvarmodule::update_smp_items()
+{
+  int error_code = COLVARS_OK;
+  std::vector<colvar *>::iterator cvi;
 
-    variables_active_smp()->reserve(variables_active()->size());
-    variables_active_smp_items()->reserve(variables_active()->size());
+  // first, calculate how much work (currently, how many active CVCs) each colvar has
 
-    // set up a vector containing all components
-    cvm::increase_depth();
-    for (cvi = variables_active()->begin(); cvi != variables_active()->end(); cvi++) {
+  variables_active_smp()->clear();
+  variables_active_smp_items()->clear();
 
-      error_code |= (*cvi)->update_cvc_flags();
+  variables_active_smp()->reserve(variables_active()->size());
+  variables_active_smp_items()->reserve(variables_active()->size());
 
-      size_t num_items = (*cvi)->num_active_cvcs();
-      variables_active_smp()->reserve(variables_active_smp()->size() + num_items);
-      variables_active_smp_items()->reserve(variables_active_smp_items()->size() + num_items);
-      for (size_t icvc = 0; icvc < num_items; icvc++) {
-        variables_active_smp()->push_back(*cvi);
-        variables_active_smp_items()->push_back(icvc);
-      }
+  // set up a vector containing all components
+  cvm::increase_depth();
+  for (cvi = variables_active()->begin(); cvi != variables_active()->end(); cvi++) {
+
+    error_code |= (*cvi)->update_cvc_flags();
+
+    size_t num_items = (*cvi)->num_active_cvcs();
+    (*cvi)->smp_cvc_costs.resize(num_items, 0.0);
+    variables_active_smp()->reserve(variables_active_smp()->size() + num_items);
+    variables_active_smp_items()->reserve(variables_active_smp_items()->size() + num_items);
+    for (size_t icvc = 0; icvc < num_items; icvc++) {
+      variables_active_smp()->push_back(*cvi);
+      variables_active_smp_items()->push_back(icvc);
     }
-    cvm::decrease_depth();
+  }
+  cvm::decrease_depth();
+
+  // Dispatch the most expensive items first (based on their cost at the
+  // previous step), so that the cheaper ones fill in the gaps at the end
+  sort_smp_items_by_cost();
+
+  return error_code;
+}
+
+
+int colvarmodule::collect_colvars_smp()
+{
+  int error_code = COLVARS_OK;
+  cvm::increase_depth();
+  for (std::vector<colvar *>::iterator cvi = variables_active()->begin();
+       cvi != variables_active()->end(); cvi++) {
+    error_code |= (*cvi)->collect_cvc_data();
+  }
+  cvm::decrease_depth();
+  return error_code;
+}
+
+
+int colvarmodule::calc_colvars()
+{
+  if (cvm::debug())
+    cvm::log("Calculating collective variables.\n");
+  // calculate collective variables and their gradients
+
+  int error_code = update_active_colvars();
+  std::vector<colvar *>::iterator cvi;
+
+  // if SMP support is available, split up the work
+  if (proxy->check_smp_enabled() == COLVARS_OK) {
+
+    error_code |= update_smp_items();
 
     // calculate colvar components in parallel
     error_code |= proxy->smp_colvars_loop();
 
-    cvm::increase_depth();
-    for (cvi = variables_active()->begin(); cvi != variables_active()->end(); cvi++) {
-      error_code |= (*cvi)->collect_cvc_data();
-    }
-    cvm::decrease_depth();
+    error_code |= collect_colvars_smp();
 
   } else {
 
@@ -989,22 +1048,36 @@ int colvarmodule::calc_colvars()
 }
 
 
-int colvarmodule::calc_biases()
+void colvarmodule::sort_smp_items_by_cost()
 {
-  // update the biases and communicate their forces to the collective
-  // variables
-  if (cvm::debug() && num_biases())
-    cvm::log("Updating collective variable biases.\n");
+  size_t const num_items = colvars_smp.size();
+  std::vector<cvm::real> costs(num_items);
+  std::vector<size_t> order(num_items);
+  for (size_t i = 0; i < num_items; i++) {
+    costs[i] = colvars_smp[i]->smp_cvc_costs[colvars_smp_items[i]];
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+  std::vector<colvar *> sorted_colvars(num_items);
+  std::vector<int> sorted_items(num_items);
+  for (size_t i = 0; i < num_items; i++) {
+    sorted_colvars[i] = colvars_smp[order[i]];
+    sorted_items[i] = colvars_smp_items[order[i]];
+  }
+  colvars_smp.swap(sorted_colvars);
+  colvars_smp_items.swap(sorted_items);
+}
+
 
+int colvarmodule::update_active_biases()
+{
   // set biasing forces to zero before biases are calculated and summed over
   for (std::vector<colvar *>::iterator cvi = colvars.begin();
        cvi != colvars.end(); cvi++) {
     (*cvi)->reset_bias_force();
   }
 
-  std::vector<colvarbias *>::iterator bi;
-  int error_code = COLVARS_OK;
-
   // Total bias energy is reset before calling scripted biases
   total_bias_energy = 0.0;
 
@@ -1012,22 +1085,49 @@ int colvarmodule::calc_biases()
   // which may have changed based on f_cvb_awake in calc_colvars()
   biases_active()->clear();
   biases_active()->reserve(biases.size());
-  for (bi = biases.begin(); bi != biases.end(); bi++) {
+  for (std::vector<colvarbias *>::iterator bi = biases.begin(); bi != biases.end(); bi++) {
     if ((*bi)->is_enabled()) {
       biases_active()->push_back(*bi);
     }
   }
 
-  bool biases_need_main_thread = false;
-  for (bi = biases_active()->begin(); bi != biases_active()->end(); bi++) {
+  return COLVARS_OK;
+}
+
+
+bool colvarmodule::biases_need_main_thread()
+{
+  for (std::vector<colvarbias *>::iterator bi = biases_active()->begin();
+       bi != biases_active()->end(); bi++) {
     if ((*bi)->replica_share_freq() > 0) {
       // Biases that share data with replicas need read/write access to I/O or MPI
-      biases_need_main_thread = true;
+      return true;
     }
   }
+  return false;
+}
+
+
+int colvarmodule::calc_biases()
+{
+  // update the biases and communicate their forces to the collective
+  // variables
+  if (cvm::debug() && num_biases())
+    cvm::log("Updating collective variable biases.\n");
+
+  int error_code = update_active_biases();
+  error_code |= update_biases();
+  return error_code;
+}
+
+
+int colvarmodule::update_biases()
+{
+  std::vector<colvarbias *>::iterator bi;
+  int error_code = COLVARS_OK;
 
   // If SMP support is available, split up the work (unless biases need to use main thread's memory)
-  if (proxy->check_smp_enabled() == COLVARS_OK && !biases_need_main_thread) {
+  if (proxy->check_smp_enabled() == COLVARS_OK && !biases_need_main_thread()) {
 
     if (use_scripted_forces && !scripting_after_biases) {
       // calculate biases and scripted forces in parallel
@@ -1063,6 +1163,62 @@ int colvarmodule::calc_biases()
 }
 
 
+int colvarmodule::calc_task_graph()
+{
+  if (cvm::debug())
+    cvm::log("Calculating collective variables and biases as a task graph.\n");
+
+  int error_code = update_active_colvars();
+  error_code |= update_smp_items();
+  error_code |= update_active_biases();
+
+  bool use_graph = !biases_need_main_thread();
+  for (std::vector<colvar *>::iterator cvi = variables_active()->begin();
+       cvi != variables_active()->end(); cvi++) {
+    if ((*cvi)->is_enabled(colvardeps::f_cv_scripted)) {
+      // Scripted functions are evaluated on the main thread
+      use_graph = false;
+    }
+  }
+
+  int graph_error_code = use_graph ? proxy->smp_task_graph() : COLVARS_NOT_IMPLEMENTED;
+
+  if (graph_error_code == COLVARS_NOT_IMPLEMENTED) {
+    // Compute all colvars before the biases
+    error_code |= proxy->smp_colvars_loop();
+    error_code |= collect_colvars_smp();
+    error_code |= update_biases();
+  } else {
+    error_code |= graph_error_code;
+    for (std::vector<colvarbias *>::iterator bi = biases_active()->begin();
+         bi != biases_active()->end(); bi++) {
+      total_bias_energy += (*bi)->get_energy();
+    }
+  }
+
+  error_code |= cvm::get_error();
+  return error_code;
+}
+
+
+int colvarmodule::calc_deferred_gradients()
+{
+  int error_code = COLVARS_NOT_IMPLEMENTED;
+  if (proxy->check_smp_enabled() == COLVARS_OK) {
+    // Same items as the colvar calculation at this step
+    error_code = proxy->smp_gradients_loop();
+  }
+  if (error_code == COLVARS_NOT_IMPLEMENTED) {
+    error_code = COLVARS_OK;
+    for (std::vector<colvar *>::iterator cvi = variables_active()->begin();
+         cvi != variables_active()->end(); cvi++) {
+      error_code |= (*cvi)->calc_deferred_gradients(0, (*cvi)->num_active_cvcs());
+    }
+  }
+  return error_code;
+}
+
+
 int colvarmodule::update_colvar_forces()
 {
   int error_code = COLVARS_OK;
@@ -1098,7 +1254,11 @@ int colvarmodule::update_colvar_forces()
   cvm::increase_depth();
   for (cvi = variables()->begin(); cvi != variables()->end(); cvi++) {
     // Inactive colvars will only reset their forces and return 0 energy
-    total_colvar_energy += (*cvi)->update_forces_energy();
+    total_colvar_energy += (*cvi)->update_forces_energy(batch_extended_Lagrangian);
+  }
+  if (ext_batch.colvars.size() > 0) {
+    // Extended-Lagrangian coordinates added by the loop above
+    total_colvar_energy += integrate_extended_Lagrangian_batch();
   }
   cvm::decrease_depth();
   if (cvm::debug())
@@ -1107,6 +1267,10 @@ int colvarmodule::update_colvar_forces()
 
   // make collective variables communicate their forces to their
   // coupled degrees of freedom (i.e. atoms)
+  if (defer_gradients) {
+    error_code |= calc_deferred_gradients();
+  }
+
   if (cvm::debug())
     cvm::log("Communicating forces from the colvars to the atoms.\n");
   cvm::increase_depth();
@@ -1124,6 +1288,90 @@ int colvarmodule::update_colvar_forces()
 }
 
 
+void colvarmodule::add_extended_Lagrangian_batch(colvar *cv, real x, real v, real f,
+                                                 real mass, real dt, real friction,
+                                                 real noise, bool thermostat)
+{
+  ext_batch.colvars.push_back(cv);
+  ext_batch.x.push_back(x);
+  ext_batch.v.push_back(v);
+  ext_batch.f.push_back(f);
+  ext_batch.mass.push_back(mass);
+  ext_batch.dt.push_back(dt);
+  ext_batch.half_kick.push_back(0.5 * dt / mass);
+  ext_batch.friction.push_back(friction);
+  ext_batch.noise.push_back(noise);
+  ext_batch.thermostat.push_back(thermostat ? 1 : 0);
+}
+
+
+cvm::real colvarmodule::integrate_extended_Lagrangian_batch()
+{
+  size_t const n = ext_batch.colvars.size();
+  size_t i;
+
+  // Random numbers are drawn in the order of the colvars, as when each
+  // colvar was integrated separately
+  ext_batch.random.assign(n, 0.0);
+  for (i = 0; i < n; i++) {
+    if (ext_batch.thermostat[i]) {
+      ext_batch.random[i] = rand_gaussian();
+    }
+  }
+  ext_batch.kinetic.resize(n);
+
+  real *const x = ext_batch.x.data();
+  real *const v = ext_batch.v.data();
+  real *const kinetic = ext_batch.kinetic.data();
+  real const *const f = ext_batch.f.data();
+  real const *const mass = ext_batch.mass.data();
+  real const *const dt = ext_batch.dt.data();
+  real const *const half_kick = ext_batch.half_kick.data();
+  real const *const friction = ext_batch.friction.data();
+  real const *const noise = ext_batch.noise.data();
+  real const *const random = ext_batch.random.data();
+
+  // Same BAOA scheme as colvar::update_extended_Lagrangian()
+  for (i = 0; i < n; i++) {
+    // [B] first half-step, giving the velocity at t for the kinetic energy
+    v[i] += half_kick[i] * f[i];
+    kinetic[i] = 0.5 * mass[i] * (v[i] * v[i]);
+    // [B] second half-step
+    v[i] += half_kick[i] * f[i];
+    // [A] half-step in position
+    x[i] += (0.5 * dt[i]) * v[i];
+  }
+  for (i = 0; i < n; i++) {
+    // [O] (friction is 1 and noise 0 without a thermostat)
+    v[i] = friction[i] * v[i];
+    v[i] += noise[i] * random[i];
+  }
+  for (i = 0; i < n; i++) {
+    // [A] second half-step in position
+    x[i] += (0.5 * dt[i]) * v[i];
+  }
+
+  real total_kinetic_energy = 0.0;
+  for (i = 0; i < n; i++) {
+    ext_batch.colvars[i]->set_extended_Lagrangian_state(x[i], v[i], kinetic[i]);
+    total_kinetic_energy += kinetic[i];
+  }
+
+  ext_batch.colvars.clear();
+  ext_batch.x.clear();
+  ext_batch.v.clear();
+  ext_batch.f.clear();
+  ext_batch.mass.clear();
+  ext_batch.dt.clear();
+  ext_batch.half_kick.clear();
+  ext_batch.friction.clear();
+  ext_batch.noise.clear();
+  ext_batch.thermostat.clear();
+
+  return total_kinetic_energy;
+}
+
+
 int colvarmodule::calc_scripted_forces()
 {
   // Run user force script, if provided,
@@ -1966,6 +2214,46 @@ std::ostream & colvarmodule::write_traj(std::ostream &os)
 }
 
 
+namespace {
+
+  /// \brief Holds the proxy's SMP lock while in scope; messages and error
+  /// bits from concurrent tasks are serialized this way.  A thread that already
+  /// holds it (e.g. a proxy logging from within error()) does not lock again
+  class smp_message_lock {
+
+  public:
+
+    smp_message_lock(colvarproxy *proxy_in)
+      : proxy(proxy_in), locked(false)
+    {
+      if (proxy && !held) {
+        proxy->smp_lock();
+        held = locked = true;
+      }
+    }
+
+    ~smp_message_lock()
+    {
+      if (locked) {
+        held = false;
+        proxy->smp_unlock();
+      }
+    }
+
+  private:
+
+    colvarproxy *proxy;
+
+    bool locked;
+
+    /// Whether the current thread holds the lock
+    static thread_local bool held;
+  };
+
+  thread_local bool smp_message_lock::held = false;
+}
+
+
 void colvarmodule::log(std::string const &message, int min_log_level)
 {
   if (cvm::log_level() < min_log_level) return;
@@ -1974,6 +2262,7 @@ void colvarmodule::log(std::string const &message, int min_log_level)
     (message[message.size()-1] == '\n' ? "" : "\n") : "";
   // allow logging when the module is not fully initialized
   size_t const d = (cvm::main() != NULL) ? depth() : 0;
+  smp_message_lock const lock(proxy);
   if (d > 0) {
     proxy->log((std::string(2*d, ' ')) + message + trailing_newline);
   } else {
@@ -2003,12 +2292,11 @@ size_t & colvarmodule::depth()
   if (proxy->check_smp_enabled() == COLVARS_OK) {
     int const nt = proxy->smp_num_threads();
     if (int(cv->depth_v.size()) != nt) {
-      proxy->smp_lock();
+      smp_message_lock const lock(proxy);
       // update array of depths
       if (cv->depth_v.size() > 0) { cv->depth_s = cv->depth_v[0]; }
       cv->depth_v.clear();
       cv->depth_v.assign(nt, cv->depth_s);
-      proxy->smp_unlock();
     }
     return cv->depth_v[proxy->smp_thread_id()];
   }
@@ -2022,9 +2310,8 @@ void colvarmodule::set_error_bits(int code)
     cvm::log("Error: set_error_bits() received negative error code.\n");
     return;
   }
-  proxy->smp_lock();
+  smp_message_lock const lock(proxy);
   errorCode |= code | COLVARS_ERROR;
-  proxy->smp_unlock();
 }
 
 
@@ -2036,9 +2323,8 @@ bool colvarmodule::get_error_bit(int code)
 
 void colvarmodule::clear_error()
 {
-  proxy->smp_lock();
+  smp_message_lock const lock(proxy);
   errorCode = COLVARS_OK;
-  proxy->smp_unlock();
   proxy->clear_error_msgs();
 }
 
@@ -2050,6 +2336,7 @@ int colvarmodule::error(std::string const &message, int code)
   std::string const trailing_newline = (message.size() > 0) ?
     (message[message.size()-1] == '\n' ? "" : "\n") : "";
   size_t const d = depth();
+  smp_message_lock const lock(proxy);
   if (d > 0) {
     proxy->error((std::string(2*d, ' ')) + message + trailing_newline);
   } else {
@@ -2609,6 +2896,11 @@ colvarproxy *colvarmodule::proxy = NULL;
 
 // static runtime data
 cvm::real colvarmodule::debug_gradients_step_size = 1.0e-07;
+bool      colvarmodule::sparse_grids = false;
+bool      colvarmodule::binary_grid_files = false;
+bool      colvarmodule::smp_task_graph = false;
+bool      colvarmodule::defer_gradients = false;
+bool      colvarmodule::batch_extended_Lagrangian = true;
 int       colvarmodule::errorCode = 0;
 int       colvarmodule::log_level_ = 10;
 cvm::step_number colvarmodule::it = 0;
@@ -249,6 +249,26 @@ public:
   /// dt)
   static real debug_gradients_step_size;
 
+  /// \brief Whether grids created from now on store their data in tiles that
+  /// are only allocated where needed (see colvar_grid_storage)
+  static bool sparse_grids;
+
+  /// \brief Whether grid files are written in binary format (see
+  /// colvar_grid_binary_format) instead of the multicolumn text format
+  static bool binary_grid_files;
+
+  /// \brief Whether colvars and biases are computed as a graph of tasks, where
+  /// each bias starts as soon as its colvars are available
+  static bool smp_task_graph;
+
+  /// \brief Whether atomic gradients are only computed for colvars with a
+  /// nonzero applied force (see colvar::defer_gradients())
+  static bool defer_gradients;
+
+  /// \brief Whether the extended-Lagrangian coordinates of all colvars are
+  /// integrated together in one pass (see integrate_extended_Lagrangian_batch())
+  static bool batch_extended_Lagrangian;
+
 private:
 
   /// Prefix for all output files for this run
@@ -276,6 +296,27 @@ private:
   /// Indexes of the items to calculate for each colvar
   std::vector<int> colvars_smp_items;
 
+  /// Sort colvars_smp and colvars_smp_items by decreasing cost at the last step
+  void sort_smp_items_by_cost();
+
+  /// Update the wake state of biases and colvars, and the list of active colvars
+  int update_active_colvars();
+
+  /// Update the cvc flags of active colvars and the list of SMP items
+  int update_smp_items();
+
+  /// Collect the data of active colvars after their SMP items are computed
+  int collect_colvars_smp();
+
+  /// Reset the bias forces and energy, and update the list of active biases
+  int update_active_biases();
+
+  /// Whether any active bias must be updated on the main thread
+  bool biases_need_main_thread();
+
+  /// Update the active biases and add up their energies
+  int update_biases();
+
   /// Array of named atom groups
   std::vector<atom_group *> named_atom_groups;
 public:
@@ -556,9 +597,36 @@ public:
   /// Calculate biases
   int calc_biases();
 
+  /// \brief Calculate colvars and biases with proxy->smp_task_graph(), or
+  /// one after the other when that is not possible
+  int calc_task_graph();
+
+  /// \brief Compute the gradients of the colvars that deferred them (see
+  /// defer_gradients) and have a nonzero force, in parallel if possible
+  int calc_deferred_gradients();
+
   /// Integrate bias and restraint forces, send colvar forces to atoms
   int update_colvar_forces();
 
+  /// \brief Add the scalar extended-Lagrangian coordinate of a colvar to the
+  /// batch integrated at this step
+  /// \param cv Colvar whose coordinate is added
+  /// \param x Position of the coordinate
+  /// \param v Velocity of the coordinate (lagging half a step behind x)
+  /// \param f Total force on the coordinate
+  /// \param mass Fictitious mass
+  /// \param dt Integration time step (including the time step factor)
+  /// \param friction Velocity decay factor of the thermostat, exp(-gamma*dt)
+  /// \param noise Amplitude of the random velocity of the thermostat
+  /// \param thermostat Whether the Langevin thermostat is applied
+  void add_extended_Lagrangian_batch(colvar *cv, real x, real v, real f, real mass, real dt,
+                                     real friction, real noise, bool thermostat);
+
+  /// \brief Integrate all coordinates added by add_extended_Lagrangian_batch()
+  /// in one pass, send them back to their colvars and empty the batch
+  /// \returns Total kinetic energy of the coordinates
+  real integrate_extended_Lagrangian_batch();
+
   /// Perform analysis
   int analyze();
 
@@ -814,6 +882,22 @@ protected:
   /// Track how many times the XYZ reader has been used
   int xyz_reader_use_count;
 
+  /// Scalar extended-Lagrangian coordinates integrated together at this step
+  struct extended_Lagrangian_batch {
+    /// Colvars owning the coordinates
+    std::vector<colvar *> colvars;
+    /// Positions, velocities and forces
+    std::vector<real> x, v, f;
+    /// Masses, time steps, and half-step velocity increments per unit force
+    std::vector<real> mass, dt, half_kick;
+    /// Thermostat parameters, and random numbers drawn at this step
+    std::vector<real> friction, noise, random;
+    /// Kinetic energies at this step
+    std::vector<real> kinetic;
+    /// Whether each coordinate is coupled to the thermostat
+    std::vector<int> thermostat;
+  } ext_batch;
+
   /// Track usage of Colvars features
   usage *usage_;
 
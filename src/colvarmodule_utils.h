@@ -77,4 +77,80 @@ cvm::real compute_norm2_stats(std::vector<T> const &v,
 }
 
 
+/// \brief Fixed-capacity circular buffer of records of equal width, stored
+/// contiguously; once the buffer is full, each new record replaces the oldest
+template <typename T>
+class ring_buffer {
+public:
+
+  /// Discard all records, and set the maximum number of records and the
+  /// number of elements in each
+  void reset(size_t capacity, size_t width = 1)
+  {
+    data_.assign(capacity * width, T());
+    capacity_ = capacity;
+    width_ = width;
+    first_ = 0;
+    size_ = 0;
+  }
+
+  /// Maximum number of records
+  inline size_t capacity() const
+  {
+    return capacity_;
+  }
+
+  /// Number of elements in each record
+  inline size_t width() const
+  {
+    return width_;
+  }
+
+  /// Number of records currently stored
+  inline size_t size() const
+  {
+    return size_;
+  }
+
+  /// Whether the next record will replace the oldest one
+  inline bool full() const
+  {
+    return size_ == capacity_;
+  }
+
+  /// Record i, counting from the oldest (0) to the newest (size()-1)
+  inline T *operator [] (size_t i)
+  {
+    return data_.data() + ((first_ + i) % capacity_) * width_;
+  }
+
+  /// Record i, counting from the oldest (0) to the newest (size()-1)
+  inline T const *operator [] (size_t i) const
+  {
+    return data_.data() + ((first_ + i) % capacity_) * width_;
+  }
+
+  /// Append a record (replacing the oldest one if the buffer is full) and
+  /// return it, for the caller to set its elements
+  inline T *push()
+  {
+    size_t const slot = (first_ + size_) % capacity_;
+    if (size_ < capacity_) {
+      size_++;
+    } else {
+      first_ = (first_ + 1) % capacity_;
+    }
+    return data_.data() + slot * width_;
+  }
+
+private:
+
+  std::vector<T> data_;
+  size_t capacity_ = 0;
+  size_t width_ = 1;
+  size_t first_ = 0;
+  size_t size_ = 0;
+};
+
+
 #endif
@@ -7,8 +7,11 @@
 // If you wish to distribute your changes, please submit them to the
 // Colvars repository at GitHub.
 
+#include <atomic>
 #include <fstream>
 #include <list>
+#include <map>
+#include <memory>
 #include <utility>
 
 #include "colvarmodule.h"
@@ -279,22 +282,214 @@ int colvarproxy_smp::check_smp_enabled()
 }
 
 
+#if defined(_OPENMP)
+namespace {
+
+  /// \brief Computes the SMP items, colvars and biases of the current step as
+  /// OpenMP tasks: each colvar is collected as soon as its last item is done,
+  /// and each bias is updated as soon as its last colvar is collected
+  ///
+  /// Tasks that may run at the same time, and the state that each one uses:
+  /// - run_item(): the cvc computed and the colvar's cost array element, as in
+  ///   smp_colvars_loop()
+  /// - colvar_done(): the data of one colvar only (values, velocities,
+  ///   extended coordinate, gradients), after all of its cvcs are done; each
+  ///   colvar is collected once and before any bias using it is started
+  /// - spawn_bias(): the bias's own data, reading colvars that are already
+  ///   collected, as in smp_biases_loop(); biases that share data with
+  ///   replicas cause colvarmodule::calc_task_graph() not to use this class
+  /// - cvm::log(), cvm::error() and the error bits are serialized by the
+  ///   proxy's SMP lock; the per-thread depth is not shared
+  /// Global state (step number, units, input/output streams, atom buffers
+  /// other than the gradients of a colvar's own groups) must not be modified
+  class smp_task_graph_runner {
+
+  public:
+
+    smp_task_graph_runner(colvarmodule *cv_in)
+      : cv(cv_in),
+        colvars(*(cv_in->variables_active())),
+        items(*(cv_in->variables_active_smp())),
+        item_cvcs(*(cv_in->variables_active_smp_items())),
+        biases(*(cv_in->biases_active())),
+        with_script(cvm::scripted_forces() && !cvm::scripting_after_biases)
+    {
+      std::map<colvar const *, size_t> colvar_index;
+      colvar_pending.reset(new std::atomic<int>[colvars.size()]);
+      for (size_t c = 0; c < colvars.size(); c++) {
+        colvar_index[colvars[c]] = c;
+        colvar_pending[c] = 0;
+      }
+      item_colvar.resize(items.size());
+      for (size_t i = 0; i < items.size(); i++) {
+        item_colvar[i] = colvar_index[items[i]];
+        colvar_pending[item_colvar[i]]++;
+      }
+      colvar_biases.resize(colvars.size());
+      bias_pending.reset(new std::atomic<int>[biases.size()]);
+      for (size_t b = 0; b < biases.size(); b++) {
+        int num_pending = 0;
+        for (size_t v = 0; v < biases[b]->num_variables(); v++) {
+          auto const c = colvar_index.find(biases[b]->variables(v));
+          if (c != colvar_index.end()) {
+            colvar_biases[c->second].push_back(b);
+            num_pending++;
+          }
+        }
+        bias_pending[b] = num_pending;
+      }
+      script_pending = static_cast<int>(colvars.size());
+    }
+
+    void run()
+    {
+#pragma omp parallel
+      {
+#pragma omp single
+        {
+          for (size_t b = 0; b < biases.size(); b++) {
+            if (bias_pending[b] == 0) spawn_bias(b);
+          }
+          if (with_script && (script_pending == 0)) spawn_script();
+          for (size_t c = 0; c < colvars.size(); c++) {
+            if (colvar_pending[c] == 0) colvar_done(c);
+          }
+          // Items are sorted by decreasing cost
+          for (size_t i = 0; i < items.size(); i++) {
+#pragma omp task firstprivate(i)
+            run_item(i);
+          }
+        }
+      }
+    }
+
+  private:
+
+    void run_item(size_t i)
+    {
+      colvar *x = items[i];
+      int const x_item = item_cvcs[i];
+      if (cvm::debug()) {
+        cvm::log("["+cvm::to_str(omp_get_thread_num())+"/"+
+                 cvm::to_str(omp_get_num_threads())+
+                 "]: smp_task_graph(), i = "+cvm::to_str(i)+", cv = "+
+                 x->name+", cvc = "+cvm::to_str(x_item)+"\n");
+      }
+      double const start_time = omp_get_wtime();
+      x->calc_cvcs(x_item, 1);
+      x->smp_cvc_costs[x_item] = omp_get_wtime() - start_time;
+      if (--colvar_pending[item_colvar[i]] == 0) colvar_done(item_colvar[i]);
+    }
+
+    void colvar_done(size_t c)
+    {
+      colvars[c]->collect_cvc_data();
+      for (size_t const b : colvar_biases[c]) {
+        if (--bias_pending[b] == 0) spawn_bias(b);
+      }
+      if (with_script && (--script_pending == 0)) spawn_script();
+    }
+
+    void spawn_bias(size_t b)
+    {
+#pragma omp task firstprivate(b)
+      biases[b]->update();
+    }
+
+    void spawn_script()
+    {
+#pragma omp task
+      cv->calc_scripted_forces();
+    }
+
+    colvarmodule *cv;
+    std::vector<colvar *> const &colvars;
+    std::vector<colvar *> const &items;
+    std::vector<int> const &item_cvcs;
+    std::vector<colvarbias *> const &biases;
+    bool const with_script;
+
+    /// Index in colvars of the colvar of each item
+    std::vector<size_t> item_colvar;
+    /// Number of items of each colvar not yet computed
+    std::unique_ptr<std::atomic<int>[]> colvar_pending;
+    /// Indices of the biases using each colvar
+    std::vector<std::vector<size_t>> colvar_biases;
+    /// Number of colvars of each bias not yet collected
+    std::unique_ptr<std::atomic<int>[]> bias_pending;
+    /// Number of colvars not yet collected, for scripted forces
+    std::atomic<int> script_pending;
+  };
+
+}
+#endif
+
+
+int colvarproxy_smp::smp_task_graph()
+{
+#if defined(_OPENMP)
+  smp_task_graph_runner graph(cvm::main());
+  graph.run();
+  return cvm::get_error();
+#else
+  return COLVARS_NOT_IMPLEMENTED;
+#endif
+}
+
+
 int colvarproxy_smp::smp_colvars_loop()
 {
 #if defined(_OPENMP)
   colvarmodule *cv = cvm::main();
   colvarproxy *proxy = cv->proxy;
-#pragma omp parallel for
-  for (int i = 0; i < static_cast<int>(cv->variables_active_smp()->size()); i++) {
-    colvar *x = (*(cv->variables_active_smp()))[i];
-    int x_item = (*(cv->variables_active_smp_items()))[i];
-    if (cvm::debug()) {
-      cvm::log("["+cvm::to_str(proxy->smp_thread_id())+"/"+
-               cvm::to_str(proxy->smp_num_threads())+
-               "]: calc_colvars_items_smp(), i = "+cvm::to_str(i)+", cv = "+
-               x->name+", cvc = "+cvm::to_str(x_item)+"\n");
+  // Items are sorted by decreasing cost: each is a task, picked up by the next
+  // available thread, and may spawn its own subtasks (see smp_subtasks())
+#pragma omp parallel
+  {
+#pragma omp single
+    {
+      for (int i = 0; i < static_cast<int>(cv->variables_active_smp()->size()); i++) {
+#pragma omp task firstprivate(i)
+        {
+          colvar *x = (*(cv->variables_active_smp()))[i];
+          int x_item = (*(cv->variables_active_smp_items()))[i];
+          if (cvm::debug()) {
+            cvm::log("["+cvm::to_str(proxy->smp_thread_id())+"/"+
+                     cvm::to_str(proxy->smp_num_threads())+
+                     "]: calc_colvars_items_smp(), i = "+cvm::to_str(i)+", cv = "+
+                     x->name+", cvc = "+cvm::to_str(x_item)+"\n");
+          }
+          double const start_time = omp_get_wtime();
+          x->calc_cvcs(x_item, 1);
+          x->smp_cvc_costs[x_item] = omp_get_wtime() - start_time;
+        }
+      }
+    }
+  }
+  return cvm::get_error();
+#else
+  return COLVARS_NOT_IMPLEMENTED;
+#endif
+}
+
+
+int colvarproxy_smp::smp_gradients_loop()
+{
+#if defined(_OPENMP)
+  colvarmodule *cv = cvm::main();
+#pragma omp parallel
+  {
+#pragma omp single
+    {
+      for (int i = 0; i < static_cast<int>(cv->variables_active_smp()->size()); i++) {
+#pragma omp task firstprivate(i)
+        {
+          colvar *x = (*(cv->variables_active_smp()))[i];
+          int x_item = (*(cv->variables_active_smp_items()))[i];
+          x->calc_deferred_gradients(x_item, 1);
+        }
+      }
     }
-    x->calc_cvcs(x_item, 1);
   }
   return cvm::get_error();
 #else
@@ -303,6 +498,25 @@ int colvarproxy_smp::smp_colvars_loop()
 }
 
 
+int colvarproxy_smp::smp_subtasks(int num_tasks, std::function<void(int)> const &task)
+{
+#if defined(_OPENMP)
+  if (num_tasks > 1) {
+    for (int i = 0; i < num_tasks; i++) {
+#pragma omp task firstprivate(i) shared(task)
+      task(i);
+    }
+#pragma omp taskwait
+    return cvm::get_error();
+  }
+#endif
+  for (int i = 0; i < num_tasks; i++) {
+    task(i);
+  }
+  return cvm::get_error();
+}
+
+
 int colvarproxy_smp::smp_biases_loop()
 {
 #if defined(_OPENMP)
@@ -10,6 +10,8 @@
 #ifndef COLVARPROXY_H
 #define COLVARPROXY_H
 
+#include <functional>
+
 #include "colvarmodule.h"
 #include "colvartypes.h"
 #include "colvarproxy_io.h"
@@ -464,6 +466,21 @@ public:
   /// Distribute calculation of colvars (and their components) across threads
   virtual int smp_colvars_loop();
 
+  /// \brief Run task(0) through task(num_tasks-1), which must be independent;
+  /// when called by an item of smp_colvars_loop(), idle threads may take them
+  virtual int smp_subtasks(int num_tasks, std::function<void(int)> const &task);
+
+  /// \brief Calculate the SMP items of colvars and the biases as a graph of
+  /// tasks, starting each bias once its colvars are computed (see
+  /// colvarmodule::smp_task_graph); returns COLVARS_NOT_IMPLEMENTED without
+  /// doing any work if unsupported.  Tasks may call log() and error()
+  /// concurrently; colvarmodule serializes these calls with smp_lock()
+  virtual int smp_task_graph();
+
+  /// \brief Distribute the deferred gradients of the colvars with a nonzero
+  /// force across threads (see colvar::calc_deferred_gradients())
+  virtual int smp_gradients_loop();
+
   /// Distribute calculation of biases across threads
   virtual int smp_biases_loop();
 
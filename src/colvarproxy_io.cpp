@@ -22,6 +22,9 @@
 #else
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef __cpp_lib_filesystem
 #include <filesystem>
@@ -505,3 +508,66 @@ int colvarproxy_io::close_output_streams()
 
   return COLVARS_OK;
 }
+
+
+colvarproxy_mapped_file::colvarproxy_mapped_file()
+  : data_(NULL), size_(0), mapped_(false)
+{}
+
+
+colvarproxy_mapped_file::~colvarproxy_mapped_file()
+{
+  close();
+}
+
+
+int colvarproxy_mapped_file::open(std::string const &filename)
+{
+  close();
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+  std::ifstream is(filename.c_str(), std::ios::binary);
+  if (!is) {
+    return COLVARS_FILE_ERROR;
+  }
+  std::ostringstream os;
+  os << is.rdbuf();
+  buffer_ = os.str();
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+#else
+  int const fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return COLVARS_FILE_ERROR;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+    ::close(fd);
+    return COLVARS_FILE_ERROR;
+  }
+  void *const addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // The mapping remains valid after closing the descriptor
+  if (addr == MAP_FAILED) {
+    return COLVARS_FILE_ERROR;
+  }
+  data_ = reinterpret_cast<char const *>(addr);
+  size_ = st.st_size;
+  mapped_ = true;
+#endif
+
+  return COLVARS_OK;
+}
+
+
+void colvarproxy_mapped_file::close()
+{
+#if !(defined(_WIN32) && !defined(__CYGWIN__))
+  if (mapped_) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+#endif
+  buffer_.clear();
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+}
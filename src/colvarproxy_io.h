@@ -191,4 +191,55 @@ protected:
 };
 
 
+/// \brief Read-only view of the contents of a file
+///
+/// The file is memory-mapped where supported, and read into a buffer
+/// otherwise; it remains accessible until close() or the destructor
+class colvarproxy_mapped_file {
+
+public:
+
+  colvarproxy_mapped_file();
+
+  ~colvarproxy_mapped_file();
+
+  /// Map the given file; returns an error code (without printing errors)
+  int open(std::string const &filename);
+
+  /// Release the contents of the file
+  void close();
+
+  /// Pointer to the contents of the file
+  inline char const *data() const
+  {
+    return data_;
+  }
+
+  /// Size of the file in bytes
+  inline size_t size() const
+  {
+    return size_;
+  }
+
+protected:
+
+  /// Pointer to the contents of the file
+  char const *data_;
+
+  /// Size of the file in bytes
+  size_t size_;
+
+  /// Whether data_ is a memory map (as opposed to buffer_)
+  bool mapped_;
+
+  /// Contents of the file, when memory-mapping is not available
+  std::string buffer_;
+
+private:
+
+  colvarproxy_mapped_file(colvarproxy_mapped_file const &);
+  colvarproxy_mapped_file &operator = (colvarproxy_mapped_file const &);
+};
+
+
 #endif
@@ -8,6 +8,8 @@
 // Colvars repository at GitHub.
 
 
+#include <algorithm>
+
 #include "colvarmodule.h"
 #include "colvarproxy_replicas.h"
 
@@ -107,3 +109,184 @@ int colvarproxy_replicas::replica_comm_send(char *buffer, int buffer_length, int
   return COLVARS_NOT_IMPLEMENTED;
 #endif
 }
+
+
+bool colvarproxy_replicas::replicas_mpi_collectives() const
+{
+#ifdef COLVARS_MPI
+  return replicas_mpi_comm != MPI_COMM_NULL;
+#else
+  return false;
+#endif
+}
+
+
+int colvarproxy_replicas::replica_comm_bcast(char *buffer, int buffer_length, int root_rank)
+{
+  int const n = num_replicas();
+  if ((n <= 1) || (buffer_length == 0)) {
+    return COLVARS_OK;
+  }
+#ifdef COLVARS_MPI
+  if (replicas_mpi_collectives()) {
+    return (MPI_Bcast(buffer, buffer_length, MPI_CHAR, root_rank, replicas_mpi_comm) ==
+            MPI_SUCCESS) ? COLVARS_OK : COLVARS_ERROR;
+  }
+#endif
+  // Binomial tree: each replica receives once from its parent, and then
+  // forwards the buffer to its children (log2(n) rounds in total)
+  int const rank = (replica_index() - root_rank + n) % n;
+  int mask = 1;
+  while (mask < n) {
+    if (rank & mask) {
+      if (replica_comm_recv(buffer, buffer_length, (rank - mask + root_rank) % n) != buffer_length) {
+        return COLVARS_ERROR;
+      }
+      break;
+    }
+    mask <<= 1;
+  }
+  for (mask >>= 1; mask > 0; mask >>= 1) {
+    if (rank + mask < n) {
+      if (replica_comm_send(buffer, buffer_length, (rank + mask + root_rank) % n) != buffer_length) {
+        return COLVARS_ERROR;
+      }
+    }
+  }
+  return COLVARS_OK;
+}
+
+
+namespace {
+
+  /// Binomial-tree reduction onto replica 0, followed by a broadcast; the
+  /// order of the additions only depends on the number of replicas
+  template <typename T>
+  int allreduce_sum_p2p(colvarproxy_replicas *proxy, T *data, int count)
+  {
+    int const n = proxy->num_replicas();
+    int const rank = proxy->replica_index();
+    int const length = count * sizeof(T);
+    std::vector<T> partial(count);
+    for (int mask = 1; mask < n; mask <<= 1) {
+      if (rank & mask) {
+        if (proxy->replica_comm_send(reinterpret_cast<char *>(data), length, rank - mask) !=
+            length) {
+          return COLVARS_ERROR;
+        }
+        break;
+      } else if (rank + mask < n) {
+        if (proxy->replica_comm_recv(reinterpret_cast<char *>(partial.data()), length,
+                                     rank + mask) != length) {
+          return COLVARS_ERROR;
+        }
+        for (int i = 0; i < count; i++) {
+          data[i] += partial[i];
+        }
+      }
+    }
+    return proxy->replica_comm_bcast(reinterpret_cast<char *>(data), length, 0);
+  }
+
+}
+
+
+int colvarproxy_replicas::replica_comm_allreduce_sum(cvm::real *data, int count)
+{
+  if ((num_replicas() <= 1) || (count == 0)) {
+    return COLVARS_OK;
+  }
+#ifdef COLVARS_MPI
+  if (replicas_mpi_collectives()) {
+    return (MPI_Allreduce(MPI_IN_PLACE, data, count, MPI_DOUBLE, MPI_SUM, replicas_mpi_comm) ==
+            MPI_SUCCESS) ? COLVARS_OK : COLVARS_ERROR;
+  }
+#endif
+  return allreduce_sum_p2p(this, data, count);
+}
+
+
+int colvarproxy_replicas::replica_comm_allreduce_sum(size_t *data, int count)
+{
+  if ((num_replicas() <= 1) || (count == 0)) {
+    return COLVARS_OK;
+  }
+#ifdef COLVARS_MPI
+  if (replicas_mpi_collectives()) {
+    MPI_Datatype const type = (sizeof(size_t) == sizeof(unsigned long long)) ?
+      MPI_UNSIGNED_LONG_LONG : MPI_UNSIGNED;
+    return (MPI_Allreduce(MPI_IN_PLACE, data, count, type, MPI_SUM, replicas_mpi_comm) ==
+            MPI_SUCCESS) ? COLVARS_OK : COLVARS_ERROR;
+  }
+#endif
+  return allreduce_sum_p2p(this, data, count);
+}
+
+
+int colvarproxy_replicas::replica_comm_allgather(char const *send_data, int send_length,
+                                                 char *recv_data)
+{
+#ifdef COLVARS_MPI
+  if (replicas_mpi_collectives() && (num_replicas() > 1)) {
+    return (MPI_Allgather(send_data, send_length, MPI_CHAR, recv_data, send_length, MPI_CHAR,
+                          replicas_mpi_comm) == MPI_SUCCESS) ? COLVARS_OK : COLVARS_ERROR;
+  }
+#endif
+  return replica_comm_allgatherv_p2p(send_data, std::vector<int>(num_replicas(), send_length),
+                                     recv_data);
+}
+
+
+int colvarproxy_replicas::replica_comm_allgatherv(char const *send_data,
+                                                  std::vector<int> const &recv_lengths,
+                                                  char *recv_data)
+{
+#ifdef COLVARS_MPI
+  if (replicas_mpi_collectives() && (num_replicas() > 1)) {
+    std::vector<int> displacements(recv_lengths.size(), 0);
+    for (size_t i = 1; i < recv_lengths.size(); i++) {
+      displacements[i] = displacements[i-1] + recv_lengths[i-1];
+    }
+    return (MPI_Allgatherv(send_data, recv_lengths[replica_index()], MPI_CHAR, recv_data,
+                           recv_lengths.data(), displacements.data(), MPI_CHAR,
+                           replicas_mpi_comm) == MPI_SUCCESS) ? COLVARS_OK : COLVARS_ERROR;
+  }
+#endif
+  return replica_comm_allgatherv_p2p(send_data, recv_lengths, recv_data);
+}
+
+
+int colvarproxy_replicas::replica_comm_allgatherv_p2p(char const *send_data,
+                                                      std::vector<int> const &recv_lengths,
+                                                      char *recv_data)
+{
+  int const n = num_replicas();
+  int const rank = replica_index();
+  std::vector<int> offsets(n + 1, 0);
+  for (int i = 0; i < n; i++) {
+    offsets[i+1] = offsets[i] + recv_lengths[i];
+  }
+  std::copy(send_data, send_data + recv_lengths[rank], recv_data + offsets[rank]);
+  if (n <= 1) {
+    return COLVARS_OK;
+  }
+  // Binomial-tree gather onto replica 0: at each round, a replica holds the
+  // contiguous buffers of the replicas between itself and rank + mask
+  for (int mask = 1; mask < n; mask <<= 1) {
+    if (rank & mask) {
+      int const length = offsets[std::min(rank + mask, n)] - offsets[rank];
+      if ((length > 0) &&
+          (replica_comm_send(recv_data + offsets[rank], length, rank - mask) != length)) {
+        return COLVARS_ERROR;
+      }
+      break;
+    } else if (rank + mask < n) {
+      int const length = offsets[std::min(rank + 2 * mask, n)] - offsets[rank + mask];
+      if ((length > 0) &&
+          (replica_comm_recv(recv_data + offsets[rank + mask], length, rank + mask) != length)) {
+        return COLVARS_ERROR;
+      }
+    }
+  }
+  return replica_comm_bcast(recv_data, offsets[n], 0);
+}
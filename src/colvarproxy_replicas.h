@@ -10,6 +10,7 @@
 #ifndef COLVARPROXY_REPLICAS_H
 #define COLVARPROXY_REPLICAS_H
 
+#include <vector>
 
 #ifdef COLVARS_MPI
 #include <mpi.h>
@@ -51,6 +52,57 @@ public:
   /// Send data to other replica
   virtual int replica_comm_send(char* msg_data, int msg_len, int dest_rep);
 
+  /// \brief Sum an array elementwise over all replicas, leaving the result on
+  /// every replica
+  virtual int replica_comm_allreduce_sum(cvm::real *data, int count);
+
+  /// \brief Sum an array of counters elementwise over all replicas, leaving
+  /// the result on every replica
+  virtual int replica_comm_allreduce_sum(size_t *data, int count);
+
+  /// Copy a buffer from the given replica to all others
+  virtual int replica_comm_bcast(char *msg_data, int msg_len, int root_rep);
+
+  /// \brief Concatenate buffers of the same length from all replicas (in order
+  /// of replica index), leaving the result on every replica
+  virtual int replica_comm_allgather(char const *send_data, int send_len,
+                                     char *recv_data);
+
+  /// \brief Concatenate buffers of different lengths from all replicas (in
+  /// order of replica index), leaving the result on every replica
+  /// \param recv_lens Length of the buffer from each replica (the same on all)
+  virtual int replica_comm_allgatherv(char const *send_data,
+                                      std::vector<int> const &recv_lens,
+                                      char *recv_data);
+
+  /// Typed version of replica_comm_allgather()
+  template <typename T>
+  int replica_comm_allgather(T const &value, std::vector<T> &all_values)
+  {
+    all_values.resize(num_replicas());
+    return replica_comm_allgather(reinterpret_cast<char const *>(&value), sizeof(T),
+                                  reinterpret_cast<char *>(all_values.data()));
+  }
+
+  /// \brief Typed version of replica_comm_allgatherv() for arrays: their
+  /// sizes are exchanged first
+  template <typename T>
+  int replica_comm_allgatherv(std::vector<T> const &values, std::vector<T> &all_values)
+  {
+    std::vector<int> lens;
+    int error_code = replica_comm_allgather(static_cast<int>(values.size() * sizeof(T)), lens);
+    size_t total_len = 0;
+    for (size_t i = 0; i < lens.size(); i++) {
+      total_len += lens[i];
+    }
+    all_values.resize(total_len / sizeof(T));
+    if (error_code == COLVARS_OK) {
+      error_code = replica_comm_allgatherv(reinterpret_cast<char const *>(values.data()), lens,
+                                           reinterpret_cast<char *>(all_values.data()));
+    }
+    return error_code;
+  }
+
 protected:
 
   /// MPI communicator containint 1 root proc from each world
@@ -61,6 +113,15 @@ protected:
 
   /// Number of replicas in the MPI implementation
   int replicas_mpi_num = 1;
+
+  /// Whether collective operations can be delegated to the MPI library
+  bool replicas_mpi_collectives() const;
+
+  /// \brief Tree-based implementation of replica_comm_allgatherv() using
+  /// point-to-point messages, used when MPI collectives are not available
+  int replica_comm_allgatherv_p2p(char const *send_data,
+                                  std::vector<int> const &recv_lens,
+                                  char *recv_data);
 };
 
 #endif
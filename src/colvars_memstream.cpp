@@ -51,13 +51,13 @@ template <> void cvm::memory_stream::write_object(colvarvalue const &t)
 
 template <> void cvm::memory_stream::write_object(cvm::vector1d<cvm::real> const &t)
 {
-  return write_vector<cvm::real>(t.data_array());
+  return write_vector<cvm::real>(std::vector<cvm::real>(t.c_array(), t.c_array() + t.size()));
 }
 
 template <>
 cvm::memory_stream &operator<<(cvm::memory_stream &os, cvm::vector1d<cvm::real> const &t)
 {
-  os.write_vector<cvm::real>(t.data_array());
+  os.write_object<cvm::vector1d<cvm::real>>(t);
   return os;
 }
 
@@ -92,11 +92,13 @@ template <> void cvm::memory_stream::read_object(colvarvalue &t)
 
 template <> void cvm::memory_stream::read_object(cvm::vector1d<cvm::real> &t)
 {
-  return read_vector<cvm::real>(t.data_array());
+  std::vector<cvm::real> v(t.c_array(), t.c_array() + t.size());
+  read_vector<cvm::real>(v);
+  t = cvm::vector1d<cvm::real>(v.size(), v.data());
 }
 
 template <> cvm::memory_stream &operator>>(cvm::memory_stream &is, cvm::vector1d<cvm::real> &t)
 {
-  is.read_vector<cvm::real>(t.data_array());
+  is.read_object<cvm::vector1d<cvm::real>>(t);
   return is;
 }
@@ -133,8 +133,9 @@ CVSCRIPT(colvar_getgradients,
          "gradients : array of arrays of floats - Atomic gradients",
          0, 0,
          "",
+         int const error_code = this_colvar->update_atomic_gradients();
          script->set_result_rvector_vec(this_colvar->atomic_gradients);
-         return COLVARS_OK;
+         return error_code;
          )
 
 CVSCRIPT(colvar_gettotalforce,
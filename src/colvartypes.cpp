@@ -385,3 +385,87 @@ void colvarmodule::rotation::calc_optimal_rotation_impl() {
     q_old = q;
   }
 }
+
+
+
+namespace {
+
+  /// Smallest prime factor of n
+  size_t smallest_factor(size_t n)
+  {
+    for (size_t f = 2; f * f <= n; f++) {
+      if (n % f == 0) return f;
+    }
+    return n;
+  }
+
+  /// \brief Mixed-radix discrete Fourier transform of n elements of in (with the
+  /// given stride) into out; twiddle[j] = exp(+/- 2 pi i j / N), where N is the
+  /// length of the top-level transform
+  void dft(std::complex<cvm::real> const *in, size_t stride, size_t n,
+           std::vector<std::complex<cvm::real>> const &twiddle, std::complex<cvm::real> *out)
+  {
+    if (n == 1) {
+      out[0] = in[0];
+      return;
+    }
+    size_t const p = smallest_factor(n);
+    size_t const m = n / p;
+    for (size_t r = 0; r < p; r++) {
+      dft(in + r * stride, stride * p, m, twiddle, out + r * m);
+    }
+    size_t const N = twiddle.size();
+    size_t const step = N / n;
+    std::vector<std::complex<cvm::real>> y(p);
+    for (size_t k = 0; k < m; k++) {
+      for (size_t r = 0; r < p; r++) y[r] = out[r * m + k];
+      for (size_t q = 0; q < p; q++) {
+        std::complex<cvm::real> sum = y[0];
+        for (size_t r = 1; r < p; r++) {
+          sum += y[r] * twiddle[(r * (k + m * q) * step) % N];
+        }
+        out[q * m + k] = sum;
+      }
+    }
+  }
+
+}
+
+
+void FFT::transform(std::vector<std::complex<cvm::real>> &a, bool inverse)
+{
+  size_t const n = a.size();
+  if (n < 2) return;
+  std::vector<std::complex<cvm::real>> twiddle(n), out(n);
+  for (size_t j = 0; j < n; j++) {
+    twiddle[j] = std::polar(cvm::real(1.0), (inverse ? 2.0 : -2.0) * PI * cvm::real(j) / n);
+  }
+  dft(a.data(), 1, n, twiddle, out.data());
+  a.swap(out);
+}
+
+
+void FFT::transform_nd(std::vector<std::complex<cvm::real>> &a, std::vector<int> const &nx,
+                       bool inverse)
+{
+  size_t stride = a.size();
+  std::vector<std::complex<cvm::real>> line, line_out, twiddle;
+  for (size_t d = 0; d < nx.size(); d++) {
+    size_t const n = nx[d];
+    stride /= n;
+    twiddle.resize(n);
+    for (size_t j = 0; j < n; j++) {
+      twiddle[j] = std::polar(cvm::real(1.0), (inverse ? 2.0 : -2.0) * PI * cvm::real(j) / n);
+    }
+    line.resize(n);
+    line_out.resize(n);
+    for (size_t base = 0; base < a.size(); base += n * stride) {
+      for (size_t s = 0; s < stride; s++) {
+        for (size_t i = 0; i < n; i++) line[i] = a[base + i * stride + s];
+        dft(line.data(), 1, n, twiddle, line_out.data());
+        for (size_t i = 0; i < n; i++) a[base + i * stride + s] = line_out[i];
+      }
+    }
+  }
+}
+
@@ -10,6 +10,7 @@
 #ifndef COLVARTYPES_H
 #define COLVARTYPES_H
 
+#include <complex>
 #include <sstream> // TODO specialize templates and replace this with iosfwd
 #include <vector>
 
@@ -37,22 +38,35 @@ template <class T> class colvarmodule::vector1d
 {
 protected:
 
-  std::vector<T> data;
+  /// \brief Number of elements that are stored within the object itself
+  /// (larger vectors are allocated on the heap)
+  enum { inline_capacity = (sizeof(T) < 64) ? (64 / sizeof(T)) : 1 };
+
+  /// Storage for vectors of up to inline_capacity elements
+  T inline_data[inline_capacity];
+
+  /// Storage for vectors of more than inline_capacity elements
+  std::vector<T> heap_data;
+
+  /// Number of elements
+  size_t num_elements = 0;
+
+  /// Location of the elements (either inline_data or heap_data)
+  T *data = inline_data;
 
 public:
 
   /// Default constructor
   inline vector1d(size_t const n = 0)
   {
-    data.resize(n);
+    resize(n);
     reset();
   }
 
   /// Constructor from C array
   inline vector1d(size_t const n, T const *t)
   {
-    data.resize(n);
-    reset();
+    resize(n);
     size_t i;
     for (i = 0; i < size(); i++) {
       data[i] = t[i];
@@ -60,57 +74,109 @@ public:
   }
 
   /// Explicit Copy constructor
-  inline vector1d(const vector1d&) = default;
+  inline vector1d(const vector1d &v)
+  {
+    *this = v;
+  }
 
-  /// Explicit Copy assignement
-  inline vector1d& operator=(const vector1d&) = default;
+  /// Move constructor
+  inline vector1d(vector1d &&v)
+  {
+    *this = std::move(v);
+  }
 
-  /// Return a pointer to the data location
-  inline T * c_array()
+  /// Explicit Copy assignement
+  inline vector1d& operator=(const vector1d &v)
   {
-    if (data.size() > 0) {
-      return &(data[0]);
-    } else {
-      return NULL;
+    if (this != &v) {
+      resize(v.size());
+      for (size_t i = 0; i < num_elements; i++) {
+        data[i] = v.data[i];
+      }
     }
+    return *this;
   }
 
-  /// Return a reference to the data
-  inline std::vector<T> &data_array()
+  /// Move assignment (takes over the heap storage of v, if any)
+  inline vector1d& operator=(vector1d &&v)
   {
-    return data;
+    if (this == &v) {
+      return *this;
+    }
+    if (v.num_elements > inline_capacity) {
+      heap_data.swap(v.heap_data);
+      num_elements = v.num_elements;
+      data = heap_data.data();
+      v.num_elements = 0;
+      v.data = v.inline_data;
+    } else {
+      *this = static_cast<vector1d const &>(v);
+    }
+    return *this;
   }
 
-  /// Return a reference to the data
-  inline std::vector<T> const &data_array() const
+  /// Return a pointer to the data location
+  inline T * c_array()
   {
-    return data;
+    if (num_elements > 0) {
+      return data;
+    } else {
+      return NULL;
+    }
   }
 
-  inline ~vector1d()
+  /// Return a pointer to the data location
+  inline T const * c_array() const
   {
-    data.clear();
+    if (num_elements > 0) {
+      return data;
+    } else {
+      return NULL;
+    }
   }
 
   /// Set all elements to zero
   inline void reset()
   {
-    data.assign(data.size(), T(0.0));
+    for (size_t i = 0; i < num_elements; i++) {
+      data[i] = T(0.0);
+    }
   }
 
   inline size_t size() const
   {
-    return data.size();
+    return num_elements;
   }
 
+  /// Change the number of elements (new elements are value-initialized)
   inline void resize(size_t const n)
   {
-    data.resize(n);
+    if (n <= inline_capacity) {
+      if (num_elements > inline_capacity) {
+        // Move back into the inline storage, but keep the heap capacity
+        for (size_t i = 0; i < n; i++) {
+          inline_data[i] = heap_data[i];
+        }
+        heap_data.clear();
+        data = inline_data;
+      } else {
+        for (size_t i = num_elements; i < n; i++) {
+          inline_data[i] = T();
+        }
+      }
+    } else {
+      if (num_elements <= inline_capacity) {
+        heap_data.assign(inline_data, inline_data + num_elements);
+      }
+      heap_data.resize(n);
+      data = heap_data.data();
+    }
+    num_elements = n;
   }
 
   inline void clear()
   {
-    data.clear();
+    resize(0);
   }
 
   inline T & operator [] (size_t const i) {
@@ -163,10 +229,20 @@ public:
     }
   }
 
+  /// Add a * v to this vector in place (without temporaries)
+  inline void axpy(cvm::real a, vector1d<T> const &v)
+  {
+    check_sizes(*this, v);
+    size_t i;
+    for (i = 0; i < this->size(); i++) {
+      (*this)[i] += a * v[i];
+    }
+  }
+
   inline friend vector1d<T> operator + (vector1d<T> const &v1,
                                         vector1d<T> const &v2)
   {
-    check_sizes(v1.size(), v2.size());
+    check_sizes(v1, v2);
     vector1d<T> result(v1.size());
     size_t i;
     for (i = 0; i < v1.size(); i++) {
@@ -178,7 +254,7 @@ public:
   inline friend vector1d<T> operator - (vector1d<T> const &v1,
                                         vector1d<T> const &v2)
   {
-    check_sizes(v1.size(), v2.size());
+    check_sizes(v1, v2);
     vector1d<T> result(v1.size());
     size_t i;
     for (i = 0; i < v1.size(); i++) {
@@ -215,7 +291,7 @@ public:
   /// Inner product
   inline friend T operator * (vector1d<T> const &v1, vector1d<T> const &v2)
   {
-    check_sizes(v1.size(), v2.size());
+    check_sizes(v1, v2);
     T prod(0.0);
     size_t i;
     for (i = 0; i < v1.size(); i++) {
@@ -253,7 +329,7 @@ public:
   /// Slicing
   inline vector1d<T> const slice(size_t const i1, size_t const i2) const
   {
-    if ((i2 < i1) || (i2 >= this->size())) {
+    if ((i2 < i1) || (i2 > this->size())) {
       cvm::error("Error: trying to slice a vector using incorrect boundaries.\n");
     }
     vector1d<T> result(i2 - i1);
@@ -268,7 +344,7 @@ public:
   inline void sliceassign(size_t const i1, size_t const i2,
                           vector1d<T> const &v)
   {
-    if ((i2 < i1) || (i2 >= this->size())) {
+    if ((i2 < i1) || (i2 > this->size())) {
       cvm::error("Error: trying to slice a vector using incorrect boundaries.\n");
     }
     size_t i;
@@ -355,10 +431,7 @@ public:
     } else {
       T input;
       while (stream >> input) {
-        if ((i % 100) == 0) {
-          data.reserve(data.size()+100);
-        }
-        data.resize(data.size()+1);
+        resize(size()+1);
         data[i] = input;
         i++;
       }
@@ -1357,6 +1430,17 @@ void diagonalize_matrix(cvm::real m[4][4],
 #endif
 
 
+/// Discrete Fourier transforms (mixed radix, most efficient when all prime
+/// factors of the length are small); inverse transforms are not normalized
+namespace FFT {
+/// In-place transform of a sequence of any length
+void transform(std::vector<std::complex<cvm::real>> &a, bool inverse);
+/// In-place transform of a row-major array with dimensions nx along all of them
+void transform_nd(std::vector<std::complex<cvm::real>> &a, std::vector<int> const &nx,
+                  bool inverse);
+}
+
+
 /// \brief A rotation between two sets of coordinates (for the moment
 /// a wrapper for colvarmodule::quaternion)
 class colvarmodule::rotation
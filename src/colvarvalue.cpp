@@ -59,9 +59,7 @@ colvarvalue::colvarvalue(colvarvalue const &x)
     break;
   case type_vector:
     vector1d_value = x.vector1d_value;
-    elem_types = x.elem_types;
-    elem_indices = x.elem_indices;
-    elem_sizes = x.elem_sizes;
+    elements = x.elements;
   case type_notset:
   default:
     break;
@@ -215,13 +213,14 @@ void colvarvalue::apply_constraints()
     quaternion_value /= cvm::sqrt(quaternion_value.norm2());
     break;
   case colvarvalue::type_vector:
-    if (elem_types.size() > 0) {
+    if (elements) {
       // if we have information about non-scalar types, use it
       size_t i;
-      for (i = 0; i < elem_types.size(); i++) {
-        if (elem_sizes[i] == 1) continue; // TODO this can be optimized further
-        colvarvalue cvtmp(vector1d_value.slice(elem_indices[i],
-                                               elem_indices[i] + elem_sizes[i]), elem_types[i]);
+      for (i = 0; i < elements->types.size(); i++) {
+        if (elements->sizes[i] == 1) continue; // TODO this can be optimized further
+        colvarvalue cvtmp(vector1d_value.slice(elements->indices[i],
+                                               elements->indices[i] + elements->sizes[i]),
+                          elements->types[i]);
         cvtmp.apply_constraints();
         set_elem(i, cvtmp);
       }
@@ -241,6 +240,7 @@ void colvarvalue::type(Type const &vti)
     reset();
     if ((value_type == type_vector) && (vti != type_vector)) {
       vector1d_value.clear();
+      elements.reset();
     }
     value_type = vti;
   }
@@ -254,6 +254,7 @@ void colvarvalue::type(colvarvalue const &x)
     reset();
     if (value_type == type_vector) {
       vector1d_value.clear();
+      elements.reset();
     }
     value_type = x.type();
   }
@@ -296,11 +297,15 @@ void colvarvalue::add_elem(colvarvalue const &x)
   }
   size_t const n = vector1d_value.size();
   size_t const nd = num_dimensions(x.value_type);
-  elem_types.push_back(x.value_type);
-  elem_indices.push_back(n);
-  elem_sizes.push_back(nd);
+  // The layout is shared with copies of this value: replace it instead of modifying it
+  std::shared_ptr<elem_layout> new_elements =
+    elements ? std::make_shared<elem_layout>(*elements) : std::make_shared<elem_layout>();
+  new_elements->types.push_back(x.value_type);
+  new_elements->indices.push_back(n);
+  new_elements->sizes.push_back(nd);
+  elements = new_elements;
   vector1d_value.resize(n + nd);
-  set_elem(n, x);
+  set_elem(n, n + nd, x);
 }
 
 
@@ -328,9 +333,9 @@ void colvarvalue::set_elem(int const i_begin, int const i_end, colvarvalue const
 
 colvarvalue const colvarvalue::get_elem(int const icv) const
 {
-  if (elem_types.size() > 0) {
-    return get_elem(elem_indices[icv], elem_indices[icv] + elem_sizes[icv],
-                    elem_types[icv]);
+  if (elements) {
+    return get_elem(elements->indices[icv], elements->indices[icv] + elements->sizes[icv],
+                    elements->types[icv]);
   } else {
     cvm::error("Error: trying to get a colvarvalue element from a vector colvarvalue that was initialized as a plain array.\n");
     return colvarvalue(type_notset);
@@ -340,9 +345,9 @@ colvarvalue const colvarvalue::get_elem(int const icv) const
 
 void colvarvalue::set_elem(int const icv, colvarvalue const &x)
 {
-  if (elem_types.size() > 0) {
-    check_types_assign(elem_types[icv], x.value_type);
-    set_elem(elem_indices[icv], elem_indices[icv] + elem_sizes[icv], x);
+  if (elements) {
+    check_types_assign(elements->types[icv], x.value_type);
+    set_elem(elements->indices[icv], elements->indices[icv] + elements->sizes[icv], x);
   } else {
     cvm::error("Error: trying to set a colvarvalue element for a colvarvalue that was initialized as a plain array.\n");
   }
@@ -581,11 +586,11 @@ cvm::real colvarvalue::norm2() const
   case colvarvalue::type_quaternionderiv:
     return (this->quaternion_value).norm2();
   case colvarvalue::type_vector:
-    if (elem_types.size() > 0) {
+    if (elements) {
       // if we have information about non-scalar types, use it
       cvm::real result = 0.0;
       size_t i;
-      for (i = 0; i < elem_types.size(); i++) {
+      for (i = 0; i < elements->types.size(); i++) {
         result += (this->get_elem(i)).norm2();
       }
       return result;
@@ -11,6 +11,7 @@
 #define COLVARVALUE_H
 
 #include <list>
+#include <memory>
 
 #include "colvarmodule.h"
 #include "colvartypes.h"
@@ -86,16 +87,17 @@ public:
   cvm::vector1d<cvm::real> vector1d_value;
 
   /// \brief If \link vector1d_value \endlink is a concatenation of colvarvalues,
-  /// keep track of the individual types
-  std::vector<Type> elem_types;
-
-  /// \brief If \link vector1d_value \endlink is a concatenation of colvarvalues,
-  /// these mark the initial components of each colvarvalue
-  std::vector<int> elem_indices;
+  /// keep track of the individual types, initial components and sizes
+  struct elem_layout {
+    std::vector<Type> types;
+    std::vector<int> indices;
+    std::vector<int> sizes;
+  };
 
-  /// \brief If \link vector1d_value \endlink is a concatenation of colvarvalues,
-  /// these mark how many components for each colvarvalue
-  std::vector<int> elem_sizes;
+  /// \brief Layout of the concatenated elements (null if not a concatenation);
+  /// immutable and shared between copies, so that copying a vector-type value
+  /// does not allocate beyond \link vector1d_value \endlink
+  std::shared_ptr<elem_layout const> elements;
 
   /// \brief Whether or not the type check is enforced
   static inline bool type_checking()
@@ -201,6 +203,10 @@ public:
   void operator *= (cvm::real const &a);
   void operator /= (cvm::real const &a);
 
+  /// \brief Add a * x to this value in place, with a single type check and
+  /// without creating temporaries (equivalent to *this += a * x)
+  void axpy(cvm::real const &a, colvarvalue const &x);
+
   // Binary operators (return values)
   friend colvarvalue operator + (colvarvalue const &x1, colvarvalue const &x2);
   friend colvarvalue operator - (colvarvalue const &x1, colvarvalue const &x2);
@@ -530,9 +536,7 @@ inline colvarvalue & colvarvalue::operator = (colvarvalue const &x)
     break;
   case colvarvalue::type_vector:
     vector1d_value = x.vector1d_value;
-    elem_types = x.elem_types;
-    elem_indices = x.elem_indices;
-    elem_sizes = x.elem_sizes;
+    elements = x.elements;
     break;
   case colvarvalue::type_notset:
   default:
@@ -597,6 +601,33 @@ inline void colvarvalue::operator -= (colvarvalue const &x)
 }
 
 
+inline void colvarvalue::axpy(cvm::real const &a, colvarvalue const &x)
+{
+  colvarvalue::check_types(*this, x);
+
+  switch (value_type) {
+  case colvarvalue::type_scalar:
+    real_value += a * x.real_value;
+    break;
+  case colvarvalue::type_3vector:
+  case colvarvalue::type_unit3vector:
+  case colvarvalue::type_unit3vectorderiv:
+    rvector_value += a * x.rvector_value;
+    break;
+  case colvarvalue::type_quaternion:
+  case colvarvalue::type_quaternionderiv:
+    quaternion_value += a * x.quaternion_value;
+    break;
+  case colvarvalue::type_vector:
+    vector1d_value.axpy(a, x.vector1d_value);
+    break;
+  case colvarvalue::type_notset:
+  default:
+    undef_op();
+  }
+}
+
+
 inline void colvarvalue::operator *= (cvm::real const &a)
 {
   switch (value_type) {
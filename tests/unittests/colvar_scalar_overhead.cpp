@@ -0,0 +1,150 @@
+// -*- c++ -*-
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvar.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// Simple distance variables with a restraint applied to all of them.  With a
+// coefficient of 1 each colvar passes its value and force directly through its
+// only component; with a coefficient of -1 the generic linear combination is
+// used instead.  Both describe the same potential, so the values must be
+// opposite and the atomic forces identical.  The timing of the two code paths
+// is measured by colvar_scalar_overhead_benchmark.
+
+std::string make_config(size_t num_colvars, int natoms, cvm::real coeff)
+{
+  std::string conf;
+  std::string names, centers;
+  conf += "colvarsTrajFrequency 0\n";
+  conf += "colvarsRestartFrequency 0\n";
+  for (size_t i = 0; i < num_colvars; i++) {
+    int const a1 = (i % natoms) + 1;
+    int const a2 = ((i * 7 + 13) % natoms) + 1;
+    std::string const name = "d" + cvm::to_str(i + 1);
+    conf += "colvar {\n";
+    conf += "  name " + name + "\n";
+    conf += "  distance {\n";
+    conf += "    componentCoeff " + cvm::to_str(coeff) + "\n";
+    conf += "    group1 {\n";
+    conf += "      atomNumbers " + cvm::to_str(a1) + "\n";
+    conf += "    }\n";
+    conf += "    group2 {\n";
+    conf += "      atomNumbers " + cvm::to_str((a2 == a1) ? (a1 % natoms) + 1 : a2) + "\n";
+    conf += "    }\n";
+    conf += "  }\n";
+    conf += "}\n";
+    names += " " + name;
+    centers += " " + cvm::to_str(coeff * 5.0);
+  }
+  conf += "harmonic {\n";
+  conf += "  colvars" + names + "\n";
+  conf += "  centers" + centers + "\n";
+  conf += "  forceConstant 1.0\n";
+  conf += "}\n";
+  return conf;
+}
+
+
+/// Values of all colvars, energies and atomic forces at each step
+struct run_output {
+  std::vector<cvm::real> values;
+  std::vector<cvm::real> energies;
+  std::vector<cvm::rvector> forces;
+};
+
+
+int run(size_t num_colvars, cvm::real coeff, run_output &out)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            "colvar_scalar_overhead.out");
+
+  int err = proxy->colvars->read_config_string(make_config(num_colvars,
+                                                           decaalanine_num_atoms, coeff));
+  if (err) {
+    delete proxy;
+    return err;
+  }
+
+  // The direct path is taken exactly when the coefficient is 1
+  bool const single = (coeff == 1.0);
+  for (colvar *cv : *(proxy->colvars->variables())) {
+    if ((cv->is_enabled(colvardeps::f_cv_single_cvc) &&
+         cv->is_enabled(colvardeps::f_cv_scalar)) != single) {
+      std::cerr << "Error: colvar \"" << cv->name << "\" should " << (single ? "" : "not ")
+                << "pass its value directly through its component." << std::endl;
+      err |= COLVARS_ERROR;
+    }
+  }
+
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  while (proxy->read_frame_xyz("da-traj.xyz") == COLVARS_OK) {
+    out.energies.push_back(proxy->colvars->total_bias_energy);
+    for (colvar *cv : *(proxy->colvars->variables())) {
+      out.values.push_back(cv->value().real_value);
+    }
+    for (size_t ia = 0; ia < forces.size(); ia++) {
+      out.forces.push_back(forces[ia]);
+      forces[ia].reset();
+    }
+  }
+  err |= cvm::get_error();
+
+  delete proxy;
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  size_t const num_colvars = 50;
+
+  run_output out_single, out_generic;
+  if ((run(num_colvars, 1.0, out_single) != COLVARS_OK) ||
+      (run(num_colvars, -1.0, out_generic) != COLVARS_OK)) {
+    std::cerr << "Error: could not run the test." << std::endl;
+    return 1;
+  }
+
+  if (out_single.energies.empty() ||
+      (out_single.energies.size() != out_generic.energies.size())) {
+    std::cerr << "Error: the two runs have different numbers of steps." << std::endl;
+    return 1;
+  }
+
+  int err = 0;
+  for (size_t i = 0; i < out_single.energies.size(); i++) {
+    if ((out_single.energies[i] == 0.0) ||
+        (cvm::fabs(out_single.energies[i] - out_generic.energies[i]) >
+         1.0e-12 * cvm::fabs(out_single.energies[i]))) {
+      std::cerr << "Error: energies at step " << i + 1 << " are " << out_single.energies[i]
+                << " and " << out_generic.energies[i] << std::endl;
+      err = 1;
+    }
+  }
+  for (size_t i = 0; i < out_single.values.size(); i++) {
+    if (cvm::fabs(out_single.values[i] + out_generic.values[i]) >
+        1.0e-12 * cvm::fabs(out_single.values[i])) {
+      std::cerr << "Error: values " << out_single.values[i] << " and "
+                << out_generic.values[i] << " are not opposite" << std::endl;
+      err = 1;
+    }
+  }
+  for (size_t i = 0; i < out_single.forces.size(); i++) {
+    if ((out_single.forces[i] - out_generic.forces[i]).norm() >
+        1.0e-12 * out_single.forces[i].norm()) {
+      std::cerr << "Error: atomic forces " << out_single.forces[i] << " and "
+                << out_generic.forces[i] << " differ" << std::endl;
+      err = 1;
+    }
+  }
+
+  return err;
+}
@@ -0,0 +1,104 @@
+// -*- c++ -*-
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// Measure the per-colvar cost of many simple distance variables with a
+// restraint applied to all of them.  With a coefficient of 1 each colvar
+// passes its value and force directly through its only component; with a
+// coefficient of -1 the generic linear combination is used instead.
+// Not run by ctest: colvar_scalar_overhead checks the results instead.
+
+std::string make_config(size_t num_colvars, int natoms, cvm::real coeff)
+{
+  std::string conf;
+  std::string names, centers;
+  conf += "colvarsTrajFrequency 0\n";
+  conf += "colvarsRestartFrequency 0\n";
+  for (size_t i = 0; i < num_colvars; i++) {
+    int const a1 = (i % natoms) + 1;
+    int const a2 = ((i * 7 + 13) % natoms) + 1;
+    std::string const name = "d" + cvm::to_str(i + 1);
+    conf += "colvar {\n";
+    conf += "  name " + name + "\n";
+    conf += "  distance {\n";
+    conf += "    componentCoeff " + cvm::to_str(coeff) + "\n";
+    conf += "    group1 {\n";
+    conf += "      atomNumbers " + cvm::to_str(a1) + "\n";
+    conf += "    }\n";
+    conf += "    group2 {\n";
+    conf += "      atomNumbers " + cvm::to_str((a2 == a1) ? (a1 % natoms) + 1 : a2) + "\n";
+    conf += "    }\n";
+    conf += "  }\n";
+    conf += "}\n";
+    names += " " + name;
+    centers += " " + cvm::to_str(coeff * 5.0);
+  }
+  conf += "harmonic {\n";
+  conf += "  colvars" + names + "\n";
+  conf += "  centers" + centers + "\n";
+  conf += "  forceConstant 1.0\n";
+  conf += "}\n";
+  return conf;
+}
+
+
+double run_benchmark(size_t num_colvars, size_t num_steps, cvm::real coeff)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            "colvar_scalar_overhead_benchmark.out");
+
+  int err = proxy->colvars->read_config_string(make_config(num_colvars,
+                                                           decaalanine_num_atoms, coeff));
+  err |= proxy->colvars->load_coords_xyz("da-traj.xyz", proxy->modify_atom_positions(),
+                                         nullptr, true);
+  if (err) {
+    delete proxy;
+    return -1.0;
+  }
+
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t step = 0; step < num_steps; step++) {
+    proxy->colvars->it++;
+    proxy->colvars->calc();
+    for (size_t ia = 0; ia < forces.size(); ia++) {
+      forces[ia].reset();
+    }
+  }
+  auto const end = std::chrono::steady_clock::now();
+
+  delete proxy;
+  return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+
+int main(int argc, char *argv[])
+{
+  size_t const num_colvars = 500;
+  size_t const num_steps = 200;
+
+  double const t_single = run_benchmark(num_colvars, num_steps, 1.0);
+  double const t_generic = run_benchmark(num_colvars, num_steps, -1.0);
+
+  if ((t_single < 0.0) || (t_generic < 0.0)) {
+    std::cerr << "Error: could not set up the benchmark." << std::endl;
+    return 1;
+  }
+
+  std::cout << "Colvars: " << num_colvars << ", steps: " << num_steps << std::endl;
+  std::cout << "Single scalar component: "
+            << t_single / (num_colvars * num_steps) << " us per colvar per step" << std::endl;
+  std::cout << "Linear combination:      "
+            << t_generic / (num_colvars * num_steps) << " us per colvar per step" << std::endl;
+
+  return 0;
+}
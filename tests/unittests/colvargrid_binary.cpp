@@ -0,0 +1,153 @@
+// -*- c++ -*-
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvargrid.h"
+
+
+// Set up a 3-dimensional grid without colvars (as done by the standalone tools)
+template <class G> void init_grid(G &g, std::vector<int> const &nx, size_t mult = 1)
+{
+  for (size_t i = 0; i < nx.size(); i++) {
+    g.lower_boundaries.push_back(colvarvalue(-1.0 * i));
+    g.upper_boundaries.push_back(colvarvalue(-1.0 * i + 0.1 * (i + 1) * nx[i]));
+    g.widths.push_back(0.1 * (i + 1));
+    g.periodic.push_back(i == 2);
+  }
+  g.setup(nx, 0, mult);
+}
+
+
+template <class G> std::string multicol(G const &g)
+{
+  std::ostringstream os;
+  g.write_multicol(os);
+  return os.str();
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  colvarproxy *proxy = new colvarproxy();
+  proxy->colvars = new colvarmodule(proxy);
+
+  std::vector<int> const nx{7, 5, 6};
+
+  colvar_grid_count count;
+  init_grid(count, nx);
+  colvar_grid_gradient gradient;
+  init_grid(gradient, nx, nx.size());
+  gradient.samples = std::make_shared<colvar_grid_count>(count);
+  gradient.samples->setup(nx, 0, 1);
+
+  cvm::real forces[3];
+  size_t n = 0;
+  for (colvar_grid_index ix = count.new_index(); count.index_ok(ix); count.incr(ix), n++) {
+    for (size_t k = 0; k < n % 3; k++) {
+      count.incr_count(ix);
+      forces[0] = 0.5 * n;
+      forces[1] = -1.0 / (n + 1);
+      forces[2] = 1.0e-3 * n * n;
+      gradient.acc_force(ix, forces);
+    }
+  }
+
+  // Round trip through the binary format
+  std::ostringstream count_os, gradient_os;
+  count.write_binary(count_os);
+  gradient.write_binary(gradient_os);
+  std::string const count_bin = count_os.str();
+  std::string const gradient_bin = gradient_os.str();
+
+  if (count_bin.size() != colvar_grid_binary_format::header_size +
+      nx.size() * colvar_grid_binary_format::dimension_size +
+      count.number_of_points() * sizeof(uint64_t)) {
+    std::cerr << "Error: unexpected size of binary count grid: " << count_bin.size() << std::endl;
+    err = 1;
+  }
+
+  colvar_grid_count count_in;
+  init_grid(count_in, nx);
+  colvar_grid_gradient gradient_in;
+  init_grid(gradient_in, nx, nx.size());
+  gradient_in.samples = std::make_shared<colvar_grid_count>(count_in);
+  gradient_in.samples->setup(nx, 0, 1);
+
+  // Samples must be read before the gradients, which are stored as sums
+  gradient_in.samples->read_binary(count_bin.data(), count_bin.size());
+  std::istringstream gradient_is(gradient_bin);
+  if (!gradient_in.read_multicol(gradient_is)) {
+    std::cerr << "Error: could not read binary gradient grid from stream." << std::endl;
+    err = 1;
+  }
+
+  if (multicol(*(gradient_in.samples)) != multicol(count)) {
+    std::cerr << "Error: count grid differs after binary round trip." << std::endl;
+    err = 1;
+  }
+  if (multicol(gradient_in) != multicol(gradient)) {
+    std::cerr << "Error: gradient grid differs after binary round trip." << std::endl;
+    err = 1;
+  }
+
+  // Same through a file, whose format is detected automatically
+  count.write_binary("test_grid.count", "binary count file");
+  if ((count_in.read_multicol("test_grid.count", "binary count file") != COLVARS_OK) ||
+      (multicol(count_in) != multicol(count))) {
+    std::cerr << "Error: count grid differs after reading binary file." << std::endl;
+    err = 1;
+  }
+  proxy->remove_file("test_grid.count");
+
+  // Read into a grid with a different (coarser along the first dimension) definition
+  std::vector<int> const nx_coarse{4, 5, 6};
+  colvar_grid_count count_coarse;
+  init_grid(count_coarse, nx_coarse);
+  count_coarse.widths[0] = 0.2;
+  count_coarse.read_binary(count_bin.data(), count_bin.size(), false);
+  colvar_grid_index ix{3, 2, 1};
+  if (count_coarse.value(ix) != count.value(colvar_grid_index{6, 2, 1})) {
+    std::cerr << "Error: incorrect value after remapping binary grid." << std::endl;
+    err = 1;
+  }
+
+  // Invalid input should be rejected
+  colvar_grid_scalar scalar;
+  init_grid(scalar, nx);
+  if (scalar.read_binary(count_bin.data(), count_bin.size()) == COLVARS_OK) {
+    std::cerr << "Error: reading counts into a scalar grid should fail." << std::endl;
+    err = 1;
+  }
+  if (count_in.read_binary(count_bin.data(), count_bin.size() - 8) == COLVARS_OK) {
+    std::cerr << "Error: reading truncated binary data should fail." << std::endl;
+    err = 1;
+  }
+
+  // Corrupted numbers of points must be rejected before reading any data
+  {
+    int64_t const bad_nx[][3] = { {0, 5, 6}, {-7, 5, 6}, {7, -1, 6},
+                                  {int64_t(1) << 40, int64_t(1) << 40, int64_t(1) << 40} };
+    for (size_t k = 0; k < sizeof(bad_nx) / sizeof(bad_nx[0]); k++) {
+      std::string corrupted(count_bin);
+      for (size_t i = 0; i < nx.size(); i++) {
+        size_t const offset = colvar_grid_binary_format::header_size +
+          i * colvar_grid_binary_format::dimension_size + 2 * sizeof(double);
+        std::memcpy(&corrupted[offset], &bad_nx[k][i], sizeof(int64_t));
+      }
+      if (count_in.read_binary(corrupted.data(), corrupted.size()) == COLVARS_OK) {
+        std::cerr << "Error: reading binary data with invalid sizes should fail (case "
+                  << k << ")." << std::endl;
+        err = 1;
+      }
+    }
+  }
+
+  return err;
+}
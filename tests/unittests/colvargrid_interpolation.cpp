@@ -0,0 +1,116 @@
+// -*- c++ -*-
+
+#include <iostream>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvargrid.h"
+
+
+// Set up a 2-dimensional grid without colvars (as done by the standalone tools)
+template <class G> void init_grid(G &g, bool periodic, size_t mult = 1)
+{
+  std::vector<int> const nx{20, 16};
+  for (size_t i = 0; i < nx.size(); i++) {
+    g.lower_boundaries.push_back(colvarvalue(-1.0));
+    g.widths.push_back(0.1 * (i + 1));
+    g.periodic.push_back(periodic && (i == 1));
+  }
+  g.setup(nx, 0.0, mult);
+}
+
+
+// Values at the bin centers are given by a quadratic polynomial
+cvm::real f(cvm::real x, cvm::real y)
+{
+  return 1.0 + 0.5 * x - 2.0 * y + 0.25 * x * x - x * y;
+}
+
+
+int check(char const *what, cvm::real value, cvm::real ref)
+{
+  if (cvm::fabs(value - ref) > 1.0e-10) {
+    std::cerr << "Error: " << what << " is " << value << " instead of " << ref << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  colvarproxy *proxy = new colvarproxy();
+  proxy->colvars = new colvarmodule(proxy);
+
+  colvar_grid_scalar scalar;
+  init_grid(scalar, false);
+  colvar_grid_gradient gradient;
+  init_grid(gradient, false, 2);
+
+  for (colvar_grid_index ix = scalar.new_index(); scalar.index_ok(ix); scalar.incr(ix)) {
+    cvm::real const x = scalar.bin_to_value_scalar(ix[0], 0).real_value;
+    cvm::real const y = scalar.bin_to_value_scalar(ix[1], 1).real_value;
+    scalar.set_value(ix, f(x, y));
+    // Store a linear function as the two components of the gradient grid
+    gradient.set_value(ix, x + y, 0);
+    gradient.set_value(ix, 3.0 * x, 1);
+  }
+
+  std::vector<colvarvalue> values{colvarvalue(-0.13), colvarvalue(0.31)};
+  cvm::real const x = values[0].real_value, y = values[1].real_value;
+  colvar_grid_stencil stencil;
+
+  // Nearest bin
+  scalar.interpolation_stencil(&values, colvar_grid_stencil::nearest, stencil);
+  err |= check("nearest-bin value", scalar.value(stencil),
+               scalar.value(scalar.get_colvars_index(values)));
+
+  // Multilinear interpolation is exact for a linear function
+  if (!scalar.interpolation_stencil(&values, colvar_grid_stencil::linear, stencil) ||
+      (stencil.size() != 4)) {
+    std::cerr << "Error: invalid stencil for linear interpolation." << std::endl;
+    err = 1;
+  }
+  cvm::real v[2] = {0.0, 0.0};
+  gradient.add_vector_value(stencil, v);
+  err |= check("linear interpolation of component 0", v[0], x + y);
+  err |= check("linear interpolation of component 1", v[1], 3.0 * x);
+
+  // Cubic interpolation is exact for a quadratic function
+  if (!scalar.interpolation_stencil(&values, colvar_grid_stencil::cubic, stencil) ||
+      (stencil.size() != 16)) {
+    std::cerr << "Error: invalid stencil for cubic interpolation." << std::endl;
+    err = 1;
+  }
+  err |= check("cubic interpolation", scalar.value(stencil), f(x, y));
+
+  // Near a non-periodic boundary, the closest bin center is used
+  values[0] = colvarvalue(-0.99);
+  scalar.interpolation_stencil(&values, colvar_grid_stencil::linear, stencil);
+  cvm::real const y0 = scalar.bin_to_value_scalar(scalar.value_to_bin_scalar(values[1], 1), 1).real_value;
+  cvm::real const y1 = y0 + 0.2;
+  cvm::real const fy = (values[1].real_value - y0) / 0.2;
+  err |= check("linear interpolation at boundary", scalar.value(stencil),
+               (1.0 - fy) * f(-0.95, y0) + fy * f(-0.95, y1));
+
+  // Across a periodic boundary, the bins at the other end are used
+  colvar_grid_scalar periodic;
+  init_grid(periodic, true);
+  for (colvar_grid_index ix = periodic.new_index(); periodic.index_ok(ix); periodic.incr(ix)) {
+    periodic.set_value(ix, ix[1]);
+  }
+  values[1] = colvarvalue(-0.95);
+  periodic.interpolation_stencil(&values, colvar_grid_stencil::linear, stencil);
+  err |= check("linear interpolation across periodic boundary", periodic.value(stencil), 0.25 * 15);
+
+  // Points outside the grid are rejected
+  values[0] = colvarvalue(1.5);
+  if (scalar.interpolation_stencil(&values, colvar_grid_stencil::linear, stencil)) {
+    std::cerr << "Error: stencil computed for a point outside the grid." << std::endl;
+    err = 1;
+  }
+
+  return err;
+}
@@ -0,0 +1,89 @@
+// -*- c++ -*-
+
+#include <iostream>
+#include <sstream>
+
+#include "colvarmodule.h"
+#include "colvargrid.h"
+
+
+// Set up a 4-dimensional grid without colvars (as done by the standalone tools)
+void init_grid(colvar_grid_scalar &g, bool sparse)
+{
+  std::vector<int> const nx{40, 30, 20, 24};
+  for (size_t i = 0; i < nx.size(); i++) {
+    g.lower_boundaries.push_back(colvarvalue(-1.0 * i));
+    g.widths.push_back(0.1 * (i + 1));
+    g.periodic.push_back(i == 3);
+  }
+  g.data.set_sparse(sparse);
+  g.setup(nx, 0.0, 1);
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  colvar_grid_scalar dense_grid, sparse_grid;
+  init_grid(dense_grid, false);
+  init_grid(sparse_grid, true);
+
+  // Sample a small region of the grid
+  std::vector<int> ix(4, 0);
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 4; j++) {
+      ix = {10 + i, 12 + j, 3, 23 - i};
+      dense_grid.acc_value(ix, 0.5 * i + j);
+      sparse_grid.acc_value(ix, 0.5 * i + j);
+    }
+  }
+  // Adding zeros should not allocate anything
+  ix = {0, 0, 0, 0};
+  sparse_grid.acc_value(ix, 0.0);
+
+  if (sparse_grid.data.num_allocated() >= sparse_grid.number_of_points() / 10) {
+    std::cerr << "Error: too many elements allocated in sparse grid: "
+              << sparse_grid.data.num_allocated() << std::endl;
+    err = 1;
+  }
+
+  dense_grid.add_constant(2.0);
+  sparse_grid.add_constant(2.0);
+  dense_grid.multiply_constant(-0.5);
+  sparse_grid.multiply_constant(-0.5);
+
+  if ((dense_grid.minimum_value() != sparse_grid.minimum_value()) ||
+      (dense_grid.maximum_value() != sparse_grid.maximum_value()) ||
+      (dense_grid.integral() != sparse_grid.integral())) {
+    std::cerr << "Error: dense and sparse grids have different statistics." << std::endl;
+    err = 1;
+  }
+
+  std::ostringstream dense_os, sparse_os;
+  dense_grid.write_multicol(dense_os);
+  sparse_grid.write_multicol(sparse_os);
+  if (dense_os.str() != sparse_os.str()) {
+    std::cerr << "Error: dense and sparse grids produce different output." << std::endl;
+    err = 1;
+  }
+
+  // Round trip through the contiguous representation
+  std::vector<cvm::real> raw;
+  sparse_grid.raw_data_out(raw);
+  colvar_grid_scalar copy_grid(sparse_grid);
+  copy_grid.setup(sparse_grid.number_of_points_vec(), 0.0, 1);
+  copy_grid.raw_data_in(raw);
+  copy_grid.data.set_sparse(false);
+  std::ostringstream copy_os;
+  copy_grid.write_multicol(copy_os);
+  if (copy_os.str() != dense_os.str()) {
+    std::cerr << "Error: copy of sparse grid differs from original." << std::endl;
+    err = 1;
+  }
+
+  std::cout << "Sparse grid uses " << sparse_grid.data.num_allocated() << " of "
+            << sparse_grid.number_of_points() << " elements." << std::endl;
+
+  return err;
+}
@@ -0,0 +1,122 @@
+// -*- c++ -*-
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "colvarmodule.h"
+#include "colvarvalue.h"
+
+
+// Count heap allocations made by the operations under test
+static size_t num_allocations = 0;
+
+void *operator new(std::size_t size)
+{
+  num_allocations++;
+  void *p = std::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+
+// Operations done on colvar values at each step by a harmonic restraint and
+// by the colvar itself (copies, differences, gradients, scaling)
+cvm::real restraint_step(colvarvalue const &x, colvarvalue const &x0, colvarvalue &force)
+{
+  colvarvalue const diff = x.dist2_grad(x0);
+  colvarvalue f(x);
+  f = -0.5 * diff;
+  force = f;
+  force += f * 0.5;
+  force -= f * 0.5;
+  return 0.5 * x.dist2(x0);
+}
+
+
+int test_type(char const *desc, colvarvalue const &x, colvarvalue const &x0)
+{
+  size_t const num_steps = 1000;
+  colvarvalue force(x0.type());
+  force.type(x0);
+  cvm::real energy = 0.0;
+
+  // Warm up to exclude one-time allocations
+  energy += restraint_step(x, x0, force);
+
+  size_t const start = num_allocations;
+  for (size_t step = 0; step < num_steps; step++) {
+    energy += restraint_step(x, x0, force);
+  }
+  size_t const count = num_allocations - start;
+
+  std::cout << desc << ": energy = " << energy << ", allocations per step = "
+            << static_cast<double>(count) / num_steps << std::endl;
+
+  if (count > 0) {
+    std::cerr << "Error: " << desc << " values allocated memory " << count
+              << " times over " << num_steps << " steps." << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  err |= test_type("scalar", colvarvalue(1.5), colvarvalue(0.5));
+
+  err |= test_type("3-vector", colvarvalue(cvm::rvector(1.0, 2.0, 3.0)),
+                   colvarvalue(cvm::rvector(0.5, 0.0, -1.0)));
+
+  {
+    colvarvalue x(cvm::rvector(1.0, 0.1, 0.0), colvarvalue::type_unit3vector);
+    colvarvalue x0(cvm::rvector(0.0, 1.0, 0.2), colvarvalue::type_unit3vector);
+    x.apply_constraints();
+    x0.apply_constraints();
+    err |= test_type("unit 3-vector", x, x0);
+  }
+
+  {
+    colvarvalue q(cvm::quaternion(1.0, 0.1, 0.2, 0.0), colvarvalue::type_quaternion);
+    colvarvalue q0(cvm::quaternion(0.9, 0.0, -0.3, 0.1), colvarvalue::type_quaternion);
+    q.apply_constraints();
+    q0.apply_constraints();
+    err |= test_type("quaternion", q, q0);
+  }
+
+  {
+    // Small vectors use the inline buffer of vector1d
+    cvm::vector1d<cvm::real> v(6), v0(6);
+    for (size_t i = 0; i < v.size(); i++) {
+      v[i] = 0.1 * i;
+      v0[i] = -0.2 * i;
+    }
+    err |= test_type("6-dimensional vector", colvarvalue(v, colvarvalue::type_vector),
+                     colvarvalue(v0, colvarvalue::type_vector));
+  }
+
+  {
+    // Concatenated values share their element layout between copies
+    colvarvalue x(colvarvalue::type_vector), x0(colvarvalue::type_vector);
+    x.add_elem(colvarvalue(1.0));
+    x.add_elem(colvarvalue(cvm::rvector(1.0, 2.0, 3.0)));
+    x0.add_elem(colvarvalue(0.0));
+    x0.add_elem(colvarvalue(cvm::rvector(0.0, 1.0, 0.0)));
+    err |= test_type("concatenated vector", x, x0);
+  }
+
+  return err;
+}
@@ -0,0 +1,144 @@
+// -*- c++ -*-
+
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Lepton.h"
+
+#include "colvarmodule.h"
+#include "colvar.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// Each expression is evaluated by Colvars as the customFunction of a colvar,
+// and compared against Lepton's own CompiledExpression; the atomic forces
+// are compared against finite differences of the restraint energy.  The
+// expressions cover every operation that Colvars evaluates by itself, and a
+// few of those that it leaves to Lepton.
+std::vector<std::string> const expressions = {
+  "d1 + d2",
+  "d1 - d2",
+  "d1 * d2",
+  "d1 / d2",
+  "-(d1 * d2)",
+  "d1^2 + d2^3",
+  "1 / d1",
+  "2.5 * d1 + 3.0",
+  "sqrt(d1 * d2)",
+  "exp(-d1 / d2)",
+  "log(d1 + d2)",
+  "sin(d1) * cos(d2)",
+  "(d1 - d2)^2 + sin(d1 - d2) + cos(d1 - d2)",
+  "d1^2.5 + atan2(d1, d2)",
+  "tanh(d1 - d2) + erf(d2 - d1)",
+  "min(d1, d2) * max(d1, d2) + abs(d1 - d2)",
+};
+
+
+std::string make_config(std::string const &expression)
+{
+  return R"(
+colvarsTrajFrequency 0
+colvarsRestartFrequency 0
+
+colvar {
+  name d1
+  distance {
+    group1 { atomNumbers 1 2 }
+    group2 { atomNumbers 30 }
+  }
+}
+
+colvar {
+  name d2
+  distance {
+    group1 { atomNumbers 3 }
+    group2 { atomNumbers 50 51 }
+  }
+}
+
+colvar {
+  name f
+  customFunction )" + expression + R"(
+  distance {
+    name d1
+    group1 { atomNumbers 1 2 }
+    group2 { atomNumbers 30 }
+  }
+  distance {
+    name d2
+    group1 { atomNumbers 3 }
+    group2 { atomNumbers 50 51 }
+  }
+}
+
+harmonic {
+  colvars f
+  centers 0.0
+  forceConstant 0.01
+}
+)";
+}
+
+
+/// Value of the expression computed by Lepton itself
+cvm::real lepton_value(std::string const &expression, cvm::real d1, cvm::real d2)
+{
+  Lepton::CompiledExpression compiled =
+    Lepton::Parser::parse(expression).createCompiledExpression();
+  std::set<std::string> const &variables = compiled.getVariables();
+  if (variables.count("d1")) compiled.getVariableReference("d1") = d1;
+  if (variables.count("d2")) compiled.getVariableReference("d2") = d2;
+  return compiled.evaluate();
+}
+
+
+int test_expression(std::string const &expression)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            "custom_function_evaluator.out");
+
+  if (proxy->colvars->read_config_string(make_config(expression)) != COLVARS_OK) {
+    delete proxy;
+    return 1;
+  }
+
+  if (proxy->read_frame_xyz("da-traj.xyz") != COLVARS_OK) {
+    delete proxy;
+    return 1;
+  }
+
+  int err = 0;
+
+  cvm::real const value = proxy->colvars->colvar_by_name("f")->value().real_value;
+  cvm::real const ref_value =
+    lepton_value(expression, proxy->colvars->colvar_by_name("d1")->value().real_value,
+                 proxy->colvars->colvar_by_name("d2")->value().real_value);
+  if (std::fabs(value - ref_value) > 1.0e-12 * std::max(1.0, std::fabs(ref_value))) {
+    std::cerr << "Error: \"" << expression << "\" is " << value << ", Lepton gives "
+              << ref_value << std::endl;
+    err = 1;
+  }
+
+  err |= check_forces_finite_difference(proxy, {1, 2, 3, 30, 50, 51},
+                                        "with \"" + expression + "\", ");
+
+  delete proxy;
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+  for (std::string const &expression : expressions) {
+    err |= test_expression(expression);
+  }
+  return err;
+}
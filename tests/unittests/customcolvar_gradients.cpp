@@ -0,0 +1,63 @@
+// -*- c++ -*-
+
+#include <string>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// A customColvar combining a component without explicit atomic gradients
+// (distanceVec) with one that has them (distance): the forces on the atoms
+// must match the finite-difference derivatives of the restraint energy
+std::string const config = R"(
+colvarsTrajFrequency 0
+colvarsRestartFrequency 0
+
+colvar {
+  name c
+  customColvar {
+    customFunction r1*r2 + 2.0*r3 + d^2
+    distanceVec {
+      name r
+      group1 { atomNumbers 1 2 }
+      group2 { atomNumbers 30 }
+    }
+    distance {
+      name d
+      group1 { atomNumbers 3 }
+      group2 { atomNumbers 50 51 }
+    }
+  }
+}
+
+harmonic {
+  colvars c
+  centers 0.0
+  forceConstant 0.01
+}
+)";
+
+
+int main(int argc, char *argv[])
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            "customcolvar_gradients.out");
+
+  if (proxy->colvars->read_config_string(config) != COLVARS_OK) {
+    delete proxy;
+    return 1;
+  }
+
+  if (proxy->read_frame_xyz("da-traj.xyz") != COLVARS_OK) {
+    delete proxy;
+    return 1;
+  }
+
+  int const err = check_forces_finite_difference(proxy, {1, 2, 3, 30, 50, 51}, "");
+
+  delete proxy;
+  return err;
+}
@@ -0,0 +1,139 @@
+// -*- c++ -*-
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvar.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// The walls on "one" apply a force only at some frames; those on "free"
+// never do, so that its deferred gradients are never needed by the forces
+std::string const config = R"(
+colvarsTrajFrequency 0
+colvarsRestartFrequency 0
+indexFile index.ndx
+
+colvar {
+  name one
+  distance {
+    group1 { indexGroup group1 }
+    group2 { indexGroup group2 }
+  }
+}
+
+colvar {
+  name rmsd
+  rmsd {
+    atoms { indexGroup RMSD_atoms }
+    refPositionsFile da-traj.xyz
+  }
+}
+
+colvar {
+  name free
+  distance {
+    group1 { atomNumbers 1 }
+    group2 { atomNumbers 20 }
+  }
+}
+
+harmonicWalls {
+  colvars one
+  lowerWalls 3.4
+  upperWalls 3.42
+  forceConstant 10.0
+}
+
+harmonicWalls {
+  colvars free
+  lowerWalls 0.0
+  upperWalls 100.0
+  forceConstant 10.0
+}
+
+harmonic {
+  colvars rmsd
+  centers 0.5
+  forceConstant 10.0
+}
+)";
+
+
+int run(bool defer, std::vector<cvm::rvector> &out_forces)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            std::string("defer_gradients_") +
+                                            (defer ? "on" : "off"));
+
+  std::string const conf = std::string("deferGradients ") + (defer ? "on" : "off") + "\n";
+  int err = proxy->colvars->read_config_string(conf + config);
+  err |= run_script(proxy, {"cv", "colvar", "free", "set", "collect_atom_ids", "1"});
+  if (err) {
+    delete proxy;
+    return err;
+  }
+
+  colvar *cv_one = proxy->colvars->colvar_by_name("one");
+  colvar *cv_free = proxy->colvars->colvar_by_name("free");
+  std::vector<cvm::rvector> const &positions = *(proxy->modify_atom_positions());
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  size_t num_forced_steps = 0, num_steps = 0;
+
+  // Each frame is read twice to obtain more steps
+  for (int pass = 0; pass < 2 && !err; pass++) {
+    while (proxy->read_frame_xyz("da-traj.xyz") == COLVARS_OK) {
+      num_steps++;
+      for (size_t ia = 0; ia < forces.size(); ia++) {
+        out_forces.push_back(forces[ia]);
+        forces[ia].reset();
+      }
+      if (cv_one->applied_force().norm2() > 0.0) num_forced_steps++;
+
+      if (defer) {
+        // Gradients not needed for the forces are computed on request
+        err |= run_script(proxy, {"cv", "colvar", "free", "getgradients"});
+        cvm::rvector const u = (positions[19] - positions[0]).unit();
+        if ((cv_free->atomic_gradients.size() != 2) ||
+            ((cv_free->atomic_gradients[0] + u).norm() > 1.0e-12) ||
+            ((cv_free->atomic_gradients[1] - u).norm() > 1.0e-12)) {
+          std::cerr << "Error: incorrect gradients of colvar \"free\" at step "
+                    << cvm::step_absolute() << std::endl;
+          err |= COLVARS_ERROR;
+        }
+      }
+    }
+    proxy->close_input_stream("da-traj.xyz");
+    err |= cvm::get_error();
+  }
+
+  if (num_forced_steps == 0 || num_forced_steps == num_steps) {
+    std::cerr << "Error: the test requires steps with and without forces on \"one\"." << std::endl;
+    err |= COLVARS_ERROR;
+  }
+
+  proxy->post_run();
+  delete proxy;
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  std::vector<cvm::rvector> forces_off, forces_on;
+  if (run(false, forces_off) != COLVARS_OK) {
+    std::cerr << "Error: run without deferred gradients failed." << std::endl;
+    return 1;
+  }
+  if (run(true, forces_on) != COLVARS_OK) {
+    std::cerr << "Error: run with deferred gradients failed." << std::endl;
+    return 1;
+  }
+
+  return compare_runs(forces_off, forces_on, "force", "deferred gradients");
+}
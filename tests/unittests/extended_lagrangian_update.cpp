@@ -0,0 +1,111 @@
+// -*- c++ -*-
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvar.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// Updating an extended-Lagrangian colvar from a script during a run must give
+// the same trajectory whether or not the coordinates are integrated in batch
+std::string const config = R"(
+colvarsTrajFrequency 0
+colvarsRestartFrequency 0
+indexFile index.ndx
+
+colvar {
+  name x
+  extendedLagrangian on
+  extendedTemp 300.0
+  extendedFluctuation 0.2
+  extendedTimeConstant 40.0
+  distance {
+    group1 { indexGroup group1 }
+    group2 { indexGroup group2 }
+  }
+}
+
+colvar {
+  name y
+  extendedLagrangian on
+  extendedTemp 300.0
+  extendedFluctuation 0.1
+  extendedTimeConstant 40.0
+  distance {
+    group1 { indexGroup Protein_C-alpha_1 }
+    group2 { indexGroup Protein_C-alpha_2 }
+  }
+}
+
+harmonic {
+  colvars x y
+  centers 3.0 4.0
+  forceConstant 10.0
+}
+)";
+
+
+/// Stub proxy that reports a running simulation, so that the extended
+/// coordinates are integrated
+class colvarproxy_stub_running : public colvarproxy_stub {
+public:
+  colvarproxy_stub_running()
+  {
+    b_simulation_running = true;
+  }
+};
+
+
+int run(bool batch, std::vector<cvm::real> &out)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub_running(),
+                                            std::string("extended_lagrangian_update_") +
+                                            (batch ? "on" : "off"));
+
+  std::string const conf = std::string("batchExtendedLagrangian ") + (batch ? "on" : "off") +
+    "\n";
+  int err = proxy->colvars->read_config_string(conf + config);
+  if (err) {
+    delete proxy;
+    return err;
+  }
+
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  // Each frame is read several times to obtain more steps
+  for (int pass = 0; pass < 4 && !err; pass++) {
+    while (proxy->read_frame_xyz("da-traj.xyz") == COLVARS_OK) {
+      err |= run_script(proxy, {"cv", "colvar", "x", "update"});
+      out.push_back(proxy->colvars->total_bias_energy);
+      for (colvar *cv : *(proxy->colvars->variables())) {
+        out.push_back(cv->value().real_value);
+      }
+      for (size_t ia = 0; ia < forces.size(); ia++) {
+        for (size_t k = 0; k < 3; k++) out.push_back(forces[ia][k]);
+        forces[ia].reset();
+      }
+    }
+    proxy->close_input_stream("da-traj.xyz");
+    err |= cvm::get_error();
+  }
+
+  delete proxy;
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  std::vector<cvm::real> out_off, out_on;
+  if ((run(false, out_off) != COLVARS_OK) || (run(true, out_on) != COLVARS_OK)) {
+    std::cerr << "Error: could not run the test." << std::endl;
+    return 1;
+  }
+
+  return compare_runs(out_off, out_on, "value", "batched integration");
+}
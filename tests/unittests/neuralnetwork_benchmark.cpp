@@ -0,0 +1,79 @@
+// -*- c++ -*-
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+#include "colvar_neuralnetworkcompute.h"
+
+using namespace neuralnetworkCV;
+
+
+// Measure the cost of evaluating one output of a dense network and its
+// gradient.  Not run by ctest: neuralnetwork_gradients checks the results.
+
+// Write the weights and biases of a layer with deterministic pseudo-random values
+void write_layer(std::string const &prefix, size_t input_size, size_t output_size,
+                 unsigned &state)
+{
+  std::ofstream weights(prefix + "_weights.txt");
+  std::ofstream biases(prefix + "_biases.txt");
+  weights.precision(17);
+  biases.precision(17);
+  for (size_t i = 0; i < output_size; i++) {
+    for (size_t j = 0; j < input_size; j++) {
+      state = state * 1103515245u + 12345u;
+      weights << (((state >> 8) % 2001) / 1000.0 - 1.0) / std::sqrt(double(input_size)) << " ";
+    }
+    weights << "\n";
+    state = state * 1103515245u + 12345u;
+    biases << (((state >> 8) % 2001) / 1000.0 - 1.0) * 0.1 << "\n";
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  colvarproxy_stub *proxy = new colvarproxy_stub();
+  proxy->set_output_prefix("neuralnetwork_benchmark.out");
+
+  std::vector<size_t> const sizes = {6, 32, 32, 3};
+  std::vector<std::string> const activations = {"tanh", "sigmoid", "linear"};
+
+  unsigned state = 12345u;
+  neuralNetworkCompute nn;
+  for (size_t i_layer = 0; i_layer + 1 < sizes.size(); i_layer++) {
+    std::string const prefix = "neuralnetwork_benchmark.layer" + cvm::to_str(i_layer + 1);
+    write_layer(prefix, sizes[i_layer], sizes[i_layer + 1], state);
+    auto const &f = activation_function_map[activations[i_layer]];
+    denseLayer d(prefix + "_weights.txt", prefix + "_biases.txt", f.first, f.second);
+    if (!nn.addDenseLayer(d)) {
+      std::cerr << "Error: could not add layer " << i_layer + 1 << std::endl;
+      return 1;
+    }
+  }
+
+  nn.input().resize(sizes.front());
+  for (size_t j = 0; j < sizes.front(); j++) {
+    nn.input()[j] = 0.3 * j - 0.7;
+  }
+
+  size_t const num_steps = 20000;
+  auto const start = std::chrono::steady_clock::now();
+  for (size_t step = 0; step < num_steps; step++) {
+    nn.compute(0);
+  }
+  auto const end = std::chrono::steady_clock::now();
+  std::cout << "Network " << sizes[0] << "-" << sizes[1] << "-" << sizes[2] << "-" << sizes[3]
+            << ": " << std::chrono::duration<double, std::micro>(end - start).count() / num_steps
+            << " us per evaluation of one output and its gradient" << std::endl;
+
+  delete proxy;
+  return 0;
+}
@@ -0,0 +1,130 @@
+// -*- c++ -*-
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+#include "colvar_neuralnetworkcompute.h"
+
+using namespace neuralnetworkCV;
+
+
+// Write the weights and biases of a layer with deterministic pseudo-random values
+void write_layer(std::string const &prefix, size_t input_size, size_t output_size,
+                 unsigned &state)
+{
+  std::ofstream weights(prefix + "_weights.txt");
+  std::ofstream biases(prefix + "_biases.txt");
+  weights.precision(17);
+  biases.precision(17);
+  for (size_t i = 0; i < output_size; i++) {
+    for (size_t j = 0; j < input_size; j++) {
+      state = state * 1103515245u + 12345u;
+      weights << (((state >> 8) % 2001) / 1000.0 - 1.0) / std::sqrt(double(input_size)) << " ";
+    }
+    weights << "\n";
+    state = state * 1103515245u + 12345u;
+    biases << (((state >> 8) % 2001) / 1000.0 - 1.0) * 0.1 << "\n";
+  }
+}
+
+
+int main(int argc, char *argv[])
+{
+  colvarproxy_stub *proxy = new colvarproxy_stub();
+  proxy->set_output_prefix("neuralnetwork_gradients.out");
+
+  std::vector<size_t> const sizes = {6, 32, 32, 3};
+  std::vector<std::string> const activations = {"tanh", "sigmoid", "linear"};
+
+  unsigned state = 12345u;
+  neuralNetworkCompute nn;
+  for (size_t i_layer = 0; i_layer + 1 < sizes.size(); i_layer++) {
+    std::string const prefix = "neuralnetwork_gradients.layer" + cvm::to_str(i_layer + 1);
+    write_layer(prefix, sizes[i_layer], sizes[i_layer + 1], state);
+    auto const &f = activation_function_map[activations[i_layer]];
+    denseLayer d(prefix + "_weights.txt", prefix + "_biases.txt", f.first, f.second);
+    if (!nn.addDenseLayer(d)) {
+      std::cerr << "Error: could not add layer " << i_layer + 1 << std::endl;
+      return 1;
+    }
+  }
+
+  nn.input().resize(sizes.front());
+  for (size_t j = 0; j < sizes.front(); j++) {
+    nn.input()[j] = 0.3 * j - 0.7;
+  }
+
+  int err = 0;
+  size_t const num_outputs = sizes.back();
+  size_t const num_inputs = sizes.front();
+
+  // Gradients of all outputs, compared with central finite differences
+  nn.compute();
+  std::vector<double> grads(num_outputs * num_inputs), outputs(num_outputs);
+  for (size_t i = 0; i < num_outputs; i++) {
+    outputs[i] = nn.getOutput(i);
+    for (size_t j = 0; j < num_inputs; j++) {
+      grads[i * num_inputs + j] = nn.getGradient(i, j);
+    }
+  }
+
+  double const h = 1.0e-5;
+  for (size_t j = 0; j < num_inputs; j++) {
+    double const x = nn.input()[j];
+    std::vector<double> f_plus(num_outputs), f_minus(num_outputs);
+    nn.input()[j] = x + h;
+    nn.compute(0);
+    for (size_t i = 0; i < num_outputs; i++) f_plus[i] = nn.getOutput(i);
+    nn.input()[j] = x - h;
+    nn.compute(0);
+    for (size_t i = 0; i < num_outputs; i++) f_minus[i] = nn.getOutput(i);
+    nn.input()[j] = x;
+    for (size_t i = 0; i < num_outputs; i++) {
+      double const fd = (f_plus[i] - f_minus[i]) / (2.0 * h);
+      if (std::fabs(fd - grads[i * num_inputs + j]) > 1.0e-7) {
+        std::cerr << "Error: gradient of output " << i << " wrt input " << j << " is "
+                  << grads[i * num_inputs + j] << ", finite difference gives " << fd
+                  << std::endl;
+        err = 1;
+      }
+    }
+  }
+
+  // Computing the gradient of one output only gives the same values
+  for (size_t i = 0; i < num_outputs; i++) {
+    nn.compute(i);
+    for (size_t j = 0; j < num_inputs; j++) {
+      if ((nn.getGradient(i, j) != grads[i * num_inputs + j]) ||
+          (nn.getOutput(i) != outputs[i])) {
+        std::cerr << "Error: single-output gradient of output " << i << " wrt input " << j
+                  << " differs from the full computation" << std::endl;
+        err = 1;
+      }
+    }
+  }
+
+  // Per-layer Jacobians are consistent with the backpropagated gradients
+  {
+    denseLayer const &d = nn.getLayer(0);
+    std::vector<std::vector<double>> jacobian(d.getOutputSize(),
+                                              std::vector<double>(d.getInputSize()));
+    d.computeGradient(nn.input(), jacobian);
+    for (size_t i = 0; i < d.getOutputSize(); i++) {
+      for (size_t j = 0; j < d.getInputSize(); j++) {
+        if (jacobian[i][j] != d.computeGradientElement(nn.input(), i, j)) {
+          std::cerr << "Error: inconsistent Jacobian element " << i << ", " << j << std::endl;
+          err = 1;
+        }
+      }
+    }
+  }
+
+  delete proxy;
+  return err;
+}
@@ -0,0 +1,135 @@
+// -*- c++ -*-
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "colvarmodule.h"
+#include "colvarproxy_replicas.h"
+
+
+// Messages exchanged between simulated replicas
+struct mailbox {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::map<std::pair<int, int>, std::deque<std::vector<char>>> queues;
+};
+
+
+// Replica that communicates with others (in separate threads) only through
+// point-to-point messages, thus exercising the generic collective operations
+class thread_replica : public colvarproxy_replicas {
+
+public:
+
+  thread_replica(int rank, int num, mailbox *box) : rank_(rank), num_(num), box_(box) {}
+
+  int replica_index() override { return rank_; }
+
+  int num_replicas() override { return num_; }
+
+  int replica_comm_send(char *msg_data, int msg_len, int dest_rep) override
+  {
+    std::lock_guard<std::mutex> lock(box_->mutex);
+    box_->queues[std::make_pair(rank_, dest_rep)].emplace_back(msg_data, msg_data + msg_len);
+    box_->cond.notify_all();
+    return msg_len;
+  }
+
+  int replica_comm_recv(char *msg_data, int buf_len, int src_rep) override
+  {
+    std::unique_lock<std::mutex> lock(box_->mutex);
+    auto &queue = box_->queues[std::make_pair(src_rep, rank_)];
+    box_->cond.wait(lock, [&queue] { return !queue.empty(); });
+    std::vector<char> const msg = queue.front();
+    queue.pop_front();
+    if (int(msg.size()) > buf_len) return 0;
+    std::memcpy(msg_data, msg.data(), msg.size());
+    return msg.size();
+  }
+
+protected:
+
+  int rank_, num_;
+  mailbox *box_;
+};
+
+
+int run_replica(int rank, int num, mailbox *box)
+{
+  thread_replica replica(rank, num, box);
+  int err = 0;
+
+  // Sum of 0, 1, ..., num-1 in each element
+  std::vector<cvm::real> x(5, cvm::real(rank));
+  std::vector<size_t> n(3, rank);
+  replica.replica_comm_allreduce_sum(x.data(), x.size());
+  replica.replica_comm_allreduce_sum(n.data(), n.size());
+  for (size_t i = 0; i < x.size(); i++) {
+    if (x[i] != 0.5 * num * (num - 1)) err = 1;
+  }
+  for (size_t i = 0; i < n.size(); i++) {
+    if (n[i] != size_t(num * (num - 1) / 2)) err = 1;
+  }
+
+  // Broadcast from the last replica
+  int value = (rank == num - 1) ? 42 : -1;
+  replica.replica_comm_bcast(reinterpret_cast<char *>(&value), sizeof(value), num - 1);
+  if (value != 42) err = 1;
+
+  // Gather one value per replica
+  std::vector<double> all_ranks;
+  replica.replica_comm_allgather(double(rank), all_ranks);
+  for (int p = 0; p < num; p++) {
+    if (all_ranks[p] != p) err = 1;
+  }
+
+  // Gather arrays of different sizes (replica p contributes p copies of p)
+  std::vector<int> all_values;
+  replica.replica_comm_allgatherv(std::vector<int>(rank, rank), all_values);
+  if (all_values.size() != size_t(num * (num - 1) / 2)) {
+    err = 1;
+  } else {
+    size_t k = 0;
+    for (int p = 0; p < num; p++) {
+      for (int i = 0; i < p; i++, k++) {
+        if (all_values[k] != p) err = 1;
+      }
+    }
+  }
+
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  for (int num : {1, 2, 5, 8}) {
+    mailbox box;
+    std::vector<int> errors(num, 0);
+    std::vector<std::thread> threads;
+    for (int rank = 0; rank < num; rank++) {
+      threads.emplace_back([rank, num, &box, &errors] {
+        errors[rank] = run_replica(rank, num, &box);
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    for (int rank = 0; rank < num; rank++) {
+      if (errors[rank]) {
+        std::cerr << "Error: incorrect result of collective operations on replica " << rank
+                  << " of " << num << "." << std::endl;
+        err = 1;
+      }
+    }
+  }
+
+  return err;
+}
@@ -0,0 +1,157 @@
+// -*- c++ -*-
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvar.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+
+#include "unittest_stub_proxy.h"
+
+
+// Variables and biases of different costs, some sharing variables, so that
+// biases are updated while other variables are still being computed.
+// Extended-Lagrangian variables log a message from each task at every step.
+std::string const config = R"(
+colvarsTrajFrequency 1
+colvarsRestartFrequency 10
+indexFile index.ndx
+
+colvar {
+  name one
+  distance {
+    group1 { indexGroup group1 }
+    group2 { indexGroup group2 }
+  }
+}
+
+colvar {
+  name rg
+  gyration {
+    atoms { indexGroup Protein }
+  }
+}
+
+colvar {
+  name rmsd
+  rmsd {
+    atoms { indexGroup RMSD_atoms }
+    refPositionsFile da-traj.xyz
+  }
+}
+
+colvar {
+  name two
+  extendedLagrangian on
+  extendedTemp 300.0
+  extendedFluctuation 0.2
+  width 0.1
+  distance {
+    componentCoeff 0.5
+    group1 { indexGroup Protein_C-alpha_1 }
+    group2 { indexGroup Protein_C-alpha_2 }
+  }
+  distance {
+    componentCoeff 0.5
+    group1 { indexGroup Protein_C-alpha_1_2 }
+    group2 { indexGroup Protein_C-alpha_9_10 }
+  }
+}
+
+harmonic {
+  colvars        one
+  centers        0.1
+  forceConstant  0.001
+  targetForceConstant 0.0001
+  targetNumSteps 10
+  outputEnergy   yes
+}
+
+harmonicWalls {
+  colvars rg rmsd
+  lowerWalls 5.0 0.0
+  upperWalls 6.0 0.5
+  forceConstant 10.0
+}
+
+metadynamics {
+  colvars two
+  hillWeight 0.01
+  hillWidth 2.0
+  newHillFrequency 1
+}
+
+histogram {
+  colvars one rg
+}
+)";
+
+
+/// Energies, colvar values and atomic forces at each step
+struct run_output {
+  std::vector<cvm::real> values;
+  std::vector<cvm::rvector> forces;
+};
+
+
+int run(bool task_graph, run_output &out)
+{
+  colvarproxy_stub *proxy = init_stub_proxy(new colvarproxy_stub(),
+                                            std::string("smp_task_graph_") +
+                                            (task_graph ? "on" : "off"));
+
+  std::string const conf = std::string("smpTaskGraph ") + (task_graph ? "on" : "off") + "\n";
+  int err = proxy->colvars->read_config_string(conf + config);
+  if (err) {
+    delete proxy;
+    return err;
+  }
+
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  // Each frame is read several times to obtain more steps
+  for (int pass = 0; pass < 4 && !err; pass++) {
+    int io_err = 0;
+    while (!io_err) {
+      io_err = proxy->read_frame_xyz("da-traj.xyz");
+      if (io_err) {
+        proxy->close_input_stream("da-traj.xyz");
+        break;
+      }
+      out.values.push_back(proxy->colvars->total_bias_energy);
+      for (colvar *cv : *(proxy->colvars->variables())) {
+        for (size_t i = 0; i < cv->value().size(); i++) {
+          out.values.push_back(cv->value()[i]);
+        }
+      }
+      for (size_t ia = 0; ia < forces.size(); ia++) {
+        out.forces.push_back(forces[ia]);
+        forces[ia].reset();
+      }
+    }
+    err |= cvm::get_error();
+  }
+  proxy->post_run();
+
+  delete proxy;
+  return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+  run_output out_off, out_on;
+  if (run(false, out_off) != COLVARS_OK) {
+    std::cerr << "Error: run without task graph failed." << std::endl;
+    return 1;
+  }
+  if (run(true, out_on) != COLVARS_OK) {
+    std::cerr << "Error: run with task graph failed." << std::endl;
+    return 1;
+  }
+
+  return compare_runs(out_off.values, out_on.values, "value", "task graph") |
+    compare_runs(out_off.forces, out_on.forces, "force", "task graph");
+}
@@ -0,0 +1,130 @@
+// -*- c++ -*-
+
+#ifndef UNITTEST_STUB_PROXY_H
+#define UNITTEST_STUB_PROXY_H
+
+// Functions shared by the unit tests that run the stub proxy over the
+// decaalanine trajectory (da-traj.xyz)
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "colvarmodule.h"
+#include "colvarproxy.h"
+#include "colvarproxy_stub.h"
+#include "colvarscript.h"
+
+
+/// Number of atoms in the decaalanine system
+int const decaalanine_num_atoms = 104;
+
+
+/// \brief Set up a newly created stub proxy for the decaalanine system
+/// \returns The same proxy
+inline colvarproxy_stub *init_stub_proxy(colvarproxy_stub *proxy,
+                                         std::string const &output_prefix)
+{
+  proxy->set_unit_system("real", false);
+  proxy->set_output_prefix(output_prefix);
+  proxy->colvars->setup_input();
+  proxy->colvars->setup_output();
+  for (int ai = 0; ai < decaalanine_num_atoms; ai++) {
+    proxy->init_atom(ai+1);
+  }
+  return proxy;
+}
+
+
+/// Run a scripting command given as a list of words, e.g. {"cv", "version"}
+inline int run_script(colvarproxy *proxy, std::vector<std::string> const &args)
+{
+  std::vector<unsigned char *> objv;
+  for (size_t i = 0; i < args.size(); i++) {
+    objv.push_back(reinterpret_cast<unsigned char *>(const_cast<char *>(args[i].c_str())));
+  }
+  return proxy->script->run(static_cast<int>(objv.size()), objv.data());
+}
+
+
+inline bool differ(cvm::real a, cvm::real b)
+{
+  return a != b;
+}
+
+
+inline bool differ(cvm::rvector const &a, cvm::rvector const &b)
+{
+  return (a - b).norm2() != 0.0;
+}
+
+
+/// \brief Check that two runs, without and with the given option, produced
+/// identical sequences of values (or forces)
+/// \returns 0 if they are identical, 1 otherwise
+template <typename T>
+int compare_runs(std::vector<T> const &out_off, std::vector<T> const &out_on,
+                 std::string const &what, std::string const &option)
+{
+  if (out_off.empty() || (out_on.size() != out_off.size())) {
+    std::cerr << "Error: the two runs produced " << out_off.size() << " and " << out_on.size()
+              << " " << what << "s." << std::endl;
+    return 1;
+  }
+  int err = 0;
+  for (size_t i = 0; i < out_off.size(); i++) {
+    if (differ(out_on[i], out_off[i])) {
+      std::cerr << "Error: " << what << " " << i << " differs: " << out_off[i] << " without and "
+                << out_on[i] << " with " << option << "." << std::endl;
+      err = 1;
+    }
+  }
+  return err;
+}
+
+
+/// \brief Check the atomic forces applied at the current frame against
+/// central finite differences of the total bias energy
+/// \param atom_numbers Atoms (numbered from 1) that are displaced
+/// \param label Prefix of the error messages
+/// \returns 0 if all forces agree, 1 otherwise
+inline int check_forces_finite_difference(colvarproxy_stub *proxy,
+                                          std::vector<int> const &atom_numbers,
+                                          std::string const &label)
+{
+  std::vector<cvm::rvector> &positions = *(proxy->modify_atom_positions());
+  std::vector<cvm::rvector> &forces = *(proxy->modify_atom_applied_forces());
+  std::vector<cvm::rvector> const analytic_forces(forces);
+
+  int err = 0;
+  cvm::real const h = 1.0e-5;
+  for (int const number : atom_numbers) {
+    size_t const ia = number - 1;
+    for (size_t k = 0; k < 3; k++) {
+      cvm::real const x0 = positions[ia][k];
+      positions[ia][k] = x0 + h;
+      proxy->colvars->calc();
+      cvm::real const e_plus = proxy->colvars->total_bias_energy;
+      positions[ia][k] = x0 - h;
+      proxy->colvars->calc();
+      cvm::real const e_minus = proxy->colvars->total_bias_energy;
+      positions[ia][k] = x0;
+      cvm::real const fd_force = -(e_plus - e_minus) / (2.0 * h);
+      if (std::fabs(fd_force - analytic_forces[ia][k]) >
+          1.0e-6 * std::max(1.0, std::fabs(fd_force))) {
+        std::cerr << "Error: " << label << "force on atom " << number << ", component " << k
+                  << " is " << analytic_forces[ia][k] << ", finite difference gives "
+                  << fd_force << std::endl;
+        err = 1;
+      }
+    }
+  }
+  for (size_t ia = 0; ia < forces.size(); ia++) {
+    forces[ia].reset();
+  }
+  return err;
+}
+
+#endif